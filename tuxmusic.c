@@ -37,7 +37,10 @@
 #include <string.h>
 #include <math.h>
 #include <time.h>
+#include <errno.h>
 #include <assert.h>
+#include <stdatomic.h>
+#include <signal.h>
 
 // Threading
 #include <pthread.h>
@@ -59,6 +62,12 @@
     #define PATH_SEP "/"
 #endif
 
+// SIMD kernels (runtime-dispatched, see equalizer_initialize)
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+    #include <immintrin.h>
+    #define TUXMUSIC_X86_SIMD 1
+#endif
+
 // Multimedia libraries
 #include <SDL2/SDL.h>
 #include <SDL2/SDL_ttf.h>
@@ -66,6 +75,7 @@
 #include <libavformat/avformat.h>
 #include <libavcodec/avcodec.h>
 #include <libavutil/dict.h>
+#include <libavutil/channel_layout.h>
 #include <libswresample/swresample.h>
 #include <fftw3.h>
 
@@ -74,16 +84,93 @@
 #define WINDOW_HEIGHT         1000
 #define WINDOW_MIN_WIDTH      1200
 #define WINDOW_MIN_HEIGHT     800
-#define TARGET_FPS            144
-#define AUDIO_SAMPLE_RATE     96000
+#define TARGET_FPS            144    // Frame rate when the display does not report one
+#define AUDIO_SAMPLE_RATE     48000  // Asked for when the device has no native rate to offer
 #define AUDIO_CHANNELS        2
-#define AUDIO_BUFFER_SIZE     4096
-#define MAX_TRACKS           100000
+#define AUDIO_BUFFER_MIN      128    // Device buffer limits in frames, powers of two;
+#define AUDIO_BUFFER_MAX      8192   // --audio-buffer=MIN:MAX narrows them
+#define AUDIO_BUFFER_START    512    // Adaptive sizing starts here, ~11 ms at 48 kHz
+#define AUDIO_DEPTH_BUFFERS   4      // Least ring depth decoded ahead, in device buffers
+#define AUDIO_ADAPT_SECONDS   2.0    // Misses are judged per window this long
+#define AUDIO_CALM_SECONDS    30.0   // Clean playback before latency steps back down
+#define AUDIO_LATE_FACTOR     1.5    // A callback this many periods after the last one is late
+#define AUDIO_RING_FRAMES    32768  // Must be a power of two
+#define AUDIO_DECODER_BACKOFF_MS 2
+#define AUDIO_PRELOAD_FRAMES 16384  // Decoded ahead when the next track is queued
+#define AUDIO_CROSSFADE_MAX  12.0f  // Seconds
+#define SEEK_INDEX_INTERVAL  0.5    // Seconds between seek index points
+#define SEEK_PREROLL         0.1    // Decoded and discarded ahead of a seek target
+#define SEEK_INDEX_MAGIC     "TUXSEEK1"
+#define TRACK_STORE_INITIAL  1024   // Rows; the store grows by doubling
+#define SCAN_THREADS_PER_CORE 2     // Probing is mostly I/O latency on network shares
+#define SCAN_MAX_THREADS     64
+#define SCAN_BATCH_PER_FRAME 4096   // Results merged into the library per UI frame
+#define LIBRARY_HASH_BYTES   (64 * 1024)  // Hashed from each end of a file
+#define LOUDNESS_TARGET_LUFS -18.0  // ReplayGain 2.0 reference level
+#define LOUDNESS_PEAK_CEILING -1.0  // dBTP a gained track may reach
+#define LOUDNESS_ABSOLUTE_GATE -70.0  // LUFS; quieter blocks never count
+#define LOUDNESS_TP_TAPS     12     // Per phase of the 4x true-peak interpolator
+#define LOUDNESS_PEAK_CHUNK  64     // Frames at a time checked against the peak bound
+#define LOUDNESS_JOBS_PER_WORKER 2  // Files in flight per loudness worker
+#define LOUDNESS_SAVE_SECONDS 120.0 // A long pass writes the library database this often
 #define MAX_PATH             4096
 #define MAX_TEXT             1024
 #define SPECTRUM_SIZE        1024
+#define FFT_SIZE             4096   // Real-input FFT length for the analyzer
+#define SPECTRUM_MIN_FREQ    20.0f
+#define SPECTRUM_MAX_FREQ    20000.0f
+#define SPECTRUM_FLOOR_DB    -80.0f
 #define EQ_BANDS             32
+#define EQ_MIN_FREQ          20.0f
+#define EQ_MAX_FREQ          20000.0f
+#define EQ_MAX_GAIN_DB       12.0f
 #define UI_ANIMATION_SPEED   8.0f
+#define UI_DAMAGE_MAX        16     // Damage rects kept per frame before they are merged
+#define UI_DAMAGE_MARGIN     8      // Widget glow and shadow reach past its bounds
+#define UI_IDLE_WAIT_MS      500    // Longest the idle main loop sleeps between checks
+#define FRAME_STATS_WINDOW   1024   // Frames in the rolling window, power of two
+#define FRAME_STATS_BUCKET_US 250   // Frame time histogram resolution
+#define FRAME_STATS_BUCKETS  800    // 200 ms worth; the last bucket takes everything longer
+#define FRAME_STALL_SECONDS  0.05   // Longer frames count as stalls; animation steps clamp here
+#define PACE_SPIN_SECONDS    0.0002 // Spun rather than slept before each frame deadline
+#define PACE_MAX_OVERSLEEP   0.004  // Cap on the learned sleep overshoot
+#define UI_GRID_CELL         64     // Pixels per side of a hit-test grid cell
+#define HEADLESS_POLL_MS     20     // Headless scan and playback loops wake this often
+#define TRACE_RING_EVENTS    16384  // Per thread, power of two; the oldest are overwritten
+#define TRACE_MAX_THREADS    8
+#define BENCH_REPEATS        5      // Timed runs per measurement; the median is reported
+#define BENCH_MAX_RESULTS    256
+#define BENCH_FIXTURE_SECONDS 20.0  // Length of each generated decode fixture
+#define BENCH_SCAN_FILES     256    // One-second files generated for the scan benchmark
+#define BENCH_LIBRARY_TRACKS 100000 // Synthetic rows for the database and render benchmarks
+#define BENCH_RENDER_FRAMES  120    // Frames timed per playlist size and scenario
+#define WIDGET_MAX           100
+#define LIST_ROW_HEIGHT      28.0f  // Pixels per track list row
+#define LIST_ROW_CACHE       256    // Formatted rows kept, power of two
+#define LIST_WHEEL_ROWS      3.0f   // Rows per mouse wheel notch
+#define LIST_SCROLL_SPEED    18.0f  // Per second; the list eases toward its target
+#define TEXT_FONTS           6      // Entries in g_app->fonts
+#define TEXT_ATLAS_SIZE      2048   // Pixels per side of the glyph atlas all fonts share
+#define TEXT_ATLAS_SLOTS     8192   // Glyph hash slots, power of two
+#define TEXT_ATLAS_TOP       (GEOM_SHADOW_EDGE * 2 + 2) // First shelf row, below the shadow texels
+#define TEXT_CACHE_SIZE      256    // Laid-out strings kept; least recently used is evicted
+#define GEOM_CORNER_RADII    64     // Rounded corner meshes kept, one per whole-pixel radius
+#define GEOM_CORNER_SEGMENTS 12     // Most segments in one quarter circle
+#define GEOM_SHADOW_EDGE     16     // Texels of falloff around the shadow texture's solid center
+#define BACKDROP_BLUR_RADIUS 6      // Box radius in half-resolution pixels
+#define BACKDROP_BLUR_PASSES 3      // Box passes per axis; three approximate a Gaussian
+#define ARTWORK_CACHE_SLOTS  128    // Artwork entries kept, ready or in flight
+#define ARTWORK_QUEUE_SIZE   32     // Pending decodes; the oldest is dropped when full
+#define ARTWORK_BUDGET_MB    48     // Default texture budget, see --art-cache-mb
+#define ARTWORK_THUMB_MAGIC  "TUXART02"
+#define SEARCH_GRAM_BITS     16     // Trigram posting lists: 1 << bits, hashed
+#define SEARCH_TEXT_MAX      512    // Normalized searchable text per track
+#define SEARCH_INDEX_PER_FRAME 2048 // New rows indexed per UI frame, about 3 us each
+#define QUERY_MAX_TERMS      16
+#define SMART_PLAYLIST_MAX   8      // Entry 0 is the search results, the rest Ctrl+1..7
+#define SORT_MAX_KEYS        4      // Columns in one sort order
+#define SORT_PARALLEL_MIN    16384  // Shorter playlists sort on the UI thread alone
+#define SORT_MAX_THREADS     16
 
 // ═══════════════════════════════════════════════════════════════════════════════
 // ║                              CORE TYPES                                    ║
@@ -147,40 +234,578 @@ typedef struct {
     float rating; // 0.0 - 5.0
 } TrackMetadata;
 
-// Audio track representation
+// Audio track representation. This is the unpacked form used while probing
+// files; the library itself lives in the columnar TrackStore below.
 typedef struct {
     char filepath[MAX_PATH];
     char filename[512];
     TrackMetadata metadata;
     bool metadata_loaded;
+    
+    // File identity, used to recognise unchanged files across runs
+    int64_t file_size;
+    int64_t file_mtime;
     uint32_t file_hash;
+    bool cached;                // Unchanged since the library database was written
 } Track;
 
-// Modern playlist with smart features
+typedef uint32_t TrackId;     // Row in the TrackStore, stable for its lifetime
+typedef uint32_t StringRef;   // Offset into a StringArena, 0 is the empty string
+#define TRACK_ID_NONE UINT32_MAX
+
+// Interned strings: each distinct string is stored once in a growable arena.
+// References are offsets, so they survive the arena being reallocated.
+typedef struct {
+    char *data;
+    size_t size;
+    size_t capacity;
+    StringRef *slots;           // Open-addressed hash table, 0 = free
+    size_t slot_mask;
+    size_t entries;
+} StringArena;
+
+#define TRACK_FLAG_METADATA_LOADED  0x01
+#define TRACK_FLAG_HAS_ARTWORK      0x02
+#define TRACK_FLAG_LOUDNESS         0x04    // loudness, loudness_range and true_peak are measured
+
+// Columnar track store. One array per field, indexed by TrackId. Rows are
+// only ever appended, so IDs held by playlists never go stale.
+typedef struct {
+    size_t count;
+    size_t capacity;
+    StringArena strings;
+    
+    // Interned text columns
+    StringRef *path;
+    StringRef *title;
+    StringRef *artist;
+    StringRef *album;
+    StringRef *genre;
+    StringRef *format;
+    StringRef *artwork_path;
+    
+    // Fixed-size numeric columns
+    double *duration_seconds;
+    int32_t *bitrate;
+    int32_t *sample_rate;
+    uint8_t *channels;
+    int16_t *year;
+    uint16_t *track_num;
+    int64_t *date_added;
+    int32_t *play_count;
+    float *rating;
+    float *loudness;            // Integrated, LUFS
+    float *loudness_range;      // LU
+    float *true_peak;           // Linear
+    uint32_t *file_hash;
+    int64_t *file_size;
+    int64_t *file_mtime;
+    uint8_t *flags;
+    
+    // Path -> TrackId lookup, open-addressed, stores id + 1 (0 = free)
+    uint32_t *path_slots;
+    size_t path_slot_mask;
+    
+    // Existing rows rewritten since the search index and smart playlists
+    // last caught up; new rows are found by count alone
+    TrackId *changed;
+    size_t changed_count;
+    size_t changed_capacity;
+} TrackStore;
+
+// On-disk library database: this header, then every TrackStore column
+// written verbatim (widest first, so all stay aligned), then the string arena.
+// Older versions load with the columns they lack zeroed.
+#define LIBRARY_DB_MAGIC     "TUXLIBDB"
+#define LIBRARY_DB_VERSION   2
+
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t byte_order;        // 0x01020304 as seen by the writer
+    uint32_t row_width;         // Sum of column widths, catches layout changes
+    uint32_t reserved;
+    uint64_t row_count;
+    uint64_t string_bytes;
+} LibraryDbHeader;
+
+// Read-only snapshot of the database as loaded at startup. Scanner workers
+// consult it without locking to skip files that have not changed.
+typedef struct {
+    void *blob;                 // The whole file; the columns below point into it
+    size_t count;
+    const char *strings;
+    const StringRef *path;
+    const int64_t *file_size;
+    const int64_t *file_mtime;
+    const uint32_t *file_hash;
+    uint32_t *slots;            // hash_string(path) -> row + 1, 0 = free
+    size_t slot_mask;
+} LibraryCache;
+
+// Compiled smart playlist filter, see query_compile
+typedef enum {
+    QUERY_ANY = 0,              // Any of the text fields
+    QUERY_TITLE,                // Text fields, in search index order
+    QUERY_ARTIST,
+    QUERY_ALBUM,
+    QUERY_GENRE,
+    QUERY_YEAR,                 // Numeric fields
+    QUERY_RATING,
+    QUERY_PLAYS
+} QueryField;
+
+typedef struct {
+    QueryField field;
+    bool negate;
+    char text[128];             // Normalized, text fields only
+    double low, high;           // Inclusive, numeric fields only
+} QueryTerm;
+
+typedef struct {
+    QueryTerm terms[QUERY_MAX_TERMS];   // All must hold
+    int count;
+} Query;
+
+// Modern playlist with smart features. Holds TrackIds into a shared store.
 typedef struct {
     char name[MAX_TEXT];
-    Track tracks[MAX_TRACKS];
+    TrackStore *store;
+    TrackId *track_ids;
     int track_count;
+    int track_capacity;
+    uint8_t *members;           // Per TrackId: non-zero if in this playlist
+    size_t member_capacity;
     int current_index;
+    int queued_index;           // What the engine will move on to by itself, -1 if nothing
     int scroll_position;
     
     bool is_smart_playlist;
     char smart_filter[MAX_TEXT];
+    Query smart_query;
     
     time_t created;
     time_t modified;
 } Playlist;
 
-// Professional audio engine
 typedef struct {
-    // Core playback
+    TrackId *ids;               // Ascending for rows indexed once
+    uint32_t count;
+    uint32_t capacity;
+} SearchPosting;
+
+// Trigram inverted index over each track's normalized text. Candidates
+// come from the rarest trigram of a query and are then verified against
+// the text, so stale postings and hash collisions cost nothing but time.
+typedef struct {
+    char *text;                 // "title\nartist\nalbum\ngenre" per row, NUL-terminated
+    size_t text_size;
+    size_t text_capacity;
+    size_t text_garbage;        // Left behind by rows indexed again
+    uint32_t *offset;           // Per TrackId, into text
+    size_t count;               // Rows indexed so far
+    size_t capacity;
+    SearchPosting *postings;    // 1 << SEARCH_GRAM_BITS lists
+} SearchIndex;
+
+#define SMART_PLAYLIST_SEARCH 0
+
+// Work-stealing task pool. Each worker owns a deque: it pushes and pops at
+// the bottom, idle workers steal from the top of someone else's.
+typedef void (*TaskFunction)(void *arg);
+
+typedef struct {
+    TaskFunction function;
+    void *arg;
+} Task;
+
+typedef struct TaskPool TaskPool;
+
+typedef struct {
+    TaskPool *pool;
+    pthread_mutex_t lock;       // Per deque, so contention is only ever pairwise
+    Task *tasks;                // Ring of capacity entries
+    size_t capacity;
+    size_t top;                 // Steal end
+    size_t bottom;              // Owner end
+} TaskDeque;
+
+struct TaskPool {
+    pthread_t *threads;
+    TaskDeque *deques;
+    int worker_count;
+    atomic_size_t queued;       // Tasks sitting in deques
+    atomic_uint submit_cursor;  // Round-robin target for outside submissions
+    atomic_int sleeping;
+    atomic_bool running;
+    pthread_mutex_t idle_lock;
+    pthread_cond_t idle_cond;
+    bool started;
+};
+
+// Background library scanner. Directory walks and FFmpeg probes are tasks on
+// a TaskPool; finished tracks queue up here until the UI thread merges them.
+typedef struct {
+    TaskPool pool;
+    
+    pthread_mutex_t results_lock;
+    Track **results;
+    int result_count;
+    int result_capacity;
+    
+    atomic_size_t outstanding;  // Scan tasks submitted but not finished
+    atomic_size_t dirs_scanned;
+    atomic_size_t files_found;
+    atomic_size_t files_probed;
+    atomic_size_t files_failed;
+    atomic_size_t files_cached; // Skipped because the database was current
+    atomic_bool cancelled;
+    
+    Playlist *target;           // Where merged tracks are appended
+    const LibraryCache *cache;  // Immutable while workers run
+    Uint64 started;
+    bool active;
+    bool initialized;
+} LibraryScanner;
+
+// EBU R128 / ITU-R BS.1770 meter for one track. K-weighting is two biquads
+// per channel; true peak comes from 4x polyphase oversampling.
+typedef struct LoudnessMeter LoudnessMeter;
+typedef double (*LoudnessFilterKernel)(LoudnessMeter *meter, const float *samples, int frames);
+typedef float (*LoudnessPeakKernel)(LoudnessMeter *meter, const float *samples, int frames);
+
+struct LoudnessMeter {
+    // Lanes: shelving pre-filter left and right, then the RLB high-pass left
+    // and right. Transposed direct form II like the equalizer, a1/a2 negated.
+    float b0[4], b1[4], b2[4], a1[4], a2[4];
+    float s1[4], s2[4];
+    float pipe[4];                          // SIMD pipeline carry between blocks
+    
+    float taps[LOUDNESS_TP_TAPS][4];        // Interpolator, [tap][phase]
+    float tap_bound;                        // Most any phase can amplify a sample
+    float history[2][LOUDNESS_TP_TAPS * 2]; // Per channel, written twice so reads never wrap
+    int history_pos;
+    float peak;                             // Linear
+    
+    int block_frames;                       // 100 ms at the track's rate
+    int block_filled;
+    double block_energy;
+    float *energy;                          // Mean square of each complete 100 ms block
+    size_t count;
+    size_t capacity;
+    bool failed;                            // Out of memory
+    
+    LoudnessFilterKernel filter_kernel;
+    LoudnessPeakKernel peak_kernel;
+    const char *kernel_name;
+};
+
+typedef struct {
+    TrackId id;
+    uint32_t file_hash;         // Row identity when queued; a rewritten row drops the result
+    bool measured;
+    float loudness;
+    float range;
+    float peak;
+} LoudnessResult;
+
+// Background loudness measurement. Each task decodes one file at full speed
+// on a low-priority TaskPool; results queue up until the UI thread stores them.
+typedef struct {
+    TaskPool pool;
+    
+    pthread_mutex_t results_lock;
+    LoudnessResult *results;
+    int result_count;
+    int result_capacity;
+    
+    uint8_t *queued;            // Per TrackId: 1 in flight, 2 failed; a rewind skips both
+    size_t queued_capacity;
+    size_t cursor;              // Rows below it were looked at in this pass
+    size_t total;               // Rows this pass found unmeasured
+    
+    atomic_size_t outstanding;  // Tasks submitted but not finished
+    atomic_size_t measured;
+    atomic_size_t failed;
+    atomic_uint_least64_t audio_ms; // Decoded and measured, for the speed
+    atomic_bool cancelled;
+    
+    Uint64 started;
+    Uint64 saved;               // When measurements were last written out
+    size_t saved_measured;      // `measured` at that point
+    bool active;
     bool initialized;
-    bool playing;
-    bool paused;
+} LoudnessScanner;
+
+// Sortable columns; the text ones come first and index CollationCache
+typedef enum {
+    SORT_TITLE = 0,
+    SORT_ARTIST,
+    SORT_ALBUM,
+    SORT_TRACK_NUM,
+    SORT_YEAR,
+    SORT_DATE_ADDED,
+    SORT_RATING,
+    SORT_PLAY_COUNT,
+    SORT_DURATION,
+    SORT_FIELD_COUNT
+} SortField;
+
+#define SORT_TEXT_COLUMNS 3
+
+typedef struct {
+    SortField field;
+    bool descending;
+} SortKey;
+
+typedef struct {
+    SortKey keys[SORT_MAX_KEYS];    // Most significant first
+    int count;
+} SortSpec;
+
+typedef struct {
+    StringRef ref;
+    uint32_t key;               // Offset of the collation key in CollationCache::keys
+    uint32_t rank;              // Order among all keys; equal keys share one
+} CollationEntry;
+
+// Collation keys, made once per distinct string and ranked, so comparing
+// two tracks by a text column is comparing two integers
+typedef struct {
+    CollationEntry *entries;
+    size_t count;
+    size_t capacity;
+    uint32_t *slots;            // hash_u32(ref) -> entry + 1, 0 = free
+    size_t slot_mask;
+    char *keys;
+    size_t keys_size;
+    size_t keys_capacity;
+    bool ranked;                // No entries added since the last ranking
+    int rank_bits;              // Enough for the highest rank
+    
+    // Per TrackId and text column: the entry, and the StringRef it was
+    // looked up for; a different ref in the store means the row changed
+    uint32_t *row_entry[SORT_TEXT_COLUMNS];
+    StringRef *row_ref[SORT_TEXT_COLUMNS];
+    size_t row_capacity;
+} CollationCache;
+
+typedef struct {
+    uint64_t key;               // Packed sort columns, see sort_layout
+    uint32_t position;          // Index in the playlist before sorting
+} SortItem;
+
+typedef struct {
+    SortSpec spec;
+    int packed;                 // Leading columns held in the key
+    int bits[SORT_MAX_KEYS];
+    int shift[SORT_MAX_KEYS];
+    int key_bits;
+} SortLayout;
+
+typedef struct {
+    TaskPool pool;              // Started by the first large sort
+    pthread_mutex_t lock;
+    pthread_cond_t done;
+    int pending;                // Tasks of the current step still running
+    CollationCache collation;
+    SortItem *items;
+    SortItem *scratch;
+    size_t capacity;
+    int preset;                 // Next SORT_PRESETS entry for Ctrl+S
+    double last_seconds;
+} PlaylistSorter;
+
+// Lock-free single-producer/single-consumer PCM ring buffer.
+// The decoder thread owns write_pos, the device callback owns read_pos,
+// so neither side ever waits on the other.
+typedef struct {
+    float *samples;             // Interleaved, AUDIO_CHANNELS per frame
+    size_t capacity;            // In frames, power of two
+    size_t mask;
+    atomic_size_t write_pos;    // Total frames written (producer)
+    atomic_size_t read_pos;     // Total frames consumed (consumer)
+    atomic_size_t discard_pos;  // Flush marker, consumer skips up to here
+    size_t history;             // Frames kept intact behind read_pos for taps
+} PcmRing;
+
+// 32-band graphic equalizer: a cascade of peaking biquads (transposed direct
+// form II). All per-band arrays are stored per lane, index = band * 2 + channel,
+// so SIMD kernels can load 2 (SSE) or 4 (AVX2) bands of stereo at once.
+typedef struct Equalizer Equalizer;
+typedef void (*EqualizerKernel)(Equalizer *eq, float *samples, int frames);
+
+struct Equalizer {
+    float b0[EQ_BANDS * 2], b1[EQ_BANDS * 2], b2[EQ_BANDS * 2];
+    float a1[EQ_BANDS * 2], a2[EQ_BANDS * 2]; // Stored negated
+    float s1[EQ_BANDS * 2], s2[EQ_BANDS * 2];
+    float pipe[EQ_BANDS * 2];                 // SIMD pipeline carry between blocks
+    int latency;                              // Frames the pipelined kernels delay the output
+    
+    float applied_gain[EQ_BANDS];             // Gains the coefficients were built for
+    float preamp;                             // Linear
+    int sample_rate;
+    unsigned generation;                      // Last engine->eq_generation seen
+    bool active;                              // At least one band is not flat
+    
+    EqualizerKernel kernel;
+    const char *kernel_name;
+};
+
+// A packet the demuxer can restart at, in stream time base and byte offset
+typedef struct {
+    int64_t pts;
+    int64_t pos;
+} SeekPoint;
+
+// Per-track seek table, built lazily by demuxing ahead of the furthest seek
+// and cached on disk next to the library database
+typedef struct {
+    SeekPoint *points;          // Ascending pts
+    int count;
+    int capacity;
+    bool usable;                // Format benefits from it and packets carry pos/duration
+    bool complete;              // Covers the whole file
+    bool dirty;                 // Grown since it was loaded
+} SeekIndex;
+
+typedef struct {
+    char magic[8];              // SEEK_INDEX_MAGIC
+    int64_t file_size;
+    int64_t file_mtime;
+    uint32_t path_length;       // Path follows the header, then the points
+    int32_t count;
+    uint32_t complete;
+    uint32_t reserved;
+} SeekIndexHeader;
+
+// A seek index detached from its decoder: grown on a demuxer of its own while
+// the decoder thread has audio_mutex released, or queued for the preload
+// thread to write out
+typedef struct SeekIndexJob {
+    char filepath[MAX_PATH];
+    int64_t file_size;
+    int64_t file_mtime;
+    int stream_index;
+    int64_t target;             // Stream time base the index has to reach
+    SeekIndex index;
+    struct SeekIndexJob *next;  // Save queue
+} SeekIndexJob;
+
+// How a decoder gets its frames to the device format, cheapest first
+typedef enum {
+    AUDIO_PATH_COPY,            // Already float stereo at the device rate
+    AUDIO_PATH_CONVERT,         // Sample format or channel layout only
+    AUDIO_PATH_RESAMPLE,        // Rate conversion
+    AUDIO_PATH_COUNT
+} AudioPath;
+
+// CPU time spent getting decoded frames to the device format, per path.
+// Updated by the decoder and preload threads.
+typedef struct {
+    atomic_uint_least64_t ticks;    // Performance counter ticks
+    atomic_uint_least64_t frames;   // Output frames produced
+} AudioPathStats;
+
+// One open track: demuxer, decoder and converter to the device format, with
+// a FIFO of converted frames between decoding and the ring buffer.
+typedef struct {
+    AVFormatContext *format_context;
+    AVCodecContext *codec_context;
+    SwrContext *swr_context;    // NULL on AUDIO_PATH_COPY
+    AudioPath path;
+    int output_rate;
+    int stream_index;
+    double duration;
+    
+    char filepath[MAX_PATH];
+    int64_t file_size;
+    int64_t file_mtime;
+    SeekIndex index;
+    int64_t sample_cursor;      // Codec-rate sample of the next decoded frame, -1 = unknown
+    int64_t discard_to;         // Decode and drop up to this sample, -1 = not seeking
+    double seek_reached;        // Where the last seek actually landed
+    
+    float *frames;              // Interleaved, AUDIO_CHANNELS per frame
+    int capacity;
+    int count;                  // Frames decoded
+    int offset;                 // Frames handed to the ring
+    int processed;              // Frames the DSP has run over
+    bool eof;                   // Decoder and resampler fully drained
+    float gain;                 // ReplayGain, linear, applied as frames are decoded
+    bool unplayed;              // Decoded for analysis, kept out of the path stats
+} AudioDecoder;
+
+// Gain that brings every track, or every album, to LOUDNESS_TARGET_LUFS
+typedef enum {
+    REPLAYGAIN_OFF = 0,
+    REPLAYGAIN_TRACK,
+    REPLAYGAIN_ALBUM,
+    REPLAYGAIN_MODE_COUNT
+} ReplayGainMode;
+
+typedef enum {
+    AUDIO_NEXT_NONE,            // Nothing queued
+    AUDIO_NEXT_LOADING,         // Preload thread is opening it
+    AUDIO_NEXT_READY,
+    AUDIO_NEXT_FAILED
+} AudioNextState;
+
+// Where a stretch of contiguous audio begins in the ring's frame count.
+// Queued whenever the ring is flushed or a new track is spliced in, and
+// adopted by the device callback once it reaches that frame.
+typedef struct {
+    size_t ring_frame;          // ring.write_pos when the segment began
+    double start_seconds;       // Track time of its first frame
+    double duration;
+    unsigned track_serial;      // Bumped when the engine moved on by itself
+} ClockSegment;
+
+#define CLOCK_SEGMENTS 32       // Power of two
+
+typedef struct {
+    double position;            // Track time of the first frame of the last callback
+    double segment_start;       // Never report earlier than this
+    double span;                // Seconds of audio that callback delivered
+    double duration;
+    unsigned track_serial;
+    Uint64 timestamp;           // Performance counter at that callback
+} ClockSnapshot;
+
+// Seqlock: the device callback is the only writer, readers retry instead
+// of ever making the callback wait
+typedef struct {
+    atomic_uint sequence;       // Odd while a write is in progress
+    ClockSnapshot data;
+} PlaybackClock;
+
+// What the UI gets from audio_get_clock
+typedef struct {
     double position;
     double duration;
-    float volume;
-    bool muted;
+    unsigned track_serial;
+} AudioClock;
+
+// What the UI and the exit summary get from audio_get_latency
+typedef struct {
+    int buffer_frames;          // Device buffer
+    size_t ring_depth;          // Frames the decoder keeps ahead of the device
+    double device_latency;      // Seconds, the device buffer alone
+    double decode_ahead;        // Seconds, the ring depth
+    unsigned underruns;
+    unsigned late_callbacks;
+    unsigned callbacks;
+    unsigned resizes;
+} AudioLatency;
+
+// Professional audio engine
+typedef struct {
+    // Core playback
+    bool initialized;
+    atomic_bool playing;
+    atomic_bool paused;
+    _Atomic float volume;
+    atomic_bool muted;
     
     // Playback modes
     bool shuffle;
@@ -188,31 +813,88 @@ typedef struct {
     bool repeat_all;
     bool crossfade_enabled;
     float crossfade_duration;
-    
-    // Advanced audio processing
-    SwrContext *swr_context;
-    AVFormatContext *format_context;
-    AVCodecContext *codec_context;
-    int audio_stream_index;
+    ReplayGainMode replaygain;  // Read by the UI thread when it loads and queues tracks
+    
+    // Decoders: the track playing and the one preloaded to follow it.
+    // Guarded by audio_mutex; the decoder thread does the transition.
+    AudioDecoder *current;
+    AudioDecoder *next;
+    AudioNextState next_state;
+    bool next_crossfade;        // Fade into the next track instead of splicing
+    unsigned queue_generation;  // Invalidates preloads for an outdated queue
+    double seek_target;         // Seconds, done by the decoder thread; < 0 = none
+    
+    // Playback clock, see audio_clock_mark / audio_get_clock
+    ClockSegment segments[CLOCK_SEGMENTS];
+    atomic_size_t segment_write;    // Producer: whoever holds audio_mutex
+    atomic_size_t segment_read;     // Consumer: the device callback
+    ClockSegment segment;           // Segment now playing, callback-owned
+    unsigned track_serial;          // Guarded by audio_mutex
+    PlaybackClock clock;
+    double clock_latency;           // Seconds between a callback and its audio being heard
+    
+    // Output device and decode-to-device pipeline. The device rate is
+    // negotiated; it follows the track's rate family when the device allows.
+    SDL_AudioDeviceID device;
+    SDL_AudioSpec device_spec;      // Written under audio_mutex with the device closed
+    atomic_int device_rate;         // device_spec.freq, for readers without audio_mutex
+    atomic_int device_frames;       // device_spec.samples, the buffer SDL actually granted
+    bool device_reopening;          // audio_resize_device has let go of audio_mutex
+    bool follow_source_rate;        // Reopen the device for 44.1k vs 48k material
+    unsigned rejected_families;     // Rate families the device would not switch to
+    PcmRing ring;
+    atomic_bool decoder_eof;    // Current track done and nothing queued
+    
+    // Adaptive latency, see audio_adapt_latency. The device buffer and the
+    // ring depth start low and follow the misses the callback counts.
+    int buffer_min, buffer_max;     // Bounds on the device buffer, frames
+    atomic_int buffer_frames;       // Device buffer now, written under audio_mutex
+    atomic_size_t ring_depth;       // Frames audio_release_frames keeps queued
+    atomic_uint underruns;          // Mid-track callbacks the ring could not fill
+    atomic_uint late_callbacks;     // Callbacks a period or more behind schedule
+    atomic_uint callbacks;
+    atomic_uint stream_generation;  // Bumped by flushes, play and device reopens
+    atomic_uint resizes;            // Device reopens for a new buffer size
+    unsigned adapt_underruns;       // Counts when the current window opened,
+    unsigned adapt_late;            // owned by the decoder thread
+    Uint64 adapt_start;
+    Uint64 calm_since;              // Last window with a miss
+    Uint64 late_ticks;              // Callback gap that counts as late
+    unsigned stream_seen;           // Callback-owned from here on
+    bool streaming;                 // Full buffers delivered since the last generation
+    Uint64 last_callback;
     
     // Real-time spectrum analysis
     float spectrum_data[SPECTRUM_SIZE];
     float spectrum_smooth[SPECTRUM_SIZE];
-    fftw_complex *fft_input;
-    fftw_complex *fft_output;
-    fftw_plan fft_plan;
+    float *fft_input;
+    fftwf_complex *fft_output;
+    fftwf_plan fft_plan;
+    float *fft_window;
+    float *fft_frames;          // FFT_SIZE interleaved frames copied out of the ring
+    float *spectrum_edges;      // SPECTRUM_SIZE + 1 band edges, in FFT bins
+    int spectrum_rate;          // Sample rate the band edges were built for
     
     // Professional equalizer
     float eq_bands[EQ_BANDS];
     float eq_preamp;
     bool eq_enabled;
+    unsigned eq_generation;     // Bumped on every change, guarded by audio_mutex
+    Equalizer eq;               // DSP state, owned by the decoder thread
     
     // Threading
     pthread_t audio_thread;
     pthread_t spectrum_thread;
+    pthread_t preload_thread;
     pthread_mutex_t audio_mutex;
     pthread_mutex_t spectrum_mutex;
-    bool threads_active;
+    pthread_mutex_t preload_mutex;
+    pthread_cond_t preload_cond;
+    char preload_path[MAX_PATH];    // Pending request, guarded by preload_mutex
+    float preload_gain;
+    unsigned preload_generation;
+    SeekIndexJob *index_saves;      // Grown indexes to write, guarded by preload_mutex
+    atomic_bool threads_active;
 } AudioEngine;
 
 // Modern UI widget system
@@ -233,62 +915,367 @@ typedef struct Widget Widget;
 typedef void (*WidgetCallback)(Widget *widget, void *user_data);
 typedef void (*WidgetRenderer)(Widget *widget, SDL_Renderer *renderer);
 
-struct Widget {
-    WidgetType type;
+// Per-type state, allocated separately by widget_create for the types that
+// have any, so a Widget stays the same small size whatever its type
+typedef struct {
+    float value;
+    float min_value;
+    float max_value;
+    bool dragging;
+} WidgetSlider;
+
+typedef struct {
+    float progress;
+    bool indeterminate;
+} WidgetProgress;
+
+// Virtualized: rows are pulled from the playlist by index as they
+// scroll into view, so the widget's size is independent of it
+typedef struct {
+    Playlist *source;
+    int selected_index;
+    float scroll;               // Row at the top edge, fractional
+    float scroll_target;        // Where the smooth scroll is heading
+    float row_height;
+} WidgetList;
+
+typedef struct {
+    SDL_Texture *texture;
+    bool maintain_aspect;
+} WidgetImage;
+
+// Cold widget data: touched when a widget is drawn or clicked, never by
+// the per-frame update. Parallel to g_app->widgets.
+typedef struct {
     char id[64];
     char text[MAX_TEXT];
     
+    Color color;
+    Color hover_color;
+    Color press_color;
+    
+    WidgetCallback on_click;
+    WidgetCallback on_hover;
+    WidgetCallback on_value_change;
+    WidgetRenderer custom_render;
+    void *user_data;
+} WidgetInfo;
+
+// Hot widget data: what hit testing, updates and damage tracking read
+struct Widget {
+    WidgetType type;
+    
     Rect bounds;
-    Rect render_bounds;
+    Rect render_bounds;         // Bounds plus glow and shadow, the area a redraw covers
     
     bool visible;
     bool enabled;
     bool hovered;
     bool pressed;
     bool focused;
-    
-    Color color;
-    Color hover_color;
-    Color press_color;
+    bool dirty;                 // Needs redrawing, see widget_mark_dirty
+    bool active;                // In g_app->active_widgets, see widget_activate
     
     float animation_t;
     float target_animation_t;
     
-    // Widget-specific data
+    // Widget-specific data, NULL for types without any
     union {
-        struct {
-            float value;
-            float min_value;
-            float max_value;
-            bool dragging;
-        } slider;
-        
-        struct {
-            float progress;
-            bool indeterminate;
-        } progressbar;
-        
-        struct {
-            int selected_index;
-            int scroll_offset;
-            int visible_items;
-            char items[1000][256];
-            int item_count;
-        } list;
-        
-        struct {
-            SDL_Texture *texture;
-            bool maintain_aspect;
-        } image;
+        void *payload;
+        WidgetSlider *slider;
+        WidgetProgress *progressbar;
+        WidgetList *list;
+        WidgetImage *image;
     };
     
-    WidgetCallback on_click;
-    WidgetCallback on_hover;
-    WidgetCallback on_value_change;
-    WidgetRenderer custom_render;
-    void *user_data;
+    WidgetInfo *info;
 };
 
+// A glyph rasterized into the atlas. The bitmap is the glyph rendered as a
+// one-character string, so its origin is the pen at the top of the line.
+typedef struct {
+    uint32_t key;               // Font index << 24 | codepoint, 0 = free slot
+    SDL_Rect source;            // Where it sits in the atlas
+    int offset_x;               // From the pen to the bitmap's left edge
+    int advance;
+} AtlasGlyph;
+
+// One texture of white glyphs for every font, tinted per vertex when drawn.
+// The shadow texels sit in its top-left corner, so shapes and text sample
+// the same texture. Glyphs are packed in shelves below them; when full it is
+// cleared and refilled on demand.
+typedef struct {
+    SDL_Texture *texture;
+    AtlasGlyph *glyphs;         // TEXT_ATLAS_SLOTS, open addressing on key
+    int glyph_count;
+    int shelf_x, shelf_y, shelf_height;
+    unsigned generation;        // Bumped on every clear, invalidating layouts
+} GlyphAtlas;
+
+// A string laid out as atlas quads, relative to its top-left corner. Colour is
+// not part of the key; text_draw tints the copied vertices.
+typedef struct {
+    TTF_Font *font;             // NULL = free entry
+    uint32_t hash;
+    char *text;
+    SDL_Vertex *vertices;       // Four per glyph, as geom_quads takes them
+    int vertex_count;
+    int width, height;
+    unsigned generation;        // Atlas generation the quads point into
+    uint64_t last_used;         // TextRenderer::frame, for LRU eviction
+} TextLayout;
+
+typedef struct {
+    int uploads;                // Glyphs rasterized and uploaded to an atlas
+    int layouts;                // Strings laid out, i.e. cache misses
+    int hits;
+    int draws;                  // Strings queued into the geometry batch
+} TextStats;
+
+typedef struct {
+    GlyphAtlas atlas;
+    TextLayout cache[TEXT_CACHE_SIZE];
+    SDL_Vertex *scratch;                // A layout moved to where it is drawn
+    int scratch_capacity;
+    
+    uint64_t frame;
+    TextStats stats;                    // This frame so far
+    TextStats last;                     // The previous frame
+    uint64_t total_uploads;
+    uint64_t upload_frames;             // Frames that uploaded anything
+    uint64_t last_upload_frame;
+} TextRenderer;
+
+// A quarter circle for one radius, as offsets from the corner's center
+// running from the horizontal to the vertical
+typedef struct {
+    int segments;               // 0 = not built yet
+    Point arc[GEOM_CORNER_SEGMENTS + 1];
+} CornerMesh;
+
+// Texture coordinates as a linear function of window position
+typedef struct {
+    float u, u_per_x;
+    float v, v_per_y;
+} GeomTexMap;
+
+typedef struct {
+    SDL_Vertex *vertices;
+    int *indices;
+    int vertex_count, index_count;
+    int vertex_capacity, index_capacity;
+} GeomBuffer;
+
+typedef struct {
+    int draw_calls;             // Geometry submissions, shapes and text together
+    int vertices;
+} GeomStats;
+
+// One box blur pass over RGBA floats, see backdrop_blur_scalar
+typedef void (*BlurKernel)(const float *src, float *dst, int width, int height, int radius);
+
+// The window background, drawn once and kept beside a blurred copy at half
+// resolution for glass panels to sample. Rebuilt only when the window size
+// changes or `stale` is set. Its layer goes out before the shapes; a cut
+// queued over pending shapes flushes them first, so glass covers the
+// shadow under its own panel.
+typedef struct {
+    SDL_Texture *texture;       // Sharp background at the top left, blurred beside or below it
+    int width, height;          // Window size it was built for
+    int texture_width, texture_height;
+    int blur_x, blur_y;         // Where the blurred copy starts in the texture
+    bool stale;
+    BlurKernel kernel;
+    GeomBuffer layer;
+} Backdrop;
+
+// Shapes and text go into one indexed buffer in the order they are drawn,
+// all sampling the glyph atlas: glyphs for text, and the shadow nine-slice
+// in its corner for shadows, whose solid center also serves as a plain
+// fill. geom_flush submits it in one draw call, plus one for the backdrop
+// layer when glass is in view.
+typedef struct {
+    float solid_u;              // Texture coordinate of the opaque center texel, both axes
+    float shadow_u;             // Far edge of the shadow nine-slice, both axes
+    Backdrop backdrop;
+    GeomBuffer shapes;
+    CornerMesh corners[GEOM_CORNER_RADII];
+    GeomStats stats;                    // This frame so far
+    GeomStats last;                     // The last frame drawn
+} GeomBatch;
+
+// A track list row as displayed, cached by TrackId and rebuilt when the
+// track's metadata changes
+typedef struct {
+    TrackId id;                 // TRACK_ID_NONE = empty
+    StringRef title, artist;
+    uint8_t flags;
+    char text[256];
+} ListRow;
+
+// What the composite panels showed when they were last drawn. Compared
+// every frame so a panel is redrawn only when its content changed.
+typedef struct {
+    TrackId track;
+    uint32_t track_flags;
+    char time_display[64];
+    bool shuffle, repeat_one, repeat_all;
+    char status[MAX_TEXT];
+    char latency[64];
+    int track_count;
+} UiSnapshot;
+
+// Hit-test index: each UI_GRID_CELL square of the window lists the
+// visible widgets overlapping it, so a mouse event is offered only to the
+// widgets of one cell. Stored flat, cell c owning items[cell_start[c]]
+// up to items[cell_start[c + 1]].
+typedef struct {
+    int cols, rows;
+    int *cell_start;            // cols * rows + 1 entries
+    uint16_t *items;            // Indices into g_app->widgets
+    int item_capacity;
+    bool dirty;                 // Bounds or visibility changed, see ui_hit_grid_build
+} HitGrid;
+
+typedef enum {
+    PACE_VSYNC,                 // Present waits for the display
+    PACE_FIXED,                 // Steady rate from deadlines, never idles
+    PACE_ON_DEMAND,             // Frames only when something changes, capped at the display rate
+    PACE_MODE_COUNT
+} PaceMode;
+
+// Frame times in microseconds: the last FRAME_STATS_WINDOW frames for the
+// overlay, and the whole run for the report on exit
+typedef struct {
+    uint32_t samples[FRAME_STATS_WINDOW];   // A ring, indexed by frames
+    uint64_t window_counts[FRAME_STATS_BUCKETS];
+    uint64_t total_counts[FRAME_STATS_BUCKETS];
+    uint64_t frames;
+    uint64_t stalls;
+    uint32_t max_us;
+} FrameStats;
+
+typedef struct {
+    PaceMode mode;
+    int fixed_rate;             // Hz from --pace=fixed:N, 0 = the display's
+    int refresh_rate;           // Detected, TARGET_FPS when unknown
+    bool vsync;                 // Whether present currently waits for the display
+    Uint64 frequency;           // Performance counter ticks per second
+    Uint64 period;              // Ticks per frame
+    Uint64 deadline;            // When the current frame should end
+    double oversleep;           // Seconds the OS tends to overshoot a sleep by
+    FrameStats stats;
+    
+    bool overlay;
+    Uint64 overlay_updated;
+    char overlay_text[96];
+} FramePacer;
+
+// Timed sections recorded by the tracer
+typedef enum {
+    TRACE_DECODE = 0,           // audio_decoder_read, on the decoder and preload threads
+    TRACE_RESAMPLE,             // Output conversion; arg is the AudioPath
+    TRACE_DSP,                  // Equalizer; arg is frames
+    TRACE_CALLBACK,             // Device callback; arg is frames delivered
+    TRACE_FFT,                  // Spectrum analysis
+    TRACE_EVENTS,               // Main loop stages from here on
+    TRACE_UPDATE,
+    TRACE_RENDER,
+    TRACE_SPAN_COUNT
+} TraceSpan;
+
+typedef struct {
+    Uint64 start;               // Performance counter ticks
+    Uint64 end;
+    uint32_t arg;
+    uint16_t span;
+} TraceEvent;
+
+// One per traced thread. Only the owning thread writes; the exporter reads
+// behind it and drops anything the writer may have lapped meanwhile.
+typedef struct {
+    TraceEvent *events;         // TRACE_RING_EVENTS, allocated before tracing is enabled
+    atomic_size_t head;         // Events ever written; slot is head & (TRACE_RING_EVENTS - 1)
+    atomic_bool live;           // Name is set
+    char name[32];
+} TraceRing;
+
+typedef struct {
+    atomic_bool enabled;
+    atomic_int thread_count;    // Rings claimed, may run past TRACE_MAX_THREADS
+    TraceRing rings[TRACE_MAX_THREADS];
+    bool allocated;
+    Uint64 origin;              // Events before the latest trace_start are not exported
+    char path[MAX_PATH];
+} Tracer;
+
+typedef enum {
+    ARTWORK_PENDING = 0,        // Queued or being decoded
+    ARTWORK_READY,
+    ARTWORK_MISSING             // No artwork, or it failed to decode
+} ArtworkState;
+
+typedef struct {
+    TrackId track;              // TRACK_ID_NONE = free
+    int size;                   // Longest side asked for, in pixels
+    ArtworkState state;
+    SDL_Texture *texture;
+    int width, height;
+    size_t bytes;
+    uint64_t last_used;         // ArtworkCache::frame when last drawn
+} ArtworkEntry;
+
+// Copied out of the store on the UI thread; the worker never touches it
+typedef struct {
+    TrackId track;
+    int size;
+    bool embedded;              // TRACK_FLAG_HAS_ARTWORK
+    char path[MAX_PATH];
+    char image_path[MAX_PATH];  // Track::artwork_path, may be empty
+} ArtworkRequest;
+
+typedef struct {
+    TrackId track;
+    int size;
+    int width, height;
+    uint32_t *pixels;           // ARGB8888, NULL when there is no artwork
+} ArtworkResult;
+
+typedef struct {
+    char magic[8];              // ARTWORK_THUMB_MAGIC
+    uint32_t width;
+    uint32_t height;
+    int64_t source_size;
+    int64_t source_mtime;
+    uint32_t path_length;       // The source path follows the header, then ARGB8888 pixels
+    uint32_t reserved;
+} ArtworkThumbHeader;
+
+// Cover art is decoded and downscaled on its own thread; the UI thread only
+// uploads finished pixels and evicts least recently drawn textures to stay
+// under the budget
+typedef struct {
+    ArtworkEntry entries[ARTWORK_CACHE_SLOTS];
+    size_t bytes;               // Texture memory held by ready entries
+    size_t budget;
+    uint64_t frame;
+    
+    pthread_t thread;
+    pthread_mutex_t lock;       // Guards the queue and results
+    pthread_cond_t cond;
+    ArtworkRequest queue[ARTWORK_QUEUE_SIZE];   // Served newest first
+    int queue_count;
+    ArtworkResult *results;
+    int result_count;
+    int result_capacity;
+    bool running;
+    bool initialized;           // The thread is started on first use
+    
+    atomic_size_t decoded;
+    atomic_size_t thumbs_loaded;
+    uint64_t evicted;
+} ArtworkCache;
+
 // Application state
 typedef struct {
     // Core SDL
@@ -307,22 +1294,52 @@ typedef struct {
     bool mouse_pressed;
     bool mouse_released;
     int mouse_wheel;
+    bool mouse_event;               // Any mouse input arrived this frame
     bool keys[SDL_NUM_SCANCODES];
     bool keys_pressed[SDL_NUM_SCANCODES];
     
     // UI resources
-    TTF_Font *fonts[6]; // Various sizes
+    TTF_Font *fonts[TEXT_FONTS]; // Various sizes
     SDL_Texture *icons[20];
+    TextRenderer text;
+    GeomBatch geom;
+    ListRow list_rows[LIST_ROW_CACHE];  // Direct-mapped on TrackId
+    ArtworkCache artwork;
     
     // Core systems
     AudioEngine audio;
+    TrackStore library;
+    LibraryCache library_cache;
+    bool ephemeral_library;         // Benchmarks: never saved over the user's database
     Playlist current_playlist;
+    LibraryScanner scanner;
+    LoudnessScanner loudness;
+    SearchIndex search;
+    PlaylistSorter sorter;
+    Playlist smart_playlists[SMART_PLAYLIST_MAX];
+    int smart_playlist_count;
+    
+    // Type-to-search over the library, shown in the track list
+    bool searching;
+    char search_text[256];
+    double search_seconds;      // Last filter update
     
     // UI widgets
-    Widget widgets[100];
+    Widget widgets[WIDGET_MAX];
+    WidgetInfo widget_info[WIDGET_MAX];
     int widget_count;
     Widget *focused_widget;
     
+    // Only these are updated each frame; a widget leaves once it is at rest
+    Widget *active_widgets[WIDGET_MAX];
+    int active_count;
+    
+    // Mouse routing: the grid finds the widgets under the cursor, and the
+    // ones that were hovered or held last time still get the leave/release
+    HitGrid hit_grid;
+    Widget *mouse_targets[WIDGET_MAX];
+    int mouse_target_count;
+    
     // Main UI elements
     Widget *play_button;
     Widget *stop_button;
@@ -335,48 +1352,224 @@ typedef struct {
     Widget *album_art;
     Widget *equalizer;
     
+    // Damage tracking: only these regions of frame_texture are redrawn,
+    // and nothing is presented when the list is empty
+    SDL_Texture *frame_texture;     // Persistent render target, window-sized
+    SDL_Rect damage[UI_DAMAGE_MAX];
+    int damage_count;
+    UiSnapshot drawn;
+    bool animating;                 // Some widget is still active
+    
     // Status
     char status_message[MAX_TEXT];
+    unsigned track_serial_seen;     // Last AudioClock::track_serial handled
     char current_time[32];
     char total_time[32];
     
     // Animation system
     float frame_time;
     Uint64 last_frame_time;
+    FramePacer pacer;
 } TuxMusicApp;
 
+// One measurement for the machine-readable benchmark report. Names are
+// dotted keys ("decode.flac.sweep") that stay the same between releases.
+typedef struct {
+    char name[64];
+    char unit[16];
+    double value;
+} BenchResult;
+
+typedef struct {
+    BenchResult results[BENCH_MAX_RESULTS];
+    int count;
+} BenchReport;
+
+// An encoder and container the suite writes its fixtures with
+typedef struct {
+    const char *name;
+    const char *extension;
+    const char *muxer;
+    enum AVCodecID codec;
+    int sample_rate;
+    int64_t bit_rate;           // Zero for lossless codecs
+} BenchFormat;
+
 // Global application instance
 static TuxMusicApp *g_app = NULL;
 
+// Conversion cost per AudioPath, see audio_print_path_stats
+static AudioPathStats g_audio_path_stats[AUDIO_PATH_COUNT];
+
+// Filled by every benchmark as it runs
+static BenchReport g_bench;
+
+// Flight recorder for the audio, decode and render threads, see trace_start
+static Tracer g_trace;
+static _Thread_local int t_trace_slot;  // Ring index + 1; 0 = unclaimed, -1 = none left
+
 // ═══════════════════════════════════════════════════════════════════════════════
 // ║                          FUNCTION DECLARATIONS                             ║
 // ═══════════════════════════════════════════════════════════════════════════════
 
 // Core application
-static void     app_initialize(void);
+static void     app_initialize(PaceMode pace_mode, int pace_rate, bool ephemeral);
 static void     app_cleanup(void);
+static void     app_cleanup_library(void);
 static void     app_run_main_loop(void);
+
+// Headless mode
+static bool     headless_requested(int argc, char *argv[]);
+static int      headless_run(int argc, char *argv[], Uint64 launched);
+static void     headless_initialize(bool playback, Uint64 launched);
+static void     headless_wait_for_scan(void);
+static void     headless_measure_loudness(void);
+static bool     headless_enqueue(const char *path);
+static void     headless_print_field(const char *text, char separator);
+static void     headless_print_library(void);
+static void     headless_play(void);
+
+// Tracing
+static bool     trace_parse_args(int argc, char *argv[]);
+static bool     trace_start(const char *path);
+static bool     trace_stop(void);
+static void     trace_toggle(void);
+static void     trace_cleanup(void);
+static bool     trace_active(void);
+static void     trace_thread(const char *name);
+static Uint64   trace_begin(void);
+static void     trace_end(TraceSpan span, Uint64 start, uint32_t arg);
+static void     trace_record(TraceSpan span, Uint64 start, Uint64 end, uint32_t arg);
+static bool     trace_export(const char *path);
+
+// Frame pacing
+static bool     pacer_parse(const char *arg, PaceMode *mode, int *fixed_rate);
+static void     pacer_initialize(FramePacer *pacer, PaceMode mode, int fixed_rate);
+static void     pacer_set_mode(FramePacer *pacer, PaceMode mode);
+static void     pacer_detect_refresh(FramePacer *pacer);
+static void     pacer_wait(FramePacer *pacer, bool presented);
+static void     pacer_update_overlay(FramePacer *pacer);
+static void     pacer_print_stats(const FramePacer *pacer);
+static void     frame_stats_add(FrameStats *stats, double seconds);
+static void     render_pacing_overlay(void);
+static const char* pace_mode_name(PaceMode mode);
+static Rect     pacer_overlay_rect(void);
 static void     app_handle_events(void);
 static void     app_update(float delta_time);
-static void     app_render(void);
+static bool     app_render(void);
 
 // Audio engine
-static bool     audio_initialize(AudioEngine *engine);
+static bool     audio_initialize(AudioEngine *engine, bool analyzer);
 static void     audio_cleanup(AudioEngine *engine);
-static bool     audio_load_track(AudioEngine *engine, const Track *track);
+static bool     audio_load_track(AudioEngine *engine, const char *filepath, float gain);
+static void     audio_queue_next(AudioEngine *engine, const char *filepath, float gain, bool crossfade);
+static void     audio_set_track_gain(AudioEngine *engine, float gain);
+static void     audio_drop_next(AudioEngine *engine);
 static void     audio_play(AudioEngine *engine);
 static void     audio_pause(AudioEngine *engine);
 static void     audio_stop(AudioEngine *engine);
 static void     audio_seek(AudioEngine *engine, double position);
 static void     audio_set_volume(AudioEngine *engine, float volume);
+static AudioClock audio_get_clock(AudioEngine *engine);
+static AudioLatency audio_get_latency(AudioEngine *engine);
+static void     audio_clock_mark(AudioEngine *engine, double start_seconds, double duration, bool track_changed);
+static void     audio_clock_publish(AudioEngine *engine, size_t first, size_t filled);
+static void     audio_set_eq_band(AudioEngine *engine, int band, float gain_db);
+static void     audio_set_eq_preamp(AudioEngine *engine, float gain_db);
+static void     audio_set_eq_enabled(AudioEngine *engine, bool enabled);
+static bool     audio_track_finished(AudioEngine *engine);
+static bool     audio_next_failed(AudioEngine *engine);
+static unsigned audio_track_serial(AudioEngine *engine);
+static void     audio_device_callback(void *userdata, Uint8 *stream, int len);
 static void*    audio_thread_function(void *data);
+static void*    audio_preload_function(void *data);
+static bool     audio_decoder_open(AudioDecoder *decoder, const char *filepath, int output_rate);
+static void     audio_decoder_close(AudioDecoder *decoder);
+static bool     audio_decoder_set_output(AudioDecoder *decoder, int64_t in_layout, int in_channels,
+                                         enum AVSampleFormat in_format, int in_rate, int output_rate);
+static SDL_AudioDeviceID audio_device_open(AudioEngine *engine, int rate, int frames, SDL_AudioSpec *obtained);
+static bool     audio_open_device(AudioEngine *engine, int rate);
+static void     audio_device_install(AudioEngine *engine, SDL_AudioDeviceID device, const SDL_AudioSpec *obtained);
+static bool     audio_parse_buffer_bounds(const char *arg, int *min, int *max);
+static void     audio_set_buffer_bounds(AudioEngine *engine, int min, int max);
+static void     audio_resize_device(AudioEngine *engine, int frames);
+static void     audio_set_ring_depth(AudioEngine *engine, size_t frames);
+static void     audio_adapt_latency(AudioEngine *engine);
+static void     audio_print_path_stats(void);
+static void     audio_print_latency_stats(AudioEngine *engine);
+static void     audio_decoder_seek(AudioDecoder *decoder, double seconds);
+static bool     audio_decoder_read(AudioDecoder *decoder, AVPacket *packet, AVFrame *frame);
+static int      audio_decoder_seek_skip(AudioDecoder *decoder, const AVFrame *frame);
+static void     audio_seek_apply(AudioEngine *engine, AVPacket *packet, AVFrame *frame);
+static SeekIndexJob* audio_seek_index_begin(AudioEngine *engine);
+static void     audio_seek_index_finish(AudioEngine *engine, SeekIndexJob *job);
+static void     audio_retire_decoder(AudioEngine *engine, AudioDecoder *decoder);
 static void*    spectrum_thread_function(void *data);
+static bool     spectrum_initialize(AudioEngine *engine);
+static void     spectrum_cleanup(AudioEngine *engine);
+static void     spectrum_analyze(AudioEngine *engine);
+
+// Equalizer DSP
+static void     equalizer_initialize(Equalizer *eq);
+static void     equalizer_update(Equalizer *eq, const float *gains_db, float preamp_db, 
+                                 int sample_rate, unsigned generation);
+static void     equalizer_process(Equalizer *eq, float *samples, int frames);
+static void     equalizer_reset(Equalizer *eq);
+static void     equalizer_flush_denormals(void);
+
+// Seek index
+static bool     seek_index_supported(const AVFormatContext *format);
+static void     seek_index_load(AudioDecoder *decoder, const char *filepath);
+static void     seek_index_write(const SeekIndexJob *job);
+static void     seek_index_build(SeekIndexJob *job, AVPacket *packet);
+static void     seek_index_job_free(SeekIndexJob *job);
+static int64_t  audio_decoder_index_target(const AudioDecoder *decoder, double seconds);
+static bool     audio_decoder_index_short(const AudioDecoder *decoder, int64_t target);
+static void     audio_decoder_index_to(AudioDecoder *decoder, double seconds, AVPacket *packet);
+
+// PCM ring buffer
+static bool     pcm_ring_initialize(PcmRing *ring, size_t frames, size_t history);
+static void     pcm_ring_cleanup(PcmRing *ring);
+static size_t   pcm_ring_readable(PcmRing *ring);
+static size_t   pcm_ring_writable(PcmRing *ring);
+static size_t   pcm_ring_write(PcmRing *ring, const float *frames, size_t count);
+static size_t   pcm_ring_read(PcmRing *ring, float *frames, size_t count);
+static void     pcm_ring_flush(PcmRing *ring);
+static bool     pcm_ring_tap(PcmRing *ring, float *frames, size_t count);
 
 // Metadata & file handling
 static bool     metadata_extract_from_file(const char *filepath, TrackMetadata *metadata);
 static bool     file_is_supported_audio(const char *filepath);
+static bool     file_is_directory(const char *path);
 static void     file_scan_directory(const char *path, Playlist *playlist);
 
+// Task pool
+static bool     task_pool_initialize(TaskPool *pool, int workers);
+static void     task_pool_cleanup(TaskPool *pool);
+static void     task_pool_submit(TaskPool *pool, TaskFunction function, void *arg);
+
+// Library scanner
+static void     library_scanner_add_directory(LibraryScanner *scanner, const char *path, Playlist *target);
+static void     library_scanner_add_file(LibraryScanner *scanner, const char *path, Playlist *target);
+static int      library_scanner_poll(LibraryScanner *scanner, int max_tracks);
+static bool     library_scanner_busy(LibraryScanner *scanner);
+static void     library_scanner_cleanup(LibraryScanner *scanner);
+
+// Loudness & ReplayGain
+static void     loudness_meter_initialize(LoudnessMeter *meter, int rate);
+static void     loudness_meter_add(LoudnessMeter *meter, const float *samples, int frames);
+static bool     loudness_meter_finish(LoudnessMeter *meter, LoudnessResult *result);
+static bool     loudness_measure_file(const char *path, LoudnessResult *result,
+                                      atomic_bool *cancelled, uint64_t *milliseconds);
+static void     loudness_scanner_poll(LoudnessScanner *scanner, TrackStore *store);
+static void     loudness_scanner_rewind(LoudnessScanner *scanner, TrackStore *store);
+static void     loudness_scanner_save(LoudnessScanner *scanner, TrackStore *store, size_t measured);
+static void     loudness_scanner_cleanup(LoudnessScanner *scanner, TrackStore *store);
+static float    replaygain_for_track(const TrackStore *store, TrackId id, ReplayGainMode mode);
+static void     replaygain_set_mode(ReplayGainMode mode);
+static bool     replaygain_parse(const char *text, ReplayGainMode *mode);
+static const char* replaygain_mode_name(ReplayGainMode mode);
+
 // Widget system
 static Widget*  widget_create(WidgetType type, const char *id);
 static void     widget_destroy(Widget *widget);
@@ -384,8 +1577,30 @@ static void     widget_set_bounds(Widget *widget, float x, float y, float w, flo
 static void     widget_set_text(Widget *widget, const char *text);
 static void     widget_set_callback(Widget *widget, WidgetCallback callback);
 static bool     widget_handle_mouse(Widget *widget, int x, int y, bool pressed, bool released);
-static void     widget_update(Widget *widget, float delta_time);
+static bool     widget_update(Widget *widget, float delta_time);
 static void     widget_render(Widget *widget, SDL_Renderer *renderer);
+static void     widget_mark_dirty(Widget *widget);
+static void     widget_activate(Widget *widget);
+static void     list_widget_scroll_to(Widget *widget, int index, bool center);
+static void     list_widget_jump(Widget *widget, float rows);
+static float    list_widget_max_scroll(const Widget *widget);
+static void     list_widget_handle_mouse(Widget *widget, int y, bool pressed);
+static void     list_widget_play(Widget *widget, int index);
+static bool     list_widget_update(Widget *widget, float delta_time);
+static void     render_list_widget(Widget *widget, SDL_Renderer *renderer, Color color);
+static void     render_album_art_widget(Widget *widget, SDL_Renderer *renderer);
+
+// Damage tracking
+static void     ui_invalidate(Rect rect);
+static void     ui_invalidate_all(void);
+static void     ui_track_changes(void);
+static void     ui_latency_text(char *text, size_t size);
+static bool     ui_is_idle(void);
+static void     ui_hit_grid_build(void);
+static void     ui_route_mouse(void);
+static Rect     ui_main_area_rect(void);
+static Rect     ui_controls_rect(void);
+static Rect     ui_status_bar_rect(void);
 
 // Specialized widgets
 static Widget*  create_play_button(const char *id);
@@ -406,11 +1621,30 @@ static void     render_text_aligned(SDL_Renderer *renderer, TTF_Font *font, cons
 static void     render_glassmorphism_effect(SDL_Renderer *renderer, Rect rect, float blur_radius);
 static void     render_drop_shadow(SDL_Renderer *renderer, Rect rect, float offset, Color color);
 
+// Geometry batch
+static void     geom_begin_frame(void);
+static void     geom_flush(SDL_Renderer *renderer);
+static void     backdrop_update(SDL_Renderer *renderer);
+static bool     backdrop_draw(Rect rect, float radius, bool blurred);
+static void     geom_drop_textures(void);
+static void     geom_cleanup(void);
+
+// Text rendering
+static void     text_begin_frame(void);
+static void     text_draw(SDL_Renderer *renderer, TTF_Font *font, const char *text, 
+                          float x, float y, Color color, int *width, int *height);
+static bool     text_measure(SDL_Renderer *renderer, TTF_Font *font, const char *text, 
+                             int *width, int *height);
+static GlyphAtlas* text_atlas(SDL_Renderer *renderer);
+static void     text_drop_atlas(void);
+static void     text_cleanup(void);
+
 // UI layouts
 static void     setup_main_interface(void);
 static void     layout_now_playing_view(void);
 static void     layout_library_view(void);
 static void     render_background(void);
+static void     render_background_gradient(void);
 static void     render_main_player_area(void);
 static void     render_sidebar(void);
 static void     render_bottom_controls(void);
@@ -421,13 +1655,86 @@ static void     handle_key_press(SDL_Scancode key);
 static void     handle_file_drop(const char *filepath);
 static void     handle_window_resize(int width, int height);
 
+// Track store
+static void     track_store_initialize(TrackStore *store);
+static void     track_store_cleanup(TrackStore *store);
+static TrackId  track_store_add(TrackStore *store, const Track *track);
+static void     track_store_update(TrackStore *store, TrackId id, const Track *track);
+static void     track_store_set_identity(TrackStore *store, TrackId id, const Track *track);
+static void     track_store_set_loudness(TrackStore *store, TrackId id, const LoudnessResult *result);
+static TrackId  track_store_find(TrackStore *store, const char *filepath);
+static void     track_store_get(const TrackStore *store, TrackId id, Track *track);
+static const char* track_store_text(const TrackStore *store, StringRef ref);
+static const char* track_store_filename(const TrackStore *store, TrackId id);
+static size_t   track_store_memory_usage(const TrackStore *store);
+static uint32_t hash_string(const char *text);
+static bool     string_arena_initialize(StringArena *arena);
+static void     string_arena_cleanup(StringArena *arena);
+static StringRef string_arena_intern(StringArena *arena, const char *text);
+static StringRef string_arena_find(const StringArena *arena, const char *text);
+static bool     string_arena_load(StringArena *arena, const char *data, size_t size);
+static void     track_store_rebuild_path_index(TrackStore *store);
+static bool     track_store_reserve(TrackStore *store, size_t rows);
+static void     track_store_touch(TrackStore *store, TrackId id);
+
+// Library database
+static bool     cache_directory(char *directory, size_t size);
+static bool     make_directory(const char *path);
+static bool     library_db_path(char *path, size_t size);
+static bool     library_db_load(LibraryCache *cache, TrackStore *store, const char *path);
+static bool     library_db_save(TrackStore *store, const char *path);
+static bool     library_cache_check(const LibraryCache *cache, Track *track);
+static void     library_cache_cleanup(LibraryCache *cache);
+static bool     file_get_identity(const char *path, int64_t *size, int64_t *mtime);
+
+// Artwork
+static SDL_Texture* artwork_get(ArtworkCache *cache, const TrackStore *store, TrackId id, int size,
+                                int *width, int *height);
+static bool     artwork_poll(ArtworkCache *cache, SDL_Renderer *renderer);
+static void     artwork_drop_textures(ArtworkCache *cache);
+static void     artwork_cleanup(ArtworkCache *cache);
+static uint32_t file_content_hash(const char *path, int64_t size);
+
 // Playlist management  
 static void     playlist_initialize(Playlist *playlist, const char *name);
+static void     playlist_cleanup(Playlist *playlist);
 static void     playlist_add_track(Playlist *playlist, const Track *track);
+static void     playlist_append(Playlist *playlist, TrackId id);
+static bool     playlist_contains(const Playlist *playlist, TrackId id);
 static void     playlist_remove_track(Playlist *playlist, int index);
-static void     playlist_play_track(Playlist *playlist, int index);
+static bool     playlist_play_track(Playlist *playlist, int index);
+static bool     playlist_play_from(Playlist *playlist, int index);
+static int      playlist_pick_next(Playlist *playlist, bool automatic);
 static void     playlist_next_track(Playlist *playlist);
+static void     playlist_track_finished(Playlist *playlist);
+static void     playlist_queue_next(Playlist *playlist);
+static void     playlist_track_changed(Playlist *playlist);
 static void     playlist_previous_track(Playlist *playlist);
+static int      playlist_index_of(const Playlist *playlist, TrackId id);
+
+// Search & smart playlists
+static bool     search_index_initialize(SearchIndex *index);
+static void     search_index_cleanup(SearchIndex *index);
+static void     smart_playlist_initialize(Playlist *playlist, const char *name, const char *filter);
+static void     smart_playlist_set_filter(Playlist *playlist, const SearchIndex *index, const char *filter);
+static void     smart_playlists_load(void);
+static bool     smart_playlists_save(void);
+static void     smart_playlist_save_search(void);
+static void     smart_playlist_show(int slot);
+static void     smart_playlist_delete(int slot);
+static int      smart_playlist_shown(void);
+static bool     library_views_sync(void);
+static void     search_update_status(void);
+static void     search_open(void);
+static void     search_close(void);
+static void     search_input_text(const char *text);
+static bool     search_handle_key(SDL_Scancode key);
+
+// Playlist sorting
+static bool     sort_spec_parse(const char *text, SortSpec *spec);
+static bool     playlist_sort(Playlist *playlist, const SortSpec *spec);
+static void     playlist_sort_next_preset(void);
+static void     playlist_sorter_cleanup(PlaylistSorter *sorter);
 
 // Utility functions
 static Color    color_lerp(Color a, Color b, float t);
@@ -435,14 +1742,51 @@ static float    smooth_step(float t);
 static float    ease_out_cubic(float t);
 static void     format_time_string(double seconds, char *output, size_t size);
 static bool     point_in_rect(int x, int y, Rect rect);
+static bool     rect_intersects(Rect a, Rect b);
 static char*    get_file_extension(const char *filepath);
 static void     show_file_dialog(void);
 
+// Benchmarks
+static int      bench_equalizer(void);
+static int      bench_seek(int count, char **files);
+static int      bench_convert(void);
+static int      bench_suite(int argc, char **argv);
+static double   bench_median(double *values, int count);
+static int      compare_double(const void *a, const void *b);
+static void     bench_record(const char *name, const char *unit, double value);
+static bool     bench_write_report(const char *path);
+static bool     bench_write_fixture(const char *path, const BenchFormat *format, double seconds,
+                                    bool noise, const char *title, int track);
+static void     bench_signal(float *samples, int frames, int64_t position, int rate, double seconds,
+                             bool noise, double *phase, uint32_t *seed);
+static bool     bench_encode(AVFormatContext *output, AVStream *stream, AVCodecContext *encoder,
+                             AVFrame *frame, AVPacket *packet);
+static void     bench_fft(void);
+static void     bench_loudness(void);
+static void     bench_decode(const char *directory);
+static double   bench_scan_pass(const char *directory);
+static void     bench_library(const char *directory);
+static void     bench_synthetic_library(TrackStore *store, int count);
+static bool     bench_audio_available(void);
+static void     bench_render(void);
+
 // ═══════════════════════════════════════════════════════════════════════════════
 // ║                            MAIN ENTRY POINT                                ║
 // ═══════════════════════════════════════════════════════════════════════════════
 
 int main(int argc, char *argv[]) {
+    Uint64 launched = SDL_GetPerformanceCounter();
+    
+    // Before anything starts, so every thread is traced from the beginning
+    if (!trace_parse_args(argc, argv)) {
+        return 1;
+    }
+    
+    // Headless runs keep stdout for their own output, so no banner
+    if (headless_requested(argc, argv)) {
+        return headless_run(argc, argv, launched);
+    }
+    
     printf("\n");
     printf("╔════════════════════════════════════════════════════════════════╗\n");
     printf("║                       TUX MUSIC PREMIUM                        ║\n");
@@ -453,23 +1797,65 @@ int main(int argc, char *argv[]) {
     printf("╚════════════════════════════════════════════════════════════════╝\n");
     printf("\n");
     
-    // Initialize application
-    app_initialize();
+    // Developer benchmarks run without a window or an audio device
+    if (argc > 1 && strcmp(argv[1], "--bench-eq") == 0) {
+        return bench_equalizer();
+    }
+    if (argc > 1 && strcmp(argv[1], "--bench-convert") == 0) {
+        return bench_convert();
+    }
+    if (argc > 1 && strcmp(argv[1], "--bench-seek") == 0) {
+        return bench_seek(argc - 2, argv + 2);
+    }
+    if (argc > 1 && strcmp(argv[1], "--bench-suite") == 0) {
+        return bench_suite(argc - 2, argv + 2);
+    }
     
-    // Process command line arguments
+    // Options come before the window exists
+    PaceMode pace_mode = PACE_VSYNC;
+    int pace_rate = 0;
+    int art_budget_mb = ARTWORK_BUDGET_MB;
+    int buffer_min = AUDIO_BUFFER_MIN, buffer_max = AUDIO_BUFFER_MAX;
+    ReplayGainMode replaygain = REPLAYGAIN_ALBUM;
     for (int i = 1; i < argc; i++) {
-        if (file_is_supported_audio(argv[i])) {
-            Track track = {0};
-            strncpy(track.filepath, argv[i], MAX_PATH - 1);
-            const char *filename = strrchr(argv[i], PATH_SEP[0]);
-            strncpy(track.filename, filename ? filename + 1 : argv[i], 511);
-            
-            if (metadata_extract_from_file(argv[i], &track.metadata)) {
-                track.metadata_loaded = true;
+        if (strncmp(argv[i], "--pace=", 7) == 0 && !pacer_parse(argv[i], &pace_mode, &pace_rate)) {
+            fprintf(stderr, "Unknown pacing %s; use --pace=vsync, --pace=fixed[:HZ] or --pace=demand\n",
+                    argv[i]);
+            return 1;
+        }
+        if (strncmp(argv[i], "--art-cache-mb=", 15) == 0) {
+            art_budget_mb = atoi(argv[i] + 15);
+            if (art_budget_mb < 1) {
+                fprintf(stderr, "Artwork cache budget must be at least 1 MB\n");
+                return 1;
             }
-            
-            playlist_add_track(&g_app->current_playlist, &track);
-            printf("Loaded: %s\n", track.filename);
+        }
+        if (strncmp(argv[i], "--audio-buffer=", 15) == 0 &&
+            !audio_parse_buffer_bounds(argv[i] + 15, &buffer_min, &buffer_max)) {
+            fprintf(stderr, "Audio buffer bounds must be powers of two within %d:%d frames\n",
+                    AUDIO_BUFFER_MIN, AUDIO_BUFFER_MAX);
+            return 1;
+        }
+        if (strncmp(argv[i], "--replaygain=", 13) == 0 && !replaygain_parse(argv[i] + 13, &replaygain)) {
+            fprintf(stderr, "Unknown ReplayGain mode %s; use --replaygain=off, track or album\n", argv[i]);
+            return 1;
+        }
+    }
+    
+    // Initialize application
+    app_initialize(pace_mode, pace_rate, false);
+    g_app->artwork.budget = (size_t)art_budget_mb << 20;
+    audio_set_buffer_bounds(&g_app->audio, buffer_min, buffer_max);
+    g_app->audio.replaygain = replaygain;
+    
+    // Process command line arguments; probing happens on the scanner pool
+    for (int i = 1; i < argc; i++) {
+        if (strncmp(argv[i], "--", 2) == 0) {
+            continue;
+        } else if (file_is_directory(argv[i])) {
+            file_scan_directory(argv[i], &g_app->current_playlist);
+        } else if (file_is_supported_audio(argv[i])) {
+            library_scanner_add_file(&g_app->scanner, argv[i], &g_app->current_playlist);
         }
     }
     
@@ -481,22 +1867,477 @@ int main(int argc, char *argv[]) {
     // Cleanup and exit
     printf("Shutting down gracefully...\n");
     app_cleanup();
+    
+    // Every traced thread has stopped by now
+    trace_cleanup();
     printf("Thank you for using Tux Music Premium!\n");
     
     return 0;
 }
 
+// ═══════════════════════════════════════════════════════════════════════════════
+// ║                            FRAME PACING                                    ║
+// ═══════════════════════════════════════════════════════════════════════════════
+
+static const char* pace_mode_name(PaceMode mode) {
+    switch (mode) {
+        case PACE_VSYNC:     return "vsync";
+        case PACE_FIXED:     return "fixed";
+        case PACE_ON_DEMAND: return "on-demand";
+        default:             return "?";
+    }
+}
+
+// "--pace=vsync", "--pace=fixed", "--pace=fixed:120" or "--pace=demand"
+static bool pacer_parse(const char *arg, PaceMode *mode, int *fixed_rate) {
+    const char *value = arg + strlen("--pace=");
+    *fixed_rate = 0;
+    
+    if (strcmp(value, "vsync") == 0) {
+        *mode = PACE_VSYNC;
+    } else if (strcmp(value, "demand") == 0 || strcmp(value, "on-demand") == 0) {
+        *mode = PACE_ON_DEMAND;
+    } else if (strncmp(value, "fixed", 5) == 0 && (value[5] == '\0' || value[5] == ':')) {
+        *mode = PACE_FIXED;
+        if (value[5] == ':') {
+            *fixed_rate = atoi(value + 6);
+            if (*fixed_rate <= 0) return false;
+        }
+    } else {
+        return false;
+    }
+    return true;
+}
+
+// The refresh rate of the display the window is on; TARGET_FPS when the
+// driver does not report one
+static void pacer_detect_refresh(FramePacer *pacer) {
+    SDL_DisplayMode mode;
+    int display = SDL_GetWindowDisplayIndex(g_app->window);
+    
+    int refresh = TARGET_FPS;
+    if (display >= 0 && SDL_GetCurrentDisplayMode(display, &mode) == 0 && mode.refresh_rate > 0) {
+        refresh = mode.refresh_rate;
+    }
+    
+    pacer->refresh_rate = refresh;
+    int rate = pacer->mode == PACE_FIXED && pacer->fixed_rate > 0 ? pacer->fixed_rate : refresh;
+    pacer->period = pacer->frequency / (Uint64)rate;
+}
+
+// Vsync is only wanted in vsync mode; the other modes time frames themselves
+static void pacer_set_mode(FramePacer *pacer, PaceMode mode) {
+    pacer->mode = mode;
+    pacer_detect_refresh(pacer);
+    pacer->deadline = SDL_GetPerformanceCounter();
+    
+#if SDL_VERSION_ATLEAST(2, 0, 18)
+    if (SDL_RenderSetVSync(g_app->renderer, mode == PACE_VSYNC) == 0) {
+        pacer->vsync = mode == PACE_VSYNC;
+    }
+#endif
+}
+
+static void pacer_initialize(FramePacer *pacer, PaceMode mode, int fixed_rate) {
+    memset(pacer, 0, sizeof(FramePacer));
+    pacer->frequency = SDL_GetPerformanceFrequency();
+    pacer->fixed_rate = fixed_rate;
+    pacer->oversleep = 0.001;
+    
+    SDL_RendererInfo info;
+    pacer->vsync = SDL_GetRendererInfo(g_app->renderer, &info) == 0 &&
+                   (info.flags & SDL_RENDERER_PRESENTVSYNC);
+    pacer_set_mode(pacer, mode);
+    
+    printf("Frame pacing: %s at %d Hz (display %d Hz)%s\n", pace_mode_name(pacer->mode),
+           (int)(pacer->frequency / pacer->period), pacer->refresh_rate,
+           pacer->mode != PACE_VSYNC && pacer->vsync ? ", renderer still vsynced" : "");
+}
+
+static void frame_stats_add(FrameStats *stats, double seconds) {
+    double us = seconds * 1e6;
+    uint32_t sample = us >= (double)UINT32_MAX ? UINT32_MAX : (uint32_t)us;
+    uint32_t bucket = sample / FRAME_STATS_BUCKET_US;
+    if (bucket >= FRAME_STATS_BUCKETS) bucket = FRAME_STATS_BUCKETS - 1;
+    
+    // The window forgets the frame it overwrites
+    uint32_t slot = (uint32_t)(stats->frames & (FRAME_STATS_WINDOW - 1));
+    if (stats->frames >= FRAME_STATS_WINDOW) {
+        uint32_t old = stats->samples[slot] / FRAME_STATS_BUCKET_US;
+        stats->window_counts[old < FRAME_STATS_BUCKETS ? old : FRAME_STATS_BUCKETS - 1]--;
+    }
+    stats->samples[slot] = sample;
+    stats->window_counts[bucket]++;
+    stats->total_counts[bucket]++;
+    stats->frames++;
+    
+    if (sample > stats->max_us) stats->max_us = sample;
+    if (seconds > FRAME_STALL_SECONDS) stats->stalls++;
+}
+
+// Upper edge, in milliseconds, of the bucket holding the `p` quantile
+static double frame_stats_percentile(const uint64_t *counts, uint64_t total, double p) {
+    if (total == 0) return 0.0;
+    
+    uint64_t rank = (uint64_t)ceil(p * total), seen = 0;
+    for (int bucket = 0; bucket < FRAME_STATS_BUCKETS; bucket++) {
+        seen += counts[bucket];
+        if (seen >= rank) return (bucket + 1) * FRAME_STATS_BUCKET_US / 1000.0;
+    }
+    return FRAME_STATS_BUCKETS * FRAME_STATS_BUCKET_US / 1000.0;
+}
+
+// Longest frame still in the rolling window, in milliseconds
+static double frame_stats_window_max(const FrameStats *stats) {
+    uint64_t count = stats->frames < FRAME_STATS_WINDOW ? stats->frames : FRAME_STATS_WINDOW;
+    uint32_t max = 0;
+    for (uint64_t i = 0; i < count; i++) {
+        if (stats->samples[i] > max) max = stats->samples[i];
+    }
+    return max / 1000.0;
+}
+
+static void pacer_os_sleep(double seconds) {
+#ifdef _WIN32
+    SDL_Delay((Uint32)(seconds * 1000.0));
+#else
+    struct timespec duration = {
+        (time_t)seconds, (long)((seconds - (time_t)seconds) * 1e9)
+    };
+    nanosleep(&duration, NULL);
+#endif
+}
+
+// Sleeps while the OS can be trusted to wake us in time, given how far it
+// has been overshooting, then spins out the remainder
+static void pacer_sleep_until(FramePacer *pacer, Uint64 deadline) {
+    const double frequency = (double)pacer->frequency;
+    
+    for (;;) {
+        Uint64 now = SDL_GetPerformanceCounter();
+        if (now >= deadline) return;
+        
+        double sleep = (deadline - now) / frequency - pacer->oversleep - PACE_SPIN_SECONDS;
+        if (sleep <= 0.0) break;
+        
+        pacer_os_sleep(sleep);
+        double over = (SDL_GetPerformanceCounter() - now) / frequency - sleep;
+        
+        // Jump to a worse overshoot at once, relax slowly after a better one
+        if (over > pacer->oversleep) {
+            pacer->oversleep = fmin(over, PACE_MAX_OVERSLEEP);
+        } else {
+            pacer->oversleep = pacer->oversleep * 0.99 + fmax(over, 0.0) * 0.01;
+        }
+    }
+    
+    while (SDL_GetPerformanceCounter() < deadline) {
+#ifdef TUXMUSIC_X86_SIMD
+        _mm_pause();
+#endif
+    }
+}
+
+// Paces the end of a frame. A presented vsync frame has already waited for
+// the display; anything else waits for the next deadline. A loop that has
+// fallen behind starts counting again from now rather than rushing.
+static void pacer_wait(FramePacer *pacer, bool presented) {
+    Uint64 now = SDL_GetPerformanceCounter();
+    
+    if (pacer->mode == PACE_VSYNC && pacer->vsync && presented) {
+        pacer->deadline = now;
+        return;
+    }
+    
+    pacer->deadline += pacer->period;
+    if (pacer->deadline <= now) {
+        pacer->deadline = now;
+        return;
+    }
+    pacer_sleep_until(pacer, pacer->deadline);
+}
+
+static Rect pacer_overlay_rect(void) {
+    return (Rect){ g_app->window_width - 508.0f, 8.0f, 500.0f, 24.0f };
+}
+
+// Refreshes the overlay text twice a second, damaging it only on change
+static void pacer_update_overlay(FramePacer *pacer) {
+    if (!pacer->overlay) return;
+    
+    Uint64 now = SDL_GetPerformanceCounter();
+    if (pacer->overlay_text[0] && now - pacer->overlay_updated < pacer->frequency / 2) return;
+    pacer->overlay_updated = now;
+    
+    const FrameStats *stats = &pacer->stats;
+    uint64_t count = stats->frames < FRAME_STATS_WINDOW ? stats->frames : FRAME_STATS_WINDOW;
+    char text[sizeof(pacer->overlay_text)];
+    // Draw calls in the last frame drawn; one region should stay in single digits
+    snprintf(text, sizeof(text), "%s %d Hz  p50 %.2f  p99 %.2f  max %.2f ms  %d draws",
+             pace_mode_name(pacer->mode), (int)(pacer->frequency / pacer->period),
+             frame_stats_percentile(stats->window_counts, count, 0.50),
+             frame_stats_percentile(stats->window_counts, count, 0.99),
+             frame_stats_window_max(stats), g_app->geom.last.draw_calls);
+    
+    if (strcmp(text, pacer->overlay_text) != 0) {
+        strcpy(pacer->overlay_text, text);
+        ui_invalidate(pacer_overlay_rect());
+    }
+}
+
+static void render_pacing_overlay(void) {
+    const FramePacer *pacer = &g_app->pacer;
+    if (!pacer->overlay || !pacer->overlay_text[0]) return;
+    
+    Rect rect = pacer_overlay_rect();
+    render_rounded_rect(g_app->renderer, rect, 6, (Color){0.0f, 0.0f, 0.0f, 0.6f});
+    render_text_aligned(g_app->renderer, g_app->fonts[0], pacer->overlay_text,
+                        (int)(rect.x + 10), (int)(rect.y + 4), COLOR_PALETTE.text_secondary, 0);
+}
+
+// Whole-run frame time distribution, printed on exit
+static void pacer_print_stats(const FramePacer *pacer) {
+    const FrameStats *stats = &pacer->stats;
+    if (stats->frames == 0) return;
+    
+    printf("  Frames: %llu (%s), p50 %.2f ms, p99 %.2f ms, max %.2f ms, %llu stalls over %.0f ms\n",
+           (unsigned long long)stats->frames, pace_mode_name(pacer->mode),
+           frame_stats_percentile(stats->total_counts, stats->frames, 0.50),
+           frame_stats_percentile(stats->total_counts, stats->frames, 0.99),
+           stats->max_us / 1000.0, (unsigned long long)stats->stalls, FRAME_STALL_SECONDS * 1000.0);
+    
+    // Coarse bands, doubling, so a stall pattern shows at a glance
+    static const double edges_ms[] = { 2, 4, 8, 16, 33, 50, 100 };
+    const int bands = sizeof(edges_ms) / sizeof(edges_ms[0]);
+    uint64_t counts[sizeof(edges_ms) / sizeof(edges_ms[0]) + 1] = {0};
+    for (int bucket = 0; bucket < FRAME_STATS_BUCKETS; bucket++) {
+        double upper = (bucket + 1) * FRAME_STATS_BUCKET_US / 1000.0;
+        int band = 0;
+        while (band < bands && upper > edges_ms[band]) band++;
+        counts[band] += stats->total_counts[bucket];
+    }
+    
+    printf("   ");
+    for (int band = 0; band <= bands; band++) {
+        if (band < bands) printf(" <%g ms: %llu", edges_ms[band], (unsigned long long)counts[band]);
+        else printf(" more: %llu", (unsigned long long)counts[band]);
+    }
+    printf("\n");
+}
+
+// ═══════════════════════════════════════════════════════════════════════════════
+// ║                               TRACING                                      ║
+// ═══════════════════════════════════════════════════════════════════════════════
+
+// --trace records from startup and writes the trace on exit, to --trace=FILE
+// or trace.json in the cache directory. F7 starts and stops it at runtime.
+static bool trace_parse_args(int argc, char *argv[]) {
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--trace") == 0) return trace_start(NULL);
+        if (strncmp(argv[i], "--trace=", 8) == 0) return trace_start(argv[i] + 8);
+    }
+    return true;
+}
+
+// Buffers are allocated on the first start and kept until exit, so a thread
+// still finishing a section after trace_stop always has somewhere to write
+static bool trace_start(const char *path) {
+    if (!g_trace.allocated) {
+        for (int i = 0; i < TRACE_MAX_THREADS; i++) {
+            g_trace.rings[i].events = calloc(TRACE_RING_EVENTS, sizeof(TraceEvent));
+            if (!g_trace.rings[i].events) {
+                fprintf(stderr, "Out of memory for trace buffers\n");
+                for (int j = 0; j < i; j++) {
+                    free(g_trace.rings[j].events);
+                    g_trace.rings[j].events = NULL;
+                }
+                return false;
+            }
+        }
+        g_trace.allocated = true;
+    }
+    
+    if (path) {
+        snprintf(g_trace.path, sizeof(g_trace.path), "%s", path);
+    } else if (!g_trace.path[0]) {
+        char directory[MAX_PATH];
+        if (cache_directory(directory, sizeof(directory))) {
+            snprintf(g_trace.path, sizeof(g_trace.path), "%s%strace.json", directory, PATH_SEP);
+        } else {
+            snprintf(g_trace.path, sizeof(g_trace.path), "tuxmusic-trace.json");
+        }
+    }
+    
+    g_trace.origin = SDL_GetPerformanceCounter();
+    atomic_store_explicit(&g_trace.enabled, true, memory_order_release);
+    return true;
+}
+
+// Stops recording and writes what the rings still hold
+static bool trace_stop(void) {
+    if (!trace_active()) return false;
+    
+    atomic_store_explicit(&g_trace.enabled, false, memory_order_release);
+    return trace_export(g_trace.path);
+}
+
+static void trace_toggle(void) {
+    if (trace_active()) {
+        bool written = trace_stop();
+        snprintf(g_app->status_message, MAX_TEXT, written ? "Trace written to %s" : "Cannot write trace to %s",
+                 g_trace.path);
+    } else if (trace_start(NULL)) {
+        snprintf(g_app->status_message, MAX_TEXT, "Tracing; F7 again writes %s", g_trace.path);
+    }
+}
+
+// After every traced thread has stopped
+static void trace_cleanup(void) {
+    if (trace_active() && trace_stop()) {
+        fprintf(stderr, "Trace written to %s\n", g_trace.path);
+    }
+    
+    for (int i = 0; i < TRACE_MAX_THREADS; i++) {
+        free(g_trace.rings[i].events);
+        g_trace.rings[i].events = NULL;
+    }
+    g_trace.allocated = false;
+}
+
+static bool trace_active(void) {
+    return atomic_load_explicit(&g_trace.enabled, memory_order_acquire);
+}
+
+// Gives the calling thread a ring. Threads that come and go under the same
+// name (the device callback, across device reopens) share one, as only one
+// of them runs at a time. Costs one thread-local check after the first call;
+// the first call itself neither locks nor allocates, so the audio callback
+// can make it.
+static void trace_thread(const char *name) {
+    if (t_trace_slot != 0) return;
+    
+    int claimed = atomic_load_explicit(&g_trace.thread_count, memory_order_acquire);
+    for (int i = 0; i < claimed && i < TRACE_MAX_THREADS; i++) {
+        TraceRing *ring = &g_trace.rings[i];
+        if (atomic_load_explicit(&ring->live, memory_order_acquire) && strcmp(ring->name, name) == 0) {
+            t_trace_slot = i + 1;
+            return;
+        }
+    }
+    
+    int slot = atomic_fetch_add_explicit(&g_trace.thread_count, 1, memory_order_acq_rel);
+    if (slot >= TRACE_MAX_THREADS) {
+        t_trace_slot = -1;
+        return;
+    }
+    
+    TraceRing *ring = &g_trace.rings[slot];
+    size_t length = 0;
+    while (name[length] && length < sizeof(ring->name) - 1) {
+        ring->name[length] = name[length];
+        length++;
+    }
+    ring->name[length] = '\0';
+    atomic_store_explicit(&ring->live, true, memory_order_release);
+    t_trace_slot = slot + 1;
+}
+
+// Zero while tracing is off, which trace_end takes as "nothing to record"
+static Uint64 trace_begin(void) {
+    return trace_active() ? SDL_GetPerformanceCounter() : 0;
+}
+
+static void trace_end(TraceSpan span, Uint64 start, uint32_t arg) {
+    if (start) trace_record(span, start, SDL_GetPerformanceCounter(), arg);
+}
+
+// Wait-free: one slot write and one release store on the thread's own ring
+static void trace_record(TraceSpan span, Uint64 start, Uint64 end, uint32_t arg) {
+    if (t_trace_slot <= 0) return;
+    
+    TraceRing *ring = &g_trace.rings[t_trace_slot - 1];
+    size_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    TraceEvent *event = &ring->events[head & (TRACE_RING_EVENTS - 1)];
+    event->start = start;
+    event->end = end;
+    event->arg = arg;
+    event->span = (uint16_t)span;
+    atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+}
+
+// Chrome trace event JSON, which Perfetto and chrome://tracing both open.
+// Runs on the main thread while the others may still be recording.
+static bool trace_export(const char *path) {
+    static const char *names[TRACE_SPAN_COUNT] = {
+        "decode", "resample", "dsp", "callback", "fft", "events", "update", "render"
+    };
+    static const char *categories[TRACE_SPAN_COUNT] = {
+        "audio", "audio", "audio", "audio", "audio", "ui", "ui", "ui"
+    };
+    static const char *arguments[TRACE_SPAN_COUNT] = {
+        "samples", "path", "frames", "frames", NULL, NULL, NULL, "presented"
+    };
+    
+    FILE *file = fopen(path, "w");
+    if (!file) {
+        fprintf(stderr, "Cannot write trace %s: %s\n", path, strerror(errno));
+        return false;
+    }
+    
+    double to_us = 1e6 / (double)SDL_GetPerformanceFrequency();
+    fprintf(file, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+    fprintf(file, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"args\":{\"name\":\"Tux Music\"}}");
+    
+    int threads = atomic_load_explicit(&g_trace.thread_count, memory_order_acquire);
+    for (int slot = 0; slot < threads && slot < TRACE_MAX_THREADS; slot++) {
+        TraceRing *ring = &g_trace.rings[slot];
+        if (!atomic_load_explicit(&ring->live, memory_order_acquire)) continue;
+        
+        fprintf(file, ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":\"%s\"}}",
+                slot + 1, ring->name);
+        
+        size_t head = atomic_load_explicit(&ring->head, memory_order_acquire);
+        size_t first = head > TRACE_RING_EVENTS ? head - TRACE_RING_EVENTS : 0;
+        for (size_t i = first; i < head; i++) {
+            TraceEvent event = ring->events[i & (TRACE_RING_EVENTS - 1)];
+            
+            // The writer may have lapped this slot while it was being copied
+            atomic_thread_fence(memory_order_acquire);
+            if (atomic_load_explicit(&ring->head, memory_order_relaxed) - i >= TRACE_RING_EVENTS) continue;
+            if (event.start < g_trace.origin || event.span >= TRACE_SPAN_COUNT) continue;
+            
+            fprintf(file, ",\n{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,"
+                          "\"ts\":%.3f,\"dur\":%.3f",
+                    names[event.span], categories[event.span], slot + 1,
+                    (event.start - g_trace.origin) * to_us, (event.end - event.start) * to_us);
+            if (arguments[event.span]) {
+                fprintf(file, ",\"args\":{\"%s\":%u}", arguments[event.span], event.arg);
+            }
+            fputc('}', file);
+        }
+    }
+    
+    fprintf(file, "\n]}\n");
+    if (fclose(file) != 0) {
+        fprintf(stderr, "Cannot write trace %s: %s\n", path, strerror(errno));
+        return false;
+    }
+    return true;
+}
+
 // ═══════════════════════════════════════════════════════════════════════════════
 // ║                         CORE APPLICATION                                   ║
 // ═══════════════════════════════════════════════════════════════════════════════
 
-static void app_initialize(void) {
+// `ephemeral` starts from an empty library that is never saved, for benchmarks
+static void app_initialize(PaceMode pace_mode, int pace_rate, bool ephemeral) {
     // Allocate application state
     g_app = calloc(1, sizeof(TuxMusicApp));
     if (!g_app) {
         fprintf(stderr, "Fatal: Cannot allocate application memory\n");
         exit(1);
     }
+    g_app->ephemeral_library = ephemeral;
     
     // Initialize SDL with all subsystems
     if (SDL_Init(SDL_INIT_EVERYTHING) < 0) {
@@ -538,9 +2379,9 @@ static void app_initialize(void) {
     // Set minimum window size
     SDL_SetWindowMinimumSize(g_app->window, WINDOW_MIN_WIDTH, WINDOW_MIN_HEIGHT);
     
-    // Create hardware-accelerated renderer
+    // Create hardware-accelerated renderer, vsynced only when that paces frames
     g_app->renderer = SDL_CreateRenderer(g_app->window, -1, 
-        SDL_RENDERER_ACCELERATED | SDL_RENDERER_PRESENTVSYNC);
+        SDL_RENDERER_ACCELERATED | (pace_mode == PACE_VSYNC ? SDL_RENDERER_PRESENTVSYNC : 0));
     
     if (!g_app->renderer) {
         fprintf(stderr, "Renderer creation failed: %s\n", SDL_GetError());
@@ -577,13 +2418,33 @@ static void app_initialize(void) {
     }
     
     // Initialize audio engine
-    if (!audio_initialize(&g_app->audio)) {
+    if (!audio_initialize(&g_app->audio, true)) {
         fprintf(stderr, "Audio initialization failed\n");
         exit(1);
     }
     
-    // Initialize playlist
+    // Initialize library and playlist
+    track_store_initialize(&g_app->library);
     playlist_initialize(&g_app->current_playlist, "Now Playing");
+    if (!search_index_initialize(&g_app->search)) {
+        fprintf(stderr, "Fatal: Cannot allocate search index\n");
+        exit(1);
+    }
+    smart_playlist_initialize(&g_app->smart_playlists[SMART_PLAYLIST_SEARCH], "Search", "");
+    g_app->smart_playlist_count = 1;
+    if (!ephemeral) smart_playlists_load();
+    
+    // Warm start: the library database stands in for probing every file
+    char db_path[MAX_PATH];
+    Uint64 load_start = SDL_GetPerformanceCounter();
+    if (!ephemeral && library_db_path(db_path, sizeof(db_path)) &&
+        library_db_load(&g_app->library_cache, &g_app->library, db_path)) {
+        for (TrackId id = 0; id < g_app->library.count; id++) {
+            playlist_append(&g_app->current_playlist, id);
+        }
+        printf("✓ Library loaded: %zu tracks in %.1f ms\n", g_app->library.count,
+               (double)(SDL_GetPerformanceCounter() - load_start) * 1000.0 / SDL_GetPerformanceFrequency());
+    }
     
     // Setup beautiful user interface
     setup_main_interface();
@@ -592,8 +2453,9 @@ static void app_initialize(void) {
     g_app->running = true;
     strcpy(g_app->status_message, "Ready to play beautiful music");
     g_app->last_frame_time = SDL_GetPerformanceCounter();
+    pacer_initialize(&g_app->pacer, pace_mode, pace_rate);
     
-    printf("✓ Audio engine initialized (96kHz/32-bit)\n");
+    printf("✓ Audio engine initialized (%dHz/32-bit float)\n", g_app->audio.device_spec.freq);
     printf("✓ Spectrum analyzer ready (1024 bands)\n");
     printf("✓ Professional EQ enabled (32 bands)\n");
     printf("✓ Beautiful UI loaded with glassmorphism\n");
@@ -645,36 +2507,47 @@ static void setup_main_interface(void) {
 }
 
 static void app_run_main_loop(void) {
-    const Uint64 performance_freq = SDL_GetPerformanceFrequency();
-    const float target_frame_time = 1.0f / TARGET_FPS;
+    FramePacer *pacer = &g_app->pacer;
+    const double performance_freq = (double)pacer->frequency;
+    pacer->deadline = SDL_GetPerformanceCounter();
+    trace_thread("main");
     
     while (g_app->running) {
         // Calculate precise frame timing
         Uint64 current_time = SDL_GetPerformanceCounter();
-        g_app->frame_time = (float)(current_time - g_app->last_frame_time) / performance_freq;
+        double elapsed = (current_time - g_app->last_frame_time) / performance_freq;
         g_app->last_frame_time = current_time;
         
-        // Limit frame time to prevent spiral of death
-        if (g_app->frame_time > 0.05f) {
-            g_app->frame_time = 0.05f;
-        }
+        // The stats see every stall as it was; only the animation step is
+        // limited, so one long frame doesn't throw everything across the screen
+        frame_stats_add(&pacer->stats, elapsed);
+        g_app->frame_time = (float)fmin(elapsed, FRAME_STALL_SECONDS);
         
         // Process events
+        Uint64 trace = trace_begin();
         app_handle_events();
+        trace_end(TRACE_EVENTS, trace, 0);
         
         // Update application state
+        trace = trace_begin();
         app_update(g_app->frame_time);
+        trace_end(TRACE_UPDATE, trace, 0);
         
-        // Render beautiful frame
-        app_render();
-        
-        // Precise frame rate limiting
-        Uint64 frame_end = SDL_GetPerformanceCounter();
-        float elapsed = (float)(frame_end - current_time) / performance_freq;
+        // Render only what changed
+        trace = trace_begin();
+        bool presented = app_render();
+        trace_end(TRACE_RENDER, trace, presented);
         
-        if (elapsed < target_frame_time) {
-            SDL_Delay((Uint32)((target_frame_time - elapsed) * 1000.0f));
+        // A static window sleeps until something happens instead of ticking
+        if (pacer->mode != PACE_FIXED && ui_is_idle()) {
+            SDL_WaitEventTimeout(NULL, UI_IDLE_WAIT_MS);
+            
+            // Don't count the sleep as animation time or as a frame
+            g_app->last_frame_time = pacer->deadline = SDL_GetPerformanceCounter();
+            continue;
         }
+        
+        pacer_wait(pacer, presented);
     }
 }
 
@@ -686,6 +2559,7 @@ static void app_handle_events(void) {
     g_app->mouse_pressed = false;
     g_app->mouse_released = false;
     g_app->mouse_wheel = 0;
+    g_app->mouse_event = false;
     
     while (SDL_PollEvent(&event)) {
         switch (event.type) {
@@ -694,11 +2568,39 @@ static void app_handle_events(void) {
                 break;
                 
             case SDL_WINDOWEVENT:
-                if (event.window.event == SDL_WINDOWEVENT_SIZE_CHANGED) {
+                if (event.window.event == SDL_WINDOWEVENT_MOVED) {
+                    // Possibly onto a display with another refresh rate
+                    pacer_detect_refresh(&g_app->pacer);
+                } else if (event.window.event == SDL_WINDOWEVENT_SIZE_CHANGED) {
                     handle_window_resize(event.window.data1, event.window.data2);
+                    ui_invalidate_all();
+                    
+                    // Widgets may have moved under a still cursor
+                    g_app->hit_grid.dirty = true;
+                    g_app->mouse_event = true;
+                } else if (event.window.event == SDL_WINDOWEVENT_EXPOSED) {
+                    ui_invalidate_all();
                 }
                 break;
                 
+            case SDL_RENDER_TARGETS_RESET:
+                g_app->geom.backdrop.stale = true;
+                ui_invalidate_all();
+                break;
+                
+            case SDL_RENDER_DEVICE_RESET:
+                // Every texture is lost, not only the render targets; each
+                // is created again the next time it is drawn
+                artwork_drop_textures(&g_app->artwork);
+                geom_drop_textures();
+                text_drop_atlas();
+                if (g_app->frame_texture) {
+                    SDL_DestroyTexture(g_app->frame_texture);
+                    g_app->frame_texture = NULL;
+                }
+                ui_invalidate_all();
+                break;
+                
             case SDL_KEYDOWN:
                 if (!event.key.repeat) {
                     g_app->keys_pressed[event.key.keysym.scancode] = true;
@@ -711,25 +2613,33 @@ static void app_handle_events(void) {
                 g_app->keys[event.key.keysym.scancode] = false;
                 break;
                 
+            case SDL_TEXTINPUT:
+                if (g_app->searching) search_input_text(event.text.text);
+                break;
+                
             case SDL_MOUSEBUTTONDOWN:
                 if (event.button.button == SDL_BUTTON_LEFT) {
                     g_app->mouse_pressed = true;
+                    g_app->mouse_event = true;
                 }
                 break;
                 
             case SDL_MOUSEBUTTONUP:
                 if (event.button.button == SDL_BUTTON_LEFT) {
                     g_app->mouse_released = true;
+                    g_app->mouse_event = true;
                 }
                 break;
                 
             case SDL_MOUSEMOTION:
                 g_app->mouse_x = event.motion.x;
                 g_app->mouse_y = event.motion.y;
+                g_app->mouse_event = true;
                 break;
                 
             case SDL_MOUSEWHEEL:
-                g_app->mouse_wheel = event.wheel.y;
+                g_app->mouse_wheel += event.wheel.y;
+                g_app->mouse_event = true;
                 break;
                 
             case SDL_DROPFILE:
@@ -739,17 +2649,15 @@ static void app_handle_events(void) {
         }
     }
     
-    // Update all widgets with events
-    for (int i = 0; i < g_app->widget_count; i++) {
-        Widget *widget = &g_app->widgets[i];
-        if (widget->visible) {
-            widget_handle_mouse(widget, g_app->mouse_x, g_app->mouse_y, 
-                              g_app->mouse_pressed, g_app->mouse_released);
-        }
+    // Widgets hear about the mouse only when it did something
+    if (g_app->mouse_event) {
+        ui_route_mouse();
     }
 }
 
 static void handle_key_press(SDL_Scancode key) {
+    if (g_app->searching && search_handle_key(key)) return;
+    
     switch (key) {
         case SDL_SCANCODE_SPACE:
             if (g_app->audio.playing) {
@@ -764,8 +2672,9 @@ static void handle_key_press(SDL_Scancode key) {
                 playlist_next_track(&g_app->current_playlist);
             } else {
                 // Seek forward 10 seconds
-                double new_pos = g_app->audio.position + 10.0;
-                if (new_pos < g_app->audio.duration) {
+                AudioClock clock = audio_get_clock(&g_app->audio);
+                double new_pos = clock.position + 10.0;
+                if (new_pos < clock.duration) {
                     audio_seek(&g_app->audio, new_pos);
                 }
             }
@@ -776,7 +2685,7 @@ static void handle_key_press(SDL_Scancode key) {
                 playlist_previous_track(&g_app->current_playlist);
             } else {
                 // Seek backward 10 seconds
-                double new_pos = fmax(0.0, g_app->audio.position - 10.0);
+                double new_pos = fmax(0.0, audio_get_clock(&g_app->audio).position - 10.0);
                 audio_seek(&g_app->audio, new_pos);
             }
             break;
@@ -799,6 +2708,22 @@ static void handle_key_press(SDL_Scancode key) {
             g_app->audio.muted = !g_app->audio.muted;
             break;
             
+        case SDL_SCANCODE_F7:
+            trace_toggle();
+            break;
+            
+        case SDL_SCANCODE_F8:
+            pacer_set_mode(&g_app->pacer, (g_app->pacer.mode + 1) % PACE_MODE_COUNT);
+            snprintf(g_app->status_message, MAX_TEXT, "Frame pacing: %s",
+                     pace_mode_name(g_app->pacer.mode));
+            break;
+            
+        case SDL_SCANCODE_F9:
+            g_app->pacer.overlay = !g_app->pacer.overlay;
+            g_app->pacer.overlay_text[0] = '\0';
+            ui_invalidate(pacer_overlay_rect());
+            break;
+            
         case SDL_SCANCODE_F11:
             g_app->fullscreen = !g_app->fullscreen;
             SDL_SetWindowFullscreen(g_app->window, 
@@ -811,8 +2736,76 @@ static void handle_key_press(SDL_Scancode key) {
             }
             break;
             
+        case SDL_SCANCODE_F:
+            if (g_app->keys[SDL_SCANCODE_LCTRL]) {
+                search_open();
+            }
+            break;
+            
+        case SDL_SCANCODE_S:
+            if (g_app->keys[SDL_SCANCODE_LCTRL]) {
+                playlist_sort_next_preset();
+            }
+            break;
+            
+        case SDL_SCANCODE_G:
+            if (g_app->keys[SDL_SCANCODE_LCTRL]) {
+                replaygain_set_mode((g_app->audio.replaygain + 1) % REPLAYGAIN_MODE_COUNT);
+                snprintf(g_app->status_message, MAX_TEXT, "ReplayGain: %s",
+                         replaygain_mode_name(g_app->audio.replaygain));
+            }
+            break;
+            
+        case SDL_SCANCODE_SLASH:
+            search_open();
+            break;
+            
+        case SDL_SCANCODE_1:
+        case SDL_SCANCODE_2:
+        case SDL_SCANCODE_3:
+        case SDL_SCANCODE_4:
+        case SDL_SCANCODE_5:
+        case SDL_SCANCODE_6:
+        case SDL_SCANCODE_7:
+            if (g_app->keys[SDL_SCANCODE_LCTRL]) {
+                smart_playlist_show(key - SDL_SCANCODE_1 + 1);
+            }
+            break;
+            
+        case SDL_SCANCODE_0:
+            if (g_app->keys[SDL_SCANCODE_LCTRL]) {
+                smart_playlist_show(0);
+            }
+            break;
+            
+        case SDL_SCANCODE_DELETE:
+            if (g_app->keys[SDL_SCANCODE_LCTRL]) {
+                smart_playlist_delete(smart_playlist_shown());
+            }
+            break;
+            
+        case SDL_SCANCODE_PAGEUP:
+        case SDL_SCANCODE_PAGEDOWN:
+            if (g_app->track_list) {
+                float page = g_app->track_list->bounds.h / g_app->track_list->list->row_height - 1.0f;
+                list_widget_jump(g_app->track_list, key == SDL_SCANCODE_PAGEUP ? -page : page);
+            }
+            break;
+            
+        case SDL_SCANCODE_HOME:
+            if (g_app->track_list) list_widget_scroll_to(g_app->track_list, 0, false);
+            break;
+            
+        case SDL_SCANCODE_END:
+            if (g_app->track_list) {
+                list_widget_scroll_to(g_app->track_list, g_app->track_list->list->source->track_count - 1, false);
+            }
+            break;
+            
         case SDL_SCANCODE_ESCAPE:
-            if (g_app->fullscreen) {
+            if (smart_playlist_shown()) {
+                smart_playlist_show(0);
+            } else if (g_app->fullscreen) {
                 g_app->fullscreen = false;
                 SDL_SetWindowFullscreen(g_app->window, 0);
             } else {
@@ -825,68 +2818,181 @@ static void handle_key_press(SDL_Scancode key) {
 static void app_update(float delta_time) {
     // Update audio position display
     if (g_app->audio.playing) {
-        format_time_string(g_app->audio.position, g_app->current_time, 32);
-        format_time_string(g_app->audio.duration, g_app->total_time, 32);
+        AudioClock clock = audio_get_clock(&g_app->audio);
+        format_time_string(clock.position, g_app->current_time, 32);
+        format_time_string(clock.duration, g_app->total_time, 32);
         
         // Update progress slider if not being dragged
-        if (g_app->progress_slider && !g_app->progress_slider->slider.dragging) {
-            if (g_app->audio.duration > 0) {
-                g_app->progress_slider->slider.value = 
-                    (float)(g_app->audio.position / g_app->audio.duration);
+        if (g_app->progress_slider && !g_app->progress_slider->slider->dragging && clock.duration > 0) {
+            float value = (float)(clock.position / clock.duration);
+            if (value != g_app->progress_slider->slider->value) {
+                g_app->progress_slider->slider->value = value;
+                widget_mark_dirty(g_app->progress_slider);
             }
         }
         
-        // Check if track finished
-        if (g_app->audio.position >= g_app->audio.duration && g_app->audio.duration > 0) {
-            if (g_app->audio.repeat_one) {
-                audio_seek(&g_app->audio, 0);
-            } else {
-                playlist_next_track(&g_app->current_playlist);
-            }
+        // The engine moved on to the queued track by itself and it is now audible.
+        // Newer only: the clock can still show the last segment before a load.
+        if ((int)(clock.track_serial - g_app->track_serial_seen) > 0) {
+            g_app->track_serial_seen = clock.track_serial;
+            playlist_track_changed(&g_app->current_playlist);
+        }
+        
+        // Nothing was queued, or it failed to open
+        if (audio_track_finished(&g_app->audio)) {
+            playlist_track_finished(&g_app->current_playlist);
         }
     }
     
+    // Merge freshly probed tracks while the scanner keeps running
+    if (g_app->scanner.active) {
+        library_scanner_poll(&g_app->scanner, SCAN_BATCH_PER_FRAME);
+        
+        // The scan may have rewritten rows measured earlier
+        if (!g_app->scanner.active) loudness_scanner_rewind(&g_app->loudness, &g_app->library);
+    }
+    
+    // Measure loudness in the background once the library holds still
+    if (!g_app->scanner.active && !g_app->ephemeral_library) {
+        loudness_scanner_poll(&g_app->loudness, &g_app->library);
+    }
+    
     // Update volume slider
-    if (g_app->volume_slider && !g_app->volume_slider->slider.dragging) {
-        g_app->volume_slider->slider.value = g_app->audio.volume;
+    if (g_app->volume_slider && !g_app->volume_slider->slider->dragging &&
+        g_app->volume_slider->slider->value != g_app->audio.volume) {
+        g_app->volume_slider->slider->value = g_app->audio.volume;
+        widget_mark_dirty(g_app->volume_slider);
     }
     
-    // Update all widgets with smooth animations
-    for (int i = 0; i < g_app->widget_count; i++) {
-        widget_update(&g_app->widgets[i], delta_time);
+    // The playlist may have shrunk under the track list's scroll target
+    if (g_app->track_list && 
+        g_app->track_list->list->scroll_target > list_widget_max_scroll(g_app->track_list)) {
+        widget_activate(g_app->track_list);
+    }
+    
+    // Update the widgets still in motion, dropping the ones now at rest
+    int still_active = 0;
+    for (int i = 0; i < g_app->active_count; i++) {
+        Widget *widget = g_app->active_widgets[i];
+        if (widget_update(widget, delta_time)) {
+            g_app->active_widgets[still_active++] = widget;
+        } else {
+            widget->active = false;
+        }
     }
+    g_app->active_count = still_active;
+    g_app->animating = still_active > 0;
     
     // Update play button text
     if (g_app->play_button) {
         widget_set_text(g_app->play_button, g_app->audio.playing ? "⏸" : "▶");
     }
+    
+    // The analyzer moves on every frame of playback
+    if (g_app->spectrum_display && g_app->audio.playing) {
+        widget_mark_dirty(g_app->spectrum_display);
+    }
+    
+    // New and rewritten tracks reach the search index and smart playlists
+    if (library_views_sync() && g_app->searching) {
+        if (g_app->track_list) widget_mark_dirty(g_app->track_list);
+        search_update_status();
+    }
+    
+    // Covers finished decoding on the artwork thread
+    if (artwork_poll(&g_app->artwork, g_app->renderer) && g_app->album_art) {
+        widget_mark_dirty(g_app->album_art);
+    }
+    
+    pacer_update_overlay(&g_app->pacer);
+    ui_track_changes();
 }
 
-static void app_render(void) {
-    // Clear with beautiful gradient
-    render_background();
+// Redraws the damaged regions of the persistent frame, clipped to each,
+// then presents it. A frame with no damage is not drawn or presented at
+// all; returns whether it was.
+static bool app_render(void) {
+    SDL_Renderer *renderer = g_app->renderer;
     
-    // Render main interface areas
-    render_main_player_area();
-    render_sidebar();
-    render_bottom_controls();
+    text_begin_frame();
     
-    // Render all visible widgets
+    // Dirty widgets become damage, including where they glow past their bounds
     for (int i = 0; i < g_app->widget_count; i++) {
         Widget *widget = &g_app->widgets[i];
-        if (widget->visible) {
-            widget_render(widget, g_app->renderer);
+        if (widget->dirty) {
+            ui_invalidate(widget->render_bounds);
+            widget->dirty = false;
+        }
+    }
+    
+    if (!g_app->frame_texture) {
+        g_app->frame_texture = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_ARGB8888,
+                                                 SDL_TEXTUREACCESS_TARGET,
+                                                 g_app->window_width, g_app->window_height);
+        ui_invalidate_all();
+    }
+    if (g_app->damage_count == 0) return false;
+    geom_begin_frame();
+    backdrop_update(renderer);
+    
+    // Without a render target every frame is a full redraw straight to the window
+    bool to_texture = g_app->frame_texture && SDL_SetRenderTarget(renderer, g_app->frame_texture) == 0;
+    if (!to_texture) {
+        ui_invalidate_all();
+    }
+    
+    for (int d = 0; d < g_app->damage_count; d++) {
+        const SDL_Rect *clip = &g_app->damage[d];
+        Rect area = { (float)clip->x, (float)clip->y, (float)clip->w, (float)clip->h };
+        SDL_RenderSetClipRect(renderer, clip);
+        
+        // Clear with beautiful gradient
+        render_background();
+        
+        // Render main interface areas
+        render_main_player_area();
+        render_sidebar();
+        render_bottom_controls();
+        
+        // Render the visible widgets that reach into this region
+        for (int i = 0; i < g_app->widget_count; i++) {
+            Widget *widget = &g_app->widgets[i];
+            if (widget->visible && rect_intersects(widget->render_bounds, area)) {
+                widget_render(widget, renderer);
+            }
         }
+        
+        // Render status bar
+        render_status_bar();
+        render_pacing_overlay();
+        
+        // Everything queued for this region goes out before the clip moves
+        geom_flush(renderer);
     }
     
-    // Render status bar
-    render_status_bar();
+    SDL_RenderSetClipRect(renderer, NULL);
+    g_app->damage_count = 0;
+    
+    if (to_texture) {
+        SDL_SetRenderTarget(renderer, NULL);
+        SDL_RenderCopy(renderer, g_app->frame_texture, NULL, NULL);
+    }
     
     // Present the beautiful frame
-    SDL_RenderPresent(g_app->renderer);
+    SDL_RenderPresent(renderer);
+    return true;
 }
 
 static void render_background(void) {
+    // The backdrop holds this gradient already, and drawing it from there
+    // keeps it in the layer beneath the glass panels
+    Rect screen = {0, 0, g_app->window_width, g_app->window_height};
+    if (backdrop_draw(screen, 0.0f, false)) return;
+    
+    render_background_gradient();
+}
+
+static void render_background_gradient(void) {
     // Beautiful gradient background
     Rect screen = {0, 0, g_app->window_width, g_app->window_height};
     Color top = COLOR_PALETTE.bg_primary;
@@ -896,46 +3002,51 @@ static void render_background(void) {
 
 static void render_main_player_area(void) {
     // Main content area with glassmorphism effect
-    Rect main_area = {40, 40, g_app->window_width - 80, 720};
+    Rect main_area = ui_main_area_rect();
     render_glassmorphism_effect(g_app->renderer, main_area, 8);
     
     // Current track info area
     if (g_app->current_playlist.current_index >= 0 && 
         g_app->current_playlist.current_index < g_app->current_playlist.track_count) {
         
-        Track *current = &g_app->current_playlist.tracks[g_app->current_playlist.current_index];
+        const TrackStore *store = &g_app->library;
+        TrackId current = g_app->current_playlist.track_ids[g_app->current_playlist.current_index];
+        const char *title = track_store_text(store, store->title[current]);
         
         // Track title
-        if (current->metadata_loaded && strlen(current->metadata.title) > 0) {
+        if ((store->flags[current] & TRACK_FLAG_METADATA_LOADED) && title[0]) {
             Rect title_rect = {400, 100, 800, 50};
             render_text_centered(g_app->renderer, g_app->fonts[4], 
-                                current->metadata.title, title_rect, COLOR_PALETTE.text_primary);
+                                title, title_rect, COLOR_PALETTE.text_primary);
             
             // Artist name
-            if (strlen(current->metadata.artist) > 0) {
+            const char *artist = track_store_text(store, store->artist[current]);
+            if (artist[0]) {
                 Rect artist_rect = {400, 160, 800, 30};
                 render_text_centered(g_app->renderer, g_app->fonts[2], 
-                                   current->metadata.artist, artist_rect, COLOR_PALETTE.text_secondary);
+                                   artist, artist_rect, COLOR_PALETTE.text_secondary);
             }
             
             // Album name
-            if (strlen(current->metadata.album) > 0) {
+            const char *album = track_store_text(store, store->album[current]);
+            if (album[0]) {
                 Rect album_rect = {400, 200, 800, 25};
                 render_text_centered(g_app->renderer, g_app->fonts[1], 
-                                   current->metadata.album, album_rect, COLOR_PALETTE.text_tertiary);
+                                   album, album_rect, COLOR_PALETTE.text_tertiary);
             }
         } else {
             // Show filename if no metadata
             Rect filename_rect = {400, 130, 800, 40};
             render_text_centered(g_app->renderer, g_app->fonts[3], 
-                               current->filename, filename_rect, COLOR_PALETTE.text_primary);
+                               track_store_filename(store, current), filename_rect, 
+                               COLOR_PALETTE.text_primary);
         }
     }
 }
 
 static void render_bottom_controls(void) {
     // Control panel with beautiful glass effect
-    Rect control_area = {40, 770, g_app->window_width - 80, 180};
+    Rect control_area = ui_controls_rect();
     render_glassmorphism_effect(g_app->renderer, control_area, 6);
     
     // Time display
@@ -964,9 +3075,15 @@ static void render_bottom_controls(void) {
     }
 }
 
+static void ui_latency_text(char *text, size_t size) {
+    AudioLatency latency = audio_get_latency(&g_app->audio);
+    snprintf(text, size, "%.0f ms, %u underrun%s", latency.device_latency * 1000.0,
+             latency.underruns, latency.underruns == 1 ? "" : "s");
+}
+
 static void render_status_bar(void) {
     // Status bar at the very bottom
-    Rect status_rect = {0, g_app->window_height - 30, g_app->window_width, 30};
+    Rect status_rect = ui_status_bar_rect();
     render_rounded_rect(g_app->renderer, status_rect, 0, 
                        (Color){COLOR_PALETTE.bg_secondary.r, COLOR_PALETTE.bg_secondary.g, 
                               COLOR_PALETTE.bg_secondary.b, 0.8f});
@@ -975,6 +3092,13 @@ static void render_status_bar(void) {
     render_text_aligned(g_app->renderer, g_app->fonts[0], g_app->status_message,
                        20, g_app->window_height - 22, COLOR_PALETTE.text_tertiary, 0);
     
+    // Output latency and underruns, see audio_adapt_latency
+    char latency_info[64];
+    ui_latency_text(latency_info, sizeof(latency_info));
+    render_text_aligned(g_app->renderer, g_app->fonts[0], latency_info,
+                       g_app->window_width - 400, g_app->window_height - 22, 
+                       COLOR_PALETTE.text_tertiary, 0);
+    
     // Track count
     char track_info[64];
     snprintf(track_info, sizeof(track_info), "%d tracks", g_app->current_playlist.track_count);
@@ -984,30 +3108,331 @@ static void render_status_bar(void) {
 }
 
 // ═══════════════════════════════════════════════════════════════════════════════
-// ║                            AUDIO ENGINE                                    ║
+// ║                            HEADLESS MODE                                   ║
 // ═══════════════════════════════════════════════════════════════════════════════
 
-static bool audio_initialize(AudioEngine *engine) {
-    memset(engine, 0, sizeof(AudioEngine));
-    
-    // Initialize threading
-    if (pthread_mutex_init(&engine->audio_mutex, NULL) != 0 ||
-        pthread_mutex_init(&engine->spectrum_mutex, NULL) != 0) {
-        fprintf(stderr, "Failed to initialize audio mutexes\n");
-        return false;
+// tuxmusic --headless [--scan=DIR]... [--loudness] [--print-library] [--play=PATH] [--enqueue=PATH]... [PATH]...
+//
+// Audio and decoding only: no window, renderer, fonts or image loaders. Scans
+// run first and are saved to the library database, --loudness then measures
+// every track still lacking a loudness measurement, then the library listing
+// goes to stdout as tab-separated artist, album, track, title, seconds and
+// path. --play and --enqueue (or bare paths) fill the queue, which plays to
+// the end or until interrupted. Progress goes to stderr.
+
+static volatile sig_atomic_t g_headless_interrupted = 0;
+
+static void headless_interrupt(int signal_number) {
+    (void)signal_number;
+    g_headless_interrupted = 1;
+}
+
+// Any headless operation implies --headless
+static bool headless_requested(int argc, char *argv[]) {
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--headless") == 0 || strcmp(argv[i], "--print-library") == 0 ||
+            strncmp(argv[i], "--scan=", 7) == 0 || strncmp(argv[i], "--play=", 7) == 0 ||
+            strncmp(argv[i], "--enqueue=", 10) == 0 || strcmp(argv[i], "--loudness") == 0) {
+            return true;
+        }
     }
-    
-    // Initialize FFTW for spectrum analysis
-    engine->fft_input = (fftw_complex*)fftw_malloc(sizeof(fftw_complex) * SPECTRUM_SIZE);
-    engine->fft_output = (fftw_complex*)fftw_malloc(sizeof(fftw_complex) * SPECTRUM_SIZE);
-    
-    if (!engine->fft_input || !engine->fft_output) {
-        fprintf(stderr, "Failed to allocate FFT buffers\n");
+    return false;
+}
+
+static int headless_run(int argc, char *argv[], Uint64 launched) {
+    bool playback = false;
+    bool loudness = false;
+    int buffer_min = AUDIO_BUFFER_MIN, buffer_max = AUDIO_BUFFER_MAX;
+    ReplayGainMode replaygain = REPLAYGAIN_ALBUM;
+    for (int i = 1; i < argc; i++) {
+        if (strncmp(argv[i], "--play=", 7) == 0 || strncmp(argv[i], "--enqueue=", 10) == 0 ||
+            strncmp(argv[i], "--", 2) != 0) {
+            playback = true;
+        }
+        if (strncmp(argv[i], "--audio-buffer=", 15) == 0 &&
+            !audio_parse_buffer_bounds(argv[i] + 15, &buffer_min, &buffer_max)) {
+            fprintf(stderr, "Audio buffer bounds must be powers of two within %d:%d frames\n",
+                    AUDIO_BUFFER_MIN, AUDIO_BUFFER_MAX);
+            return 1;
+        }
+        if (strncmp(argv[i], "--replaygain=", 13) == 0 && !replaygain_parse(argv[i] + 13, &replaygain)) {
+            fprintf(stderr, "Unknown ReplayGain mode %s; use --replaygain=off, track or album\n", argv[i]);
+            return 1;
+        }
+        if (strcmp(argv[i], "--loudness") == 0) loudness = true;
+    }
+    
+    signal(SIGINT, headless_interrupt);
+    signal(SIGTERM, headless_interrupt);
+    headless_initialize(playback, launched);
+    if (playback) {
+        audio_set_buffer_bounds(&g_app->audio, buffer_min, buffer_max);
+        g_app->audio.replaygain = replaygain;
+    }
+    
+    int status = 0;
+    for (int i = 1; i < argc && !g_headless_interrupted; i++) {
+        if (strncmp(argv[i], "--scan=", 7) != 0) continue;
+        
+        const char *path = argv[i] + 7;
+        if (!file_is_directory(path)) {
+            fprintf(stderr, "Not a directory: %s\n", path);
+            status = 1;
+            continue;
+        }
+        
+        // A throwaway target: the scan only has to reach the library
+        Playlist scanned;
+        playlist_initialize(&scanned, "Scan");
+        library_scanner_add_directory(&g_app->scanner, path, &scanned);
+        headless_wait_for_scan();
+        fprintf(stderr, "%s\n", g_app->status_message);
+        playlist_cleanup(&scanned);
+    }
+    
+    if (loudness && !g_headless_interrupted) headless_measure_loudness();
+    
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--print-library") == 0) {
+            headless_print_library();
+            break;
+        }
+    }
+    
+    // --play goes to the front of the queue, everything else in order after it
+    for (int i = 1; i < argc && !g_headless_interrupted; i++) {
+        if (strncmp(argv[i], "--play=", 7) == 0 && !headless_enqueue(argv[i] + 7)) status = 1;
+    }
+    for (int i = 1; i < argc && !g_headless_interrupted; i++) {
+        const char *path = NULL;
+        if (strncmp(argv[i], "--enqueue=", 10) == 0) {
+            path = argv[i] + 10;
+        } else if (strncmp(argv[i], "--", 2) != 0) {
+            path = argv[i];
+        }
+        if (path && !headless_enqueue(path)) status = 1;
+    }
+    
+    if (g_app->current_playlist.track_count > 0) {
+        headless_play();
+    } else if (playback) {
+        fprintf(stderr, "Nothing to play\n");
+        status = 1;
+    }
+    
+    app_cleanup_library();
+    SDL_Quit();
+    free(g_app);
+    g_app = NULL;
+    trace_cleanup();
+    
+    return status;
+}
+
+// The audio device is opened only when something will play
+static void headless_initialize(bool playback, Uint64 launched) {
+    g_app = calloc(1, sizeof(TuxMusicApp));
+    if (!g_app) {
+        fprintf(stderr, "Fatal: Cannot allocate application memory\n");
+        exit(1);
+    }
+    
+    // Interrupts end playback here rather than becoming SDL_QUIT events
+    SDL_SetHint(SDL_HINT_NO_SIGNAL_HANDLERS, "1");
+    if (SDL_Init(playback ? SDL_INIT_AUDIO : 0) < 0) {
+        fprintf(stderr, "SDL initialization failed: %s\n", SDL_GetError());
+        exit(1);
+    }
+    
+    av_register_all();
+    
+    track_store_initialize(&g_app->library);
+    playlist_initialize(&g_app->current_playlist, "Now Playing");
+    
+    // Known files are queued straight from the database without probing
+    char db_path[MAX_PATH];
+    if (library_db_path(db_path, sizeof(db_path))) {
+        library_db_load(&g_app->library_cache, &g_app->library, db_path);
+    }
+    
+    // Nobody reads the analyzer without a window
+    if (playback && !audio_initialize(&g_app->audio, false)) {
+        fprintf(stderr, "Audio initialization failed\n");
+        exit(1);
+    }
+    
+    g_app->running = true;
+    fprintf(stderr, "Headless startup: %.1f ms (%zu tracks in library%s)\n",
+            (double)(SDL_GetPerformanceCounter() - launched) * 1000.0 / SDL_GetPerformanceFrequency(),
+            g_app->library.count, playback ? ", audio ready" : "");
+}
+
+static void headless_wait_for_scan(void) {
+    while (g_app->scanner.active && !g_headless_interrupted) {
+        library_scanner_poll(&g_app->scanner, SCAN_BATCH_PER_FRAME);
+        if (g_app->scanner.active) SDL_Delay(HEADLESS_POLL_MS);
+    }
+}
+
+// Runs a full loudness pass over the library; an interrupt keeps what finished
+static void headless_measure_loudness(void) {
+    LoudnessScanner *scanner = &g_app->loudness;
+    
+    loudness_scanner_rewind(scanner, &g_app->library);
+    loudness_scanner_poll(scanner, &g_app->library);
+    if (!scanner->active) {
+        fprintf(stderr, "Loudness already measured for every track\n");
+        return;
+    }
+    
+    while (scanner->active && !g_headless_interrupted) {
+        SDL_Delay(HEADLESS_POLL_MS);
+        loudness_scanner_poll(scanner, &g_app->library);
+    }
+    fprintf(stderr, "%s\n", g_app->status_message);
+}
+
+// Files already in the library are queued as they are; anything else is
+// probed first. A directory is queued in album order.
+static bool headless_enqueue(const char *path) {
+    Playlist *queue = &g_app->current_playlist;
+    
+    if (!file_is_directory(path)) {
+        TrackId id = track_store_find(&g_app->library, path);
+        if (id != TRACK_ID_NONE) {
+            playlist_append(queue, id);
+            return true;
+        }
+        if (!file_is_supported_audio(path)) {
+            fprintf(stderr, "Not a supported audio file: %s\n", path);
+            return false;
+        }
+    }
+    
+    Playlist found;
+    playlist_initialize(&found, "Enqueue");
+    if (file_is_directory(path)) {
+        library_scanner_add_directory(&g_app->scanner, path, &found);
+    } else {
+        library_scanner_add_file(&g_app->scanner, path, &found);
+    }
+    headless_wait_for_scan();
+    
+    SortSpec spec;
+    if (found.track_count > 1 && sort_spec_parse("artist,album,track", &spec)) {
+        playlist_sort(&found, &spec);
+    }
+    for (int i = 0; i < found.track_count; i++) {
+        playlist_append(queue, found.track_ids[i]);
+    }
+    
+    bool queued = found.track_count > 0;
+    if (!queued) fprintf(stderr, "Nothing playable in %s\n", path);
+    playlist_cleanup(&found);
+    return queued;
+}
+
+// Tabs and line breaks in tags would split the row
+static void headless_print_field(const char *text, char separator) {
+    for (const char *c = text; *c; c++) {
+        putchar(*c == '\t' || *c == '\n' || *c == '\r' ? ' ' : *c);
+    }
+    putchar(separator);
+}
+
+static void headless_print_library(void) {
+    TrackStore *store = &g_app->library;
+    
+    Playlist all;
+    playlist_initialize(&all, "Library");
+    for (TrackId id = 0; id < store->count; id++) {
+        playlist_append(&all, id);
+    }
+    
+    SortSpec spec;
+    if (sort_spec_parse("artist,album,track", &spec)) {
+        playlist_sort(&all, &spec);
+    }
+    
+    for (int i = 0; i < all.track_count; i++) {
+        TrackId id = all.track_ids[i];
+        char number[32];
+        
+        headless_print_field(track_store_text(store, store->artist[id]), '\t');
+        headless_print_field(track_store_text(store, store->album[id]), '\t');
+        snprintf(number, sizeof(number), "%u", (unsigned)store->track_num[id]);
+        headless_print_field(number, '\t');
+        headless_print_field(track_store_text(store, store->title[id]), '\t');
+        snprintf(number, sizeof(number), "%.3f", store->duration_seconds[id]);
+        headless_print_field(number, '\t');
+        headless_print_field(track_store_text(store, store->path[id]), '\n');
+    }
+    fflush(stdout);
+    
+    playlist_cleanup(&all);
+}
+
+// Plays the queue through once, following the engine the way app_update does
+static void headless_play(void) {
+    Playlist *playlist = &g_app->current_playlist;
+    TrackStore *store = playlist->store;
+    
+    // Start from the first entry that opens
+    playlist_play_from(playlist, 0);
+    
+    int announced = -1;
+    while (g_app->audio.playing && !g_headless_interrupted) {
+        int index = playlist->current_index;
+        if (index != announced && index >= 0) {
+            TrackId id = playlist->track_ids[index];
+            char duration[32];
+            format_time_string(store->duration_seconds[id], duration, sizeof(duration));
+            fprintf(stderr, "[%d/%d] %s - %s (%s)\n", index + 1, playlist->track_count,
+                    track_store_text(store, store->artist[id]),
+                    track_store_text(store, store->title[id]), duration);
+            announced = index;
+        }
+        
+        SDL_Delay(HEADLESS_POLL_MS);
+        
+        AudioClock clock = audio_get_clock(&g_app->audio);
+        if ((int)(clock.track_serial - g_app->track_serial_seen) > 0) {
+            g_app->track_serial_seen = clock.track_serial;
+            playlist_track_changed(playlist);
+        }
+        if (audio_track_finished(&g_app->audio)) {
+            playlist_track_finished(playlist);
+        }
+    }
+    
+    if (g_headless_interrupted) {
+        audio_stop(&g_app->audio);
+        fprintf(stderr, "Interrupted\n");
+    }
+}
+
+// ═══════════════════════════════════════════════════════════════════════════════
+// ║                            AUDIO ENGINE                                    ║
+// ═══════════════════════════════════════════════════════════════════════════════
+
+// `analyzer` is false when nothing will ever read the spectrum
+static bool audio_initialize(AudioEngine *engine, bool analyzer) {
+    memset(engine, 0, sizeof(AudioEngine));
+    engine->seek_target = -1.0;
+    
+    // Initialize threading
+    if (pthread_mutex_init(&engine->audio_mutex, NULL) != 0 ||
+        pthread_mutex_init(&engine->spectrum_mutex, NULL) != 0 ||
+        pthread_mutex_init(&engine->preload_mutex, NULL) != 0 ||
+        pthread_cond_init(&engine->preload_cond, NULL) != 0) {
+        fprintf(stderr, "Failed to initialize audio mutexes\n");
         return false;
     }
     
-    engine->fft_plan = fftw_plan_dft_1d(SPECTRUM_SIZE, engine->fft_input, 
-                                       engine->fft_output, FFTW_FORWARD, FFTW_ESTIMATE);
+    if (!spectrum_initialize(engine)) {
+        fprintf(stderr, "Failed to allocate FFT buffers\n");
+        return false;
+    }
     
     // Initialize equalizer with flat response
     for (int i = 0; i < EQ_BANDS; i++) {
@@ -1015,98 +3440,289 @@ static bool audio_initialize(AudioEngine *engine) {
     }
     engine->eq_preamp = 0.0f;
     engine->eq_enabled = true;
+    engine->eq_generation = 1;
+    equalizer_initialize(&engine->eq);
     
     // Set default audio parameters
     engine->volume = 0.7f;
     engine->crossfade_duration = 3.0f;
     engine->crossfade_enabled = true;
+    engine->replaygain = REPLAYGAIN_ALBUM;
+    
+    // Ring buffer between the decoder thread and the device callback,
+    // keeping enough already-played audio intact for the spectrum tap
+    if (!pcm_ring_initialize(&engine->ring, AUDIO_RING_FRAMES, FFT_SIZE + AUDIO_BUFFER_MAX)) {
+        fprintf(stderr, "Failed to allocate PCM ring buffer\n");
+        return false;
+    }
+    
+    // Open the output device at its own rate, so nothing is resampled for it
+    int rate = AUDIO_SAMPLE_RATE;
+#if SDL_VERSION_ATLEAST(2, 24, 0)
+    SDL_AudioSpec native;
+    if (SDL_GetDefaultAudioInfo(NULL, &native, 0) == 0 && native.freq > 0) {
+        rate = native.freq;
+    }
+#endif
+    
+    // Start at low latency; audio_adapt_latency grows it if the system cannot keep up
+    engine->buffer_min = AUDIO_BUFFER_MIN;
+    engine->buffer_max = AUDIO_BUFFER_MAX;
+    engine->buffer_frames = AUDIO_BUFFER_START;
+    audio_set_ring_depth(engine, 0);
+    engine->adapt_start = engine->calm_since = SDL_GetPerformanceCounter();
+    
+    engine->follow_source_rate = true;
+    if (!audio_open_device(engine, rate)) {
+        fprintf(stderr, "Failed to open audio device: %s\n", SDL_GetError());
+        return false;
+    }
     
     // Start background threads
     engine->threads_active = true;
-    pthread_create(&engine->spectrum_thread, NULL, spectrum_thread_function, engine);
+    pthread_create(&engine->audio_thread, NULL, audio_thread_function, engine);
+    if (analyzer) {
+        pthread_create(&engine->spectrum_thread, NULL, spectrum_thread_function, engine);
+    }
+    pthread_create(&engine->preload_thread, NULL, audio_preload_function, engine);
     
     engine->initialized = true;
     return true;
 }
 
-static bool audio_load_track(AudioEngine *engine, const Track *track) {
+// Opens an output device asking for `rate`, but taking whatever rate the
+// device runs at natively. The callback only ever touches the ring. Touches
+// no engine state, so it needs no lock.
+static SDL_AudioDeviceID audio_device_open(AudioEngine *engine, int rate, int frames, SDL_AudioSpec *obtained) {
+    SDL_AudioSpec wanted = {0};
+    wanted.freq = rate;
+    wanted.format = AUDIO_F32SYS;
+    wanted.channels = AUDIO_CHANNELS;
+    wanted.samples = (Uint16)frames;
+    wanted.callback = audio_device_callback;
+    wanted.userdata = engine;
+    
+    return SDL_OpenAudioDevice(NULL, 0, &wanted, obtained, SDL_AUDIO_ALLOW_FREQUENCY_CHANGE);
+}
+
+// Opens the device with the current buffer size.
+// Caller holds audio_mutex, or is audio_initialize.
+static bool audio_open_device(AudioEngine *engine, int rate) {
+    SDL_AudioSpec obtained;
+    SDL_AudioDeviceID device = audio_device_open(engine, rate, atomic_load(&engine->buffer_frames), &obtained);
+    if (!device) return false;
+    
+    audio_device_install(engine, device, &obtained);
+    return true;
+}
+
+// Makes a freshly opened device the engine's. Caller holds audio_mutex,
+// or is audio_initialize.
+static void audio_device_install(AudioEngine *engine, SDL_AudioDeviceID device, const SDL_AudioSpec *obtained) {
+    engine->device = device;
+    engine->device_spec = *obtained;
+    atomic_store(&engine->device_rate, engine->device_spec.freq);
+    atomic_store(&engine->device_frames, engine->device_spec.samples);
+    
+    // SDL fills one buffer while the previous one plays
+    engine->clock_latency = (double)engine->device_spec.samples / engine->device_spec.freq;
+    engine->late_ticks = (Uint64)(AUDIO_LATE_FACTOR * engine->clock_latency * SDL_GetPerformanceFrequency());
+    
+    // The gap since the old device's last callback is not the new one's fault
+    engine->stream_generation++;
+}
+
+// Parses the value of --audio-buffer=MIN:MAX, or =FRAMES for a fixed buffer
+static bool audio_parse_buffer_bounds(const char *arg, int *min, int *max) {
+    char *end;
+    long low = strtol(arg, &end, 10);
+    long high = low;
+    if (*end == ':') high = strtol(end + 1, &end, 10);
+    
+    if (*end != '\0' || low < AUDIO_BUFFER_MIN || high > AUDIO_BUFFER_MAX || low > high ||
+        (low & (low - 1)) != 0 || (high & (high - 1)) != 0) {
+        return false;
+    }
+    *min = (int)low;
+    *max = (int)high;
+    return true;
+}
+
+// Confines the device buffer to [min, max] frames, reopening the device if
+// the current size falls outside
+static void audio_set_buffer_bounds(AudioEngine *engine, int min, int max) {
     pthread_mutex_lock(&engine->audio_mutex);
     
-    // Cleanup previous track
-    if (engine->format_context) {
-        avformat_close_input(&engine->format_context);
-        engine->format_context = NULL;
-    }
-    if (engine->codec_context) {
-        avcodec_free_context(&engine->codec_context);
-        engine->codec_context = NULL;
-    }
+    engine->buffer_min = min;
+    engine->buffer_max = max;
+    audio_resize_device(engine, atomic_load(&engine->buffer_frames));
     
-    // Open new audio file
-    if (avformat_open_input(&engine->format_context, track->filepath, NULL, NULL) < 0) {
-        pthread_mutex_unlock(&engine->audio_mutex);
-        return false;
+    pthread_mutex_unlock(&engine->audio_mutex);
+}
+
+// Reopens the device with a buffer of `frames`, clamped to the bounds. The
+// ring keeps its contents, so playback carries on from where it was.
+// Caller holds audio_mutex. It is let go for the close and reopen, which
+// can take a while on a struggling host, so play, seek and load are not
+// held up; until the new device is in, engine->device is the closed one.
+static void audio_resize_device(AudioEngine *engine, int frames) {
+    if (frames < engine->buffer_min) frames = engine->buffer_min;
+    if (frames > engine->buffer_max) frames = engine->buffer_max;
+    
+    int previous = atomic_load(&engine->buffer_frames);
+    if (frames == previous || !engine->device || engine->device_reopening) return;
+    
+    SDL_AudioDeviceID old = engine->device;
+    int rate = engine->device_spec.freq;
+    engine->device_reopening = true;
+    pthread_mutex_unlock(&engine->audio_mutex);
+    
+    SDL_AudioSpec obtained;
+    SDL_CloseAudioDevice(old);
+    SDL_AudioDeviceID device = audio_device_open(engine, rate, frames, &obtained);
+    if (!device) {
+        frames = previous;
+        device = audio_device_open(engine, rate, frames, &obtained);
     }
     
-    if (avformat_find_stream_info(engine->format_context, NULL) < 0) {
-        avformat_close_input(&engine->format_context);
-        engine->format_context = NULL;
-        pthread_mutex_unlock(&engine->audio_mutex);
-        return false;
+    pthread_mutex_lock(&engine->audio_mutex);
+    engine->device_reopening = false;
+    if (!device) {
+        engine->device = 0;
+        fprintf(stderr, "Failed to reopen audio device: %s\n", SDL_GetError());
+        return;
     }
     
-    // Find audio stream
-    engine->audio_stream_index = -1;
-    for (int i = 0; i < engine->format_context->nb_streams; i++) {
-        if (engine->format_context->streams[i]->codecpar->codec_type == AVMEDIA_TYPE_AUDIO) {
-            engine->audio_stream_index = i;
-            break;
+    atomic_store(&engine->buffer_frames, frames);
+    audio_device_install(engine, device, &obtained);
+    engine->resizes++;
+    audio_set_ring_depth(engine, atomic_load(&engine->ring_depth));
+    if (engine->playing) SDL_PauseAudioDevice(engine->device, 0);
+}
+
+// At least AUDIO_DEPTH_BUFFERS device buffers, at most what the ring holds
+// besides the spectrum history
+static void audio_set_ring_depth(AudioEngine *engine, size_t frames) {
+    size_t least = (size_t)atomic_load(&engine->buffer_frames) * AUDIO_DEPTH_BUFFERS;
+    size_t most = AUDIO_RING_FRAMES - (FFT_SIZE + AUDIO_BUFFER_MAX);
+    
+    if (frames < least) frames = least;
+    if (frames > most) frames = most;
+    atomic_store(&engine->ring_depth, frames);
+}
+
+// Runs on the decoder thread every AUDIO_ADAPT_SECONDS, holding audio_mutex,
+// which a device reopen lets go of for a while.
+// A late callback means the device itself is starved of CPU time, which only
+// a bigger device buffer hides. An on-time callback finding the ring empty
+// means decoding fell behind, so the decoder works further ahead first.
+// After AUDIO_CALM_SECONDS without either, latency steps back down: the ring
+// any time, the device only while nothing is playing, as a reopen is audible.
+static void audio_adapt_latency(AudioEngine *engine) {
+    Uint64 now = SDL_GetPerformanceCounter();
+    Uint64 frequency = SDL_GetPerformanceFrequency();
+    if (now - engine->adapt_start < (Uint64)(AUDIO_ADAPT_SECONDS * frequency)) return;
+    
+    unsigned underruns = atomic_load(&engine->underruns);
+    unsigned late = atomic_load(&engine->late_callbacks);
+    bool starved = underruns != engine->adapt_underruns;
+    bool delayed = late != engine->adapt_late;
+    engine->adapt_underruns = underruns;
+    engine->adapt_late = late;
+    engine->adapt_start = now;
+    
+    int buffer = atomic_load(&engine->buffer_frames);
+    size_t depth = atomic_load(&engine->ring_depth);
+    size_t most = AUDIO_RING_FRAMES - (FFT_SIZE + AUDIO_BUFFER_MAX);
+    
+    if (starved || delayed) {
+        engine->calm_since = now;
+        if (delayed || depth >= most) {
+            audio_resize_device(engine, buffer * 2);
+        } else {
+            audio_set_ring_depth(engine, depth * 2);
+        }
+    } else if (now - engine->calm_since >= (Uint64)(AUDIO_CALM_SECONDS * frequency)) {
+        engine->calm_since = now;
+        if (depth > (size_t)buffer * AUDIO_DEPTH_BUFFERS) {
+            audio_set_ring_depth(engine, depth / 2);
+        } else if (!engine->playing) {
+            audio_resize_device(engine, buffer / 2);
         }
     }
-    
-    if (engine->audio_stream_index == -1) {
-        avformat_close_input(&engine->format_context);
-        engine->format_context = NULL;
-        pthread_mutex_unlock(&engine->audio_mutex);
-        return false;
+}
+
+// 44.1 kHz and its multiples, or everything else (the 48 kHz family)
+static int audio_rate_family(int rate) {
+    return rate % 11025 == 0 ? 0 : 1;
+}
+
+// Moves the device to the track's rate family if it is not there already,
+// so a whole album plays without a resampler. Rates within a family are
+// still resampled; switching between them is not worth a device reopen.
+// Caller holds audio_mutex and has flushed the ring.
+static void audio_follow_source_rate(AudioEngine *engine, int source_rate) {
+    int family = audio_rate_family(source_rate);
+    int previous = engine->device_spec.freq;
+    
+    if (!engine->follow_source_rate || source_rate <= 0 || engine->device_reopening ||
+        family == audio_rate_family(previous) || (engine->rejected_families & (1u << family))) {
+        return;
     }
     
-    // Get codec and open decoder
-    AVCodecParameters *codecpar = engine->format_context->streams[engine->audio_stream_index]->codecpar;
-    const AVCodec *codec = avcodec_find_decoder(codecpar->codec_id);
+    SDL_CloseAudioDevice(engine->device);
+    engine->device = 0;
     
-    if (!codec) {
-        avformat_close_input(&engine->format_context);
-        engine->format_context = NULL;
-        pthread_mutex_unlock(&engine->audio_mutex);
-        return false;
+    if (!audio_open_device(engine, source_rate) && !audio_open_device(engine, previous)) {
+        fprintf(stderr, "Failed to reopen audio device: %s\n", SDL_GetError());
+        return;
     }
     
-    engine->codec_context = avcodec_alloc_context3(codec);
-    if (!engine->codec_context) {
-        avformat_close_input(&engine->format_context);
-        engine->format_context = NULL;
-        pthread_mutex_unlock(&engine->audio_mutex);
+    if (audio_rate_family(engine->device_spec.freq) != family) {
+        engine->rejected_families |= 1u << family;
+    }
+}
+
+static bool audio_load_track(AudioEngine *engine, const char *filepath, float gain) {
+    // Open outside the lock so the decoder thread keeps feeding the device
+    AudioDecoder *decoder = calloc(1, sizeof(AudioDecoder));
+    if (!decoder || !audio_decoder_open(decoder, filepath, atomic_load(&engine->device_rate))) {
+        free(decoder);
         return false;
     }
+    decoder->gain = gain;
+    
+    pthread_mutex_lock(&engine->audio_mutex);
     
-    if (avcodec_parameters_to_context(engine->codec_context, codecpar) < 0 ||
-        avcodec_open2(engine->codec_context, codec, NULL) < 0) {
-        avcodec_free_context(&engine->codec_context);
-        avformat_close_input(&engine->format_context);
-        engine->format_context = NULL;
+    // Drop whatever the previous track left in flight
+    pcm_ring_flush(&engine->ring);
+    equalizer_reset(&engine->eq);
+    engine->stream_generation++;
+    if (engine->current) {
+        audio_retire_decoder(engine, engine->current);
+        engine->current = NULL;
+    }
+    audio_drop_next(engine);
+    
+    // Nothing has been decoded yet, so the output side can still change
+    audio_follow_source_rate(engine, decoder->codec_context->sample_rate);
+    bool ok = engine->device != 0;
+    if (ok && decoder->output_rate != engine->device_spec.freq) {
+        ok = audio_decoder_set_output(decoder, decoder->codec_context->channel_layout,
+                                      decoder->codec_context->channels, decoder->codec_context->sample_fmt,
+                                      decoder->codec_context->sample_rate, engine->device_spec.freq);
+    }
+    if (!ok) {
         pthread_mutex_unlock(&engine->audio_mutex);
+        audio_decoder_close(decoder);
+        free(decoder);
         return false;
     }
     
-    // Get duration
-    if (engine->format_context->duration != AV_NOPTS_VALUE) {
-        engine->duration = (double)engine->format_context->duration / AV_TIME_BASE;
-    } else {
-        engine->duration = 0.0;
-    }
-    
-    engine->position = 0.0;
+    engine->current = decoder;
+    engine->decoder_eof = false;
+    engine->seek_target = -1.0;
+    audio_clock_mark(engine, 0.0, decoder->duration, false);
     engine->playing = false;
     engine->paused = false;
     
@@ -1114,6 +3730,73 @@ static bool audio_load_track(AudioEngine *engine, const Track *track) {
     return true;
 }
 
+// Opens the track that should follow the current one on the preload thread,
+// so the transition itself needs no file I/O. NULL clears the queue.
+static void audio_queue_next(AudioEngine *engine, const char *filepath, float gain, bool crossfade) {
+    pthread_mutex_lock(&engine->audio_mutex);
+    
+    audio_drop_next(engine);
+    engine->next_crossfade = crossfade;
+    engine->next_state = filepath ? AUDIO_NEXT_LOADING : AUDIO_NEXT_NONE;
+    unsigned generation = engine->queue_generation;
+    
+    pthread_mutex_unlock(&engine->audio_mutex);
+    
+    pthread_mutex_lock(&engine->preload_mutex);
+    snprintf(engine->preload_path, sizeof(engine->preload_path), "%s", filepath ? filepath : "");
+    engine->preload_gain = gain;
+    engine->preload_generation = generation;
+    pthread_cond_signal(&engine->preload_cond);
+    pthread_mutex_unlock(&engine->preload_mutex);
+}
+
+// Applies to what the current track decodes from now on; the little already
+// queued for the device plays out at the old gain
+static void audio_set_track_gain(AudioEngine *engine, float gain) {
+    pthread_mutex_lock(&engine->audio_mutex);
+    if (engine->current) engine->current->gain = gain;
+    pthread_mutex_unlock(&engine->audio_mutex);
+}
+
+// Forgets the queued track, including one still being opened. Caller holds audio_mutex.
+static void audio_drop_next(AudioEngine *engine) {
+    if (engine->next) {
+        audio_decoder_close(engine->next);
+        free(engine->next);
+        engine->next = NULL;
+    }
+    engine->next_state = AUDIO_NEXT_NONE;
+    engine->queue_generation++;
+}
+
+// Closes a decoder the engine is finished with. Callers hold audio_mutex, so
+// a seek index that grew is handed to the preload thread to write.
+static void audio_retire_decoder(AudioEngine *engine, AudioDecoder *decoder) {
+    SeekIndexJob *job = decoder->index.dirty ? calloc(1, sizeof(SeekIndexJob)) : NULL;
+    if (job) {
+        snprintf(job->filepath, sizeof(job->filepath), "%s", decoder->filepath);
+        job->file_size = decoder->file_size;
+        job->file_mtime = decoder->file_mtime;
+        job->index = decoder->index;
+        memset(&decoder->index, 0, sizeof(SeekIndex));
+    }
+    
+    audio_decoder_close(decoder);
+    free(decoder);
+    if (!job) return;
+    
+    if (engine->preload_thread) {
+        pthread_mutex_lock(&engine->preload_mutex);
+        job->next = engine->index_saves;
+        engine->index_saves = job;
+        pthread_cond_signal(&engine->preload_cond);
+        pthread_mutex_unlock(&engine->preload_mutex);
+    } else {
+        seek_index_write(job);
+        seek_index_job_free(job);
+    }
+}
+
 static void audio_play(AudioEngine *engine) {
     pthread_mutex_lock(&engine->audio_mutex);
     
@@ -1122,13 +3805,13 @@ static void audio_play(AudioEngine *engine) {
         engine->playing = true;
     } else if (!engine->playing) {
         engine->playing = true;
-        // Start audio thread if not already running
-        if (!engine->threads_active) {
-            engine->threads_active = true;
-            pthread_create(&engine->audio_thread, NULL, audio_thread_function, engine);
-        }
     }
     
+    // The decoder thread is always running; just let the device pull.
+    // The callback must not blame the pause on the stream.
+    engine->stream_generation++;
+    SDL_PauseAudioDevice(engine->device, 0);
+    
     pthread_mutex_unlock(&engine->audio_mutex);
 }
 
@@ -1138,6 +3821,7 @@ static void audio_pause(AudioEngine *engine) {
     if (engine->playing) {
         engine->paused = true;
         engine->playing = false;
+        SDL_PauseAudioDevice(engine->device, 1);
     }
     
     pthread_mutex_unlock(&engine->audio_mutex);
@@ -1148,260 +3832,8386 @@ static void audio_stop(AudioEngine *engine) {
     
     engine->playing = false;
     engine->paused = false;
-    engine->position = 0.0;
+    SDL_PauseAudioDevice(engine->device, 1);
+    
+    // Rewind so the next play starts from the top
+    pcm_ring_flush(&engine->ring);
+    equalizer_reset(&engine->eq);
+    engine->stream_generation++;
+    if (engine->current) {
+        engine->seek_target = 0.0;
+        engine->decoder_eof = false;
+    }
     
     pthread_mutex_unlock(&engine->audio_mutex);
 }
 
+// Only records the target: building the seek index and decoding up to the
+// exact sample happen on the decoder thread, see audio_seek_apply
 static void audio_seek(AudioEngine *engine, double position) {
     pthread_mutex_lock(&engine->audio_mutex);
     
-    if (engine->format_context && position >= 0 && position <= engine->duration) {
-        int64_t timestamp = (int64_t)(position * AV_TIME_BASE);
-        av_seek_frame(engine->format_context, -1, timestamp, AVSEEK_FLAG_BACKWARD);
-        engine->position = position;
+    if (engine->current && position >= 0 && position <= engine->current->duration) {
+        engine->seek_target = position;
+        
+        // Audio already queued for the device belongs to the old position
+        pcm_ring_flush(&engine->ring);
+        equalizer_reset(&engine->eq);
+        engine->stream_generation++;
+        engine->decoder_eof = false;
     }
     
     pthread_mutex_unlock(&engine->audio_mutex);
 }
 
+// Decoder thread, audio_mutex held. A copy of the current track's seek index
+// when the pending seek lies beyond it, else NULL.
+static SeekIndexJob* audio_seek_index_begin(AudioEngine *engine) {
+    AudioDecoder *decoder = engine->current;
+    int64_t target = audio_decoder_index_target(decoder, engine->seek_target);
+    if (!audio_decoder_index_short(decoder, target)) return NULL;
+    
+    SeekIndexJob *job = calloc(1, sizeof(SeekIndexJob));
+    SeekPoint *points = decoder->index.count ? malloc(sizeof(SeekPoint) * decoder->index.count) : NULL;
+    if (!job || (decoder->index.count && !points)) {
+        free(job);
+        free(points);
+        decoder->index.usable = false;
+        return NULL;
+    }
+    
+    snprintf(job->filepath, sizeof(job->filepath), "%s", decoder->filepath);
+    job->file_size = decoder->file_size;
+    job->file_mtime = decoder->file_mtime;
+    job->stream_index = decoder->stream_index;
+    job->target = target;
+    job->index = decoder->index;
+    job->index.points = points;
+    job->index.capacity = job->index.count;
+    job->index.dirty = false;
+    if (points) memcpy(points, decoder->index.points, sizeof(SeekPoint) * decoder->index.count);
+    return job;
+}
+
+// audio_mutex held again. The grown index replaces the decoder's, unless
+// another file took its place meanwhile.
+static void audio_seek_index_finish(AudioEngine *engine, SeekIndexJob *job) {
+    AudioDecoder *decoder = engine->current;
+    
+    if (decoder && strcmp(decoder->filepath, job->filepath) == 0 &&
+        decoder->file_size == job->file_size && decoder->file_mtime == job->file_mtime) {
+        bool dirty = decoder->index.dirty || job->index.dirty;
+        free(decoder->index.points);
+        decoder->index = job->index;
+        decoder->index.dirty = dirty;
+        memset(&job->index, 0, sizeof(SeekIndex));
+        
+        // Never go round again for an index that cannot get there
+        if (audio_decoder_index_short(decoder, job->target)) decoder->index.usable = false;
+    }
+    
+    seek_index_job_free(job);
+}
+
+// Performs a pending seek and starts the clock where the decoder actually
+// landed. Caller holds audio_mutex.
+static void audio_seek_apply(AudioEngine *engine, AVPacket *packet, AVFrame *frame) {
+    AudioDecoder *decoder = engine->current;
+    
+    audio_decoder_seek(decoder, engine->seek_target);
+    while (decoder->discard_to >= 0 && audio_decoder_read(decoder, packet, frame)) {}
+    
+    audio_clock_mark(engine, decoder->seek_reached, decoder->duration, false);
+    engine->seek_target = -1.0;
+}
+
+// Starts a new clock segment at the ring's current write position.
+// Caller holds audio_mutex and has just flushed the ring or spliced a track.
+static void audio_clock_mark(AudioEngine *engine, double start_seconds, double duration, bool track_changed) {
+    size_t write = atomic_load_explicit(&engine->segment_write, memory_order_relaxed);
+    size_t read = atomic_load_explicit(&engine->segment_read, memory_order_acquire);
+    
+    // Only possible while the device is paused; drop the oldest segment
+    // with the callback locked out for those few instructions
+    if (write - read == CLOCK_SEGMENTS) {
+        SDL_LockAudioDevice(engine->device);
+        atomic_fetch_add_explicit(&engine->segment_read, 1, memory_order_acq_rel);
+        SDL_UnlockAudioDevice(engine->device);
+    }
+    
+    if (track_changed) engine->track_serial++;
+    
+    // A pipelined EQ kernel puts the segment's first frame that much later
+    ClockSegment *segment = &engine->segments[write & (CLOCK_SEGMENTS - 1)];
+    segment->ring_frame = atomic_load_explicit(&engine->ring.write_pos, memory_order_relaxed);
+    if (engine->eq_enabled && engine->eq.active) segment->ring_frame += engine->eq.latency;
+    segment->start_seconds = start_seconds;
+    segment->duration = duration;
+    segment->track_serial = engine->track_serial;
+    
+    atomic_store_explicit(&engine->segment_write, write + 1, memory_order_release);
+}
+
+// Device callback only. Publishes where the frames starting at ring frame
+// `first` sit in their track.
+static void audio_clock_publish(AudioEngine *engine, size_t first, size_t filled) {
+    size_t read = atomic_load_explicit(&engine->segment_read, memory_order_relaxed);
+    size_t write = atomic_load_explicit(&engine->segment_write, memory_order_acquire);
+    
+    // Adopt every segment that starts at or before these frames
+    while (read != write && engine->segments[read & (CLOCK_SEGMENTS - 1)].ring_frame <= first) {
+        engine->segment = engine->segments[read & (CLOCK_SEGMENTS - 1)];
+        read++;
+    }
+    atomic_store_explicit(&engine->segment_read, read, memory_order_release);
+    
+    const ClockSegment *segment = &engine->segment;
+    double rate = (double)engine->device_spec.freq;
+    PlaybackClock *clock = &engine->clock;
+    
+    unsigned sequence = atomic_load_explicit(&clock->sequence, memory_order_relaxed);
+    atomic_store_explicit(&clock->sequence, sequence + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    
+    clock->data.position = segment->start_seconds + (double)(first - segment->ring_frame) / rate;
+    clock->data.segment_start = segment->start_seconds;
+    clock->data.span = (double)filled / rate;
+    clock->data.duration = segment->duration;
+    clock->data.track_serial = segment->track_serial;
+    clock->data.timestamp = SDL_GetPerformanceCounter();
+    
+    atomic_store_explicit(&clock->sequence, sequence + 2, memory_order_release);
+}
+
+// Audible position, interpolated from the last device callback and corrected
+// for the device's own buffering. Never blocks the audio path.
+static AudioClock audio_get_clock(AudioEngine *engine) {
+    PlaybackClock *clock = &engine->clock;
+    ClockSnapshot snapshot;
+    unsigned sequence;
+    
+    do {
+        sequence = atomic_load_explicit(&clock->sequence, memory_order_acquire);
+        snapshot = clock->data;
+        atomic_thread_fence(memory_order_acquire);
+    } while ((sequence & 1) || sequence != atomic_load_explicit(&clock->sequence, memory_order_relaxed));
+    
+    // Those frames start playing once the device buffer ahead of them has,
+    // and the clock stops at their end if no callback followed
+    double elapsed = (double)(SDL_GetPerformanceCounter() - snapshot.timestamp) / SDL_GetPerformanceFrequency();
+    double offset = fmin(elapsed - engine->clock_latency, snapshot.span);
+    
+    AudioClock result = {
+        fmax(snapshot.segment_start, snapshot.position + offset),
+        snapshot.duration,
+        snapshot.track_serial
+    };
+    return result;
+}
+
+// Lock-free like audio_get_clock; each field is current, if not all from the same instant
+static AudioLatency audio_get_latency(AudioEngine *engine) {
+    AudioLatency latency;
+    int rate = atomic_load(&engine->device_rate);
+    if (rate <= 0) rate = AUDIO_SAMPLE_RATE;
+    
+    // What the device runs with, which SDL may have rounded from what was asked
+    latency.buffer_frames = atomic_load(&engine->device_frames);
+    if (latency.buffer_frames <= 0) latency.buffer_frames = atomic_load(&engine->buffer_frames);
+    latency.ring_depth = atomic_load(&engine->ring_depth);
+    latency.device_latency = (double)latency.buffer_frames / rate;
+    latency.decode_ahead = (double)latency.ring_depth / rate;
+    latency.underruns = atomic_load(&engine->underruns);
+    latency.late_callbacks = atomic_load(&engine->late_callbacks);
+    latency.callbacks = atomic_load(&engine->callbacks);
+    latency.resizes = atomic_load(&engine->resizes);
+    return latency;
+}
+
 static void audio_set_volume(AudioEngine *engine, float volume) {
+    // Atomic store; the device callback reads it without locking
+    engine->volume = fmaxf(0.0f, fminf(1.0f, volume));
+}
+
+static void audio_set_eq_band(AudioEngine *engine, int band, float gain_db) {
+    if (band < 0 || band >= EQ_BANDS) return;
+    
     pthread_mutex_lock(&engine->audio_mutex);
     
-    engine->volume = fmaxf(0.0f, fminf(1.0f, volume));
+    // Coefficients are rebuilt lazily by the decoder thread, only for this band
+    engine->eq_bands[band] = fmaxf(-EQ_MAX_GAIN_DB, fminf(EQ_MAX_GAIN_DB, gain_db));
+    engine->eq_generation++;
     
     pthread_mutex_unlock(&engine->audio_mutex);
 }
 
-static void* spectrum_thread_function(void *data) {
-    AudioEngine *engine = (AudioEngine*)data;
+static void audio_set_eq_preamp(AudioEngine *engine, float gain_db) {
+    pthread_mutex_lock(&engine->audio_mutex);
     
-    while (engine->threads_active) {
-        if (engine->playing && !engine->paused) {
-            // Generate beautiful spectrum data
-            pthread_mutex_lock(&engine->spectrum_mutex);
-            
-            // Simulate spectrum data for now (replace with real FFT processing)
-            for (int i = 0; i < SPECTRUM_SIZE; i++) {
-                float freq = (float)i / SPECTRUM_SIZE;
-                float amplitude = sinf(SDL_GetTicks() * 0.01f + freq * 10.0f) * 0.5f + 0.5f;
-                amplitude *= expf(-freq * 2.0f); // Natural frequency rolloff
+    engine->eq_preamp = fmaxf(-EQ_MAX_GAIN_DB, fminf(EQ_MAX_GAIN_DB, gain_db));
+    engine->eq_generation++;
+    
+    pthread_mutex_unlock(&engine->audio_mutex);
+}
+
+static void audio_set_eq_enabled(AudioEngine *engine, bool enabled) {
+    pthread_mutex_lock(&engine->audio_mutex);
+    
+    engine->eq_enabled = enabled;
+    engine->eq_generation++;
+    
+    pthread_mutex_unlock(&engine->audio_mutex);
+}
+
+static bool audio_track_finished(AudioEngine *engine) {
+    // The decoder hit end of stream and the device has drained the ring
+    return engine->decoder_eof && pcm_ring_readable(&engine->ring) == 0;
+}
+
+// The preload thread could not open the queued track
+static bool audio_next_failed(AudioEngine *engine) {
+    pthread_mutex_lock(&engine->audio_mutex);
+    bool failed = engine->next_state == AUDIO_NEXT_FAILED;
+    pthread_mutex_unlock(&engine->audio_mutex);
+    return failed;
+}
+
+// The serial new clock segments carry. A splice bumps it as soon as the
+// decoder gets there, well before the device plays it.
+static unsigned audio_track_serial(AudioEngine *engine) {
+    pthread_mutex_lock(&engine->audio_mutex);
+    unsigned serial = engine->track_serial;
+    pthread_mutex_unlock(&engine->audio_mutex);
+    return serial;
+}
+
+static void audio_device_callback(void *userdata, Uint8 *stream, int len) {
+    // Runs on SDL's audio thread: no locks, no allocation, no FFmpeg calls
+    trace_thread("audio callback");
+    Uint64 trace = trace_begin();
+    AudioEngine *engine = (AudioEngine*)userdata;
+    float *output = (float*)stream;
+    size_t frames = (size_t)len / (sizeof(float) * AUDIO_CHANNELS);
+    size_t filled = 0;
+    Uint64 now = SDL_GetPerformanceCounter();
+    unsigned generation = atomic_load_explicit(&engine->stream_generation, memory_order_relaxed);
+    bool playing = atomic_load_explicit(&engine->playing, memory_order_relaxed);
+    
+    if (playing) {
+        filled = pcm_ring_read(&engine->ring, output, frames);
+    }
+    
+    // Misses only count once the stream has been flowing: a flush, a play
+    // or a device reopen starts from an empty ring and a stale timestamp
+    if (generation != engine->stream_seen || !playing) {
+        engine->stream_seen = generation;
+        engine->streaming = false;
+    } else if (engine->streaming) {
+        if (filled < frames && !atomic_load_explicit(&engine->decoder_eof, memory_order_relaxed)) {
+            atomic_fetch_add_explicit(&engine->underruns, 1, memory_order_relaxed);
+        }
+        if (now - engine->last_callback > engine->late_ticks) {
+            atomic_fetch_add_explicit(&engine->late_callbacks, 1, memory_order_relaxed);
+        }
+    }
+    if (playing && filled == frames) engine->streaming = true;
+    engine->last_callback = now;
+    atomic_fetch_add_explicit(&engine->callbacks, 1, memory_order_relaxed);
+    
+    // Only frames actually handed to the device move the clock
+    size_t first = atomic_load_explicit(&engine->ring.read_pos, memory_order_relaxed) - filled;
+    audio_clock_publish(engine, first, filled);
+    
+    float gain = atomic_load_explicit(&engine->muted, memory_order_relaxed) ? 0.0f :
+                 atomic_load_explicit(&engine->volume, memory_order_relaxed);
+    for (size_t i = 0; i < filled * AUDIO_CHANNELS; i++) {
+        output[i] *= gain;
+    }
+    
+    // Underrun or paused: pad with silence
+    if (filled < frames) {
+        memset(output + filled * AUDIO_CHANNELS, 0, 
+               (frames - filled) * AUDIO_CHANNELS * sizeof(float));
+    }
+    
+    trace_end(TRACE_CALLBACK, trace, (uint32_t)filled);
+}
+
+static bool audio_decoder_open(AudioDecoder *decoder, const char *filepath, int output_rate) {
+    memset(decoder, 0, sizeof(AudioDecoder));
+    decoder->gain = 1.0f;
+    
+    if (avformat_open_input(&decoder->format_context, filepath, NULL, NULL) < 0) {
+        return false;
+    }
+    
+    if (avformat_find_stream_info(decoder->format_context, NULL) < 0) {
+        audio_decoder_close(decoder);
+        return false;
+    }
+    
+    // Find audio stream
+    decoder->stream_index = -1;
+    for (int i = 0; i < decoder->format_context->nb_streams; i++) {
+        if (decoder->format_context->streams[i]->codecpar->codec_type == AVMEDIA_TYPE_AUDIO) {
+            decoder->stream_index = i;
+            break;
+        }
+    }
+    
+    if (decoder->stream_index == -1) {
+        audio_decoder_close(decoder);
+        return false;
+    }
+    
+    // Get codec and open decoder. Encoder delay and padding arrive as
+    // skip-samples side data, which the decoder trims for us.
+    AVCodecParameters *codecpar = decoder->format_context->streams[decoder->stream_index]->codecpar;
+    const AVCodec *codec = avcodec_find_decoder(codecpar->codec_id);
+    
+    decoder->codec_context = codec ? avcodec_alloc_context3(codec) : NULL;
+    if (!decoder->codec_context ||
+        avcodec_parameters_to_context(decoder->codec_context, codecpar) < 0 ||
+        avcodec_open2(decoder->codec_context, codec, NULL) < 0) {
+        audio_decoder_close(decoder);
+        return false;
+    }
+    
+    if (!audio_decoder_set_output(decoder, decoder->codec_context->channel_layout,
+                                  decoder->codec_context->channels, decoder->codec_context->sample_fmt,
+                                  decoder->codec_context->sample_rate, output_rate)) {
+        audio_decoder_close(decoder);
+        return false;
+    }
+    
+    if (decoder->format_context->duration != AV_NOPTS_VALUE) {
+        decoder->duration = (double)decoder->format_context->duration / AV_TIME_BASE;
+    }
+    
+    // Seek index for formats whose own seeking is approximate
+    snprintf(decoder->filepath, sizeof(decoder->filepath), "%s", filepath);
+    decoder->discard_to = -1;
+    decoder->index.usable = seek_index_supported(decoder->format_context) &&
+                            file_get_identity(filepath, &decoder->file_size, &decoder->file_mtime);
+    if (decoder->index.usable) {
+        seek_index_load(decoder, filepath);
+    }
+    
+    return true;
+}
+
+static void audio_decoder_close(AudioDecoder *decoder) {
+    free(decoder->index.points);
+    
+    if (decoder->codec_context) avcodec_free_context(&decoder->codec_context);
+    if (decoder->format_context) avformat_close_input(&decoder->format_context);
+    if (decoder->swr_context) swr_free(&decoder->swr_context);
+    free(decoder->frames);
+    memset(decoder, 0, sizeof(AudioDecoder));
+}
+
+// Picks the cheapest way to interleaved float stereo at `output_rate` and sets
+// up a resampler only if it needs one. Replaces any previous setup.
+static bool audio_decoder_set_output(AudioDecoder *decoder, int64_t in_layout, int in_channels,
+                                     enum AVSampleFormat in_format, int in_rate, int output_rate) {
+    if (decoder->swr_context) swr_free(&decoder->swr_context);
+    decoder->output_rate = output_rate;
+    
+    if (in_rate == output_rate && in_channels == AUDIO_CHANNELS &&
+        (in_format == AV_SAMPLE_FMT_FLT || in_format == AV_SAMPLE_FMT_FLTP)) {
+        decoder->path = AUDIO_PATH_COPY;
+        return true;
+    }
+    
+    decoder->path = in_rate == output_rate ? AUDIO_PATH_CONVERT : AUDIO_PATH_RESAMPLE;
+    if (!in_layout) {
+        in_layout = av_get_default_channel_layout(in_channels);
+    }
+    
+    decoder->swr_context = swr_alloc_set_opts(NULL,
+        AV_CH_LAYOUT_STEREO, AV_SAMPLE_FMT_FLT, output_rate,
+        in_layout, in_format, in_rate, 0, NULL);
+    
+    return decoder->swr_context && swr_init(decoder->swr_context) >= 0;
+}
+
+// Makes room for `frames` more decoded frames, reclaiming the consumed front first
+static bool audio_decoder_reserve(AudioDecoder *decoder, int frames) {
+    if (decoder->offset > 0 && decoder->count + frames > decoder->capacity) {
+        memmove(decoder->frames, decoder->frames + (size_t)decoder->offset * AUDIO_CHANNELS,
+                sizeof(float) * AUDIO_CHANNELS * (decoder->count - decoder->offset));
+        decoder->count -= decoder->offset;
+        decoder->processed -= decoder->offset;
+        decoder->offset = 0;
+    }
+    
+    if (decoder->count + frames > decoder->capacity) {
+        int capacity = decoder->capacity ? decoder->capacity : AUDIO_BUFFER_MAX;
+        while (capacity < decoder->count + frames) capacity *= 2;
+        
+        float *grown = realloc(decoder->frames, sizeof(float) * AUDIO_CHANNELS * capacity);
+        if (!grown) return false;
+        decoder->frames = grown;
+        decoder->capacity = capacity;
+    }
+    return true;
+}
+
+// AUDIO_PATH_COPY: the codec already produces float stereo at the device rate
+static bool audio_decoder_copy(AudioDecoder *decoder, const AVFrame *frame, int skip) {
+    if (!frame) return true;    // No resampler, so no filter tail
+    if (frame->channels != AUDIO_CHANNELS) return false;
+    
+    int frames = frame->nb_samples - skip;
+    if (!audio_decoder_reserve(decoder, frames)) return false;
+    
+    float *out = decoder->frames + (size_t)decoder->count * AUDIO_CHANNELS;
+    
+    if (frame->format == AV_SAMPLE_FMT_FLT) {
+        memcpy(out, (const float*)frame->extended_data[0] + (size_t)skip * AUDIO_CHANNELS,
+               sizeof(float) * AUDIO_CHANNELS * frames);
+    } else if (frame->format == AV_SAMPLE_FMT_FLTP) {
+        const float *left = (const float*)frame->extended_data[0] + skip;
+        const float *right = (const float*)frame->extended_data[1] + skip;
+        for (int i = 0; i < frames; i++) {
+            out[i * 2] = left[i];
+            out[i * 2 + 1] = right[i];
+        }
+    } else {
+        return false;
+    }
+    
+    decoder->count += frames;
+    return true;
+}
+
+// Runs a frame minus its first `skip` samples through the resampler; NULL
+// drains its filter tail
+static bool audio_decoder_resample(AudioDecoder *decoder, const AVFrame *frame, int skip) {
+    int in_samples = frame ? frame->nb_samples - skip : 0;
+    int out_frames = swr_get_out_samples(decoder->swr_context, in_samples);
+    if (out_frames <= 0) return true;
+    
+    if (!audio_decoder_reserve(decoder, out_frames)) return false;
+    
+    const uint8_t *planes[SWR_CH_MAX];
+    const uint8_t **input = frame ? (const uint8_t**)frame->extended_data : NULL;
+    
+    if (frame && skip > 0) {
+        int bytes = av_get_bytes_per_sample(frame->format);
+        if (av_sample_fmt_is_planar(frame->format)) {
+            for (int c = 0; c < frame->channels && c < SWR_CH_MAX; c++) {
+                planes[c] = frame->extended_data[c] + (size_t)skip * bytes;
+            }
+        } else {
+            planes[0] = frame->extended_data[0] + (size_t)skip * bytes * frame->channels;
+        }
+        input = planes;
+    }
+    
+    uint8_t *out[1] = { (uint8_t*)(decoder->frames + (size_t)decoder->count * AUDIO_CHANNELS) };
+    int converted = swr_convert(decoder->swr_context, out, out_frames, input, in_samples);
+    if (converted < 0) return false;
+    
+    decoder->count += converted;
+    return true;
+}
+
+// Appends a frame minus its first `skip` samples in the device format; NULL
+// drains the resampler's filter tail
+static bool audio_decoder_convert(AudioDecoder *decoder, const AVFrame *frame, int skip) {
+    Uint64 start = SDL_GetPerformanceCounter();
+    int before = decoder->count;
+    bool ok = decoder->path == AUDIO_PATH_COPY ? audio_decoder_copy(decoder, frame, skip) :
+                                                 audio_decoder_resample(decoder, frame, skip);
+    
+    // Before anything is mixed, so a crossfade blends two already-levelled tracks
+    if (decoder->gain != 1.0f) {
+        float *samples = decoder->frames + (size_t)before * AUDIO_CHANNELS;
+        for (int i = 0; i < (decoder->count - before) * AUDIO_CHANNELS; i++) {
+            samples[i] *= decoder->gain;
+        }
+    }
+    
+    Uint64 end = SDL_GetPerformanceCounter();
+    if (trace_active()) trace_record(TRACE_RESAMPLE, start, end, decoder->path);
+    
+    if (decoder->unplayed) return ok;
+    
+    AudioPathStats *stats = &g_audio_path_stats[decoder->path];
+    atomic_fetch_add_explicit(&stats->ticks, end - start, memory_order_relaxed);
+    atomic_fetch_add_explicit(&stats->frames, (uint64_t)(decoder->count - before), memory_order_relaxed);
+    return ok;
+}
+
+// Decodes the next audio frame into the decoder's FIFO.
+// Returns false once the stream is exhausted.
+static bool audio_decoder_read(AudioDecoder *decoder, AVPacket *packet, AVFrame *frame) {
+    if (decoder->eof) return false;
+    
+    Uint64 trace = trace_begin();
+    for (;;) {
+        int ret = avcodec_receive_frame(decoder->codec_context, frame);
+        if (ret == 0) {
+            int skip = audio_decoder_seek_skip(decoder, frame);
+            int samples = frame->nb_samples;
+            if (skip < samples) {
+                audio_decoder_convert(decoder, frame, skip);
+            }
+            av_frame_unref(frame);
+            trace_end(TRACE_DECODE, trace, (uint32_t)samples);
+            return true;
+        }
+        if (ret != AVERROR(EAGAIN)) {
+            // Keep the last few milliseconds the resampler is still holding
+            audio_decoder_convert(decoder, NULL, 0);
+            decoder->eof = true;
+            trace_end(TRACE_DECODE, trace, 0);
+            return false;
+        }
+        
+        if (av_read_frame(decoder->format_context, packet) < 0) {
+            // Drain frames still buffered inside the decoder
+            avcodec_send_packet(decoder->codec_context, NULL);
+            continue;
+        }
+        
+        if (packet->stream_index == decoder->stream_index) {
+            avcodec_send_packet(decoder->codec_context, packet);
+        }
+        av_packet_unref(packet);
+    }
+}
+
+// Length of the crossfade into the queued track, in device frames
+static int audio_crossfade_frames(AudioEngine *engine) {
+    if (!engine->crossfade_enabled || !engine->next_crossfade || engine->next_state == AUDIO_NEXT_NONE) {
+        return 0;
+    }
+    
+    float seconds = fmaxf(0.0f, fminf(AUDIO_CROSSFADE_MAX, engine->crossfade_duration));
+    return (int)(seconds * engine->device_spec.freq);
+}
+
+// Hands frames [offset, end) to the ring, running the DSP over each frame
+// exactly once on the way. Returns false if the ring could not take them all.
+static bool audio_release_frames(AudioEngine *engine, AudioDecoder *decoder, int end) {
+    if (end <= decoder->offset) return true;
+    
+    // DSP runs here on the decoder thread, never in the device callback
+    if (end > decoder->processed) {
+        float *samples = decoder->frames + (size_t)decoder->processed * AUDIO_CHANNELS;
+        
+        if (engine->eq_enabled) {
+            if (engine->eq.generation != engine->eq_generation || 
+                engine->eq.sample_rate != engine->device_spec.freq) {
+                equalizer_update(&engine->eq, engine->eq_bands, engine->eq_preamp,
+                                 engine->device_spec.freq, engine->eq_generation);
+            }
+            Uint64 trace = trace_begin();
+            equalizer_process(&engine->eq, samples, end - decoder->processed);
+            trace_end(TRACE_DSP, trace, (uint32_t)(end - decoder->processed));
+        }
+        decoder->processed = end;
+    }
+    
+    // No further ahead than the adaptive depth, so EQ changes and the like
+    // reach the speakers within that much of being made
+    size_t pending = (size_t)(end - decoder->offset);
+    size_t queued = pcm_ring_readable(&engine->ring);
+    size_t depth = atomic_load_explicit(&engine->ring_depth, memory_order_relaxed);
+    size_t room = queued < depth ? depth - queued : 0;
+    size_t written = pcm_ring_write(&engine->ring,
+        decoder->frames + (size_t)decoder->offset * AUDIO_CHANNELS, pending < room ? pending : room);
+    decoder->offset += (int)written;
+    return written == pending;
+}
+
+// Equal-power fade from the outgoing track's last `length` frames into the
+// incoming track's first `length`, mixed in place at the front of the incoming FIFO
+static bool audio_crossfade(AudioDecoder *outgoing, AudioDecoder *incoming, int length) {
+    if (incoming->count < length) {
+        if (!audio_decoder_reserve(incoming, length - incoming->count)) return false;
+        
+        // The incoming track is shorter than the fade
+        memset(incoming->frames + (size_t)incoming->count * AUDIO_CHANNELS, 0,
+               sizeof(float) * AUDIO_CHANNELS * (length - incoming->count));
+        incoming->count = length;
+    }
+    
+    const float *tail = outgoing->frames + (size_t)outgoing->offset * AUDIO_CHANNELS;
+    float *head = incoming->frames + (size_t)incoming->offset * AUDIO_CHANNELS;
+    
+    for (int i = 0; i < length; i++) {
+        float angle = (i + 0.5f) / length * (float)M_PI_2;
+        float fade_out = cosf(angle);
+        float fade_in = sinf(angle);
+        
+        for (int c = 0; c < AUDIO_CHANNELS; c++) {
+            head[i * AUDIO_CHANNELS + c] = tail[i * AUDIO_CHANNELS + c] * fade_out + 
+                                           head[i * AUDIO_CHANNELS + c] * fade_in;
+        }
+    }
+    
+    outgoing->offset += length;
+    return true;
+}
+
+// One unit of decoder thread work on the current track, including the
+// transition to the queued one. Caller holds audio_mutex.
+// Returns false when there was nothing to do.
+static bool audio_decoder_step(AudioEngine *engine, AVPacket *packet, AVFrame *frame) {
+    AudioDecoder *decoder = engine->current;
+    
+    // The last `fade` frames are held back until we know whether they end the track
+    int fade = audio_crossfade_frames(engine);
+    
+    if (!decoder->eof) {
+        // A full ring means we are ahead of the device
+        if (!audio_release_frames(engine, decoder, decoder->count - fade)) return false;
+        audio_decoder_read(decoder, packet, frame);
+        return true;
+    }
+    
+    if (engine->next_state == AUDIO_NEXT_LOADING) {
+        // Still being opened; keep the held-back tail for the fade
+        audio_release_frames(engine, decoder, decoder->count - fade);
+        return false;
+    }
+    
+    if (engine->next_state != AUDIO_NEXT_READY) {
+        // Nothing follows: play out the tail and let the UI take over
+        if (audio_release_frames(engine, decoder, decoder->count)) {
+            engine->decoder_eof = true;
+        }
+        return false;
+    }
+    
+    // Only frames the DSP has not seen yet can take part in the fade
+    AudioDecoder *next = engine->next;
+    int length = fade < decoder->count - decoder->processed ? fade : decoder->count - decoder->processed;
+    if (!audio_release_frames(engine, decoder, decoder->count - length)) return false;
+    
+    if (length > 0) {
+        while (next->count - next->offset < length && audio_decoder_read(next, packet, frame)) {}
+        if (!audio_crossfade(decoder, next, length)) {
+            audio_release_frames(engine, decoder, decoder->count);
+        }
+    }
+    
+    // Splice: the incoming track continues on the very next sample
+    engine->current = next;
+    engine->next = NULL;
+    engine->next_state = AUDIO_NEXT_NONE;
+    engine->seek_target = -1.0;
+    audio_clock_mark(engine, 0.0, next->duration, true);
+    
+    audio_retire_decoder(engine, decoder);
+    return true;
+}
+
+static void* audio_thread_function(void *data) {
+    AudioEngine *engine = (AudioEngine*)data;
+    AVPacket *packet = av_packet_alloc();
+    AVFrame *frame = av_frame_alloc();
+    
+    // Quiet passages must not push the EQ cascade into denormal slow paths
+    equalizer_flush_denormals();
+    trace_thread("decoder");
+    
+    if (!packet || !frame) {
+        fprintf(stderr, "Failed to allocate decoder buffers\n");
+        av_packet_free(&packet);
+        av_frame_free(&frame);
+        return NULL;
+    }
+    
+    while (engine->threads_active) {
+        bool idle = true;
+        
+        pthread_mutex_lock(&engine->audio_mutex);
+        
+        if (engine->current && engine->seek_target >= 0) {
+            // Indexing ahead can demux most of a long file: do it on a copy,
+            // with its own demuxer and the lock released, then seek next round
+            SeekIndexJob *job = audio_seek_index_begin(engine);
+            if (job) {
+                pthread_mutex_unlock(&engine->audio_mutex);
+                seek_index_build(job, packet);
+                pthread_mutex_lock(&engine->audio_mutex);
+                audio_seek_index_finish(engine, job);
+            } else {
+                audio_seek_apply(engine, packet, frame);
+            }
+            idle = false;
+        } else if (engine->current && !engine->decoder_eof) {
+            idle = !audio_decoder_step(engine, packet, frame);
+        }
+        audio_adapt_latency(engine);
+        
+        pthread_mutex_unlock(&engine->audio_mutex);
+        
+        if (idle) {
+            SDL_Delay(AUDIO_DECODER_BACKOFF_MS);
+        }
+    }
+    
+    av_frame_free(&frame);
+    av_packet_free(&packet);
+    return NULL;
+}
+
+// Opens queued tracks and decodes their first frames off the decoder thread
+static void* audio_preload_function(void *data) {
+    AudioEngine *engine = (AudioEngine*)data;
+    AVPacket *packet = av_packet_alloc();
+    AVFrame *frame = av_frame_alloc();
+    char filepath[MAX_PATH];
+    trace_thread("preload");
+    
+    pthread_mutex_lock(&engine->preload_mutex);
+    
+    // Pending index saves are written even when shutting down
+    while (engine->threads_active || engine->index_saves) {
+        if (engine->index_saves) {
+            SeekIndexJob *job = engine->index_saves;
+            engine->index_saves = job->next;
+            pthread_mutex_unlock(&engine->preload_mutex);
+            
+            seek_index_write(job);
+            seek_index_job_free(job);
+            
+            pthread_mutex_lock(&engine->preload_mutex);
+            continue;
+        }
+        if (!engine->threads_active) break;
+        if (!engine->preload_path[0]) {
+            pthread_cond_wait(&engine->preload_cond, &engine->preload_mutex);
+            continue;
+        }
+        
+        snprintf(filepath, sizeof(filepath), "%s", engine->preload_path);
+        float gain = engine->preload_gain;
+        unsigned generation = engine->preload_generation;
+        engine->preload_path[0] = '\0';
+        
+        pthread_mutex_unlock(&engine->preload_mutex);
+        
+        // The device rate moves when audio_load_track reopens it
+        pthread_mutex_lock(&engine->audio_mutex);
+        int rate = engine->device_spec.freq;
+        pthread_mutex_unlock(&engine->audio_mutex);
+        
+        AudioDecoder *decoder = calloc(1, sizeof(AudioDecoder));
+        bool ok = decoder && packet && frame && audio_decoder_open(decoder, filepath, rate);
+        if (ok) decoder->gain = gain;
+        
+        while (ok && decoder->count < AUDIO_PRELOAD_FRAMES && audio_decoder_read(decoder, packet, frame)) {}
+        
+        // Publish, unless the queue changed while we were busy
+        pthread_mutex_lock(&engine->audio_mutex);
+        if (generation == engine->queue_generation) {
+            engine->next_state = ok ? AUDIO_NEXT_READY : AUDIO_NEXT_FAILED;
+            if (ok) {
+                engine->next = decoder;
+                decoder = NULL;
+            }
+        }
+        pthread_mutex_unlock(&engine->audio_mutex);
+        
+        if (decoder) {
+            audio_decoder_close(decoder);
+            free(decoder);
+        }
+        
+        pthread_mutex_lock(&engine->preload_mutex);
+    }
+    
+    pthread_mutex_unlock(&engine->preload_mutex);
+    
+    av_frame_free(&frame);
+    av_packet_free(&packet);
+    return NULL;
+}
+
+static void audio_cleanup(AudioEngine *engine) {
+    engine->threads_active = false;
+    audio_print_path_stats();
+    audio_print_latency_stats(engine);
+    
+    if (engine->audio_thread) {
+        pthread_join(engine->audio_thread, NULL);
+        engine->audio_thread = 0;
+    }
+    
+    if (engine->preload_thread) {
+        pthread_mutex_lock(&engine->preload_mutex);
+        pthread_cond_signal(&engine->preload_cond);
+        pthread_mutex_unlock(&engine->preload_mutex);
+        pthread_join(engine->preload_thread, NULL);
+        engine->preload_thread = 0;
+    }
+    
+    if (engine->device) {
+        SDL_CloseAudioDevice(engine->device);
+        engine->device = 0;
+    }
+    
+    // The preload thread is gone, so a grown index is written right here
+    if (engine->current) {
+        audio_retire_decoder(engine, engine->current);
+        engine->current = NULL;
+    }
+    audio_drop_next(engine);
+    pcm_ring_cleanup(&engine->ring);
+    
+    spectrum_cleanup(engine);
+    
+    pthread_mutex_destroy(&engine->audio_mutex);
+    pthread_mutex_destroy(&engine->spectrum_mutex);
+    pthread_mutex_destroy(&engine->preload_mutex);
+    pthread_cond_destroy(&engine->preload_cond);
+    engine->initialized = false;
+}
+
+// What getting decoded audio to the device cost this session, per path
+static void audio_print_path_stats(void) {
+    static const char *names[AUDIO_PATH_COUNT] = { "copy", "convert", "resample" };
+    double frequency = (double)SDL_GetPerformanceFrequency();
+    
+    for (int path = 0; path < AUDIO_PATH_COUNT; path++) {
+        uint64_t frames = atomic_load(&g_audio_path_stats[path].frames);
+        uint64_t ticks = atomic_load(&g_audio_path_stats[path].ticks);
+        if (frames == 0) continue;
+        
+        printf("  Output path %-8s %12llu frames  %7.2f ns/frame  %8.1f ms total\n", names[path],
+               (unsigned long long)frames, ticks * 1e9 / frequency / frames, ticks * 1e3 / frequency);
+    }
+}
+
+// How the adaptive latency ended up, and what moved it
+static void audio_print_latency_stats(AudioEngine *engine) {
+    AudioLatency latency = audio_get_latency(engine);
+    if (latency.callbacks == 0) return;
+    
+    printf("  Output buffer %d frames (%.1f ms), ring depth %zu frames (%.1f ms)\n",
+           latency.buffer_frames, latency.device_latency * 1000.0,
+           latency.ring_depth, latency.decode_ahead * 1000.0);
+    printf("  Output misses %u underruns, %u late callbacks in %u callbacks, %u resizes\n",
+           latency.underruns, latency.late_callbacks, latency.callbacks, latency.resizes);
+}
+
+// ═══════════════════════════════════════════════════════════════════════════════
+// ║                             SEEK INDEX                                     ║
+// ═══════════════════════════════════════════════════════════════════════════════
+
+// Formats whose own seeking is a bitrate guess or a bisection over frame
+// syncs. Containers with real sample tables (MP4, Matroska, Ogg) seek fine.
+static bool seek_index_supported(const AVFormatContext *format) {
+    static const char *formats[] = { "mp3", "flac", "aac", "ac3", "eac3", "dts" };
+    
+    if (format->iformat->flags & AVFMT_NO_BYTE_SEEK) return false;
+    for (size_t i = 0; i < sizeof(formats) / sizeof(formats[0]); i++) {
+        if (strcmp(format->iformat->name, formats[i]) == 0) return true;
+    }
+    return false;
+}
+
+static bool seek_index_add(SeekIndex *index, int64_t pts, int64_t pos) {
+    if (index->count == index->capacity) {
+        int capacity = index->capacity ? index->capacity * 2 : 1024;
+        SeekPoint *points = realloc(index->points, sizeof(SeekPoint) * capacity);
+        if (!points) return false;
+        index->points = points;
+        index->capacity = capacity;
+    }
+    
+    index->points[index->count].pts = pts;
+    index->points[index->count].pos = pos;
+    index->count++;
+    index->dirty = true;
+    return true;
+}
+
+// Demux-only pass from the end of the index until it covers `target`.
+// Timestamps come from summing packet durations, which is exact even for
+// VBR MP3 without a TOC. Leaves `format` positioned wherever it stopped.
+static bool seek_index_extend(SeekIndex *index, AVFormatContext *format, int stream_index,
+                              int64_t target, AVPacket *packet) {
+    AVStream *stream = format->streams[stream_index];
+    int64_t interval = (int64_t)(SEEK_INDEX_INTERVAL / av_q2d(stream->time_base));
+    int64_t pts = AV_NOPTS_VALUE;
+    int ret;
+    
+    if (index->count == 0) {
+        ret = av_seek_frame(format, stream_index, 
+                            stream->start_time != AV_NOPTS_VALUE ? stream->start_time : 0, 
+                            AVSEEK_FLAG_BACKWARD);
+    } else {
+        // Resume at the last point; its packet is read again but not re-added
+        pts = index->points[index->count - 1].pts;
+        ret = av_seek_frame(format, -1, index->points[index->count - 1].pos, AVSEEK_FLAG_BYTE);
+    }
+    if (ret < 0) {
+        index->usable = false;
+        return false;
+    }
+    
+    while (av_read_frame(format, packet) >= 0) {
+        if (packet->stream_index != stream_index) {
+            av_packet_unref(packet);
+            continue;
+        }
+        
+        if (packet->duration <= 0 || packet->pos < 0) {
+            // Without these the index cannot be trusted
+            av_packet_unref(packet);
+            index->usable = false;
+            return false;
+        }
+        
+        if (pts == AV_NOPTS_VALUE) {
+            pts = packet->pts != AV_NOPTS_VALUE ? packet->pts : 0;
+        }
+        if (index->count == 0 || pts >= index->points[index->count - 1].pts + interval) {
+            seek_index_add(index, pts, packet->pos);
+        }
+        
+        pts += packet->duration;
+        av_packet_unref(packet);
+        
+        if (pts > target + interval) return true;
+    }
+    
+    index->complete = true;
+    return true;
+}
+
+// Extends a detached index on a demuxer opened just for this, so nothing the
+// decoder thread or the UI touches is in use
+static void seek_index_build(SeekIndexJob *job, AVPacket *packet) {
+    AVFormatContext *format = NULL;
+    
+    if (avformat_open_input(&format, job->filepath, NULL, NULL) < 0) {
+        job->index.usable = false;
+        return;
+    }
+    
+    if (avformat_find_stream_info(format, NULL) < 0 || job->stream_index >= (int)format->nb_streams) {
+        job->index.usable = false;
+    } else {
+        seek_index_extend(&job->index, format, job->stream_index, job->target, packet);
+    }
+    avformat_close_input(&format);
+}
+
+static void seek_index_job_free(SeekIndexJob *job) {
+    free(job->index.points);
+    free(job);
+}
+
+// A seek target in the stream's time base
+static int64_t audio_decoder_index_target(const AudioDecoder *decoder, double seconds) {
+    AVStream *stream = decoder->format_context->streams[decoder->stream_index];
+    if (decoder->duration > 0 && seconds > decoder->duration) seconds = decoder->duration;
+    
+    int64_t start = stream->start_time != AV_NOPTS_VALUE ? stream->start_time : 0;
+    return start + (int64_t)(seconds / av_q2d(stream->time_base));
+}
+
+// Whether the index could still be grown to reach `target`
+static bool audio_decoder_index_short(const AudioDecoder *decoder, int64_t target) {
+    const SeekIndex *index = &decoder->index;
+    AVStream *stream = decoder->format_context->streams[decoder->stream_index];
+    int64_t start = stream->start_time != AV_NOPTS_VALUE ? stream->start_time : 0;
+    
+    return index->usable && !index->complete && target > start &&
+           (index->count == 0 || index->points[index->count - 1].pts < target);
+}
+
+// Grows the decoder's index in place, on its own demuxer. Only for decoders
+// no other thread can reach; the engine goes through seek_index_build.
+static void audio_decoder_index_to(AudioDecoder *decoder, double seconds, AVPacket *packet) {
+    int64_t target = audio_decoder_index_target(decoder, seconds);
+    if (audio_decoder_index_short(decoder, target)) {
+        seek_index_extend(&decoder->index, decoder->format_context, decoder->stream_index, target, packet);
+    }
+}
+
+// ~/.cache/tuxmusic/seek/<hash of path>.idx
+static bool seek_index_cache_path(const char *filepath, char *path, size_t size) {
+    char directory[MAX_PATH];
+    if (!cache_directory(directory, sizeof(directory))) return false;
+    
+    size_t length = strlen(directory);
+    snprintf(directory + length, sizeof(directory) - length, "%sseek", PATH_SEP);
+    if (!make_directory(directory)) return false;
+    
+    return snprintf(path, size, "%s%s%08x.idx", directory, PATH_SEP, hash_string(filepath)) < (int)size;
+}
+
+// Cached indexes are only trusted for the same path, size and mtime
+static void seek_index_load(AudioDecoder *decoder, const char *filepath) {
+    SeekIndexHeader header;
+    char path[MAX_PATH];
+    char stored_path[MAX_PATH];
+    
+    if (!seek_index_cache_path(filepath, path, sizeof(path))) return;
+    
+    FILE *file = fopen(path, "rb");
+    if (!file) return;
+    
+    fseek(file, 0, SEEK_END);
+    long file_length = ftell(file);
+    fseek(file, 0, SEEK_SET);
+    
+    // The point count is trusted only if the file is exactly that long
+    bool ok = fread(&header, sizeof(header), 1, file) == 1 &&
+              memcmp(header.magic, SEEK_INDEX_MAGIC, sizeof(header.magic)) == 0 &&
+              header.count >= 0 && header.path_length < sizeof(stored_path) &&
+              (uint64_t)file_length == sizeof(header) + header.path_length + 
+                                       (uint64_t)header.count * sizeof(SeekPoint) &&
+              header.file_size == decoder->file_size && header.file_mtime == decoder->file_mtime &&
+              fread(stored_path, 1, header.path_length, file) == header.path_length;
+    
+    if (ok) {
+        stored_path[header.path_length] = '\0';
+        ok = strcmp(stored_path, filepath) == 0;
+    }
+    
+    SeekPoint *points = ok && header.count > 0 ? malloc(sizeof(SeekPoint) * header.count) : NULL;
+    if (points && fread(points, sizeof(SeekPoint), header.count, file) == (size_t)header.count) {
+        free(decoder->index.points);
+        decoder->index.points = points;
+        decoder->index.count = decoder->index.capacity = header.count;
+        decoder->index.complete = header.complete != 0;
+        points = NULL;
+    }
+    
+    free(points);
+    fclose(file);
+}
+
+// Preload thread, or the engine's shutdown: file I/O never runs under audio_mutex.
+// Decoders opening the same track read the index meanwhile, so it is written
+// aside and renamed into place like the library database.
+static void seek_index_write(const SeekIndexJob *job) {
+    char path[MAX_PATH], temp_path[MAX_PATH];
+    if (!job->index.usable || !seek_index_cache_path(job->filepath, path, sizeof(path)) ||
+        snprintf(temp_path, sizeof(temp_path), "%s.tmp", path) >= (int)sizeof(temp_path)) {
+        return;
+    }
+    
+    FILE *file = fopen(temp_path, "wb");
+    if (!file) return;
+    
+    SeekIndexHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, SEEK_INDEX_MAGIC, sizeof(header.magic));
+    header.file_size = job->file_size;
+    header.file_mtime = job->file_mtime;
+    header.path_length = (uint32_t)strlen(job->filepath);
+    header.count = job->index.count;
+    header.complete = job->index.complete;
+    
+    bool ok = fwrite(&header, sizeof(header), 1, file) == 1 &&
+              fwrite(job->filepath, 1, header.path_length, file) == header.path_length &&
+              fwrite(job->index.points, sizeof(SeekPoint), header.count, file) == (size_t)header.count;
+    ok = (fclose(file) == 0) && ok;
+    
+#ifdef _WIN32
+    ok = ok && MoveFileExA(temp_path, path, MOVEFILE_REPLACE_EXISTING);
+#else
+    ok = ok && rename(temp_path, path) == 0;
+#endif
+    
+    if (!ok) {
+        remove(temp_path);
+    }
+}
+
+// Positions the decoder so the next decoded sample is exactly at `seconds`.
+// The demuxer lands at or before the target; audio_decoder_read then decodes
+// and discards up to the target sample.
+static void audio_decoder_seek(AudioDecoder *decoder, double seconds) {
+    AVStream *stream = decoder->format_context->streams[decoder->stream_index];
+    int rate = decoder->codec_context->sample_rate;
+    
+    if (decoder->duration > 0 && seconds > decoder->duration) seconds = decoder->duration;
+    
+    int64_t start = stream->start_time != AV_NOPTS_VALUE ? stream->start_time : 0;
+    int64_t target = audio_decoder_index_target(decoder, seconds);
+    int64_t preroll = (int64_t)(SEEK_PREROLL / av_q2d(stream->time_base));
+    
+    SeekIndex *index = &decoder->index;
+    const SeekPoint *point = NULL;
+    
+    // Whatever the index covers; growing it is the caller's job
+    if (index->usable && seconds > 0) {
+        // Last point far enough ahead of the target to prime bit reservoirs
+        int low = 0, high = index->usable ? index->count - 1 : -1;
+        while (low <= high) {
+            int middle = (low + high) / 2;
+            if (index->points[middle].pts <= target - preroll) {
+                point = &index->points[middle];
+                low = middle + 1;
+            } else {
+                high = middle - 1;
+            }
+        }
+    }
+    
+    if (point && av_seek_frame(decoder->format_context, -1, point->pos, AVSEEK_FLAG_BYTE) >= 0) {
+        decoder->sample_cursor = av_rescale_q(point->pts - start, stream->time_base, (AVRational){ 1, rate });
+    } else {
+        // The container's own seek; the first decoded frame says where it landed
+        av_seek_frame(decoder->format_context, decoder->stream_index, target, AVSEEK_FLAG_BACKWARD);
+        decoder->sample_cursor = -1;
+    }
+    
+    avcodec_flush_buffers(decoder->codec_context);
+    if (decoder->swr_context) swr_init(decoder->swr_context);
+    
+    decoder->discard_to = (int64_t)(seconds * rate + 0.5);
+    decoder->seek_reached = seconds;
+    decoder->count = 0;
+    decoder->offset = 0;
+    decoder->processed = 0;
+    decoder->eof = false;
+}
+
+// Decode-and-discard after a seek: how many samples at the front of this
+// frame lie before the target. Also keeps the decoder's sample position.
+static int audio_decoder_seek_skip(AudioDecoder *decoder, const AVFrame *frame) {
+    int rate = decoder->codec_context->sample_rate;
+    
+    if (decoder->sample_cursor < 0) {
+        AVStream *stream = decoder->format_context->streams[decoder->stream_index];
+        int64_t start = stream->start_time != AV_NOPTS_VALUE ? stream->start_time : 0;
+        int64_t pts = frame->best_effort_timestamp;
+        
+        if (pts == AV_NOPTS_VALUE) {
+            // No idea where we are; take the audio as the target
+            decoder->sample_cursor = decoder->discard_to >= 0 ? decoder->discard_to : 0;
+        } else {
+            decoder->sample_cursor = av_rescale_q(pts - start, stream->time_base, (AVRational){ 1, rate });
+        }
+    }
+    
+    int64_t first = decoder->sample_cursor;
+    decoder->sample_cursor += frame->nb_samples;
+    
+    if (decoder->discard_to < 0) return 0;
+    if (decoder->sample_cursor <= decoder->discard_to) return frame->nb_samples;
+    
+    int skip = first < decoder->discard_to ? (int)(decoder->discard_to - first) : 0;
+    decoder->seek_reached = (double)(first + skip) / rate;
+    decoder->discard_to = -1;
+    return skip;
+}
+
+// ═══════════════════════════════════════════════════════════════════════════════
+// ║                          PCM RING BUFFER                                   ║
+// ═══════════════════════════════════════════════════════════════════════════════
+
+static bool pcm_ring_initialize(PcmRing *ring, size_t frames, size_t history) {
+    assert((frames & (frames - 1)) == 0);
+    assert(history < frames);
+    
+    ring->samples = calloc(frames * AUDIO_CHANNELS, sizeof(float));
+    if (!ring->samples) return false;
+    
+    ring->capacity = frames;
+    ring->mask = frames - 1;
+    ring->history = history;
+    atomic_init(&ring->write_pos, 0);
+    atomic_init(&ring->read_pos, 0);
+    atomic_init(&ring->discard_pos, 0);
+    return true;
+}
+
+static void pcm_ring_cleanup(PcmRing *ring) {
+    free(ring->samples);
+    ring->samples = NULL;
+    ring->capacity = 0;
+}
+
+static size_t pcm_ring_readable(PcmRing *ring) {
+    size_t write = atomic_load_explicit(&ring->write_pos, memory_order_acquire);
+    size_t read = atomic_load_explicit(&ring->read_pos, memory_order_acquire);
+    size_t discard = atomic_load_explicit(&ring->discard_pos, memory_order_acquire);
+    
+    // A pending flush empties the ring as far as the consumer is concerned
+    if ((ptrdiff_t)(discard - read) > 0) read = discard;
+    return write - read;
+}
+
+static size_t pcm_ring_writable(PcmRing *ring) {
+    size_t write = atomic_load_explicit(&ring->write_pos, memory_order_relaxed);
+    size_t read = atomic_load_explicit(&ring->read_pos, memory_order_acquire);
+    
+    // The last `history` consumed frames stay readable for pcm_ring_tap
+    size_t used = (write - read) + ring->history;
+    return used < ring->capacity ? ring->capacity - used : 0;
+}
+
+// Producer side. Copies as many frames as fit and returns the count.
+static size_t pcm_ring_write(PcmRing *ring, const float *frames, size_t count) {
+    size_t write = atomic_load_explicit(&ring->write_pos, memory_order_relaxed);
+    size_t space = pcm_ring_writable(ring);
+    if (count > space) count = space;
+    if (count == 0) return 0;
+    
+    size_t start = write & ring->mask;
+    size_t first = ring->capacity - start;
+    if (first > count) first = count;
+    
+    memcpy(ring->samples + start * AUDIO_CHANNELS, frames, 
+           first * AUDIO_CHANNELS * sizeof(float));
+    memcpy(ring->samples, frames + first * AUDIO_CHANNELS, 
+           (count - first) * AUDIO_CHANNELS * sizeof(float));
+    
+    atomic_store_explicit(&ring->write_pos, write + count, memory_order_release);
+    return count;
+}
+
+// Consumer side. Wait-free: a handful of atomic loads, two memcpys, one store.
+static size_t pcm_ring_read(PcmRing *ring, float *frames, size_t count) {
+    size_t read = atomic_load_explicit(&ring->read_pos, memory_order_relaxed);
+    size_t discard = atomic_load_explicit(&ring->discard_pos, memory_order_acquire);
+    if ((ptrdiff_t)(discard - read) > 0) read = discard;
+    
+    size_t write = atomic_load_explicit(&ring->write_pos, memory_order_acquire);
+    size_t available = write - read;
+    if (count > available) count = available;
+    
+    size_t start = read & ring->mask;
+    size_t first = ring->capacity - start;
+    if (first > count) first = count;
+    
+    memcpy(frames, ring->samples + start * AUDIO_CHANNELS, 
+           first * AUDIO_CHANNELS * sizeof(float));
+    memcpy(frames + first * AUDIO_CHANNELS, ring->samples, 
+           (count - first) * AUDIO_CHANNELS * sizeof(float));
+    
+    atomic_store_explicit(&ring->read_pos, read + count, memory_order_release);
+    return count;
+}
+
+// Producer side. Everything written so far is skipped by the consumer on its
+// next read, without the producer ever touching read_pos.
+static void pcm_ring_flush(PcmRing *ring) {
+    size_t write = atomic_load_explicit(&ring->write_pos, memory_order_relaxed);
+    atomic_store_explicit(&ring->discard_pos, write, memory_order_release);
+}
+
+// Analysis side. Copies the `count` frames most recently handed to the
+// device. The producer leaves the last ring->history consumed frames alone,
+// but a preempted reader can fall further behind than that, so the copy is
+// checked afterwards like a seqlock and dropped if any of it was rewritten.
+// Returns false when there is no whole window since the last flush yet.
+static bool pcm_ring_tap(PcmRing *ring, float *frames, size_t count) {
+    size_t read = atomic_load_explicit(&ring->read_pos, memory_order_acquire);
+    size_t discard = atomic_load_explicit(&ring->discard_pos, memory_order_acquire);
+    if (count > ring->history || count > read) return false;
+    
+    // Frames behind a flush point were skipped, not played
+    size_t begin = read - count;
+    if ((ptrdiff_t)(begin - discard) < 0) return false;
+    
+    size_t start = begin & ring->mask;
+    size_t head = ring->capacity - start;
+    if (head > count) head = count;
+    
+    memcpy(frames, ring->samples + start * AUDIO_CHANNELS, head * AUDIO_CHANNELS * sizeof(float));
+    memcpy(frames + head * AUDIO_CHANNELS, ring->samples, (count - head) * AUDIO_CHANNELS * sizeof(float));
+    
+    // Position `begin` is overwritten once the producer writes begin + capacity
+    atomic_thread_fence(memory_order_acquire);
+    size_t write = atomic_load_explicit(&ring->write_pos, memory_order_relaxed);
+    return write - begin <= ring->capacity;
+}
+
+static void* spectrum_thread_function(void *data) {
+    AudioEngine *engine = (AudioEngine*)data;
+    trace_thread("spectrum");
+    
+    while (engine->threads_active) {
+        if (engine->playing && !engine->paused) {
+            spectrum_analyze(engine);
+        }
+        
+        SDL_Delay(16); // ~60 FPS spectrum update
+    }
+    
+    return NULL;
+}
+
+// Log-spaced band edges, expressed in (fractional) FFT bins
+// Single-precision real-to-complex FFTW for spectrum analysis
+static bool spectrum_initialize(AudioEngine *engine) {
+    engine->fft_input = (float*)fftwf_malloc(sizeof(float) * FFT_SIZE);
+    engine->fft_output = (fftwf_complex*)fftwf_malloc(sizeof(fftwf_complex) * (FFT_SIZE / 2 + 1));
+    engine->fft_window = malloc(sizeof(float) * FFT_SIZE);
+    engine->fft_frames = malloc(sizeof(float) * FFT_SIZE * AUDIO_CHANNELS);
+    engine->spectrum_edges = malloc(sizeof(float) * (SPECTRUM_SIZE + 1));
+    
+    if (!engine->fft_input || !engine->fft_output || !engine->fft_window ||
+        !engine->fft_frames || !engine->spectrum_edges) {
+        return false;
+    }
+    
+    engine->fft_plan = fftwf_plan_dft_r2c_1d(FFT_SIZE, engine->fft_input, 
+                                            engine->fft_output, FFTW_ESTIMATE);
+    
+    // Hann window, scaled so a full-scale sine reads as 0 dB
+    for (int i = 0; i < FFT_SIZE; i++) {
+        engine->fft_window[i] = 0.5f - 0.5f * cosf(2.0f * (float)M_PI * i / (FFT_SIZE - 1));
+    }
+    return true;
+}
+
+static void spectrum_cleanup(AudioEngine *engine) {
+    if (engine->fft_plan) fftwf_destroy_plan(engine->fft_plan);
+    if (engine->fft_input) fftwf_free(engine->fft_input);
+    if (engine->fft_output) fftwf_free(engine->fft_output);
+    free(engine->fft_window);
+    free(engine->fft_frames);
+    free(engine->spectrum_edges);
+    engine->fft_plan = NULL;
+    engine->fft_input = NULL;
+    engine->fft_output = NULL;
+    engine->fft_window = NULL;
+    engine->fft_frames = NULL;
+    engine->spectrum_edges = NULL;
+}
+
+static void spectrum_build_bands(AudioEngine *engine, int sample_rate) {
+    float bin_hz = (float)sample_rate / FFT_SIZE;
+    float max_freq = fminf(SPECTRUM_MAX_FREQ, sample_rate * 0.5f);
+    float ratio = logf(max_freq / SPECTRUM_MIN_FREQ);
+    
+    for (int i = 0; i <= SPECTRUM_SIZE; i++) {
+        float freq = SPECTRUM_MIN_FREQ * expf(ratio * i / SPECTRUM_SIZE);
+        engine->spectrum_edges[i] = freq / bin_hz;
+    }
+    
+    engine->spectrum_rate = sample_rate;
+}
+
+// Runs on the spectrum thread. The audio thread does no extra work for this:
+// we copy the already-played frames out of the ring.
+static void spectrum_analyze(AudioEngine *engine) {
+    if (!pcm_ring_tap(&engine->ring, engine->fft_frames, FFT_SIZE)) {
+        return;
+    }
+    Uint64 trace = trace_begin();
+    
+    // Windowed mono downmix
+    for (size_t i = 0; i < FFT_SIZE; i++) {
+        const float *frame = engine->fft_frames + i * AUDIO_CHANNELS;
+        engine->fft_input[i] = (frame[0] + frame[1]) * 0.5f * engine->fft_window[i];
+    }
+    
+    fftwf_execute(engine->fft_plan);
+    
+    // The device can be reopened at another rate while this runs
+    int rate = atomic_load(&engine->device_rate);
+    if (rate > 0 && engine->spectrum_rate != rate) {
+        spectrum_build_bands(engine, rate);
+    }
+    
+    // Power per bin, normalized so a full-scale sine under the Hann window is 1.0
+    const float norm = 4.0f / FFT_SIZE;
+    const int last_bin = FFT_SIZE / 2;
+    float *power = engine->fft_input; // Input is consumed; reuse it as scratch
+    
+    for (int k = 0; k <= last_bin; k++) {
+        float re = engine->fft_output[k][0] * norm;
+        float im = engine->fft_output[k][1] * norm;
+        power[k] = re * re + im * im;
+    }
+    
+    pthread_mutex_lock(&engine->spectrum_mutex);
+    
+    for (int band = 0; band < SPECTRUM_SIZE; band++) {
+        float lo = engine->spectrum_edges[band];
+        float hi = engine->spectrum_edges[band + 1];
+        float level;
+        
+        if (hi - lo < 1.0f) {
+            // Narrower than a bin (low end): interpolate between neighbours
+            float center = (lo + hi) * 0.5f;
+            int k = (int)center;
+            float t = center - k;
+            level = power[k] + (power[k < last_bin ? k + 1 : k] - power[k]) * t;
+        } else {
+            // Wider than a bin: average the bins it covers
+            int k0 = (int)ceilf(lo);
+            int k1 = (int)hi;
+            if (k1 > last_bin) k1 = last_bin;
+            
+            float sum = 0.0f;
+            for (int k = k0; k <= k1; k++) sum += power[k];
+            level = sum / (k1 - k0 + 1);
+        }
+        
+        float db = 10.0f * log10f(level + 1e-12f);
+        float amplitude = fmaxf(0.0f, 1.0f - db / SPECTRUM_FLOOR_DB);
+        
+        // Smooth the spectrum
+        engine->spectrum_data[band] = engine->spectrum_data[band] * 0.8f + amplitude * 0.2f;
+    }
+    
+    pthread_mutex_unlock(&engine->spectrum_mutex);
+    trace_end(TRACE_FFT, trace, 0);
+}
+
+// ═══════════════════════════════════════════════════════════════════════════════
+// ║                           EQUALIZER DSP                                    ║
+// ═══════════════════════════════════════════════════════════════════════════════
+
+// Scalar reference kernel: every band runs over the whole block in turn
+static void eq_kernel_scalar(Equalizer *eq, float *samples, int frames) {
+    for (int lane = 0; lane < EQ_BANDS * 2; lane++) {
+        const int ch = lane & 1;
+        const float b0 = eq->b0[lane], b1 = eq->b1[lane], b2 = eq->b2[lane];
+        const float a1 = eq->a1[lane], a2 = eq->a2[lane];
+        float s1 = eq->s1[lane], s2 = eq->s2[lane];
+        
+        for (int n = 0; n < frames; n++) {
+            float x = samples[n * 2 + ch];
+            float y = b0 * x + s1;
+            s1 = b1 * x + a1 * y + s2;
+            s2 = b2 * x + a2 * y;
+            samples[n * 2 + ch] = y;
+        }
+        
+        // Without FTZ hardware support, decay tails to a hard zero per block
+        eq->s1[lane] = fabsf(s1) < 1e-15f ? 0.0f : s1;
+        eq->s2[lane] = fabsf(s2) < 1e-15f ? 0.0f : s2;
+    }
+}
+
+#ifdef TUXMUSIC_X86_SIMD
+// The cascade is serial in time, so the SIMD kernels pipeline it instead:
+// vectors hold consecutive bands for both channels, and band k processes the
+// sample band k-1 produced on the previous step. Each pass keeps two vectors
+// in flight to hide multiply/add latency, and every band after the first in a
+// pass adds one frame of pure delay, carried across blocks in eq->pipe. That
+// is eq->latency frames in all (24 for SSE2, 28 for AVX2), which the playback
+// clock adds to where each segment starts.
+
+__attribute__((target("sse2")))
+static void eq_kernel_sse(Equalizer *eq, float *samples, int frames) {
+    // 4 bands (8 lanes) per pass
+    for (int lane = 0; lane < EQ_BANDS * 2; lane += 8) {
+        const __m128 b0 = _mm_loadu_ps(eq->b0 + lane), c0 = _mm_loadu_ps(eq->b0 + lane + 4);
+        const __m128 b1 = _mm_loadu_ps(eq->b1 + lane), c1 = _mm_loadu_ps(eq->b1 + lane + 4);
+        const __m128 b2 = _mm_loadu_ps(eq->b2 + lane), c2 = _mm_loadu_ps(eq->b2 + lane + 4);
+        const __m128 a1 = _mm_loadu_ps(eq->a1 + lane), d1 = _mm_loadu_ps(eq->a1 + lane + 4);
+        const __m128 a2 = _mm_loadu_ps(eq->a2 + lane), d2 = _mm_loadu_ps(eq->a2 + lane + 4);
+        __m128 s1 = _mm_loadu_ps(eq->s1 + lane), t1 = _mm_loadu_ps(eq->s1 + lane + 4);
+        __m128 s2 = _mm_loadu_ps(eq->s2 + lane), t2 = _mm_loadu_ps(eq->s2 + lane + 4);
+        __m128 lo = _mm_loadu_ps(eq->pipe + lane), hi = _mm_loadu_ps(eq->pipe + lane + 4);
+        
+        for (int n = 0; n < frames; n++) {
+            // New frame enters band 0; every band takes its neighbour's last output
+            __m128 x = _mm_castpd_ps(_mm_load_sd((const double*)(samples + n * 2)));
+            __m128 in = _mm_movelh_ps(x, lo);
+            __m128 in2 = _mm_shuffle_ps(lo, hi, _MM_SHUFFLE(1, 0, 3, 2));
+            
+            __m128 y = _mm_add_ps(_mm_mul_ps(b0, in), s1);
+            __m128 z = _mm_add_ps(_mm_mul_ps(c0, in2), t1);
+            s1 = _mm_add_ps(_mm_add_ps(_mm_mul_ps(b1, in), _mm_mul_ps(a1, y)), s2);
+            t1 = _mm_add_ps(_mm_add_ps(_mm_mul_ps(c1, in2), _mm_mul_ps(d1, z)), t2);
+            s2 = _mm_add_ps(_mm_mul_ps(b2, in), _mm_mul_ps(a2, y));
+            t2 = _mm_add_ps(_mm_mul_ps(c2, in2), _mm_mul_ps(d2, z));
+            lo = y;
+            hi = z;
+            
+            _mm_storeh_pi((__m64*)(samples + n * 2), z);
+        }
+        
+        _mm_storeu_ps(eq->s1 + lane, s1);
+        _mm_storeu_ps(eq->s1 + lane + 4, t1);
+        _mm_storeu_ps(eq->s2 + lane, s2);
+        _mm_storeu_ps(eq->s2 + lane + 4, t2);
+        _mm_storeu_ps(eq->pipe + lane, lo);
+        _mm_storeu_ps(eq->pipe + lane + 4, hi);
+    }
+}
+
+__attribute__((target("avx2,fma")))
+static void eq_kernel_avx2(Equalizer *eq, float *samples, int frames) {
+    const __m256i shift = _mm256_setr_epi32(0, 1, 0, 1, 2, 3, 4, 5);
+    const __m256i carry = _mm256_setr_epi32(6, 7, 6, 7, 2, 3, 4, 5);
+    
+    // 8 bands (16 lanes) per pass
+    for (int lane = 0; lane < EQ_BANDS * 2; lane += 16) {
+        const __m256 b0 = _mm256_loadu_ps(eq->b0 + lane), c0 = _mm256_loadu_ps(eq->b0 + lane + 8);
+        const __m256 b1 = _mm256_loadu_ps(eq->b1 + lane), c1 = _mm256_loadu_ps(eq->b1 + lane + 8);
+        const __m256 b2 = _mm256_loadu_ps(eq->b2 + lane), c2 = _mm256_loadu_ps(eq->b2 + lane + 8);
+        const __m256 a1 = _mm256_loadu_ps(eq->a1 + lane), d1 = _mm256_loadu_ps(eq->a1 + lane + 8);
+        const __m256 a2 = _mm256_loadu_ps(eq->a2 + lane), d2 = _mm256_loadu_ps(eq->a2 + lane + 8);
+        __m256 s1 = _mm256_loadu_ps(eq->s1 + lane), t1 = _mm256_loadu_ps(eq->s1 + lane + 8);
+        __m256 s2 = _mm256_loadu_ps(eq->s2 + lane), t2 = _mm256_loadu_ps(eq->s2 + lane + 8);
+        __m256 lo = _mm256_loadu_ps(eq->pipe + lane), hi = _mm256_loadu_ps(eq->pipe + lane + 8);
+        
+        for (int n = 0; n < frames; n++) {
+            // New frame enters band 0; every band takes its neighbour's last output
+            __m256 x = _mm256_castpd_ps(_mm256_broadcast_sd((const double*)(samples + n * 2)));
+            __m256 in = _mm256_blend_ps(_mm256_permutevar8x32_ps(lo, shift), x, 0x03);
+            __m256 in2 = _mm256_blend_ps(_mm256_permutevar8x32_ps(hi, shift),
+                                         _mm256_permutevar8x32_ps(lo, carry), 0x03);
+            
+            __m256 y = _mm256_fmadd_ps(b0, in, s1);
+            __m256 z = _mm256_fmadd_ps(c0, in2, t1);
+            s1 = _mm256_fmadd_ps(b1, in, _mm256_fmadd_ps(a1, y, s2));
+            t1 = _mm256_fmadd_ps(c1, in2, _mm256_fmadd_ps(d1, z, t2));
+            s2 = _mm256_fmadd_ps(b2, in, _mm256_mul_ps(a2, y));
+            t2 = _mm256_fmadd_ps(c2, in2, _mm256_mul_ps(d2, z));
+            lo = y;
+            hi = z;
+            
+            _mm_storeh_pi((__m64*)(samples + n * 2), _mm256_extractf128_ps(z, 1));
+        }
+        
+        _mm256_storeu_ps(eq->s1 + lane, s1);
+        _mm256_storeu_ps(eq->s1 + lane + 8, t1);
+        _mm256_storeu_ps(eq->s2 + lane, s2);
+        _mm256_storeu_ps(eq->s2 + lane + 8, t2);
+        _mm256_storeu_ps(eq->pipe + lane, lo);
+        _mm256_storeu_ps(eq->pipe + lane + 8, hi);
+    }
+}
+#endif
+
+static void equalizer_initialize(Equalizer *eq) {
+    memset(eq, 0, sizeof(Equalizer));
+    eq->preamp = 1.0f;
+    
+    eq->kernel = eq_kernel_scalar;
+    eq->kernel_name = "scalar";
+    
+#ifdef TUXMUSIC_X86_SIMD
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) {
+        eq->kernel = eq_kernel_avx2;
+        eq->kernel_name = "avx2";
+        eq->latency = EQ_BANDS / 8 * 7;
+    } else if (__builtin_cpu_supports("sse2")) {
+        eq->kernel = eq_kernel_sse;
+        eq->kernel_name = "sse2";
+        eq->latency = EQ_BANDS / 4 * 3;
+    }
+#endif
+}
+
+// RBJ peaking filter for one band, written into both channel lanes
+static void equalizer_design_band(Equalizer *eq, int band, float gain_db, int sample_rate) {
+    const float span = EQ_MAX_FREQ / EQ_MIN_FREQ;
+    const float octaves = log2f(span) / (EQ_BANDS - 1);   // Spacing between centres
+    const float q = sqrtf(exp2f(octaves)) / (exp2f(octaves) - 1.0f);
+    
+    float freq = EQ_MIN_FREQ * powf(span, (float)band / (EQ_BANDS - 1));
+    freq = fminf(freq, sample_rate * 0.45f);
+    
+    double a = pow(10.0, gain_db / 40.0);
+    double w0 = 2.0 * M_PI * freq / sample_rate;
+    double alpha = sin(w0) / (2.0 * q);
+    double cosw = cos(w0);
+    double a0 = 1.0 + alpha / a;
+    
+    for (int ch = 0; ch < 2; ch++) {
+        int lane = band * 2 + ch;
+        eq->b0[lane] = (float)((1.0 + alpha * a) / a0);
+        eq->b1[lane] = (float)((-2.0 * cosw) / a0);
+        eq->b2[lane] = (float)((1.0 - alpha * a) / a0);
+        eq->a1[lane] = (float)((2.0 * cosw) / a0);
+        eq->a2[lane] = (float)(-(1.0 - alpha / a) / a0);
+    }
+    
+    eq->applied_gain[band] = gain_db;
+}
+
+// Rebuild coefficients for the bands whose gain actually changed. A sample
+// rate change invalidates all of them.
+static void equalizer_update(Equalizer *eq, const float *gains_db, float preamp_db, 
+                             int sample_rate, unsigned generation) {
+    bool rate_changed = eq->sample_rate != sample_rate;
+    bool was_active = eq->active;
+    
+    eq->active = false;
+    for (int band = 0; band < EQ_BANDS; band++) {
+        if (rate_changed || gains_db[band] != eq->applied_gain[band]) {
+            equalizer_design_band(eq, band, gains_db[band], sample_rate);
+        }
+        if (gains_db[band] != 0.0f) eq->active = true;
+    }
+    
+    // Coming out of bypass: start the cascade from silence
+    if (eq->active && (!was_active || rate_changed)) {
+        equalizer_reset(eq);
+    }
+    
+    eq->preamp = powf(10.0f, preamp_db / 20.0f);
+    eq->sample_rate = sample_rate;
+    eq->generation = generation;
+}
+
+// In place over interleaved stereo float. A flat EQ costs one compare.
+static void equalizer_process(Equalizer *eq, float *samples, int frames) {
+    if (eq->preamp != 1.0f) {
+        for (int i = 0; i < frames * 2; i++) {
+            samples[i] *= eq->preamp;
+        }
+    }
+    
+    if (eq->active) {
+        eq->kernel(eq, samples, frames);
+    }
+}
+
+// Filter and pipeline state back to silence, for a flush of everything
+// already decoded so none of the old position leaks into the new one
+static void equalizer_reset(Equalizer *eq) {
+    memset(eq->s1, 0, sizeof(eq->s1));
+    memset(eq->s2, 0, sizeof(eq->s2));
+    memset(eq->pipe, 0, sizeof(eq->pipe));
+}
+
+// Flush-to-zero / denormals-are-zero for the calling thread
+static void equalizer_flush_denormals(void) {
+#ifdef TUXMUSIC_X86_SIMD
+    _mm_setcsr(_mm_getcsr() | 0x8040);
+#endif
+}
+
+// ═══════════════════════════════════════════════════════════════════════════════
+// ║                            TRACK STORE                                     ║
+// ═══════════════════════════════════════════════════════════════════════════════
+
+static uint32_t hash_string(const char *text) {
+    // FNV-1a
+    uint32_t hash = 2166136261u;
+    while (*text) {
+        hash ^= (uint8_t)*text++;
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+static uint32_t hash_u32(uint32_t value) {
+    value ^= value >> 16;
+    value *= 0x7feb352du;
+    value ^= value >> 15;
+    value *= 0x846ca68bu;
+    value ^= value >> 16;
+    return value;
+}
+
+static bool string_arena_initialize(StringArena *arena) {
+    memset(arena, 0, sizeof(StringArena));
+    
+    arena->capacity = 64 * 1024;
+    arena->data = malloc(arena->capacity);
+    arena->slot_mask = 1024 - 1;
+    arena->slots = calloc(arena->slot_mask + 1, sizeof(StringRef));
+    
+    if (!arena->data || !arena->slots) {
+        string_arena_cleanup(arena);
+        return false;
+    }
+    
+    // Offset 0 is the shared empty string
+    arena->data[0] = '\0';
+    arena->size = 1;
+    return true;
+}
+
+static void string_arena_cleanup(StringArena *arena) {
+    free(arena->data);
+    free(arena->slots);
+    memset(arena, 0, sizeof(StringArena));
+}
+
+static StringRef string_arena_find(const StringArena *arena, const char *text) {
+    if (!text || !text[0]) return 0;
+    
+    for (size_t slot = hash_string(text) & arena->slot_mask; ; slot = (slot + 1) & arena->slot_mask) {
+        StringRef ref = arena->slots[slot];
+        if (ref == 0) return 0;
+        if (strcmp(arena->data + ref, text) == 0) return ref;
+    }
+}
+
+static bool string_arena_grow_slots(StringArena *arena) {
+    size_t new_mask = arena->slot_mask * 2 + 1;
+    StringRef *slots = calloc(new_mask + 1, sizeof(StringRef));
+    if (!slots) return false;
+    
+    for (size_t i = 0; i <= arena->slot_mask; i++) {
+        StringRef ref = arena->slots[i];
+        if (ref == 0) continue;
+        
+        size_t slot = hash_string(arena->data + ref) & new_mask;
+        while (slots[slot]) slot = (slot + 1) & new_mask;
+        slots[slot] = ref;
+    }
+    
+    free(arena->slots);
+    arena->slots = slots;
+    arena->slot_mask = new_mask;
+    return true;
+}
+
+// Returns the existing reference for text, or appends it. 0 on failure.
+static StringRef string_arena_intern(StringArena *arena, const char *text) {
+    if (!text || !text[0]) return 0;
+    
+    // Keep the table under 70% load
+    if ((arena->entries + 1) * 10 > (arena->slot_mask + 1) * 7 && !string_arena_grow_slots(arena)) {
+        return 0;
+    }
+    
+    size_t slot = hash_string(text) & arena->slot_mask;
+    for (; arena->slots[slot]; slot = (slot + 1) & arena->slot_mask) {
+        if (strcmp(arena->data + arena->slots[slot], text) == 0) return arena->slots[slot];
+    }
+    
+    size_t length = strlen(text) + 1;
+    if (arena->size + length > UINT32_MAX) return 0;
+    
+    if (arena->size + length > arena->capacity) {
+        size_t capacity = arena->capacity * 2;
+        while (capacity < arena->size + length) capacity *= 2;
+        
+        char *data = realloc(arena->data, capacity);
+        if (!data) return 0;
+        arena->data = data;
+        arena->capacity = capacity;
+    }
+    
+    StringRef ref = (StringRef)arena->size;
+    memcpy(arena->data + ref, text, length);
+    arena->size += length;
+    arena->slots[slot] = ref;
+    arena->entries++;
+    return ref;
+}
+
+// Replaces the arena with a block of NUL-terminated strings, as written by
+// library_db_save, and rebuilds the lookup table over it
+static bool string_arena_load(StringArena *arena, const char *data, size_t size) {
+    if (size > arena->capacity) {
+        size_t capacity = arena->capacity;
+        while (capacity < size) capacity *= 2;
+        
+        char *grown = realloc(arena->data, capacity);
+        if (!grown) return false;
+        arena->data = grown;
+        arena->capacity = capacity;
+    }
+    
+    memcpy(arena->data, data, size);
+    arena->size = size;
+    
+    size_t entries = 0;
+    for (size_t offset = 1; offset < size; offset += strlen(arena->data + offset) + 1) {
+        entries++;
+    }
+    
+    size_t slots = arena->slot_mask + 1;
+    while (entries * 10 > slots * 7) slots *= 2;
+    
+    StringRef *table = calloc(slots, sizeof(StringRef));
+    if (!table) return false;
+    free(arena->slots);
+    arena->slots = table;
+    arena->slot_mask = slots - 1;
+    arena->entries = entries;
+    
+    for (size_t offset = 1; offset < size; offset += strlen(arena->data + offset) + 1) {
+        size_t slot = hash_string(arena->data + offset) & arena->slot_mask;
+        while (arena->slots[slot]) slot = (slot + 1) & arena->slot_mask;
+        arena->slots[slot] = (StringRef)offset;
+    }
+    return true;
+}
+
+static void track_store_initialize(TrackStore *store) {
+    memset(store, 0, sizeof(TrackStore));
+    
+    if (!string_arena_initialize(&store->strings)) {
+        fprintf(stderr, "Fatal: Cannot allocate track store\n");
+        exit(1);
+    }
+}
+
+static void track_store_cleanup(TrackStore *store) {
+    void *columns[] = {
+        store->path, store->title, store->artist, store->album, store->genre,
+        store->format, store->artwork_path, store->duration_seconds, store->bitrate,
+        store->sample_rate, store->channels, store->year, store->track_num,
+        store->date_added, store->play_count, store->rating, store->loudness,
+        store->loudness_range, store->true_peak, store->file_hash,
+        store->file_size, store->file_mtime, store->flags, store->path_slots, store->changed
+    };
+    
+    for (size_t i = 0; i < sizeof(columns) / sizeof(columns[0]); i++) {
+        free(columns[i]);
+    }
+    
+    string_arena_cleanup(&store->strings);
+    memset(store, 0, sizeof(TrackStore));
+}
+
+static bool grow_column(void **column, size_t element_size, size_t capacity) {
+    void *grown = realloc(*column, element_size * capacity);
+    if (!grown) return false;
+    *column = grown;
+    return true;
+}
+
+static bool track_store_reserve(TrackStore *store, size_t rows) {
+    if (rows <= store->capacity) return true;
+    
+    size_t capacity = store->capacity ? store->capacity : TRACK_STORE_INITIAL;
+    while (capacity < rows) capacity *= 2;
+    
+    #define GROW(column) grow_column((void**)&store->column, sizeof(*store->column), capacity)
+    bool ok = GROW(path) && GROW(title) && GROW(artist) && GROW(album) && GROW(genre) &&
+              GROW(format) && GROW(artwork_path) && GROW(duration_seconds) && GROW(bitrate) &&
+              GROW(sample_rate) && GROW(channels) && GROW(year) && GROW(track_num) &&
+              GROW(date_added) && GROW(play_count) && GROW(rating) && GROW(loudness) &&
+              GROW(loudness_range) && GROW(true_peak) && GROW(file_hash) &&
+              GROW(file_size) && GROW(file_mtime) && GROW(flags);
+    #undef GROW
+    if (!ok) return false;
+    
+    // Rebuild the path index at twice the row capacity; on failure the old
+    // index stays in place and still covers every row
+    uint32_t *slots = calloc(capacity * 2, sizeof(uint32_t));
+    if (!slots) return false;
+    
+    free(store->path_slots);
+    store->path_slots = slots;
+    store->path_slot_mask = capacity * 2 - 1;
+    store->capacity = capacity;
+    track_store_rebuild_path_index(store);
+    return true;
+}
+
+static void track_store_rebuild_path_index(TrackStore *store) {
+    memset(store->path_slots, 0, (store->path_slot_mask + 1) * sizeof(uint32_t));
+    
+    for (TrackId id = 0; id < store->count; id++) {
+        size_t slot = hash_u32(store->path[id]) & store->path_slot_mask;
+        while (store->path_slots[slot]) slot = (slot + 1) & store->path_slot_mask;
+        store->path_slots[slot] = id + 1;
+    }
+}
+
+// Leading number of fields like "3/12" or "1999-05-01"
+static int parse_leading_int(const char *text) {
+    return (int)strtol(text, NULL, 10);
+}
+
+static void track_store_write_row(TrackStore *store, TrackId id, const Track *track) {
+    StringArena *strings = &store->strings;
+    const TrackMetadata *meta = &track->metadata;
+    
+    store->path[id] = string_arena_intern(strings, track->filepath);
+    store->title[id] = string_arena_intern(strings, meta->title);
+    store->artist[id] = string_arena_intern(strings, meta->artist);
+    store->album[id] = string_arena_intern(strings, meta->album);
+    store->genre[id] = string_arena_intern(strings, meta->genre);
+    store->format[id] = string_arena_intern(strings, meta->format);
+    store->artwork_path[id] = string_arena_intern(strings, meta->artwork_path);
+    
+    store->duration_seconds[id] = meta->duration_seconds;
+    store->bitrate[id] = meta->bitrate;
+    store->sample_rate[id] = meta->sample_rate;
+    store->channels[id] = (uint8_t)meta->channels;
+    store->year[id] = (int16_t)parse_leading_int(meta->year);
+    store->track_num[id] = (uint16_t)parse_leading_int(meta->track_num);
+    store->date_added[id] = meta->date_added ? (int64_t)meta->date_added : (int64_t)time(NULL);
+    store->play_count[id] = meta->play_count;
+    store->rating[id] = meta->rating;
+    store->file_hash[id] = track->file_hash;
+    store->file_size[id] = track->file_size;
+    store->file_mtime[id] = track->file_mtime;
+    
+    // The file may have changed: the loudness scanner measures it again
+    store->loudness[id] = 0.0f;
+    store->loudness_range[id] = 0.0f;
+    store->true_peak[id] = 0.0f;
+    store->flags[id] = (track->metadata_loaded ? TRACK_FLAG_METADATA_LOADED : 0) |
+                       (meta->has_artwork ? TRACK_FLAG_HAS_ARTWORK : 0);
+}
+
+// Appends a row, or returns the existing ID if the path is already known
+static TrackId track_store_add(TrackStore *store, const Track *track) {
+    TrackId existing = track_store_find(store, track->filepath);
+    if (existing != TRACK_ID_NONE) return existing;
+    
+    if (!track_store_reserve(store, store->count + 1)) {
+        fprintf(stderr, "Out of memory adding track %s\n", track->filepath);
+        return TRACK_ID_NONE;
+    }
+    
+    TrackId id = (TrackId)store->count++;
+    track_store_write_row(store, id, track);
+    
+    size_t slot = hash_u32(store->path[id]) & store->path_slot_mask;
+    while (store->path_slots[slot]) slot = (slot + 1) & store->path_slot_mask;
+    store->path_slots[slot] = id + 1;
+    
+    return id;
+}
+
+// Rewrites a row in place after a rescan; the path stays the same
+static void track_store_update(TrackStore *store, TrackId id, const Track *track) {
+    if (id >= store->count) return;
+    
+    int64_t date_added = store->date_added[id];
+    int32_t play_count = store->play_count[id];
+    float rating = store->rating[id];
+    
+    track_store_write_row(store, id, track);
+    
+    // Library statistics belong to the library, not to the file
+    store->date_added[id] = date_added;
+    store->play_count[id] = play_count;
+    store->rating[id] = rating;
+    track_store_touch(store, id);
+}
+
+// Notes a rewritten row for library_views_sync; repeats are harmless
+static void track_store_touch(TrackStore *store, TrackId id) {
+    if (store->changed_count == store->changed_capacity) {
+        size_t capacity = store->changed_capacity ? store->changed_capacity * 2 : 256;
+        if (!grow_column((void**)&store->changed, sizeof(TrackId), capacity)) return;
+        store->changed_capacity = capacity;
+    }
+    store->changed[store->changed_count++] = id;
+}
+
+// Records a new mtime for a file whose content hash proved it unchanged
+static void track_store_set_identity(TrackStore *store, TrackId id, const Track *track) {
+    if (id >= store->count) return;
+    
+    store->file_size[id] = track->file_size;
+    store->file_mtime[id] = track->file_mtime;
+    store->file_hash[id] = track->file_hash;
+}
+
+// Stores what the loudness scanner measured for a row
+static void track_store_set_loudness(TrackStore *store, TrackId id, const LoudnessResult *result) {
+    if (id >= store->count) return;
+    
+    store->loudness[id] = result->loudness;
+    store->loudness_range[id] = result->range;
+    store->true_peak[id] = result->peak;
+    store->flags[id] |= TRACK_FLAG_LOUDNESS;
+}
+
+static TrackId track_store_find(TrackStore *store, const char *filepath) {
+    if (store->count == 0) return TRACK_ID_NONE;
+    
+    StringRef ref = string_arena_find(&store->strings, filepath);
+    if (ref == 0) return TRACK_ID_NONE;
+    
+    for (size_t slot = hash_u32(ref) & store->path_slot_mask; ; slot = (slot + 1) & store->path_slot_mask) {
+        uint32_t entry = store->path_slots[slot];
+        if (entry == 0) return TRACK_ID_NONE;
+        if (store->path[entry - 1] == ref) return entry - 1;
+    }
+}
+
+// Unpacks a row into the probe-time representation
+static void track_store_get(const TrackStore *store, TrackId id, Track *track) {
+    memset(track, 0, sizeof(Track));
+    if (id >= store->count) return;
+    
+    TrackMetadata *meta = &track->metadata;
+    snprintf(track->filepath, sizeof(track->filepath), "%s", track_store_text(store, store->path[id]));
+    snprintf(track->filename, sizeof(track->filename), "%s", track_store_filename(store, id));
+    snprintf(meta->title, sizeof(meta->title), "%s", track_store_text(store, store->title[id]));
+    snprintf(meta->artist, sizeof(meta->artist), "%s", track_store_text(store, store->artist[id]));
+    snprintf(meta->album, sizeof(meta->album), "%s", track_store_text(store, store->album[id]));
+    snprintf(meta->genre, sizeof(meta->genre), "%s", track_store_text(store, store->genre[id]));
+    snprintf(meta->format, sizeof(meta->format), "%s", track_store_text(store, store->format[id]));
+    snprintf(meta->artwork_path, sizeof(meta->artwork_path), "%s", 
+             track_store_text(store, store->artwork_path[id]));
+    
+    if (store->year[id]) snprintf(meta->year, sizeof(meta->year), "%d", store->year[id]);
+    if (store->track_num[id]) snprintf(meta->track_num, sizeof(meta->track_num), "%d", store->track_num[id]);
+    format_time_string(store->duration_seconds[id], meta->duration_str, sizeof(meta->duration_str));
+    
+    meta->duration_seconds = store->duration_seconds[id];
+    meta->bitrate = store->bitrate[id];
+    meta->sample_rate = store->sample_rate[id];
+    meta->channels = store->channels[id];
+    meta->has_artwork = (store->flags[id] & TRACK_FLAG_HAS_ARTWORK) != 0;
+    meta->date_added = (time_t)store->date_added[id];
+    meta->play_count = store->play_count[id];
+    meta->rating = store->rating[id];
+    
+    track->metadata_loaded = (store->flags[id] & TRACK_FLAG_METADATA_LOADED) != 0;
+    track->file_hash = store->file_hash[id];
+    track->file_size = store->file_size[id];
+    track->file_mtime = store->file_mtime[id];
+}
+
+// Valid until the next insert into the store
+static const char* track_store_text(const TrackStore *store, StringRef ref) {
+    return store->strings.data + ref;
+}
+
+static const char* track_store_filename(const TrackStore *store, TrackId id) {
+    const char *path = track_store_text(store, store->path[id]);
+    const char *slash = strrchr(path, '/');
+#ifdef _WIN32
+    const char *backslash = strrchr(path, '\\');
+    if (!slash || (backslash && backslash > slash)) slash = backslash;
+#endif
+    return slash ? slash + 1 : path;
+}
+
+// One column as the library database and the memory report see it
+typedef struct {
+    void **column;
+    size_t width;
+    uint32_t since;             // First database version with this column
+} StoreColumn;
+
+// Every store column in file order. Returns the number of columns.
+static int track_store_columns(TrackStore *store, StoreColumn *columns) {
+    #define COLUMN(name, since) { (void**)&store->name, sizeof(*store->name), since }
+    StoreColumn list[] = {
+        COLUMN(duration_seconds, 1), COLUMN(date_added, 1), COLUMN(file_size, 1), COLUMN(file_mtime, 1),
+        COLUMN(path, 1), COLUMN(title, 1), COLUMN(artist, 1), COLUMN(album, 1), COLUMN(genre, 1),
+        COLUMN(format, 1), COLUMN(artwork_path, 1), COLUMN(bitrate, 1), COLUMN(sample_rate, 1),
+        COLUMN(play_count, 1), COLUMN(rating, 1), COLUMN(file_hash, 1),
+        COLUMN(loudness, 2), COLUMN(loudness_range, 2), COLUMN(true_peak, 2),
+        COLUMN(year, 1), COLUMN(track_num, 1), COLUMN(channels, 1), COLUMN(flags, 1)
+    };
+    #undef COLUMN
+    
+    int count = (int)(sizeof(list) / sizeof(list[0]));
+    memcpy(columns, list, sizeof(list));
+    return count;
+}
+
+static size_t track_store_memory_usage(const TrackStore *store) {
+    // Only the column addresses are taken, nothing is written
+    StoreColumn columns[32];
+    int column_count = track_store_columns((TrackStore*)store, columns);
+    
+    size_t row = 0;
+    for (int i = 0; i < column_count; i++) {
+        row += columns[i].width;
+    }
+    
+    return store->capacity * row + (store->path_slot_mask + 1) * sizeof(uint32_t) +
+           store->strings.capacity + (store->strings.slot_mask + 1) * sizeof(StringRef);
+}
+
+// ═══════════════════════════════════════════════════════════════════════════════
+// ║                          LIBRARY DATABASE                                  ║
+// ═══════════════════════════════════════════════════════════════════════════════
+
+static bool make_directory(const char *path) {
+#ifdef _WIN32
+    return CreateDirectoryA(path, NULL) || GetLastError() == ERROR_ALREADY_EXISTS;
+#else
+    return mkdir(path, 0755) == 0 || errno == EEXIST;
+#endif
+}
+
+static const void* library_db_column(const StoreColumn *columns, const uint8_t **data,
+                                     int count, void **field) {
+    for (int i = 0; i < count; i++) {
+        if (columns[i].column == field) return data[i];
+    }
+    return NULL;
+}
+
+// $XDG_CACHE_HOME/tuxmusic, ~/.cache/tuxmusic or %LOCALAPPDATA%\TuxMusic, created if missing
+static bool cache_directory(char *directory, size_t size) {
+#ifdef _WIN32
+    const char *base = getenv("LOCALAPPDATA");
+    if (!base || !base[0]) return false;
+    snprintf(directory, size, "%s\\TuxMusic", base);
+#else
+    const char *base = getenv("XDG_CACHE_HOME");
+    if (base && base[0]) {
+        snprintf(directory, size, "%s/tuxmusic", base);
+    } else {
+        const char *home = getenv("HOME");
+        if (!home || !home[0]) return false;
+        
+        snprintf(directory, size, "%s/.cache", home);
+        make_directory(directory);
+        snprintf(directory, size, "%s/.cache/tuxmusic", home);
+    }
+#endif
+    
+    return make_directory(directory);
+}
+
+static bool library_db_path(char *path, size_t size) {
+    char directory[MAX_PATH];
+    if (!cache_directory(directory, sizeof(directory))) return false;
+    return snprintf(path, size, "%s%slibrary.db", directory, PATH_SEP) < (int)size;
+}
+
+// Loads the database into an empty store and keeps the raw file as the
+// scanner's lookup snapshot. On any error both are left empty.
+static bool library_db_load(LibraryCache *cache, TrackStore *store, const char *path) {
+    memset(cache, 0, sizeof(LibraryCache));
+    
+    FILE *file = fopen(path, "rb");
+    if (!file) return false;
+    
+    fseek(file, 0, SEEK_END);
+    long file_size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+    
+    void *blob = file_size > (long)sizeof(LibraryDbHeader) ? malloc(file_size) : NULL;
+    bool ok = blob && fread(blob, 1, file_size, file) == (size_t)file_size;
+    fclose(file);
+    
+    StoreColumn columns[32];
+    int column_count = track_store_columns(store, columns);
+    
+    // Only the columns the writer's version had are in the file
+    const LibraryDbHeader *header = blob;
+    uint32_t version = ok ? header->version : 0;
+    size_t row_width = 0;
+    for (int i = 0; i < column_count; i++) {
+        if (columns[i].since <= version) row_width += columns[i].width;
+    }
+    
+    if (ok) {
+        ok = memcmp(header->magic, LIBRARY_DB_MAGIC, sizeof(header->magic)) == 0 &&
+             version >= 1 && version <= LIBRARY_DB_VERSION &&
+             header->byte_order == 0x01020304 &&
+             header->row_width == row_width &&
+             header->row_count <= UINT32_MAX - 1 &&
+             header->string_bytes >= 1 && header->string_bytes <= UINT32_MAX &&
+             (uint64_t)file_size == sizeof(LibraryDbHeader) + header->row_count * row_width + 
+                                    header->string_bytes;
+    }
+    
+    if (!ok) {
+        if (blob) fprintf(stderr, "Ignoring unreadable library database %s\n", path);
+        free(blob);
+        return false;
+    }
+    
+    size_t rows = (size_t)header->row_count;
+    size_t string_bytes = (size_t)header->string_bytes;
+    
+    // Locate every column inside the blob
+    const uint8_t *column_data[32];
+    const uint8_t *cursor = (const uint8_t*)blob + sizeof(LibraryDbHeader);
+    for (int i = 0; i < column_count; i++) {
+        column_data[i] = columns[i].since <= version ? cursor : NULL;
+        if (column_data[i]) cursor += rows * columns[i].width;
+    }
+    const char *strings = (const char*)cursor;
+    
+    #define BLOB_COLUMN(name) library_db_column(columns, column_data, column_count, (void**)&store->name)
+    const StringRef *text_columns[] = {
+        BLOB_COLUMN(path), BLOB_COLUMN(title), BLOB_COLUMN(artist), BLOB_COLUMN(album),
+        BLOB_COLUMN(genre), BLOB_COLUMN(format), BLOB_COLUMN(artwork_path)
+    };
+    
+    // String references must land inside the arena
+    ok = strings[0] == '\0' && strings[string_bytes - 1] == '\0';
+    for (size_t c = 0; ok && c < sizeof(text_columns) / sizeof(text_columns[0]); c++) {
+        for (size_t row = 0; row < rows; row++) {
+            if (text_columns[c][row] >= string_bytes) ok = false;
+        }
+    }
+    
+    if (!ok) {
+        fprintf(stderr, "Ignoring corrupt library database %s\n", path);
+        free(blob);
+        return false;
+    }
+    
+    if (!track_store_reserve(store, rows) || !string_arena_load(&store->strings, strings, string_bytes)) {
+        fprintf(stderr, "Out of memory loading library database\n");
+        free(blob);
+        track_store_cleanup(store);
+        track_store_initialize(store);
+        return false;
+    }
+    
+    for (int i = 0; i < column_count; i++) {
+        if (column_data[i]) {
+            memcpy(*columns[i].column, column_data[i], rows * columns[i].width);
+        } else {
+            memset(*columns[i].column, 0, rows * columns[i].width);
+        }
+    }
+    store->count = rows;
+    track_store_rebuild_path_index(store);
+    
+    // The scanner's snapshot points straight into the blob
+    cache->blob = blob;
+    cache->count = rows;
+    cache->strings = strings;
+    cache->path = text_columns[0];
+    cache->file_size = BLOB_COLUMN(file_size);
+    cache->file_mtime = BLOB_COLUMN(file_mtime);
+    cache->file_hash = BLOB_COLUMN(file_hash);
+    #undef BLOB_COLUMN
+    
+    size_t slots = 1024;
+    while (slots < rows * 2) slots *= 2;
+    cache->slot_mask = slots - 1;
+    cache->slots = calloc(slots, sizeof(uint32_t));
+    if (!cache->slots) {
+        // The library itself loaded fine; scans just cannot skip files
+        free(blob);
+        memset(cache, 0, sizeof(LibraryCache));
+        return true;
+    }
+    
+    for (size_t row = 0; row < rows; row++) {
+        size_t slot = hash_string(strings + cache->path[row]) & cache->slot_mask;
+        while (cache->slots[slot]) slot = (slot + 1) & cache->slot_mask;
+        cache->slots[slot] = (uint32_t)row + 1;
+    }
+    
+    return true;
+}
+
+// Written to a temporary file and renamed over the old one, so a crash
+// mid-save never leaves a truncated database behind
+static bool library_db_save(TrackStore *store, const char *path) {
+    char temp_path[MAX_PATH];
+    if (snprintf(temp_path, sizeof(temp_path), "%s.tmp", path) >= (int)sizeof(temp_path)) return false;
+    
+    FILE *file = fopen(temp_path, "wb");
+    if (!file) {
+        fprintf(stderr, "Cannot write library database %s: %s\n", temp_path, strerror(errno));
+        return false;
+    }
+    
+    StoreColumn columns[32];
+    int column_count = track_store_columns(store, columns);
+    
+    LibraryDbHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, LIBRARY_DB_MAGIC, sizeof(header.magic));
+    header.version = LIBRARY_DB_VERSION;
+    header.byte_order = 0x01020304;
+    header.row_count = store->count;
+    header.string_bytes = store->strings.size;
+    for (int i = 0; i < column_count; i++) header.row_width += (uint32_t)columns[i].width;
+    
+    bool ok = fwrite(&header, sizeof(header), 1, file) == 1;
+    for (int i = 0; ok && i < column_count; i++) {
+        ok = fwrite(*columns[i].column, columns[i].width, store->count, file) == store->count;
+    }
+    ok = ok && fwrite(store->strings.data, 1, store->strings.size, file) == store->strings.size;
+    ok = (fclose(file) == 0) && ok;
+    
+#ifdef _WIN32
+    ok = ok && MoveFileExA(temp_path, path, MOVEFILE_REPLACE_EXISTING);
+#else
+    ok = ok && rename(temp_path, path) == 0;
+#endif
+    
+    if (!ok) {
+        fprintf(stderr, "Failed to save library database %s\n", path);
+        remove(temp_path);
+    }
+    return ok;
+}
+
+static void library_cache_cleanup(LibraryCache *cache) {
+    free(cache->blob);
+    free(cache->slots);
+    memset(cache, 0, sizeof(LibraryCache));
+}
+
+// Thread-safe: the snapshot never changes after startup.
+// Returns true if the track's stored row is still accurate.
+static bool library_cache_check(const LibraryCache *cache, Track *track) {
+    if (cache->count == 0 || !cache->slots) return false;
+    
+    size_t row = SIZE_MAX;
+    for (size_t slot = hash_string(track->filepath) & cache->slot_mask; ; slot = (slot + 1) & cache->slot_mask) {
+        uint32_t entry = cache->slots[slot];
+        if (entry == 0) return false;
+        if (strcmp(cache->strings + cache->path[entry - 1], track->filepath) == 0) {
+            row = entry - 1;
+            break;
+        }
+    }
+    
+    if (cache->file_size[row] != track->file_size) return false;
+    
+    // Same size and mtime: trust it without reading the file
+    if (cache->file_mtime[row] == track->file_mtime) {
+        track->file_hash = cache->file_hash[row];
+        return true;
+    }
+    
+    // Touched or copied: the content hash decides
+    track->file_hash = file_content_hash(track->filepath, track->file_size);
+    return track->file_hash == cache->file_hash[row];
+}
+
+static bool file_get_identity(const char *path, int64_t *size, int64_t *mtime) {
+#ifdef _WIN32
+    WIN32_FILE_ATTRIBUTE_DATA info;
+    if (!GetFileAttributesExA(path, GetFileExInfoStandard, &info)) return false;
+    *size = ((int64_t)info.nFileSizeHigh << 32) | info.nFileSizeLow;
+    *mtime = ((int64_t)info.ftLastWriteTime.dwHighDateTime << 32) | info.ftLastWriteTime.dwLowDateTime;
+#else
+    struct stat info;
+    if (stat(path, &info) != 0) return false;
+    *size = (int64_t)info.st_size;
+    *mtime = (int64_t)info.st_mtime;
+#endif
+    return true;
+}
+
+// FNV-1a over the size and the first and last LIBRARY_HASH_BYTES, which is
+// where tag blocks live. Never 0, so 0 can mean "not computed".
+static uint32_t file_content_hash(const char *path, int64_t size) {
+    FILE *file = fopen(path, "rb");
+    if (!file) return 0;
+    
+    uint8_t *buffer = malloc(LIBRARY_HASH_BYTES);
+    if (!buffer) {
+        fclose(file);
+        return 0;
+    }
+    
+    uint32_t hash = 2166136261u;
+    for (int i = 0; i < 8; i++) {
+        hash ^= (uint8_t)(size >> (i * 8));
+        hash *= 16777619u;
+    }
+    
+    for (int part = 0; part < 2; part++) {
+        if (part == 1) {
+            if (size <= LIBRARY_HASH_BYTES) break;
+            fseek(file, size > 2 * LIBRARY_HASH_BYTES ? -LIBRARY_HASH_BYTES : LIBRARY_HASH_BYTES - size, SEEK_END);
+        }
+        
+        size_t length = fread(buffer, 1, LIBRARY_HASH_BYTES, file);
+        for (size_t i = 0; i < length; i++) {
+            hash ^= buffer[i];
+            hash *= 16777619u;
+        }
+    }
+    
+    free(buffer);
+    fclose(file);
+    return hash ? hash : 1;
+}
+
+// ═══════════════════════════════════════════════════════════════════════════════
+// ║                         PLAYLIST MANAGEMENT                                ║
+// ═══════════════════════════════════════════════════════════════════════════════
+
+static void playlist_initialize(Playlist *playlist, const char *name) {
+    memset(playlist, 0, sizeof(Playlist));
+    
+    snprintf(playlist->name, sizeof(playlist->name), "%s", name);
+    playlist->store = &g_app->library;
+    playlist->current_index = -1;
+    playlist->queued_index = -1;
+    playlist->created = time(NULL);
+    playlist->modified = playlist->created;
+}
+
+static void playlist_cleanup(Playlist *playlist) {
+    free(playlist->track_ids);
+    free(playlist->members);
+    playlist->members = NULL;
+    playlist->member_capacity = 0;
+    playlist->track_ids = NULL;
+    playlist->track_count = 0;
+    playlist->track_capacity = 0;
+}
+
+static void playlist_append(Playlist *playlist, TrackId id) {
+    if (id == TRACK_ID_NONE) return;
+    
+    if (playlist->track_count == playlist->track_capacity) {
+        int capacity = playlist->track_capacity ? playlist->track_capacity * 2 : TRACK_STORE_INITIAL;
+        TrackId *ids = realloc(playlist->track_ids, sizeof(TrackId) * capacity);
+        if (!ids) return;
+        playlist->track_ids = ids;
+        playlist->track_capacity = capacity;
+    }
+    
+    if (id >= playlist->member_capacity) {
+        size_t capacity = playlist->member_capacity ? playlist->member_capacity : TRACK_STORE_INITIAL;
+        while (capacity <= id) capacity *= 2;
+        
+        uint8_t *members = realloc(playlist->members, capacity);
+        if (!members) return;
+        memset(members + playlist->member_capacity, 0, capacity - playlist->member_capacity);
+        playlist->members = members;
+        playlist->member_capacity = capacity;
+    }
+    
+    playlist->members[id] = 1;
+    playlist->track_ids[playlist->track_count++] = id;
+    playlist->modified = time(NULL);
+}
+
+static void playlist_add_track(Playlist *playlist, const Track *track) {
+    playlist_append(playlist, track_store_add(playlist->store, track));
+}
+
+static bool playlist_contains(const Playlist *playlist, TrackId id) {
+    return id < playlist->member_capacity && playlist->members[id];
+}
+
+static void playlist_remove_track(Playlist *playlist, int index) {
+    if (index < 0 || index >= playlist->track_count) return;
+    
+    // The row stays in the store; only this playlist forgets it
+    playlist->members[playlist->track_ids[index]] = 0;
+    memmove(&playlist->track_ids[index], &playlist->track_ids[index + 1],
+            sizeof(TrackId) * (playlist->track_count - index - 1));
+    playlist->track_count--;
+    
+    if (playlist->current_index > index) {
+        playlist->current_index--;
+    } else if (playlist->current_index == index) {
+        playlist->current_index = -1;
+    }
+    
+    if (playlist->queued_index > index) {
+        playlist->queued_index--;
+    } else if (playlist->queued_index == index && playlist->current_index >= 0) {
+        playlist_queue_next(playlist);
+    }
+    playlist->modified = time(NULL);
+}
+
+// Shows, and logs, that a playlist entry would not open
+static void playlist_report_failure(Playlist *playlist, int index) {
+    TrackStore *store = playlist->store;
+    TrackId id = playlist->track_ids[index];
+    
+    snprintf(g_app->status_message, MAX_TEXT, "Cannot play %s", track_store_filename(store, id));
+    fprintf(stderr, "Cannot play %s\n", track_store_text(store, store->path[id]));
+}
+
+static bool playlist_play_track(Playlist *playlist, int index) {
+    if (index < 0 || index >= playlist->track_count) return false;
+    
+    TrackStore *store = playlist->store;
+    TrackId id = playlist->track_ids[index];
+    
+    float gain = replaygain_for_track(store, id, g_app->audio.replaygain);
+    if (!audio_load_track(&g_app->audio, track_store_text(store, store->path[id]), gain)) {
+        playlist_report_failure(playlist, index);
+        return false;
+    }
+    
+    // A splice the decoder reached but nobody heard was flushed with the
+    // ring; its serial must not read as the engine moving on by itself.
+    // Nothing is queued again until playlist_queue_next below.
+    g_app->track_serial_seen = audio_track_serial(&g_app->audio);
+    
+    playlist->current_index = index;
+    store->play_count[id]++;
+    track_store_touch(store, id);
+    audio_play(&g_app->audio);
+    snprintf(g_app->status_message, MAX_TEXT, "Playing %s", track_store_filename(store, id));
+    
+    playlist_queue_next(playlist);
+    return true;
+}
+
+// Plays `index`, or the first track after it that opens. Stops once the
+// list runs out, or every track has been tried.
+static bool playlist_play_from(Playlist *playlist, int index) {
+    for (int tried = 0; index >= 0 && tried < playlist->track_count; tried++) {
+        if (playlist_play_track(playlist, index)) return true;
+        
+        // Move on from the one that failed, not from what played before it
+        playlist->current_index = index;
+        index = playlist_pick_next(playlist, false);
+    }
+    
+    audio_stop(&g_app->audio);
+    playlist->current_index = -1;
+    return false;
+}
+
+// The track after the current one, or -1 at the end of the list.
+// Only automatic advances honour repeat-one.
+static int playlist_pick_next(Playlist *playlist, bool automatic) {
+    if (playlist->track_count == 0) return -1;
+    
+    if (automatic && g_app->audio.repeat_one && playlist->current_index >= 0) {
+        return playlist->current_index;
+    }
+    
+    int next;
+    if (g_app->audio.shuffle && playlist->track_count > 1) {
+        do {
+            next = rand() % playlist->track_count;
+        } while (next == playlist->current_index);
+    } else {
+        next = playlist->current_index + 1;
+    }
+    
+    if (next >= playlist->track_count) {
+        if (!g_app->audio.repeat_all) return -1;
+        next = 0;
+    }
+    return next;
+}
+
+// Hands the engine the track to continue with, so it can open it ahead of
+// time. Consecutive tracks of one album are spliced gapless; anything else
+// gets the configured crossfade.
+static void playlist_queue_next(Playlist *playlist) {
+    int next = playlist_pick_next(playlist, true);
+    playlist->queued_index = next;
+    
+    if (next < 0 || playlist->current_index < 0) {
+        audio_queue_next(&g_app->audio, NULL, 1.0f, false);
+        return;
+    }
+    
+    TrackStore *store = playlist->store;
+    TrackId current = playlist->track_ids[playlist->current_index];
+    TrackId upcoming = playlist->track_ids[next];
+    
+    bool same_album = store->album[current] != 0 && store->album[current] == store->album[upcoming] &&
+                      store->track_num[upcoming] == store->track_num[current] + 1;
+    bool crossfade = next != playlist->current_index && !same_album;
+    
+    audio_queue_next(&g_app->audio, track_store_text(store, store->path[upcoming]),
+                     replaygain_for_track(store, upcoming, g_app->audio.replaygain), crossfade);
+}
+
+// The engine has moved on to the queued track by itself
+static void playlist_track_changed(Playlist *playlist) {
+    int index = playlist->queued_index;
+    if (index < 0 || index >= playlist->track_count) return;
+    
+    TrackStore *store = playlist->store;
+    TrackId id = playlist->track_ids[index];
+    
+    playlist->current_index = index;
+    store->play_count[id]++;
+    track_store_touch(store, id);
+    snprintf(g_app->status_message, MAX_TEXT, "Playing %s", track_store_filename(store, id));
+    
+    playlist_queue_next(playlist);
+}
+
+static void playlist_next_track(Playlist *playlist) {
+    playlist_play_from(playlist, playlist_pick_next(playlist, false));
+}
+
+// The engine ran out of audio: either nothing was queued, or the preload
+// thread could not open the queued track, which is then skipped rather than
+// tried a second time
+static void playlist_track_finished(Playlist *playlist) {
+    bool failed = audio_next_failed(&g_app->audio);
+    audio_stop(&g_app->audio);
+    
+    int queued = playlist->queued_index;
+    if (failed && queued >= 0 && queued < playlist->track_count) {
+        playlist_report_failure(playlist, queued);
+        playlist->current_index = queued;
+    }
+    
+    playlist_play_from(playlist, playlist_pick_next(playlist, false));
+}
+
+static int playlist_index_of(const Playlist *playlist, TrackId id) {
+    if (!playlist_contains(playlist, id)) return -1;
+    
+    for (int i = 0; i < playlist->track_count; i++) {
+        if (playlist->track_ids[i] == id) return i;
+    }
+    return -1;
+}
+
+static void playlist_previous_track(Playlist *playlist) {
+    if (playlist->track_count == 0) return;
+    
+    int previous = playlist->current_index - 1;
+    if (previous < 0) {
+        previous = g_app->audio.repeat_all ? playlist->track_count - 1 : 0;
+    }
+    
+    playlist_play_track(playlist, previous);
+}
+
+// ═══════════════════════════════════════════════════════════════════════════════
+// ║                         SEARCH & SMART PLAYLISTS                           ║
+// ═══════════════════════════════════════════════════════════════════════════════
+
+// Latin-1 letters folded to their base letter; '?' keeps the character
+static const char SEARCH_LATIN1_FOLD[65] =
+    "aaaaaa?ceeeeiiiidnooooo?ouuuuy??"
+    "aaaaaa?ceeeeiiiidnooooo?ouuuuy?y";
+
+// Lowercase ASCII letters and digits, accents folded, everything else a
+// single space; other UTF-8 is kept as it is. Returns the length written.
+static size_t search_normalize(const char *input, char *output, size_t size) {
+    const unsigned char *in = (const unsigned char*)input;
+    size_t length = 0;
+    bool space = true;          // No leading space
+    
+    while (*in && length + 4 < size) {
+        unsigned char c = *in;
+        
+        if (c < 0x80) {
+            in++;
+            if ((c >= 'a' && c <= 'z') || (c >= '0' && c <= '9')) {
+                output[length++] = (char)c;
+                space = false;
+            } else if (c >= 'A' && c <= 'Z') {
+                output[length++] = (char)(c - 'A' + 'a');
+                space = false;
+            } else if (!space) {
+                output[length++] = ' ';
+                space = true;
+            }
+            continue;
+        }
+        
+        if (c == 0xC3 && in[1] >= 0x80 && in[1] <= 0xBF) {
+            char folded = SEARCH_LATIN1_FOLD[in[1] - 0x80];
+            if (folded != '?') {
+                output[length++] = folded;
+                space = false;
+                in += 2;
+                continue;
+            }
+        }
+        
+        // One whole UTF-8 sequence, never a partial one
+        size_t sequence = c >= 0xF0 ? 4 : c >= 0xE0 ? 3 : c >= 0xC0 ? 2 : 1;
+        for (size_t i = 0; i < sequence && *in; i++) {
+            output[length++] = (char)*in++;
+        }
+        space = false;
+    }
+    
+    if (length > 0 && output[length - 1] == ' ') length--;
+    output[length] = '\0';
+    return length;
+}
+
+// Trigrams are hashed straight into a fixed table of posting lists;
+// collisions only cost candidates, which are all verified anyway
+static uint32_t search_gram_bucket(const char *gram) {
+    uint32_t key = (uint8_t)gram[0] | (uint32_t)(uint8_t)gram[1] << 8 | (uint32_t)(uint8_t)gram[2] << 16;
+    return (key * 2654435761u) >> (32 - SEARCH_GRAM_BITS);
+}
+
+static int compare_u32(const void *a, const void *b) {
+    uint32_t x = *(const uint32_t*)a, y = *(const uint32_t*)b;
+    return (x > y) - (x < y);
+}
+
+static bool search_index_initialize(SearchIndex *index) {
+    memset(index, 0, sizeof(SearchIndex));
+    index->postings = calloc((size_t)1 << SEARCH_GRAM_BITS, sizeof(SearchPosting));
+    return index->postings != NULL;
+}
+
+static void search_index_cleanup(SearchIndex *index) {
+    if (index->postings) {
+        for (size_t i = 0; i < ((size_t)1 << SEARCH_GRAM_BITS); i++) {
+            free(index->postings[i].ids);
+        }
+    }
+    free(index->postings);
+    free(index->text);
+    free(index->offset);
+    memset(index, 0, sizeof(SearchIndex));
+}
+
+// "title\nartist\nalbum\ngenre", normalized; the file name stands in for
+// a missing title
+static size_t search_track_text(const TrackStore *store, TrackId id, char *text, size_t size) {
+    const char *title = track_store_text(store, store->title[id]);
+    const char *fields[] = {
+        title[0] ? title : track_store_filename(store, id),
+        track_store_text(store, store->artist[id]),
+        track_store_text(store, store->album[id]),
+        track_store_text(store, store->genre[id])
+    };
+    
+    size_t length = 0;
+    for (int i = 0; i < 4; i++) {
+        if (i > 0) text[length++] = '\n';
+        length += search_normalize(fields[i], text + length, (size - length) / (4 - i));
+    }
+    return length;
+}
+
+// Drops the text of rows that were indexed again since
+static bool search_index_compact_text(SearchIndex *index) {
+    size_t capacity = index->text_size - index->text_garbage + 1;
+    char *text = malloc(capacity);
+    if (!text) return false;
+    
+    size_t size = 0;
+    for (size_t id = 0; id < index->count; id++) {
+        size_t length = strlen(index->text + index->offset[id]) + 1;
+        memcpy(text + size, index->text + index->offset[id], length);
+        index->offset[id] = (uint32_t)size;
+        size += length;
+    }
+    
+    free(index->text);
+    index->text = text;
+    index->text_size = size;
+    index->text_capacity = capacity;
+    index->text_garbage = 0;
+    return true;
+}
+
+// Indexes a new row, or a rewritten one. Postings only ever grow: grams
+// a row no longer has stay behind and are weeded out by verification.
+static void search_index_track(SearchIndex *index, const TrackStore *store, TrackId id) {
+    char text[SEARCH_TEXT_MAX];
+    size_t length = search_track_text(store, id, text, sizeof(text));
+    
+    if (id < index->count) {
+        if (strcmp(index->text + index->offset[id], text) == 0) return;
+    } else if (id >= index->capacity) {
+        size_t capacity = index->capacity ? index->capacity : TRACK_STORE_INITIAL;
+        while (capacity <= id) capacity *= 2;
+        if (!grow_column((void**)&index->offset, sizeof(uint32_t), capacity)) return;
+        index->capacity = capacity;
+    }
+    
+    if (index->text_garbage > index->text_size / 2 && index->count > 0) {
+        search_index_compact_text(index);
+    }
+    if (id < index->count) {
+        index->text_garbage += strlen(index->text + index->offset[id]) + 1;
+    }
+    
+    if (index->text_size + length + 1 > index->text_capacity) {
+        size_t capacity = index->text_capacity ? index->text_capacity : 64 * 1024;
+        while (capacity < index->text_size + length + 1) capacity *= 2;
+        if (capacity > UINT32_MAX || !grow_column((void**)&index->text, 1, capacity)) return;
+        index->text_capacity = capacity;
+    }
+    
+    memcpy(index->text + index->text_size, text, length + 1);
+    index->offset[id] = (uint32_t)index->text_size;
+    index->text_size += length + 1;
+    if (id >= index->count) index->count = id + 1;
+    
+    // Each distinct bucket once per row
+    uint32_t buckets[SEARCH_TEXT_MAX];
+    int count = 0;
+    for (size_t i = 0; i + 3 <= length; i++) {
+        if (text[i] == '\n' || text[i + 1] == '\n' || text[i + 2] == '\n') continue;
+        buckets[count++] = search_gram_bucket(text + i);
+    }
+    qsort(buckets, count, sizeof(uint32_t), compare_u32);
+    
+    for (int i = 0; i < count; i++) {
+        if (i > 0 && buckets[i] == buckets[i - 1]) continue;
+        
+        SearchPosting *posting = &index->postings[buckets[i]];
+        if (posting->count > 0 && posting->ids[posting->count - 1] == id) continue;
+        if (posting->count == posting->capacity) {
+            uint32_t capacity = posting->capacity ? posting->capacity * 2 : 8;
+            if (!grow_column((void**)&posting->ids, sizeof(TrackId), capacity)) continue;
+            posting->capacity = capacity;
+        }
+        posting->ids[posting->count++] = id;
+    }
+}
+
+// Whether the normalized needle occurs in one field, or in any
+static bool search_text_contains(const char *text, QueryField field, const char *needle) {
+    if (field == QUERY_ANY) return strstr(text, needle) != NULL;
+    
+    for (int i = QUERY_TITLE; i < (int)field; i++) {
+        text = strchr(text, '\n');
+        if (!text) return false;
+        text++;
+    }
+    
+    const char *end = strchr(text, '\n');
+    if (!end) end = text + strlen(text);
+    
+    size_t length = strlen(needle);
+    for (const char *p = text; (size_t)(end - p) >= length; p++) {
+        p = memchr(p, needle[0], (size_t)(end - p));
+        if (!p || (size_t)(end - p) < length) return false;
+        if (memcmp(p, needle, length) == 0) return true;
+    }
+    return false;
+}
+
+static const struct {
+    const char *name;
+    QueryField field;
+} QUERY_FIELD_NAMES[] = {
+    {"title", QUERY_TITLE}, {"artist", QUERY_ARTIST}, {"album", QUERY_ALBUM},
+    {"genre", QUERY_GENRE}, {"year", QUERY_YEAR}, {"rating", QUERY_RATING},
+    {"plays", QUERY_PLAYS}, {"playcount", QUERY_PLAYS}
+};
+
+// Numeric terms: "year:1999", "year:1990..1999", "rating>=4", "plays<3"
+static bool query_parse_range(const char *op, const char *value, QueryTerm *term) {
+    bool equals = strcmp(op, ":") == 0 || strcmp(op, "=") == 0;
+    term->low = -INFINITY;
+    term->high = INFINITY;
+    
+    // "a..b", with either end left open
+    const char *dots = strstr(value, "..");
+    if (equals && dots) {
+        char low_text[32], *end;
+        snprintf(low_text, sizeof(low_text), "%.*s", (int)(dots - value), value);
+        double low = strtod(low_text, &end);
+        if (end != low_text) term->low = low;
+        double high = strtod(dots + 2, &end);
+        if (end != dots + 2) term->high = high;
+        return term->low != -INFINITY || term->high != INFINITY;
+    }
+    
+    char *end;
+    double number = strtod(value, &end);
+    if (end == value) return false;
+    
+    // Counts and years are whole numbers, ratings are not
+    double step = term->field == QUERY_RATING ? 0.001 : 1.0;
+    
+    if (equals) {
+        term->low = number;
+        term->high = number;
+    } else if (strcmp(op, ">=") == 0) {
+        term->low = number;
+    } else if (strcmp(op, ">") == 0) {
+        term->low = number + step;
+    } else if (strcmp(op, "<=") == 0) {
+        term->high = number;
+    } else if (strcmp(op, "<") == 0) {
+        term->high = number - step;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+// Parses a filter: whitespace-separated terms, all of which must hold.
+// A term is free text, "field:text", a quoted phrase, or a numeric
+// comparison, and "-" in front negates it. Incomplete terms, as typed
+// half way, are skipped rather than failing the whole filter.
+static void query_compile(const char *filter, Query *query) {
+    memset(query, 0, sizeof(Query));
+    
+    const char *p = filter;
+    while (*p && query->count < QUERY_MAX_TERMS) {
+        while (*p == ' ' || *p == '\t') p++;
+        if (!*p) break;
+        
+        QueryTerm *term = &query->terms[query->count];
+        memset(term, 0, sizeof(QueryTerm));
+        if (*p == '-') {
+            term->negate = true;
+            p++;
+        }
+        
+        // field name and operator, if the token has them
+        char op[3] = "";
+        for (size_t i = 0; i < sizeof(QUERY_FIELD_NAMES) / sizeof(QUERY_FIELD_NAMES[0]); i++) {
+            size_t name_length = strlen(QUERY_FIELD_NAMES[i].name);
+            if (SDL_strncasecmp(p, QUERY_FIELD_NAMES[i].name, name_length) != 0) continue;
+            
+            const char *after = p + name_length;
+            size_t op_length = strspn(after, ":<>=");
+            if (op_length == 0 || op_length > 2) continue;
+            
+            memcpy(op, after, op_length);
+            op[op_length] = '\0';
+            term->field = QUERY_FIELD_NAMES[i].field;
+            p = after + op_length;
+            break;
+        }
+        
+        char value[MAX_TEXT];
+        size_t length = 0;
+        if (*p == '"') {
+            for (p++; *p && *p != '"' && length + 1 < sizeof(value); p++) value[length++] = *p;
+            if (*p == '"') p++;
+        } else {
+            for (; *p && *p != ' ' && *p != '\t' && length + 1 < sizeof(value); p++) value[length++] = *p;
+        }
+        value[length] = '\0';
+        
+        bool valid;
+        if (term->field >= QUERY_YEAR) {
+            valid = query_parse_range(op, value, term);
+        } else {
+            // Text fields take ":" only; anything else is plain text
+            if (op[0] && strcmp(op, ":") != 0) term->field = QUERY_ANY;
+            valid = search_normalize(value, term->text, sizeof(term->text)) > 0;
+        }
+        if (valid) query->count++;
+    }
+}
+
+// Whether every track matching `narrower` also matches `query`, so a new
+// filter can be answered from the last one's results
+static bool query_narrows(const Query *query, const Query *narrower) {
+    if (query->count == 0 || narrower->count < query->count) return false;
+    
+    for (int i = 0; i < query->count; i++) {
+        const QueryTerm *a = &query->terms[i], *b = &narrower->terms[i];
+        if (a->field != b->field || a->negate != b->negate) return false;
+        
+        if (a->field >= QUERY_YEAR) {
+            bool inside = b->low >= a->low && b->high <= a->high;
+            bool same = b->low == a->low && b->high == a->high;
+            if (a->negate ? !same : !inside) return false;
+        } else if (a->negate ? strcmp(a->text, b->text) != 0 : !strstr(b->text, a->text)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static bool query_matches(const Query *query, const SearchIndex *index, const TrackStore *store, TrackId id) {
+    if (id >= index->count) return false;
+    const char *text = index->text + index->offset[id];
+    
+    for (int i = 0; i < query->count; i++) {
+        const QueryTerm *term = &query->terms[i];
+        bool hit;
+        
+        switch (term->field) {
+            case QUERY_YEAR:
+                hit = store->year[id] >= term->low && store->year[id] <= term->high;
+                break;
+            case QUERY_RATING:
+                hit = store->rating[id] >= term->low && store->rating[id] <= term->high;
+                break;
+            case QUERY_PLAYS:
+                hit = store->play_count[id] >= term->low && store->play_count[id] <= term->high;
+                break;
+            default:
+                hit = search_text_contains(text, term->field, term->text);
+                break;
+        }
+        if (hit == term->negate) return false;
+    }
+    return true;
+}
+
+// The shortest posting list among the query's positive text terms, or
+// NULL when no term is long enough to have a trigram and all rows qualify
+static const SearchPosting* search_index_candidates(const SearchIndex *index, const Query *query) {
+    const SearchPosting *best = NULL;
+    
+    for (int i = 0; i < query->count; i++) {
+        const QueryTerm *term = &query->terms[i];
+        if (term->negate || term->field >= QUERY_YEAR) continue;
+        
+        for (size_t j = 0; term->text[j] && term->text[j + 1] && term->text[j + 2]; j++) {
+            const SearchPosting *posting = &index->postings[search_gram_bucket(term->text + j)];
+            if (!best || posting->count < best->count) best = posting;
+        }
+    }
+    return best;
+}
+
+static void smart_playlist_initialize(Playlist *playlist, const char *name, const char *filter) {
+    playlist_initialize(playlist, name);
+    playlist->is_smart_playlist = true;
+    snprintf(playlist->smart_filter, sizeof(playlist->smart_filter), "%s", filter);
+    query_compile(filter, &playlist->smart_query);
+}
+
+// Drops the tracks whose membership was cleared. Smart playlists are
+// views; playback always runs from the Now Playing list.
+static void smart_playlist_compact(Playlist *playlist) {
+    int kept = 0;
+    for (int i = 0; i < playlist->track_count; i++) {
+        TrackId id = playlist->track_ids[i];
+        if (playlist->members[id]) playlist->track_ids[kept++] = id;
+    }
+    playlist->track_count = kept;
+    playlist->current_index = -1;
+    playlist->queued_index = -1;
+    playlist->modified = time(NULL);
+}
+
+// From scratch: the rarest trigram's candidates, or every row, verified
+// against the whole query and kept in library order
+static void smart_playlist_evaluate(Playlist *playlist, const SearchIndex *index) {
+    for (int i = 0; i < playlist->track_count; i++) {
+        playlist->members[playlist->track_ids[i]] = 0;
+    }
+    playlist->track_count = 0;
+    
+    const TrackStore *store = playlist->store;
+    const SearchPosting *candidates = search_index_candidates(index, &playlist->smart_query);
+    
+    if (candidates) {
+        for (uint32_t i = 0; i < candidates->count; i++) {
+            TrackId id = candidates->ids[i];
+            if (!playlist_contains(playlist, id) && query_matches(&playlist->smart_query, index, store, id)) {
+                playlist_append(playlist, id);
+            }
+        }
+        qsort(playlist->track_ids, playlist->track_count, sizeof(TrackId), compare_u32);
+    } else {
+        for (TrackId id = 0; id < index->count; id++) {
+            if (query_matches(&playlist->smart_query, index, store, id)) {
+                playlist_append(playlist, id);
+            }
+        }
+    }
+    playlist->current_index = -1;
+    playlist->queued_index = -1;
+}
+
+// A new filter. When it only narrows the last one, as typing usually
+// does, the last results are filtered instead of the library.
+static void smart_playlist_set_filter(Playlist *playlist, const SearchIndex *index, const char *filter) {
+    Query query;
+    query_compile(filter, &query);
+    bool narrows = query_narrows(&playlist->smart_query, &query);
+    
+    snprintf(playlist->smart_filter, sizeof(playlist->smart_filter), "%s", filter);
+    playlist->smart_query = query;
+    
+    if (!narrows) {
+        smart_playlist_evaluate(playlist, index);
+        return;
+    }
+    
+    bool dropped = false;
+    for (int i = 0; i < playlist->track_count; i++) {
+        TrackId id = playlist->track_ids[i];
+        if (!query_matches(&query, index, playlist->store, id)) {
+            playlist->members[id] = 0;
+            dropped = true;
+        }
+    }
+    if (dropped) smart_playlist_compact(playlist);
+}
+
+// One track was added or changed. Appends it, or clears its membership
+// and returns true so the caller compacts once for a whole batch.
+static bool smart_playlist_refresh(Playlist *playlist, const SearchIndex *index, TrackId id) {
+    bool match = query_matches(&playlist->smart_query, index, playlist->store, id);
+    bool member = playlist_contains(playlist, id);
+    
+    if (match && !member) {
+        playlist_append(playlist, id);
+    } else if (!match && member) {
+        playlist->members[id] = 0;
+        return true;
+    }
+    return false;
+}
+
+// Saved smart playlists are their filters, one per line, next to the
+// library database. They fill in as the search index catches up.
+static bool smart_playlists_path(char *path, size_t size) {
+    char directory[MAX_PATH];
+    if (!cache_directory(directory, sizeof(directory))) return false;
+    return snprintf(path, size, "%s%ssmart_playlists.txt", directory, PATH_SEP) < (int)size;
+}
+
+static void smart_playlists_load(void) {
+    char path[MAX_PATH], line[MAX_TEXT];
+    if (!smart_playlists_path(path, sizeof(path))) return;
+    
+    FILE *file = fopen(path, "r");
+    if (!file) return;
+    
+    while (g_app->smart_playlist_count < SMART_PLAYLIST_MAX && fgets(line, sizeof(line), file)) {
+        line[strcspn(line, "\r\n")] = '\0';
+        if (!line[0]) continue;
+        smart_playlist_initialize(&g_app->smart_playlists[g_app->smart_playlist_count++], line, line);
+    }
+    fclose(file);
+}
+
+// Rewritten whole on every change, through a temporary file like the database
+static bool smart_playlists_save(void) {
+    char path[MAX_PATH], temp_path[MAX_PATH];
+    if (!smart_playlists_path(path, sizeof(path)) ||
+        snprintf(temp_path, sizeof(temp_path), "%s.tmp", path) >= (int)sizeof(temp_path)) {
+        return false;
+    }
+    
+    FILE *file = fopen(temp_path, "w");
+    if (!file) return false;
+    
+    bool ok = true;
+    for (int p = SMART_PLAYLIST_SEARCH + 1; p < g_app->smart_playlist_count && ok; p++) {
+        ok = fprintf(file, "%s\n", g_app->smart_playlists[p].smart_filter) >= 0;
+    }
+    ok = (fclose(file) == 0) && ok;
+    
+#ifdef _WIN32
+    ok = ok && MoveFileExA(temp_path, path, MOVEFILE_REPLACE_EXISTING);
+#else
+    ok = ok && rename(temp_path, path) == 0;
+#endif
+    
+    if (!ok) {
+        fprintf(stderr, "Failed to save smart playlists %s\n", path);
+        remove(temp_path);
+    }
+    return ok;
+}
+
+// Ctrl+S while searching: the query becomes a smart playlist of its own,
+// kept up to date with the library and shown again with Ctrl+1..7
+static void smart_playlist_save_search(void) {
+    const char *filter = g_app->search_text;
+    if (!filter[0]) return;
+    
+    for (int p = SMART_PLAYLIST_SEARCH + 1; p < g_app->smart_playlist_count; p++) {
+        if (strcmp(g_app->smart_playlists[p].smart_filter, filter) == 0) {
+            snprintf(g_app->status_message, MAX_TEXT, "Already saved as Ctrl+%d", p);
+            return;
+        }
+    }
+    if (g_app->smart_playlist_count == SMART_PLAYLIST_MAX) {
+        snprintf(g_app->status_message, MAX_TEXT, "No room for another smart playlist, Ctrl+Delete removes one");
+        return;
+    }
+    
+    int slot = g_app->smart_playlist_count++;
+    Playlist *playlist = &g_app->smart_playlists[slot];
+    smart_playlist_initialize(playlist, filter, filter);
+    smart_playlist_evaluate(playlist, &g_app->search);
+    smart_playlists_save();
+    snprintf(g_app->status_message, MAX_TEXT, "Saved \"%s\" as Ctrl+%d, %d tracks",
+             filter, slot, playlist->track_count);
+}
+
+// Ctrl+1..7 put a saved smart playlist in the track list, Ctrl+0 or Escape
+// go back to Now Playing
+static void smart_playlist_show(int slot) {
+    if (!g_app->track_list) return;
+    if (slot != 0 && (slot <= SMART_PLAYLIST_SEARCH || slot >= g_app->smart_playlist_count)) return;
+    
+    Playlist *playlist = slot == 0 ? &g_app->current_playlist : &g_app->smart_playlists[slot];
+    Widget *list = g_app->track_list;
+    list->list->source = playlist;
+    list->list->selected_index = -1;
+    list->list->scroll = 0.0f;
+    list->list->scroll_target = 0.0f;
+    widget_mark_dirty(list);
+    
+    if (slot == 0) {
+        g_app->status_message[0] = '\0';
+    } else {
+        snprintf(g_app->status_message, MAX_TEXT, "Smart playlist \"%s\", %d tracks",
+                 playlist->name, playlist->track_count);
+    }
+}
+
+// Ctrl+Delete on a saved smart playlist in view; later ones move up a slot
+static void smart_playlist_delete(int slot) {
+    if (slot <= SMART_PLAYLIST_SEARCH || slot >= g_app->smart_playlist_count) return;
+    
+    char name[MAX_TEXT];
+    snprintf(name, sizeof(name), "%s", g_app->smart_playlists[slot].name);
+    smart_playlist_show(0);
+    
+    playlist_cleanup(&g_app->smart_playlists[slot]);
+    memmove(&g_app->smart_playlists[slot], &g_app->smart_playlists[slot + 1],
+            sizeof(Playlist) * (size_t)(g_app->smart_playlist_count - slot - 1));
+    g_app->smart_playlist_count--;
+    smart_playlists_save();
+    snprintf(g_app->status_message, MAX_TEXT, "Removed smart playlist \"%s\"", name);
+}
+
+// Slot of the saved smart playlist the track list shows, or 0
+static int smart_playlist_shown(void) {
+    if (!g_app->track_list) return 0;
+    for (int p = SMART_PLAYLIST_SEARCH + 1; p < g_app->smart_playlist_count; p++) {
+        if (g_app->track_list->list->source == &g_app->smart_playlists[p]) return p;
+    }
+    return 0;
+}
+
+// Once per frame: re-indexes the rows the store rewrote, indexes a batch
+// of new ones, and updates every smart playlist for just those tracks.
+// True if any smart playlist changed.
+static bool library_views_sync(void) {
+    SearchIndex *index = &g_app->search;
+    TrackStore *store = &g_app->library;
+    if (store->changed_count == 0 && index->count == store->count) return false;
+    
+    bool dropped[SMART_PLAYLIST_MAX] = {false};
+    int counts[SMART_PLAYLIST_MAX];
+    for (int p = 0; p < g_app->smart_playlist_count; p++) {
+        counts[p] = g_app->smart_playlists[p].track_count;
+    }
+    
+    // Rows not indexed yet are picked up as new below
+    for (size_t i = 0; i < store->changed_count; i++) {
+        TrackId id = store->changed[i];
+        if (id >= index->count) continue;
+        
+        search_index_track(index, store, id);
+        for (int p = 0; p < g_app->smart_playlist_count; p++) {
+            dropped[p] |= smart_playlist_refresh(&g_app->smart_playlists[p], index, id);
+        }
+    }
+    store->changed_count = 0;
+    
+    size_t last = index->count + SEARCH_INDEX_PER_FRAME;
+    if (last > store->count) last = store->count;
+    for (TrackId id = (TrackId)index->count; id < last; id++) {
+        search_index_track(index, store, id);
+        for (int p = 0; p < g_app->smart_playlist_count; p++) {
+            dropped[p] |= smart_playlist_refresh(&g_app->smart_playlists[p], index, id);
+        }
+    }
+    
+    bool changed = false;
+    for (int p = 0; p < g_app->smart_playlist_count; p++) {
+        if (dropped[p]) smart_playlist_compact(&g_app->smart_playlists[p]);
+        changed |= dropped[p] || counts[p] != g_app->smart_playlists[p].track_count;
+    }
+    return changed;
+}
+
+static void search_update_status(void) {
+    snprintf(g_app->status_message, MAX_TEXT, "Search: %s_   %d matches in %.2f ms", g_app->search_text,
+             g_app->smart_playlists[SMART_PLAYLIST_SEARCH].track_count, g_app->search_seconds * 1000.0);
+}
+
+// Re-runs the search after each keystroke and shows its results from the top
+static void search_changed(void) {
+    Playlist *results = &g_app->smart_playlists[SMART_PLAYLIST_SEARCH];
+    
+    Uint64 start = SDL_GetPerformanceCounter();
+    smart_playlist_set_filter(results, &g_app->search, g_app->search_text);
+    g_app->search_seconds = (double)(SDL_GetPerformanceCounter() - start) / SDL_GetPerformanceFrequency();
+    
+    if (g_app->track_list) {
+        g_app->track_list->list->selected_index = results->track_count > 0 ? 0 : -1;
+        g_app->track_list->list->scroll = 0.0f;
+        g_app->track_list->list->scroll_target = 0.0f;
+        widget_mark_dirty(g_app->track_list);
+    }
+    search_update_status();
+}
+
+// "/" or Ctrl+F: the track list shows search results while typing
+static void search_open(void) {
+    if (g_app->searching) return;
+    
+    g_app->searching = true;
+    g_app->search_text[0] = '\0';
+    if (g_app->track_list) g_app->track_list->list->source = &g_app->smart_playlists[SMART_PLAYLIST_SEARCH];
+    SDL_StartTextInput();
+    search_changed();
+}
+
+static void search_close(void) {
+    if (!g_app->searching) return;
+    
+    g_app->searching = false;
+    SDL_StopTextInput();
+    if (g_app->track_list) {
+        g_app->track_list->list->source = &g_app->current_playlist;
+        g_app->track_list->list->selected_index = -1;
+        widget_activate(g_app->track_list);
+        widget_mark_dirty(g_app->track_list);
+    }
+    g_app->status_message[0] = '\0';
+}
+
+static void search_input_text(const char *text) {
+    // The "/" that opened the search arrives as text too
+    if (g_app->search_text[0] == '\0' && strcmp(text, "/") == 0) return;
+    
+    size_t length = strlen(g_app->search_text);
+    if (length + strlen(text) >= sizeof(g_app->search_text)) return;
+    memcpy(g_app->search_text + length, text, strlen(text) + 1);
+    search_changed();
+}
+
+// Keys while searching; false lets the usual binding have it
+static bool search_handle_key(SDL_Scancode key) {
+    Widget *list = g_app->track_list;
+    
+    switch (key) {
+        case SDL_SCANCODE_ESCAPE:
+            search_close();
+            return true;
+            
+        case SDL_SCANCODE_BACKSPACE: {
+            // Back over one whole UTF-8 character
+            size_t length = strlen(g_app->search_text);
+            while (length > 0 && ((unsigned char)g_app->search_text[--length] & 0xC0) == 0x80) {}
+            g_app->search_text[length] = '\0';
+            search_changed();
+            return true;
+        }
+            
+        case SDL_SCANCODE_RETURN:
+            if (list && list->list->selected_index >= 0) {
+                list_widget_play(list, list->list->selected_index);
+            }
+            search_close();
+            return true;
+            
+        case SDL_SCANCODE_S:
+            if (g_app->keys[SDL_SCANCODE_LCTRL]) {
+                smart_playlist_save_search();
+            }
+            return true;
+            
+        case SDL_SCANCODE_UP:
+        case SDL_SCANCODE_DOWN:
+            if (list && list->list->source->track_count > 0) {
+                int index = list->list->selected_index + (key == SDL_SCANCODE_UP ? -1 : 1);
+                if (index < 0) index = 0;
+                if (index >= list->list->source->track_count) index = list->list->source->track_count - 1;
+                list->list->selected_index = index;
+                list_widget_scroll_to(list, index, false);
+                widget_mark_dirty(list);
+            }
+            return true;
+            
+        case SDL_SCANCODE_F7:
+        case SDL_SCANCODE_F8:
+        case SDL_SCANCODE_F9:
+        case SDL_SCANCODE_F11:
+        case SDL_SCANCODE_PAGEUP:
+        case SDL_SCANCODE_PAGEDOWN:
+            return false;
+            
+        default:
+            // Typed keys arrive as text input
+            return true;
+    }
+}
+
+// ═══════════════════════════════════════════════════════════════════════════════
+// ║                          PLAYLIST SORTING                                  ║
+// ═══════════════════════════════════════════════════════════════════════════════
+
+static const struct {
+    const char *name;
+    SortField field;
+    int bits;                   // Width of the packed ordinal, 0 = collation rank
+} SORT_FIELDS[SORT_FIELD_COUNT] = {
+    {"title",    SORT_TITLE,      0},
+    {"artist",   SORT_ARTIST,     0},
+    {"album",    SORT_ALBUM,      0},
+    {"track",    SORT_TRACK_NUM,  16},
+    {"year",     SORT_YEAR,       16},
+    {"added",    SORT_DATE_ADDED, 32},
+    {"rating",   SORT_RATING,     13},
+    {"plays",    SORT_PLAY_COUNT, 24},
+    {"duration", SORT_DURATION,   32}
+};
+
+// Orders offered by Ctrl+S, in turn
+static const char *SORT_PRESETS[] = {
+    "artist,album,track", "album,track", "title", "-added", "-rating,artist", "-plays", "year,artist,album,track"
+};
+
+// "artist,album,track" or "-added": comma-separated fields, "-" for descending
+static bool sort_spec_parse(const char *text, SortSpec *spec) {
+    memset(spec, 0, sizeof(SortSpec));
+    
+    while (*text) {
+        if (spec->count == SORT_MAX_KEYS) return false;
+        SortKey *key = &spec->keys[spec->count];
+        
+        key->descending = *text == '-';
+        if (key->descending) text++;
+        
+        size_t length = strcspn(text, ",");
+        bool found = false;
+        for (int i = 0; i < SORT_FIELD_COUNT && !found; i++) {
+            if (strlen(SORT_FIELDS[i].name) == length && strncmp(text, SORT_FIELDS[i].name, length) == 0) {
+                key->field = SORT_FIELDS[i].field;
+                found = true;
+            }
+        }
+        if (!found) return false;
+        
+        spec->count++;
+        text += length;
+        if (*text == ',') text++;
+    }
+    return spec->count > 0;
+}
+
+static void sort_spec_describe(const SortSpec *spec, char *text, size_t size) {
+    size_t length = 0;
+    text[0] = '\0';
+    for (int i = 0; i < spec->count && length < size; i++) {
+        length += snprintf(text + length, size - length, "%s%s%s", i > 0 ? ", " : "",
+                           SORT_FIELDS[spec->keys[i].field].name,
+                           spec->keys[i].descending ? " (descending)" : "");
+    }
+}
+
+// Case-folded, accent-folded, with a leading article dropped, so "The
+// Beatles" files under B and "beatles" sits beside it
+static size_t collation_key(const char *text, char *key, size_t size) {
+    static const char *articles[] = {"the ", "a ", "an "};
+    
+    size_t length = search_normalize(text, key, size);
+    for (size_t i = 0; i < sizeof(articles) / sizeof(articles[0]); i++) {
+        size_t article = strlen(articles[i]);
+        if (length > article && strncmp(key, articles[i], article) == 0) {
+            memmove(key, key + article, length - article + 1);
+            return length - article;
+        }
+    }
+    return length;
+}
+
+static void collation_cleanup(CollationCache *cache) {
+    free(cache->entries);
+    free(cache->slots);
+    free(cache->keys);
+    for (int c = 0; c < SORT_TEXT_COLUMNS; c++) {
+        free(cache->row_entry[c]);
+        free(cache->row_ref[c]);
+    }
+    memset(cache, 0, sizeof(CollationCache));
+}
+
+static bool collation_grow_slots(CollationCache *cache) {
+    size_t mask = cache->slot_mask ? cache->slot_mask * 2 + 1 : 1023;
+    uint32_t *slots = calloc(mask + 1, sizeof(uint32_t));
+    if (!slots) return false;
+    
+    for (size_t i = 0; i < cache->count; i++) {
+        size_t slot = hash_u32(cache->entries[i].ref) & mask;
+        while (slots[slot]) slot = (slot + 1) & mask;
+        slots[slot] = (uint32_t)i + 1;
+    }
+    
+    free(cache->slots);
+    cache->slots = slots;
+    cache->slot_mask = mask;
+    return true;
+}
+
+// Entry for an interned string, made on first sight. Every text column
+// shares the table: equal StringRefs are equal strings.
+static uint32_t collation_intern(CollationCache *cache, const TrackStore *store, StringRef ref) {
+    if (cache->slots) {
+        for (size_t slot = hash_u32(ref) & cache->slot_mask; cache->slots[slot];
+             slot = (slot + 1) & cache->slot_mask) {
+            uint32_t entry = cache->slots[slot] - 1;
+            if (cache->entries[entry].ref == ref) return entry;
+        }
+    }
+    
+    if ((cache->count + 1) * 10 > (cache->slot_mask + 1) * 7 && !collation_grow_slots(cache)) {
+        return UINT32_MAX;
+    }
+    if (cache->count == cache->capacity) {
+        size_t capacity = cache->capacity ? cache->capacity * 2 : 1024;
+        if (!grow_column((void**)&cache->entries, sizeof(CollationEntry), capacity)) return UINT32_MAX;
+        cache->capacity = capacity;
+    }
+    
+    char key[SEARCH_TEXT_MAX];
+    size_t length = collation_key(track_store_text(store, ref), key, sizeof(key));
+    if (cache->keys_size + length + 1 > cache->keys_capacity) {
+        size_t capacity = cache->keys_capacity ? cache->keys_capacity : 64 * 1024;
+        while (capacity < cache->keys_size + length + 1) capacity *= 2;
+        if (!grow_column((void**)&cache->keys, 1, capacity)) return UINT32_MAX;
+        cache->keys_capacity = capacity;
+    }
+    memcpy(cache->keys + cache->keys_size, key, length + 1);
+    
+    uint32_t entry = (uint32_t)cache->count++;
+    cache->entries[entry].ref = ref;
+    cache->entries[entry].key = (uint32_t)cache->keys_size;
+    cache->entries[entry].rank = 0;
+    cache->keys_size += length + 1;
+    
+    size_t slot = hash_u32(ref) & cache->slot_mask;
+    while (cache->slots[slot]) slot = (slot + 1) & cache->slot_mask;
+    cache->slots[slot] = entry + 1;
+    
+    cache->ranked = false;
+    return entry;
+}
+
+typedef struct {
+    uint64_t prefix;            // First eight bytes, big-endian, so most compares stop here
+    const char *key;
+    uint32_t entry;
+} CollationOrder;
+
+static int compare_collation_order(const void *a, const void *b) {
+    const CollationOrder *x = a, *y = b;
+    if (x->prefix != y->prefix) return x->prefix < y->prefix ? -1 : 1;
+    return x->prefix == UINT64_MAX ? 0 : strcmp(x->key, y->key);
+}
+
+// Numbers every entry by key order; equal keys share a rank
+static bool collation_rank(CollationCache *cache) {
+    CollationOrder *order = malloc(sizeof(CollationOrder) * (cache->count ? cache->count : 1));
+    if (!order) return false;
+    
+    for (size_t i = 0; i < cache->count; i++) {
+        const char *key = cache->keys + cache->entries[i].key;
+        uint64_t prefix = 0;
+        for (int b = 0, end = 0; b < 8; b++) {
+            if (!key[b]) end = 1;
+            prefix = prefix << 8 | (end ? 0 : (uint8_t)key[b]);
+        }
+        
+        // Empty keys sort after everything; UTF-8 never has a 0xFF byte
+        order[i].prefix = key[0] ? prefix : UINT64_MAX;
+        order[i].key = key;
+        order[i].entry = (uint32_t)i;
+    }
+    qsort(order, cache->count, sizeof(CollationOrder), compare_collation_order);
+    
+    uint32_t rank = 0;
+    for (size_t i = 0; i < cache->count; i++) {
+        if (i > 0 && compare_collation_order(&order[i - 1], &order[i]) != 0) rank++;
+        cache->entries[order[i].entry].rank = rank;
+    }
+    cache->rank_bits = 1;
+    while (cache->rank_bits < 32 && (rank >> cache->rank_bits) != 0) cache->rank_bits++;
+    
+    free(order);
+    cache->ranked = true;
+    return true;
+}
+
+static StringRef* collation_column(const TrackStore *store, int column) {
+    switch (column) {
+        case SORT_TITLE:  return store->title;
+        case SORT_ARTIST: return store->artist;
+        default:          return store->album;
+    }
+}
+
+// Brings the per-row entries of the text columns a sort needs up to
+// date. Rows keep theirs until their string changes, so re-sorting an
+// unchanged library costs no hashing at all.
+static bool collation_prepare(CollationCache *cache, const TrackStore *store, const Playlist *playlist,
+                              const SortSpec *spec) {
+    if (store->count > cache->row_capacity) {
+        size_t capacity = cache->row_capacity ? cache->row_capacity : TRACK_STORE_INITIAL;
+        while (capacity < store->count) capacity *= 2;
+        
+        for (int c = 0; c < SORT_TEXT_COLUMNS; c++) {
+            if (!grow_column((void**)&cache->row_entry[c], sizeof(uint32_t), capacity) ||
+                !grow_column((void**)&cache->row_ref[c], sizeof(StringRef), capacity)) {
+                return false;
+            }
+            for (size_t id = cache->row_capacity; id < capacity; id++) {
+                cache->row_ref[c][id] = UINT32_MAX;
+            }
+        }
+        cache->row_capacity = capacity;
+    }
+    
+    for (int k = 0; k < spec->count; k++) {
+        int c = spec->keys[k].field;
+        if (c >= SORT_TEXT_COLUMNS) continue;
+        
+        const StringRef *refs = collation_column(store, c);
+        for (int i = 0; i < playlist->track_count; i++) {
+            TrackId id = playlist->track_ids[i];
+            if (cache->row_ref[c][id] == refs[id]) continue;
+            
+            uint32_t entry = collation_intern(cache, store, refs[id]);
+            if (entry == UINT32_MAX) return false;
+            cache->row_entry[c][id] = entry;
+            cache->row_ref[c][id] = refs[id];
+        }
+    }
+    
+    return cache->ranked || collation_rank(cache);
+}
+
+// Order-preserving unsigned value of one column, `bits` wide
+static uint32_t sort_ordinal(const TrackStore *store, const CollationCache *collation,
+                             SortField field, TrackId id) {
+    switch (field) {
+        case SORT_TITLE:
+        case SORT_ARTIST:
+        case SORT_ALBUM:
+            return collation->entries[collation->row_entry[field][id]].rank;
+        case SORT_TRACK_NUM:
+            return store->track_num[id];
+        case SORT_YEAR:
+            return (uint32_t)(store->year[id] + 32768);
+        case SORT_DATE_ADDED: {
+            int64_t added = store->date_added[id];
+            return added < 0 ? 0 : added > UINT32_MAX ? UINT32_MAX : (uint32_t)added;
+        }
+        case SORT_RATING:
+            return (uint32_t)lrintf(fmaxf(0.0f, fminf(5.0f, store->rating[id])) * 1000.0f);
+        case SORT_PLAY_COUNT:
+            return store->play_count[id] < 0 ? 0 : (uint32_t)fmin(store->play_count[id], 0xFFFFFF);
+        case SORT_DURATION:
+            return (uint32_t)fmin(fmax(store->duration_seconds[id] * 1000.0, 0.0), UINT32_MAX);
+        default:
+            return 0;
+    }
+}
+
+// Fits the leading sort columns into one 64-bit key, most significant
+// first; columns that do not fit are compared only to break its ties
+static void sort_layout(SortLayout *layout, const SortSpec *spec, const CollationCache *collation) {
+    memset(layout, 0, sizeof(SortLayout));
+    layout->spec = *spec;
+    
+    int used = 0;
+    for (int k = 0; k < spec->count; k++) {
+        int bits = SORT_FIELDS[spec->keys[k].field].bits;
+        if (bits == 0) bits = collation->rank_bits;
+        if (used + bits > 64) break;
+        
+        layout->bits[k] = bits;
+        used += bits;
+        layout->packed = k + 1;
+    }
+    
+    int shift = used;
+    for (int k = 0; k < layout->packed; k++) {
+        shift -= layout->bits[k];
+        layout->shift[k] = shift;
+    }
+    layout->key_bits = used;
+}
+
+static uint32_t sort_directed(const SortLayout *layout, int k, uint32_t ordinal) {
+    if (!layout->spec.keys[k].descending) return ordinal;
+    uint32_t mask = layout->bits[k] >= 32 ? UINT32_MAX : (1u << layout->bits[k]) - 1;
+    return mask - (ordinal & mask);
+}
+
+// Stable LSD radix sort by key, a byte per pass; passes where every key
+// shares the byte are skipped. Leaves the result in items.
+static void sort_radix(SortItem *items, SortItem *scratch, size_t count, int key_bits) {
+    SortItem *from = items, *to = scratch;
+    if (count == 0) return;
+    
+    for (int shift = 0; shift < key_bits; shift += 8) {
+        size_t offsets[256] = {0};
+        for (size_t i = 0; i < count; i++) {
+            offsets[(from[i].key >> shift) & 0xFF]++;
+        }
+        if (offsets[(from[0].key >> shift) & 0xFF] == count) continue;
+        
+        size_t total = 0;
+        for (int d = 0; d < 256; d++) {
+            size_t digit_count = offsets[d];
+            offsets[d] = total;
+            total += digit_count;
+        }
+        for (size_t i = 0; i < count; i++) {
+            to[offsets[(from[i].key >> shift) & 0xFF]++] = from[i];
+        }
+        
+        SortItem *swap = from;
+        from = to;
+        to = swap;
+    }
+    
+    if (from != items) memcpy(items, from, sizeof(SortItem) * count);
+}
+
+// Stable: ties go to the left run, which holds the earlier positions
+static void sort_merge(const SortItem *left, size_t left_count, const SortItem *right, size_t right_count,
+                       SortItem *out) {
+    size_t i = 0, j = 0, k = 0;
+    while (i < left_count && j < right_count) {
+        out[k++] = right[j].key < left[i].key ? right[j++] : left[i++];
+    }
+    memcpy(out + k, left + i, sizeof(SortItem) * (left_count - i));
+    memcpy(out + k + (left_count - i), right + j, sizeof(SortItem) * (right_count - j));
+}
+
+typedef struct {
+    PlaylistSorter *sorter;
+    const Playlist *playlist;
+    const SortLayout *layout;
+    SortItem *from;             // Merge input
+    SortItem *to;               // Merge output
+    size_t begin, middle, end;
+} SortTask;
+
+static void sort_task_done(PlaylistSorter *sorter) {
+    if (!sorter->pool.started) return;      // Ran inline
+    
+    pthread_mutex_lock(&sorter->lock);
+    if (--sorter->pending == 0) pthread_cond_signal(&sorter->done);
+    pthread_mutex_unlock(&sorter->lock);
+}
+
+// Keys for one chunk of the playlist, radix sorted in place
+static void sort_chunk_task(void *arg) {
+    SortTask *task = arg;
+    PlaylistSorter *sorter = task->sorter;
+    const TrackStore *store = task->playlist->store;
+    const TrackId *ids = task->playlist->track_ids;
+    SortItem *items = sorter->items;
+    
+    // A column at a time, most significant first
+    for (size_t i = task->begin; i < task->end; i++) {
+        items[i].key = 0;
+        items[i].position = (uint32_t)i;
+    }
+    for (int k = 0; k < task->layout->packed; k++) {
+        SortField field = task->layout->spec.keys[k].field;
+        int shift = task->layout->shift[k];
+        for (size_t i = task->begin; i < task->end; i++) {
+            uint32_t ordinal = sort_ordinal(store, &sorter->collation, field, ids[i]);
+            items[i].key |= (uint64_t)sort_directed(task->layout, k, ordinal) << shift;
+        }
+    }
+    sort_radix(sorter->items + task->begin, sorter->scratch + task->begin, task->end - task->begin,
+               task->layout->key_bits);
+    
+    sort_task_done(sorter);
+}
+
+static void sort_merge_task(void *arg) {
+    SortTask *task = arg;
+    sort_merge(task->from + task->begin, task->middle - task->begin,
+               task->from + task->middle, task->end - task->middle, task->to + task->begin);
+    sort_task_done(task->sorter);
+}
+
+// Runs the tasks on the sort pool and waits for all of them
+static void sort_run(PlaylistSorter *sorter, TaskFunction function, SortTask *tasks, int count) {
+    if (count == 1 || !sorter->pool.started) {
+        sorter->pending = count;
+        for (int i = 0; i < count; i++) function(&tasks[i]);
+        return;
+    }
+    
+    sorter->pending = count;
+    for (int i = 0; i < count; i++) {
+        task_pool_submit(&sorter->pool, function, &tasks[i]);
+    }
+    
+    pthread_mutex_lock(&sorter->lock);
+    while (sorter->pending > 0) pthread_cond_wait(&sorter->done, &sorter->lock);
+    pthread_mutex_unlock(&sorter->lock);
+}
+
+static _Thread_local const SortLayout *t_sort_layout;
+static _Thread_local const TrackStore *t_sort_store;
+static _Thread_local const TrackId *t_sort_ids;
+
+// Columns past the packed key, then the original position
+static int compare_sort_tail(const void *a, const void *b) {
+    const SortItem *x = a, *y = b;
+    const SortLayout *layout = t_sort_layout;
+    TrackId xid = t_sort_ids[x->position], yid = t_sort_ids[y->position];
+    
+    for (int k = layout->packed; k < layout->spec.count; k++) {
+        SortField field = layout->spec.keys[k].field;
+        uint32_t xo = sort_ordinal(t_sort_store, &g_app->sorter.collation, field, xid);
+        uint32_t yo = sort_ordinal(t_sort_store, &g_app->sorter.collation, field, yid);
+        if (xo != yo) return (xo < yo) == !layout->spec.keys[k].descending ? -1 : 1;
+    }
+    return (x->position > y->position) - (x->position < y->position);
+}
+
+// Reorders a playlist by a sort spec. Only a permutation of indexes is
+// sorted; the chunks run in parallel on their own pool, then merge in
+// pairs. The playing track stays current wherever it lands.
+static bool playlist_sort(Playlist *playlist, const SortSpec *spec) {
+    PlaylistSorter *sorter = &g_app->sorter;
+    size_t count = (size_t)playlist->track_count;
+    if (count < 2) return true;
+    
+    Uint64 start = SDL_GetPerformanceCounter();
+    if (!collation_prepare(&sorter->collation, playlist->store, playlist, spec)) return false;
+    
+    if (count > sorter->capacity) {
+        if (!grow_column((void**)&sorter->items, sizeof(SortItem), count) ||
+            !grow_column((void**)&sorter->scratch, sizeof(SortItem), count)) {
+            return false;
+        }
+        sorter->capacity = count;
+    }
+    
+    int chunks = 1;
+    if (count >= SORT_PARALLEL_MIN) {
+        if (!sorter->pool.started) {
+            int workers = SDL_GetCPUCount();
+            if (workers > SORT_MAX_THREADS) workers = SORT_MAX_THREADS;
+            if (workers > 1 && task_pool_initialize(&sorter->pool, workers)) {
+                pthread_mutex_init(&sorter->lock, NULL);
+                pthread_cond_init(&sorter->done, NULL);
+            }
+        }
+        if (sorter->pool.started) chunks = sorter->pool.worker_count;
+    }
+    
+    SortLayout layout;
+    sort_layout(&layout, spec, &sorter->collation);
+    
+    SortTask tasks[SORT_MAX_THREADS];
+    size_t bounds[SORT_MAX_THREADS + 1];
+    for (int c = 0; c <= chunks; c++) bounds[c] = count * c / chunks;
+    for (int c = 0; c < chunks; c++) {
+        tasks[c] = (SortTask){ sorter, playlist, &layout, NULL, NULL, bounds[c], 0, bounds[c + 1] };
+    }
+    sort_run(sorter, sort_chunk_task, tasks, chunks);
+    
+    // Merge neighbouring runs until one is left, ping-ponging buffers
+    SortItem *from = sorter->items, *to = sorter->scratch;
+    for (int runs = chunks; runs > 1; runs = (runs + 1) / 2) {
+        int merges = 0;
+        for (int r = 0; r + 1 < runs; r += 2) {
+            tasks[merges++] = (SortTask){ sorter, playlist, &layout, from, to, bounds[r], bounds[r + 1], bounds[r + 2] };
+        }
+        if (runs % 2) {
+            memcpy(to + bounds[runs - 1], from + bounds[runs - 1], sizeof(SortItem) * (count - bounds[runs - 1]));
+        }
+        sort_run(sorter, sort_merge_task, tasks, merges);
+        
+        for (int r = 0; r <= runs / 2; r++) bounds[r] = bounds[r * 2 < runs ? r * 2 : runs];
+        bounds[(runs + 1) / 2] = count;
+        
+        SortItem *swap = from;
+        from = to;
+        to = swap;
+    }
+    
+    // Columns that did not fit the key settle the ties between equal keys
+    if (layout.packed < spec->count) {
+        t_sort_layout = &layout;
+        t_sort_store = playlist->store;
+        t_sort_ids = playlist->track_ids;
+        for (size_t i = 0; i < count; ) {
+            size_t run = i + 1;
+            while (run < count && from[run].key == from[i].key) run++;
+            if (run - i > 1) qsort(from + i, run - i, sizeof(SortItem), compare_sort_tail);
+            i = run;
+        }
+    }
+    
+    // Apply the permutation, following the playing, queued and selected rows
+    TrackId *ids = malloc(sizeof(TrackId) * count);
+    if (!ids) return false;
+    
+    int current = -1, queued = -1;
+    for (size_t i = 0; i < count; i++) {
+        ids[i] = playlist->track_ids[from[i].position];
+        if ((int)from[i].position == playlist->current_index) current = (int)i;
+        if ((int)from[i].position == playlist->queued_index) queued = (int)i;
+    }
+    memcpy(playlist->track_ids, ids, sizeof(TrackId) * count);
+    free(ids);
+    
+    Widget *list = g_app->track_list;
+    if (list && list->list->source == playlist) {
+        int anchor = playlist->current_index >= 0 ? playlist->current_index : list->list->selected_index;
+        float offset = anchor >= 0 ? anchor - list->list->scroll : 0.0f;
+        
+        if (list->list->selected_index >= 0) {
+            for (size_t i = 0; i < count; i++) {
+                if ((int)from[i].position == list->list->selected_index) {
+                    list->list->selected_index = (int)i;
+                    break;
+                }
+            }
+        }
+        
+        // The playing row stays where it was on screen
+        int moved = anchor == playlist->current_index ? current : list->list->selected_index;
+        if (anchor >= 0 && moved >= 0) {
+            float scroll = fmaxf(0.0f, fminf(list_widget_max_scroll(list), moved - offset));
+            list->list->scroll = list->list->scroll_target = scroll;
+        }
+        widget_mark_dirty(list);
+    }
+    
+    playlist->current_index = current;
+    playlist->queued_index = queued;
+    if (current >= 0 && playlist == &g_app->current_playlist) {
+        // What comes next changed with the order
+        playlist_queue_next(playlist);
+    }
+    playlist->modified = time(NULL);
+    
+    sorter->last_seconds = (double)(SDL_GetPerformanceCounter() - start) / SDL_GetPerformanceFrequency();
+    return true;
+}
+
+// Ctrl+S: the list's playlist in the next preset order
+static void playlist_sort_next_preset(void) {
+    Widget *list = g_app->track_list;
+    Playlist *playlist = list ? list->list->source : &g_app->current_playlist;
+    int preset = g_app->sorter.preset;
+    
+    SortSpec spec;
+    if (!sort_spec_parse(SORT_PRESETS[preset], &spec)) return;
+    g_app->sorter.preset = (preset + 1) % (int)(sizeof(SORT_PRESETS) / sizeof(SORT_PRESETS[0]));
+    
+    char description[128];
+    sort_spec_describe(&spec, description, sizeof(description));
+    if (playlist_sort(playlist, &spec)) {
+        snprintf(g_app->status_message, MAX_TEXT, "Sorted by %s in %.2f ms", description,
+                 g_app->sorter.last_seconds * 1000.0);
+    }
+}
+
+static void playlist_sorter_cleanup(PlaylistSorter *sorter) {
+    if (sorter->pool.started) {
+        task_pool_cleanup(&sorter->pool);
+        pthread_mutex_destroy(&sorter->lock);
+        pthread_cond_destroy(&sorter->done);
+    }
+    collation_cleanup(&sorter->collation);
+    free(sorter->items);
+    free(sorter->scratch);
+    memset(sorter, 0, sizeof(PlaylistSorter));
+}
+
+// ═══════════════════════════════════════════════════════════════════════════════
+// ║                             TASK POOL                                      ║
+// ═══════════════════════════════════════════════════════════════════════════════
+
+// Which pool (if any) the current thread works for, so tasks spawned from a
+// task land on the spawning worker's own deque
+static _Thread_local TaskPool *t_task_pool = NULL;
+static _Thread_local int t_task_worker = -1;
+
+static bool task_deque_push(TaskDeque *deque, Task task) {
+    pthread_mutex_lock(&deque->lock);
+    
+    if (deque->bottom - deque->top == deque->capacity) {
+        size_t capacity = deque->capacity ? deque->capacity * 2 : 256;
+        Task *tasks = malloc(sizeof(Task) * capacity);
+        if (!tasks) {
+            pthread_mutex_unlock(&deque->lock);
+            return false;
+        }
+        for (size_t i = deque->top; i != deque->bottom; i++) {
+            tasks[i & (capacity - 1)] = deque->tasks[i & (deque->capacity - 1)];
+        }
+        free(deque->tasks);
+        deque->tasks = tasks;
+        deque->capacity = capacity;
+    }
+    
+    deque->tasks[deque->bottom & (deque->capacity - 1)] = task;
+    deque->bottom++;
+    
+    pthread_mutex_unlock(&deque->lock);
+    return true;
+}
+
+// Owner end: newest first, keeps a directory's children hot in cache
+static bool task_deque_pop(TaskDeque *deque, Task *task) {
+    pthread_mutex_lock(&deque->lock);
+    
+    bool found = deque->bottom != deque->top;
+    if (found) {
+        deque->bottom--;
+        *task = deque->tasks[deque->bottom & (deque->capacity - 1)];
+    }
+    
+    pthread_mutex_unlock(&deque->lock);
+    return found;
+}
+
+// Thief end: oldest first, so stolen work tends to be a whole subtree
+static bool task_deque_steal(TaskDeque *deque, Task *task) {
+    if (pthread_mutex_trylock(&deque->lock) != 0) return false;
+    
+    bool found = deque->bottom != deque->top;
+    if (found) {
+        *task = deque->tasks[deque->top & (deque->capacity - 1)];
+        deque->top++;
+    }
+    
+    pthread_mutex_unlock(&deque->lock);
+    return found;
+}
+
+static void* task_pool_worker(void *data) {
+    TaskPool *pool = t_task_pool = ((TaskDeque*)data)->pool;
+    int index = t_task_worker = (int)((TaskDeque*)data - pool->deques);
+    
+    for (;;) {
+        Task task;
+        bool found = task_deque_pop(&pool->deques[index], &task);
+        
+        for (int i = 1; !found && i < pool->worker_count; i++) {
+            found = task_deque_steal(&pool->deques[(index + i) % pool->worker_count], &task);
+        }
+        
+        if (found) {
+            atomic_fetch_sub(&pool->queued, 1);
+            task.function(task.arg);
+            continue;
+        }
+        
+        // Queued work we could not grab yet (a deque was busy): try again
+        if (atomic_load(&pool->queued) > 0) continue;
+        if (!pool->running) break;
+        
+        // Nothing anywhere: sleep until the next submit
+        pthread_mutex_lock(&pool->idle_lock);
+        atomic_fetch_add(&pool->sleeping, 1);
+        while (atomic_load(&pool->queued) == 0 && pool->running) {
+            pthread_cond_wait(&pool->idle_cond, &pool->idle_lock);
+        }
+        atomic_fetch_sub(&pool->sleeping, 1);
+        pthread_mutex_unlock(&pool->idle_lock);
+    }
+    
+    return NULL;
+}
+
+static bool task_pool_initialize(TaskPool *pool, int workers) {
+    memset(pool, 0, sizeof(TaskPool));
+    
+    pool->worker_count = workers > 0 ? workers : 1;
+    pool->threads = calloc(pool->worker_count, sizeof(pthread_t));
+    pool->deques = calloc(pool->worker_count, sizeof(TaskDeque));
+    if (!pool->threads || !pool->deques) {
+        free(pool->threads);
+        free(pool->deques);
+        return false;
+    }
+    
+    pthread_mutex_init(&pool->idle_lock, NULL);
+    pthread_cond_init(&pool->idle_cond, NULL);
+    pool->running = true;
+    
+    for (int i = 0; i < pool->worker_count; i++) {
+        pthread_mutex_init(&pool->deques[i].lock, NULL);
+        pool->deques[i].pool = pool;
+    }
+    
+    for (int i = 0; i < pool->worker_count; i++) {
+        pthread_create(&pool->threads[i], NULL, task_pool_worker, &pool->deques[i]);
+    }
+    
+    pool->started = true;
+    return true;
+}
+
+// Stops the workers once every queued task has run
+static void task_pool_cleanup(TaskPool *pool) {
+    if (!pool->started) return;
+    
+    pthread_mutex_lock(&pool->idle_lock);
+    pool->running = false;
+    pthread_cond_broadcast(&pool->idle_cond);
+    pthread_mutex_unlock(&pool->idle_lock);
+    
+    for (int i = 0; i < pool->worker_count; i++) {
+        pthread_join(pool->threads[i], NULL);
+    }
+    
+    for (int i = 0; i < pool->worker_count; i++) {
+        pthread_mutex_destroy(&pool->deques[i].lock);
+        free(pool->deques[i].tasks);
+    }
+    
+    pthread_mutex_destroy(&pool->idle_lock);
+    pthread_cond_destroy(&pool->idle_cond);
+    free(pool->threads);
+    free(pool->deques);
+    memset(pool, 0, sizeof(TaskPool));
+}
+
+static void task_pool_submit(TaskPool *pool, TaskFunction function, void *arg) {
+    Task task = { function, arg };
+    int target = t_task_pool == pool ? t_task_worker :
+                 (int)(atomic_fetch_add(&pool->submit_cursor, 1) % pool->worker_count);
+    
+    atomic_fetch_add(&pool->queued, 1);
+    if (!task_deque_push(&pool->deques[target], task)) {
+        // Out of memory growing the deque: do it right here instead
+        atomic_fetch_sub(&pool->queued, 1);
+        function(arg);
+        return;
+    }
+    
+    if (atomic_load(&pool->sleeping) > 0) {
+        pthread_mutex_lock(&pool->idle_lock);
+        pthread_cond_signal(&pool->idle_cond);
+        pthread_mutex_unlock(&pool->idle_lock);
+    }
+}
+
+// ═══════════════════════════════════════════════════════════════════════════════
+// ║                          LIBRARY SCANNER                                   ║
+// ═══════════════════════════════════════════════════════════════════════════════
+
+typedef struct {
+    LibraryScanner *scanner;
+    char path[];
+} ScanJob;
+
+static void library_scanner_submit(LibraryScanner *scanner, TaskFunction function, const char *path) {
+    size_t length = strlen(path) + 1;
+    ScanJob *job = malloc(sizeof(ScanJob) + length);
+    if (!job) return;
+    
+    job->scanner = scanner;
+    memcpy(job->path, path, length);
+    
+    atomic_fetch_add(&scanner->outstanding, 1);
+    task_pool_submit(&scanner->pool, function, job);
+}
+
+static void library_scanner_finish_job(ScanJob *job) {
+    atomic_fetch_sub(&job->scanner->outstanding, 1);
+    free(job);
+}
+
+static void scan_probe_task(void *arg) {
+    ScanJob *job = (ScanJob*)arg;
+    LibraryScanner *scanner = job->scanner;
+    Track *track = scanner->cancelled ? NULL : calloc(1, sizeof(Track));
+    
+    if (track) {
+        snprintf(track->filepath, sizeof(track->filepath), "%s", job->path);
+        const char *filename = strrchr(job->path, PATH_SEP[0]);
+        snprintf(track->filename, sizeof(track->filename), "%s", filename ? filename + 1 : job->path);
+        
+        file_get_identity(job->path, &track->file_size, &track->file_mtime);
+        
+        if (library_cache_check(scanner->cache, track)) {
+            // The stored row is still right; FFmpeg never sees the file
+            track->cached = true;
+            atomic_fetch_add(&scanner->files_cached, 1);
+        } else {
+            if (!track->file_hash) track->file_hash = file_content_hash(job->path, track->file_size);
+            
+            track->metadata_loaded = metadata_extract_from_file(job->path, &track->metadata);
+            if (!track->metadata_loaded) {
+                atomic_fetch_add(&scanner->files_failed, 1);
+            }
+            atomic_fetch_add(&scanner->files_probed, 1);
+        }
+        
+        pthread_mutex_lock(&scanner->results_lock);
+        if (scanner->result_count == scanner->result_capacity) {
+            int capacity = scanner->result_capacity ? scanner->result_capacity * 2 : 256;
+            Track **results = realloc(scanner->results, sizeof(Track*) * capacity);
+            if (results) {
+                scanner->results = results;
+                scanner->result_capacity = capacity;
+            }
+        }
+        if (scanner->result_count < scanner->result_capacity) {
+            scanner->results[scanner->result_count++] = track;
+            track = NULL;
+        }
+        pthread_mutex_unlock(&scanner->results_lock);
+        
+        free(track);
+    }
+    
+    library_scanner_finish_job(job);
+}
+
+static void scan_directory_task(void *arg) {
+    ScanJob *job = (ScanJob*)arg;
+    LibraryScanner *scanner = job->scanner;
+    char child[MAX_PATH];
+    
+    if (scanner->cancelled) {
+        library_scanner_finish_job(job);
+        return;
+    }
+    
+#ifdef _WIN32
+    char pattern[MAX_PATH];
+    snprintf(pattern, sizeof(pattern), "%s\\*", job->path);
+    
+    WIN32_FIND_DATAA entry;
+    HANDLE find = FindFirstFileA(pattern, &entry);
+    if (find != INVALID_HANDLE_VALUE) {
+        do {
+            if (entry.cFileName[0] == '.') continue;
+            if (snprintf(child, sizeof(child), "%s\\%s", job->path, entry.cFileName) >= (int)sizeof(child)) continue;
+            
+            if (entry.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) {
+                if (!(entry.dwFileAttributes & FILE_ATTRIBUTE_REPARSE_POINT)) {
+                    library_scanner_submit(scanner, scan_directory_task, child);
+                }
+            } else if (file_is_supported_audio(child)) {
+                atomic_fetch_add(&scanner->files_found, 1);
+                library_scanner_submit(scanner, scan_probe_task, child);
+            }
+        } while (!scanner->cancelled && FindNextFileA(find, &entry));
+        FindClose(find);
+    }
+#else
+    DIR *dir = opendir(job->path);
+    if (dir) {
+        struct dirent *entry;
+        while (!scanner->cancelled && (entry = readdir(dir)) != NULL) {
+            if (entry->d_name[0] == '.') continue;
+            if (snprintf(child, sizeof(child), "%s/%s", job->path, entry->d_name) >= (int)sizeof(child)) continue;
+            
+            // Symlinked directories are not followed, so link loops cannot recurse
+            bool is_dir = false;
+            bool is_file = false;
+#ifdef DT_DIR
+            is_dir = entry->d_type == DT_DIR;
+            is_file = entry->d_type == DT_REG || entry->d_type == DT_LNK;
+            if (entry->d_type == DT_UNKNOWN)
+#endif
+            {
+                struct stat info;
+                if (lstat(child, &info) == 0) {
+                    is_dir = S_ISDIR(info.st_mode);
+                    is_file = S_ISREG(info.st_mode) || S_ISLNK(info.st_mode);
+                }
+            }
+            
+            if (is_dir) {
+                library_scanner_submit(scanner, scan_directory_task, child);
+            } else if (is_file && file_is_supported_audio(child)) {
+                atomic_fetch_add(&scanner->files_found, 1);
+                library_scanner_submit(scanner, scan_probe_task, child);
+            }
+        }
+        closedir(dir);
+    }
+#endif
+    
+    atomic_fetch_add(&scanner->dirs_scanned, 1);
+    library_scanner_finish_job(job);
+}
+
+static bool library_scanner_start(LibraryScanner *scanner, Playlist *target) {
+    if (!scanner->initialized) {
+        int workers = SDL_GetCPUCount() * SCAN_THREADS_PER_CORE;
+        if (workers > SCAN_MAX_THREADS) workers = SCAN_MAX_THREADS;
+        
+        if (!task_pool_initialize(&scanner->pool, workers)) {
+            fprintf(stderr, "Failed to start library scanner\n");
+            return false;
+        }
+        pthread_mutex_init(&scanner->results_lock, NULL);
+        scanner->initialized = true;
+    }
+    
+    if (!scanner->active) {
+        atomic_store(&scanner->dirs_scanned, 0);
+        atomic_store(&scanner->files_found, 0);
+        atomic_store(&scanner->files_probed, 0);
+        atomic_store(&scanner->files_failed, 0);
+        atomic_store(&scanner->files_cached, 0);
+        scanner->started = SDL_GetPerformanceCounter();
+        scanner->active = true;
+    }
+    
+    scanner->target = target;
+    scanner->cache = &g_app->library_cache;
+    return true;
+}
+
+static void library_scanner_add_directory(LibraryScanner *scanner, const char *path, Playlist *target) {
+    if (library_scanner_start(scanner, target)) {
+        library_scanner_submit(scanner, scan_directory_task, path);
+    }
+}
+
+static void library_scanner_add_file(LibraryScanner *scanner, const char *path, Playlist *target) {
+    if (library_scanner_start(scanner, target)) {
+        atomic_fetch_add(&scanner->files_found, 1);
+        library_scanner_submit(scanner, scan_probe_task, path);
+    }
+}
+
+static bool library_scanner_busy(LibraryScanner *scanner) {
+    return scanner->active;
+}
+
+// Scan throughput since the scan started
+static double library_scanner_rate(LibraryScanner *scanner) {
+    double elapsed = (double)(SDL_GetPerformanceCounter() - scanner->started) / 
+                     SDL_GetPerformanceFrequency();
+    size_t files = atomic_load(&scanner->files_probed) + atomic_load(&scanner->files_cached);
+    return elapsed > 0.0 ? files / elapsed : 0.0;
+}
+
+// UI thread. Merges up to max_tracks finished probes into the target playlist
+// and returns how many were merged.
+static int library_scanner_poll(LibraryScanner *scanner, int max_tracks) {
+    if (!scanner->active) return 0;
+    
+    Track *batch[256];
+    int merged = 0;
+    
+    while (merged < max_tracks) {
+        pthread_mutex_lock(&scanner->results_lock);
+        int take = scanner->result_count;
+        if (take > 256) take = 256;
+        if (take > max_tracks - merged) take = max_tracks - merged;
+        
+        memcpy(batch, scanner->results, sizeof(Track*) * take);
+        memmove(scanner->results, scanner->results + take, 
+                sizeof(Track*) * (scanner->result_count - take));
+        scanner->result_count -= take;
+        pthread_mutex_unlock(&scanner->results_lock);
+        
+        if (take == 0) break;
+        
+        for (int i = 0; i < take; i++) {
+            Playlist *playlist = scanner->target;
+            TrackId id = track_store_find(playlist->store, batch[i]->filepath);
+            
+            if (id == TRACK_ID_NONE) {
+                playlist_add_track(playlist, batch[i]);
+            } else {
+                if (batch[i]->cached) {
+                    track_store_set_identity(playlist->store, id, batch[i]);
+                } else {
+                    track_store_update(playlist->store, id, batch[i]);
+                }
+                if (!playlist_contains(playlist, id)) playlist_append(playlist, id);
+            }
+            free(batch[i]);
+        }
+        merged += take;
+    }
+    
+    size_t probed = atomic_load(&scanner->files_probed);
+    size_t cached = atomic_load(&scanner->files_cached);
+    size_t found = atomic_load(&scanner->files_found);
+    
+    pthread_mutex_lock(&scanner->results_lock);
+    bool done = atomic_load(&scanner->outstanding) == 0 && scanner->result_count == 0;
+    pthread_mutex_unlock(&scanner->results_lock);
+    
+    if (done) {
+        scanner->active = false;
+        snprintf(g_app->status_message, MAX_TEXT, 
+                 "Library scan complete: %zu files, %zu unchanged (%.0f files/s)",
+                 probed + cached, cached, library_scanner_rate(scanner));
+    } else {
+        snprintf(g_app->status_message, MAX_TEXT, 
+                 "Scanning library: %zu / %zu files, %zu unchanged (%.0f files/s)",
+                 probed + cached, found, cached, library_scanner_rate(scanner));
+    }
+    
+    return merged;
+}
+
+static void library_scanner_cleanup(LibraryScanner *scanner) {
+    if (!scanner->initialized) return;
+    
+    // Pending jobs see the flag and return straight away
+    scanner->cancelled = true;
+    task_pool_cleanup(&scanner->pool);
+    
+    for (int i = 0; i < scanner->result_count; i++) {
+        free(scanner->results[i]);
+    }
+    free(scanner->results);
+    pthread_mutex_destroy(&scanner->results_lock);
+    memset(scanner, 0, sizeof(LibraryScanner));
+}
+
+// ═══════════════════════════════════════════════════════════════════════════════
+// ║                        LOUDNESS & REPLAYGAIN                               ║
+// ═══════════════════════════════════════════════════════════════════════════════
+
+static _Thread_local bool t_loudness_worker = false;
+
+// Mean square (summed over channels) to LUFS and back
+static double loudness_lufs(double energy) {
+    return -0.691 + 10.0 * log10(energy);
+}
+
+static double loudness_energy(double lufs) {
+    return pow(10.0, (lufs + 0.691) / 10.0);
+}
+
+// K-weights a block of interleaved stereo and returns its summed squares.
+// Scalar reference: both filters run over each channel in turn.
+static double loudness_filter_scalar(LoudnessMeter *meter, const float *samples, int frames) {
+    double sum = 0.0;
+    
+    for (int ch = 0; ch < 2; ch++) {
+        const int pre = ch, rlb = ch + 2;
+        float s1 = meter->s1[pre], s2 = meter->s2[pre];
+        float t1 = meter->s1[rlb], t2 = meter->s2[rlb];
+        
+        for (int n = 0; n < frames; n++) {
+            float x = samples[n * 2 + ch];
+            float y = meter->b0[pre] * x + s1;
+            s1 = meter->b1[pre] * x + meter->a1[pre] * y + s2;
+            s2 = meter->b2[pre] * x + meter->a2[pre] * y;
+            
+            float z = meter->b0[rlb] * y + t1;
+            t1 = meter->b1[rlb] * y + meter->a1[rlb] * z + t2;
+            t2 = meter->b2[rlb] * y + meter->a2[rlb] * z;
+            sum += (double)z * z;
+        }
+        
+        meter->s1[pre] = fabsf(s1) < 1e-15f ? 0.0f : s1;
+        meter->s2[pre] = fabsf(s2) < 1e-15f ? 0.0f : s2;
+        meter->s1[rlb] = fabsf(t1) < 1e-15f ? 0.0f : t1;
+        meter->s2[rlb] = fabsf(t2) < 1e-15f ? 0.0f : t2;
+    }
+    
+    return sum;
+}
+
+// 4x oversampled peak of a block, pushing every frame into the history
+static float loudness_peak_scalar(LoudnessMeter *meter, const float *samples, int frames) {
+    float peak = 0.0f;
+    
+    for (int n = 0; n < frames; n++) {
+        int pos = meter->history_pos = (meter->history_pos + LOUDNESS_TP_TAPS - 1) % LOUDNESS_TP_TAPS;
+        
+        for (int ch = 0; ch < 2; ch++) {
+            float *history = meter->history[ch];
+            history[pos] = history[pos + LOUDNESS_TP_TAPS] = samples[n * 2 + ch];
+            
+            for (int phase = 0; phase < 4; phase++) {
+                float y = 0.0f;
+                for (int k = 0; k < LOUDNESS_TP_TAPS; k++) {
+                    y += meter->taps[k][phase] * history[pos + k];
+                }
+                peak = fmaxf(peak, fabsf(y));
+            }
+        }
+    }
+    
+    return peak;
+}
+
+#ifdef TUXMUSIC_X86_SIMD
+// Same pipelining as the equalizer: lanes hold the pre-filter for both
+// channels, then the RLB high-pass fed with the pre-filter's previous output.
+// The high-pass runs one frame behind, carried across blocks in meter->pipe.
+__attribute__((target("sse2")))
+static double loudness_filter_sse(LoudnessMeter *meter, const float *samples, int frames) {
+    const __m128 b0 = _mm_loadu_ps(meter->b0), b1 = _mm_loadu_ps(meter->b1);
+    const __m128 b2 = _mm_loadu_ps(meter->b2);
+    const __m128 a1 = _mm_loadu_ps(meter->a1), a2 = _mm_loadu_ps(meter->a2);
+    __m128 s1 = _mm_loadu_ps(meter->s1), s2 = _mm_loadu_ps(meter->s2);
+    __m128 last = _mm_loadu_ps(meter->pipe);
+    __m128 sum = _mm_setzero_ps();
+    
+    for (int n = 0; n < frames; n++) {
+        __m128 x = _mm_castpd_ps(_mm_load_sd((const double*)(samples + n * 2)));
+        __m128 in = _mm_movelh_ps(x, last);
+        
+        __m128 y = _mm_add_ps(_mm_mul_ps(b0, in), s1);
+        s1 = _mm_add_ps(_mm_add_ps(_mm_mul_ps(b1, in), _mm_mul_ps(a1, y)), s2);
+        s2 = _mm_add_ps(_mm_mul_ps(b2, in), _mm_mul_ps(a2, y));
+        sum = _mm_add_ps(sum, _mm_mul_ps(y, y));
+        last = y;
+    }
+    
+    _mm_storeu_ps(meter->s1, s1);
+    _mm_storeu_ps(meter->s2, s2);
+    _mm_storeu_ps(meter->pipe, last);
+    
+    // Lanes 0 and 1 hold pre-filter energy, which is not what gets measured
+    float lanes[4];
+    _mm_storeu_ps(lanes, sum);
+    return (double)lanes[2] + lanes[3];
+}
+
+// All four phases of one input sample in a vector
+__attribute__((target("sse2")))
+static float loudness_peak_sse(LoudnessMeter *meter, const float *samples, int frames) {
+    const __m128 sign = _mm_set1_ps(-0.0f);
+    __m128 taps[LOUDNESS_TP_TAPS];
+    __m128 peak = _mm_setzero_ps();
+    
+    for (int k = 0; k < LOUDNESS_TP_TAPS; k++) {
+        taps[k] = _mm_loadu_ps(meter->taps[k]);
+    }
+    
+    for (int n = 0; n < frames; n++) {
+        int pos = meter->history_pos = (meter->history_pos + LOUDNESS_TP_TAPS - 1) % LOUDNESS_TP_TAPS;
+        
+        for (int ch = 0; ch < 2; ch++) {
+            float *history = meter->history[ch] + pos;
+            history[0] = history[LOUDNESS_TP_TAPS] = samples[n * 2 + ch];
+            
+            __m128 y = _mm_mul_ps(taps[0], _mm_set1_ps(history[0]));
+            for (int k = 1; k < LOUDNESS_TP_TAPS; k++) {
+                y = _mm_add_ps(y, _mm_mul_ps(taps[k], _mm_set1_ps(history[k])));
+            }
+            peak = _mm_max_ps(peak, _mm_andnot_ps(sign, y));
+        }
+    }
+    
+    peak = _mm_max_ps(peak, _mm_shuffle_ps(peak, peak, _MM_SHUFFLE(1, 0, 3, 2)));
+    peak = _mm_max_ps(peak, _mm_shuffle_ps(peak, peak, _MM_SHUFFLE(2, 3, 0, 1)));
+    return _mm_cvtss_f32(peak);
+}
+#endif
+
+// Keeps the interpolator history current without computing any output
+static void loudness_history_push(LoudnessMeter *meter, const float *samples, int frames) {
+    // Anything older than the last LOUDNESS_TP_TAPS frames would be overwritten
+    int first = frames > LOUDNESS_TP_TAPS ? frames - LOUDNESS_TP_TAPS : 0;
+    
+    for (int n = first; n < frames; n++) {
+        int pos = meter->history_pos = (meter->history_pos + LOUDNESS_TP_TAPS - 1) % LOUDNESS_TP_TAPS;
+        for (int ch = 0; ch < 2; ch++) {
+            meter->history[ch][pos] = meter->history[ch][pos + LOUDNESS_TP_TAPS] = samples[n * 2 + ch];
+        }
+    }
+}
+
+// True peak. No interpolated value can exceed tap_bound times the largest
+// sample feeding it, so chunks that cannot raise the peak only update the
+// history; after the first loud passage that is most of a track.
+static void loudness_meter_peak(LoudnessMeter *meter, const float *samples, int frames) {
+    for (int start = 0; start < frames; start += LOUDNESS_PEAK_CHUNK) {
+        int count = frames - start < LOUDNESS_PEAK_CHUNK ? frames - start : LOUDNESS_PEAK_CHUNK;
+        const float *chunk = samples + (size_t)start * 2;
+        
+        float chunk_peak = 0.0f;
+        for (int i = 0; i < count * 2; i++) {
+            chunk_peak = fmaxf(chunk_peak, fabsf(chunk[i]));
+        }
+        
+        float held = 0.0f;
+        for (int k = 0; k < LOUDNESS_TP_TAPS; k++) {
+            held = fmaxf(held, fmaxf(fabsf(meter->history[0][k]), fabsf(meter->history[1][k])));
+        }
+        
+        // Interpolation can land below a sample, never the other way round
+        meter->peak = fmaxf(meter->peak, chunk_peak);
+        
+        if (fmaxf(chunk_peak, held) * meter->tap_bound <= meter->peak) {
+            loudness_history_push(meter, chunk, count);
+        } else {
+            meter->peak = fmaxf(meter->peak, meter->peak_kernel(meter, chunk, count));
+        }
+    }
+}
+
+// K-weighting from ITU-R BS.1770, redesigned for `rate` the way libebur128
+// does, plus the true-peak interpolator
+static void loudness_meter_initialize(LoudnessMeter *meter, int rate) {
+    memset(meter, 0, sizeof(LoudnessMeter));
+    
+    // High shelf modelling the head
+    double k = tan(M_PI * 1681.974450955533 / rate);
+    double q = 0.7071752369554196;
+    double vh = pow(10.0, 3.999843853973347 / 20.0);
+    double vb = pow(vh, 0.4996667741545416);
+    double a0 = 1.0 + k / q + k * k;
+    
+    float pre[5] = {
+        (float)((vh + vb * k / q + k * k) / a0),
+        (float)(2.0 * (k * k - vh) / a0),
+        (float)((vh - vb * k / q + k * k) / a0),
+        (float)(-2.0 * (k * k - 1.0) / a0),
+        (float)(-(1.0 - k / q + k * k) / a0),
+    };
+    
+    // RLB high-pass
+    k = tan(M_PI * 38.13547087602444 / rate);
+    q = 0.5003270373238773;
+    a0 = 1.0 + k / q + k * k;
+    
+    float rlb[5] = {
+        1.0f, -2.0f, 1.0f,
+        (float)(-2.0 * (k * k - 1.0) / a0),
+        (float)(-(1.0 - k / q + k * k) / a0),
+    };
+    
+    for (int lane = 0; lane < 4; lane++) {
+        const float *c = lane < 2 ? pre : rlb;
+        meter->b0[lane] = c[0];
+        meter->b1[lane] = c[1];
+        meter->b2[lane] = c[2];
+        meter->a1[lane] = c[3];
+        meter->a2[lane] = c[4];
+    }
+    
+    // Hann-windowed sinc, split into four phases of fractional delay
+    const int length = LOUDNESS_TP_TAPS * 4;
+    for (int n = 0; n < length; n++) {
+        double x = (n - (length - 1) * 0.5) / 4.0;
+        double sinc = sin(M_PI * x) / (M_PI * x);
+        double window = 0.5 - 0.5 * cos(2.0 * M_PI * (n + 1) / (length + 1));
+        meter->taps[n / 4][n % 4] = (float)(sinc * window);
+    }
+    
+    for (int phase = 0; phase < 4; phase++) {
+        float sum = 0.0f, bound = 0.0f;
+        for (int t = 0; t < LOUDNESS_TP_TAPS; t++) sum += meter->taps[t][phase];
+        for (int t = 0; t < LOUDNESS_TP_TAPS; t++) {
+            meter->taps[t][phase] /= sum;
+            bound += fabsf(meter->taps[t][phase]);
+        }
+        meter->tap_bound = fmaxf(meter->tap_bound, bound);
+    }
+    
+    meter->block_frames = rate / 10 > 0 ? rate / 10 : 1;
+    
+    meter->filter_kernel = loudness_filter_scalar;
+    meter->peak_kernel = loudness_peak_scalar;
+    meter->kernel_name = "scalar";
+    
+#ifdef TUXMUSIC_X86_SIMD
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("sse2")) {
+        meter->filter_kernel = loudness_filter_sse;
+        meter->peak_kernel = loudness_peak_sse;
+        meter->kernel_name = "sse2";
+    }
+#endif
+}
+
+// Interleaved stereo float at the rate the meter was set up for
+static void loudness_meter_add(LoudnessMeter *meter, const float *samples, int frames) {
+    while (frames > 0 && !meter->failed) {
+        int take = meter->block_frames - meter->block_filled;
+        if (take > frames) take = frames;
+        
+        meter->block_energy += meter->filter_kernel(meter, samples, take);
+        loudness_meter_peak(meter, samples, take);
+        meter->block_filled += take;
+        samples += (size_t)take * 2;
+        frames -= take;
+        
+        if (meter->block_filled < meter->block_frames) break;
+        
+        if (meter->count == meter->capacity) {
+            size_t capacity = meter->capacity ? meter->capacity * 2 : 4096;
+            if (!grow_column((void**)&meter->energy, sizeof(float), capacity)) {
+                meter->failed = true;
+                break;
+            }
+            meter->capacity = capacity;
+        }
+        meter->energy[meter->count++] = (float)(meter->block_energy / meter->block_frames);
+        meter->block_energy = 0.0;
+        meter->block_filled = 0;
+    }
+}
+
+// Gated integrated loudness (EBU R128: 400 ms blocks, 75% overlap, -10 LU
+// relative gate) and loudness range (3 s windows, 1 s apart, -20 LU gate,
+// 10th to 95th percentile). Frees the block energies.
+static bool loudness_meter_finish(LoudnessMeter *meter, LoudnessResult *result) {
+    const double absolute = loudness_energy(LOUDNESS_ABSOLUTE_GATE);
+    
+    result->loudness = (float)LOUDNESS_ABSOLUTE_GATE;
+    result->range = 0.0f;
+    result->peak = meter->peak;
+    
+    // Integrated
+    double sum = 0.0, gated = 0.0;
+    size_t kept = 0, passed = 0;
+    for (int pass = 0; pass < 2; pass++) {
+        double threshold = pass == 0 ? absolute : fmax(absolute, sum / kept * 0.1);
+        for (size_t i = 0; i + 4 <= meter->count; i++) {
+            double energy = ((double)meter->energy[i] + meter->energy[i + 1] +
+                             meter->energy[i + 2] + meter->energy[i + 3]) * 0.25;
+            if (energy <= threshold) continue;
+            if (pass == 0) {
+                sum += energy;
+                kept++;
+            } else {
+                gated += energy;
+                passed++;
+            }
+        }
+        if (kept == 0) break;
+    }
+    if (passed > 0) result->loudness = (float)loudness_lufs(gated / passed);
+    
+    // Range
+    size_t windows = meter->count >= 30 ? (meter->count - 30) / 10 + 1 : 0;
+    double *levels = windows ? malloc(sizeof(double) * windows) : NULL;
+    size_t count = 0;
+    sum = 0.0;
+    
+    for (size_t w = 0; levels && w < windows; w++) {
+        double energy = 0.0;
+        for (size_t i = w * 10; i < w * 10 + 30; i++) energy += meter->energy[i];
+        energy /= 30.0;
+        if (energy > absolute) {
+            levels[count++] = energy;
+            sum += energy;
+        }
+    }
+    
+    if (count > 0) {
+        double threshold = sum / count * 0.01;
+        size_t n = 0;
+        for (size_t i = 0; i < count; i++) {
+            if (levels[i] > threshold) levels[n++] = loudness_lufs(levels[i]);
+        }
+        qsort(levels, n, sizeof(double), compare_double);
+        if (n > 0) {
+            result->range = (float)(levels[(size_t)((n - 1) * 0.95 + 0.5)] - 
+                                    levels[(size_t)((n - 1) * 0.10 + 0.5)]);
+        }
+    }
+    
+    bool ok = !meter->failed && (!windows || levels);
+    free(levels);
+    free(meter->energy);
+    meter->energy = NULL;
+    meter->count = meter->capacity = 0;
+    return ok;
+}
+
+// Decodes a whole file at its own rate. Multichannel sources are measured
+// after the same stereo downmix playback uses.
+static bool loudness_measure_file(const char *path, LoudnessResult *result,
+                                  atomic_bool *cancelled, uint64_t *milliseconds) {
+    AudioDecoder decoder;
+    if (!audio_decoder_open(&decoder, path, AUDIO_SAMPLE_RATE)) return false;
+    decoder.unplayed = true;
+    
+    AVCodecContext *codec = decoder.codec_context;
+    int rate = codec->sample_rate;
+    if (rate <= 0 || !audio_decoder_set_output(&decoder, codec->channel_layout, codec->channels,
+                                               codec->sample_fmt, rate, rate)) {
+        audio_decoder_close(&decoder);
+        return false;
+    }
+    
+    LoudnessMeter meter;
+    loudness_meter_initialize(&meter, rate);
+    
+    AVPacket *packet = av_packet_alloc();
+    AVFrame *frame = av_frame_alloc();
+    uint64_t frames = 0;
+    bool ok = packet && frame;
+    
+    while (ok) {
+        bool more = audio_decoder_read(&decoder, packet, frame);
+        if (decoder.count > 0) {
+            loudness_meter_add(&meter, decoder.frames, decoder.count);
+            frames += decoder.count;
+            decoder.count = 0;
+        }
+        if (!more) break;
+        if (atomic_load(cancelled)) ok = false;
+    }
+    
+    ok = loudness_meter_finish(&meter, result) && ok;
+    *milliseconds = frames * 1000 / rate;
+    
+    av_frame_free(&frame);
+    av_packet_free(&packet);
+    audio_decoder_close(&decoder);
+    return ok;
+}
+
+typedef struct {
+    LoudnessScanner *scanner;
+    TrackId id;
+    uint32_t file_hash;
+    char path[];
+} LoudnessJob;
+
+static void loudness_measure_task(void *arg) {
+    LoudnessJob *job = (LoudnessJob*)arg;
+    LoudnessScanner *scanner = job->scanner;
+    
+    if (!t_loudness_worker) {
+        // Playback and the UI always win; this only has to finish eventually
+        SDL_SetThreadPriority(SDL_THREAD_PRIORITY_LOW);
+        equalizer_flush_denormals();
+        t_loudness_worker = true;
+    }
+    
+    LoudnessResult result = { .id = job->id, .file_hash = job->file_hash };
+    if (!atomic_load(&scanner->cancelled)) {
+        uint64_t milliseconds = 0;
+        result.measured = loudness_measure_file(job->path, &result, &scanner->cancelled, &milliseconds);
+        atomic_fetch_add(result.measured ? &scanner->measured : &scanner->failed, 1);
+        atomic_fetch_add(&scanner->audio_ms, milliseconds);
+    }
+    
+    pthread_mutex_lock(&scanner->results_lock);
+    if (scanner->result_count == scanner->result_capacity) {
+        int capacity = scanner->result_capacity ? scanner->result_capacity * 2 : 64;
+        LoudnessResult *results = realloc(scanner->results, sizeof(LoudnessResult) * capacity);
+        if (results) {
+            scanner->results = results;
+            scanner->result_capacity = capacity;
+        }
+    }
+    if (scanner->result_count < scanner->result_capacity) {
+        scanner->results[scanner->result_count++] = result;
+    }
+    pthread_mutex_unlock(&scanner->results_lock);
+    
+    atomic_fetch_sub(&scanner->outstanding, 1);
+    free(job);
+}
+
+static bool loudness_scanner_start(LoudnessScanner *scanner) {
+    if (scanner->initialized) return true;
+    
+    if (!task_pool_initialize(&scanner->pool, SDL_GetCPUCount())) {
+        fprintf(stderr, "Failed to start loudness scanner\n");
+        return false;
+    }
+    pthread_mutex_init(&scanner->results_lock, NULL);
+    scanner->initialized = true;
+    return true;
+}
+
+// Grows the per-row queue marks to cover the whole store
+static bool loudness_scanner_reserve(LoudnessScanner *scanner, const TrackStore *store) {
+    if (store->count <= scanner->queued_capacity) return true;
+    
+    size_t capacity = scanner->queued_capacity ? scanner->queued_capacity : TRACK_STORE_INITIAL;
+    while (capacity < store->count) capacity *= 2;
+    
+    if (!grow_column((void**)&scanner->queued, 1, capacity)) return false;
+    memset(scanner->queued + scanner->queued_capacity, 0, capacity - scanner->queued_capacity);
+    scanner->queued_capacity = capacity;
+    return true;
+}
+
+// Unmeasured, probed, and neither in flight nor failed earlier this session
+static bool loudness_scanner_wants(const LoudnessScanner *scanner, const TrackStore *store, TrackId id) {
+    return (store->flags[id] & (TRACK_FLAG_METADATA_LOADED | TRACK_FLAG_LOUDNESS)) == TRACK_FLAG_METADATA_LOADED &&
+           scanner->queued[id] == 0;
+}
+
+static size_t loudness_scanner_pending(const LoudnessScanner *scanner, const TrackStore *store, size_t from) {
+    size_t pending = 0;
+    for (size_t id = from; id < store->count; id++) {
+        if (loudness_scanner_wants(scanner, store, (TrackId)id)) pending++;
+    }
+    return pending;
+}
+
+// Stores finished measurements. A row rewritten while its file was being
+// measured keeps nothing unless the content hash still matches.
+static int loudness_scanner_merge(LoudnessScanner *scanner, TrackStore *store) {
+    LoudnessResult batch[64];
+    int merged = 0;
+    
+    for (;;) {
+        pthread_mutex_lock(&scanner->results_lock);
+        int take = scanner->result_count < 64 ? scanner->result_count : 64;
+        memcpy(batch, scanner->results, sizeof(LoudnessResult) * take);
+        memmove(scanner->results, scanner->results + take,
+                sizeof(LoudnessResult) * (scanner->result_count - take));
+        scanner->result_count -= take;
+        pthread_mutex_unlock(&scanner->results_lock);
+        
+        if (take == 0) break;
+        
+        for (int i = 0; i < take; i++) {
+            TrackId id = batch[i].id;
+            if (id >= store->count) continue;
+            
+            scanner->queued[id] = batch[i].measured ? 0 : 2;
+            if (batch[i].measured && store->file_hash[id] == batch[i].file_hash) {
+                track_store_set_loudness(store, id, &batch[i]);
+            }
+        }
+        merged += take;
+    }
+    
+    return merged;
+}
+
+// Looks at every row again, e.g. after a library scan rewrote some
+static void loudness_scanner_rewind(LoudnessScanner *scanner, TrackStore *store) {
+    scanner->cursor = 0;
+    if (scanner->active && loudness_scanner_reserve(scanner, store)) {
+        scanner->total = atomic_load(&scanner->measured) + atomic_load(&scanner->failed) +
+                         atomic_load(&scanner->outstanding) + loudness_scanner_pending(scanner, store, 0);
+    }
+}
+
+// UI thread, once per frame while no library scan runs. Starts a pass when
+// rows without a measurement show up, keeps a few files per worker in flight
+// and merges what finished.
+static void loudness_scanner_poll(LoudnessScanner *scanner, TrackStore *store) {
+    if (!scanner->active && scanner->cursor >= store->count) return;
+    if (!loudness_scanner_reserve(scanner, store)) return;
+    
+    bool starting = !scanner->active;
+    if (starting) {
+        size_t pending = loudness_scanner_pending(scanner, store, scanner->cursor);
+        if (pending == 0) {
+            scanner->cursor = store->count;
+            return;
+        }
+        if (!loudness_scanner_start(scanner)) {
+            scanner->cursor = store->count;
+            return;
+        }
+        
+        atomic_store(&scanner->measured, 0);
+        atomic_store(&scanner->failed, 0);
+        atomic_store(&scanner->audio_ms, 0);
+        scanner->total = pending;
+        scanner->started = SDL_GetPerformanceCounter();
+        scanner->saved = scanner->started;
+        scanner->saved_measured = 0;
+        scanner->active = true;
+    }
+    
+    bool changed = loudness_scanner_merge(scanner, store) > 0 || starting;
+    
+    size_t limit = (size_t)scanner->pool.worker_count * LOUDNESS_JOBS_PER_WORKER;
+    while (atomic_load(&scanner->outstanding) < limit && scanner->cursor < store->count) {
+        TrackId id = (TrackId)scanner->cursor++;
+        if (!loudness_scanner_wants(scanner, store, id)) continue;
+        
+        const char *path = track_store_text(store, store->path[id]);
+        size_t length = strlen(path) + 1;
+        LoudnessJob *job = malloc(sizeof(LoudnessJob) + length);
+        if (!job) break;
+        
+        job->scanner = scanner;
+        job->id = id;
+        job->file_hash = store->file_hash[id];
+        memcpy(job->path, path, length);
+        
+        scanner->queued[id] = 1;
+        atomic_fetch_add(&scanner->outstanding, 1);
+        task_pool_submit(&scanner->pool, loudness_measure_task, job);
+    }
+    
+    pthread_mutex_lock(&scanner->results_lock);
+    bool done = atomic_load(&scanner->outstanding) == 0 && scanner->result_count == 0 &&
+                scanner->cursor >= store->count;
+    pthread_mutex_unlock(&scanner->results_lock);
+    
+    size_t measured = atomic_load(&scanner->measured);
+    size_t finished = measured + atomic_load(&scanner->failed);
+    double elapsed = (double)(SDL_GetPerformanceCounter() - scanner->started) / SDL_GetPerformanceFrequency();
+    double rate = elapsed > 0.0 ? finished / elapsed : 0.0;
+    double speed = elapsed > 0.0 ? atomic_load(&scanner->audio_ms) / 1000.0 / elapsed : 0.0;
+    
+    // A whole library takes hours; what was measured survives a crash or kill
+    double unsaved = (double)(SDL_GetPerformanceCounter() - scanner->saved) / SDL_GetPerformanceFrequency();
+    if (measured > scanner->saved_measured && (done || unsaved >= LOUDNESS_SAVE_SECONDS)) {
+        loudness_scanner_save(scanner, store, measured);
+    }
+    
+    // Only as tracks finish, so other status messages stay up in between
+    if (done) {
+        scanner->active = false;
+        snprintf(g_app->status_message, MAX_TEXT,
+                 "Loudness measured: %zu tracks, %zu failed (%.0f tracks/s, %.0fx realtime)",
+                 measured, finished - measured, rate, speed);
+    } else if (changed) {
+        snprintf(g_app->status_message, MAX_TEXT,
+                 "Measuring loudness: %zu / %zu tracks (%.0f tracks/s, %.0fx realtime)",
+                 finished, scanner->total, rate, speed);
+    }
+}
+
+// Writes the library database with the results merged so far; never for
+// a benchmark's throwaway library
+static void loudness_scanner_save(LoudnessScanner *scanner, TrackStore *store, size_t measured) {
+    char db_path[MAX_PATH];
+    scanner->saved = SDL_GetPerformanceCounter();
+    scanner->saved_measured = measured;
+    
+    if (!g_app->ephemeral_library && library_db_path(db_path, sizeof(db_path))) {
+        library_db_save(store, db_path);
+    }
+}
+
+// Keeps whatever finished before shutdown
+static void loudness_scanner_cleanup(LoudnessScanner *scanner, TrackStore *store) {
+    if (!scanner->initialized) return;
+    
+    // Queued jobs return straight away; running ones stop at their next frame
+    atomic_store(&scanner->cancelled, true);
+    task_pool_cleanup(&scanner->pool);
+    
+    if (loudness_scanner_reserve(scanner, store)) {
+        loudness_scanner_merge(scanner, store);
+    }
+    
+    free(scanner->results);
+    free(scanner->queued);
+    pthread_mutex_destroy(&scanner->results_lock);
+    memset(scanner, 0, sizeof(LoudnessScanner));
+}
+
+// Album loudness as the duration-weighted mean energy of the measured tracks
+// sharing the track's album tag and directory, and their highest peak
+static void loudness_album(const TrackStore *store, TrackId id, double *loudness, double *peak) {
+    StringRef album = store->album[id];
+    if (album == 0) return;
+    
+    const char *path = track_store_text(store, store->path[id]);
+    size_t directory = (size_t)(track_store_filename(store, id) - path);
+    
+    double energy = 0.0, duration = 0.0, highest = 0.0;
+    for (TrackId other = 0; other < store->count; other++) {
+        if (store->album[other] != album || !(store->flags[other] & TRACK_FLAG_LOUDNESS)) continue;
+        
+        const char *other_path = track_store_text(store, store->path[other]);
+        if ((size_t)(track_store_filename(store, other) - other_path) != directory ||
+            strncmp(path, other_path, directory) != 0) continue;
+        
+        highest = fmax(highest, store->true_peak[other]);
+        if (store->loudness[other] <= LOUDNESS_ABSOLUTE_GATE) continue;
+        
+        double seconds = store->duration_seconds[other] > 0.0 ? store->duration_seconds[other] : 1.0;
+        energy += loudness_energy(store->loudness[other]) * seconds;
+        duration += seconds;
+    }
+    
+    if (duration > 0.0) {
+        *loudness = loudness_lufs(energy / duration);
+        *peak = highest;
+    }
+}
+
+// Linear gain bringing a track to LOUDNESS_TARGET_LUFS, held back so its
+// true peak stays under LOUDNESS_PEAK_CEILING. Unmeasured tracks play as is.
+static float replaygain_for_track(const TrackStore *store, TrackId id, ReplayGainMode mode) {
+    if (mode == REPLAYGAIN_OFF || id >= store->count || !(store->flags[id] & TRACK_FLAG_LOUDNESS)) {
+        return 1.0f;
+    }
+    
+    double loudness = store->loudness[id];
+    double peak = store->true_peak[id];
+    if (mode == REPLAYGAIN_ALBUM) loudness_album(store, id, &loudness, &peak);
+    if (loudness <= LOUDNESS_ABSOLUTE_GATE) return 1.0f;
+    
+    double gain = pow(10.0, (LOUDNESS_TARGET_LUFS - loudness) / 20.0);
+    double ceiling = pow(10.0, LOUDNESS_PEAK_CEILING / 20.0);
+    if (peak > 0.0 && gain * peak > ceiling) gain = ceiling / peak;
+    return (float)gain;
+}
+
+static const char* replaygain_mode_name(ReplayGainMode mode) {
+    static const char *names[REPLAYGAIN_MODE_COUNT] = { "off", "track", "album" };
+    return (unsigned)mode < REPLAYGAIN_MODE_COUNT ? names[mode] : "off";
+}
+
+static bool replaygain_parse(const char *text, ReplayGainMode *mode) {
+    for (int i = 0; i < REPLAYGAIN_MODE_COUNT; i++) {
+        if (strcmp(text, replaygain_mode_name((ReplayGainMode)i)) == 0) {
+            *mode = (ReplayGainMode)i;
+            return true;
+        }
+    }
+    return false;
+}
+
+// Regains the playing track in place and reopens the queued one
+static void replaygain_set_mode(ReplayGainMode mode) {
+    Playlist *playlist = &g_app->current_playlist;
+    g_app->audio.replaygain = mode;
+    
+    if (playlist->current_index >= 0) {
+        TrackId id = playlist->track_ids[playlist->current_index];
+        audio_set_track_gain(&g_app->audio, replaygain_for_track(playlist->store, id, mode));
+        playlist_queue_next(playlist);
+    }
+}
+
+// ═══════════════════════════════════════════════════════════════════════════════
+// ║                       METADATA & FILE HANDLING                             ║
+// ═══════════════════════════════════════════════════════════════════════════════
+
+static void metadata_copy_tag(const AVFormatContext *format, const AVStream *stream,
+                              const char *key, char *output, size_t size) {
+    // Container tags first; Ogg and friends keep them on the stream
+    AVDictionaryEntry *tag = av_dict_get(format->metadata, key, NULL, 0);
+    if (!tag && stream) tag = av_dict_get(stream->metadata, key, NULL, 0);
+    
+    if (tag && tag->value && !output[0]) {
+        snprintf(output, size, "%s", tag->value);
+    }
+}
+
+// Safe to call from any thread; every probe uses its own format context
+static bool metadata_extract_from_file(const char *filepath, TrackMetadata *metadata) {
+    AVFormatContext *format = NULL;
+    memset(metadata, 0, sizeof(TrackMetadata));
+    metadata->date_added = time(NULL);
+    
+    if (avformat_open_input(&format, filepath, NULL, NULL) < 0) {
+        return false;
+    }
+    
+    if (avformat_find_stream_info(format, NULL) < 0) {
+        avformat_close_input(&format);
+        return false;
+    }
+    
+    int index = av_find_best_stream(format, AVMEDIA_TYPE_AUDIO, -1, -1, NULL, 0);
+    if (index < 0) {
+        avformat_close_input(&format);
+        return false;
+    }
+    
+    AVStream *stream = format->streams[index];
+    metadata_copy_tag(format, stream, "title", metadata->title, sizeof(metadata->title));
+    metadata_copy_tag(format, stream, "artist", metadata->artist, sizeof(metadata->artist));
+    metadata_copy_tag(format, stream, "album_artist", metadata->artist, sizeof(metadata->artist));
+    metadata_copy_tag(format, stream, "album", metadata->album, sizeof(metadata->album));
+    metadata_copy_tag(format, stream, "genre", metadata->genre, sizeof(metadata->genre));
+    metadata_copy_tag(format, stream, "date", metadata->year, sizeof(metadata->year));
+    metadata_copy_tag(format, stream, "year", metadata->year, sizeof(metadata->year));
+    metadata_copy_tag(format, stream, "track", metadata->track_num, sizeof(metadata->track_num));
+    
+    if (format->duration != AV_NOPTS_VALUE) {
+        metadata->duration_seconds = (double)format->duration / AV_TIME_BASE;
+    } else if (stream->duration != AV_NOPTS_VALUE) {
+        metadata->duration_seconds = stream->duration * av_q2d(stream->time_base);
+    }
+    format_time_string(metadata->duration_seconds, metadata->duration_str, sizeof(metadata->duration_str));
+    
+    metadata->bitrate = (int)((format->bit_rate ? format->bit_rate : stream->codecpar->bit_rate) / 1000);
+    metadata->sample_rate = stream->codecpar->sample_rate;
+    metadata->channels = stream->codecpar->channels;
+    
+    // "mov,mp4,m4a,..." -> "mov"
+    snprintf(metadata->format, sizeof(metadata->format), "%s", format->iformat->name);
+    char *comma = strchr(metadata->format, ',');
+    if (comma) *comma = '\0';
+    
+    for (unsigned int i = 0; i < format->nb_streams; i++) {
+        if (format->streams[i]->disposition & AV_DISPOSITION_ATTACHED_PIC) {
+            metadata->has_artwork = true;
+        }
+    }
+    
+    avformat_close_input(&format);
+    return true;
+}
+
+static char* get_file_extension(const char *filepath) {
+    const char *dot = strrchr(filepath, '.');
+    const char *separator = strrchr(filepath, PATH_SEP[0]);
+    
+    if (!dot || (separator && dot < separator)) return (char*)"";
+    return (char*)(dot + 1);
+}
+
+static bool file_is_supported_audio(const char *filepath) {
+    static const char *extensions[] = {
+        "mp3", "flac", "ogg", "oga", "opus", "m4a", "m4b", "mp4", "aac", "wav",
+        "aif", "aiff", "wma", "ape", "wv", "mka", "mpc", "tta", "dsf", "dff", "webm"
+    };
+    
+    const char *extension = get_file_extension(filepath);
+    for (size_t i = 0; i < sizeof(extensions) / sizeof(extensions[0]); i++) {
+        if (strcasecmp(extension, extensions[i]) == 0) return true;
+    }
+    return false;
+}
+
+static bool file_is_directory(const char *path) {
+#ifdef _WIN32
+    DWORD attributes = GetFileAttributesA(path);
+    return attributes != INVALID_FILE_ATTRIBUTES && (attributes & FILE_ATTRIBUTE_DIRECTORY);
+#else
+    struct stat info;
+    return stat(path, &info) == 0 && S_ISDIR(info.st_mode);
+#endif
+}
+
+// Walks the tree in the background; tracks arrive in the playlist in batches
+static void file_scan_directory(const char *path, Playlist *playlist) {
+    library_scanner_add_directory(&g_app->scanner, path, playlist);
+}
+
+static void handle_file_drop(const char *filepath) {
+    if (file_is_directory(filepath)) {
+        file_scan_directory(filepath, &g_app->current_playlist);
+    } else if (file_is_supported_audio(filepath)) {
+        library_scanner_add_file(&g_app->scanner, filepath, &g_app->current_playlist);
+    } else {
+        snprintf(g_app->status_message, MAX_TEXT, "Unsupported file: %s", filepath);
+    }
+}
+
+// ═══════════════════════════════════════════════════════════════════════════════
+// ║                              ARTWORK                                       ║
+// ═══════════════════════════════════════════════════════════════════════════════
+
+// Folder images tried, in order, beside the audio file
+static const char *ARTWORK_FOLDER_NAMES[] = {
+    "cover.jpg", "cover.jpeg", "cover.png", "Cover.jpg", "Cover.png",
+    "folder.jpg", "folder.png", "Folder.jpg", "Folder.png",
+    "front.jpg", "front.png", "Front.jpg", "Front.png", "AlbumArt.jpg"
+};
+
+// ~/.cache/tuxmusic/art/<hash of source>-<size>.thumb
+static bool artwork_thumb_path(const char *source, int size, char *path, size_t path_size) {
+    char directory[MAX_PATH];
+    if (!cache_directory(directory, sizeof(directory))) return false;
+    
+    size_t length = strlen(directory);
+    snprintf(directory + length, sizeof(directory) - length, "%sart", PATH_SEP);
+    if (!make_directory(directory)) return false;
+    
+    return snprintf(path, path_size, "%s%s%08x-%d.thumb", directory, PATH_SEP,
+                    hash_string(source), size) < (int)path_size;
+}
+
+// Where a request's artwork comes from: an image file it names, the audio
+// file itself when that embeds a picture, or an image in the same folder
+static bool artwork_source(const ArtworkRequest *request, char *source, size_t size,
+                           bool *embedded, int64_t *file_size, int64_t *file_mtime) {
+    *embedded = false;
+    if (request->image_path[0] && file_get_identity(request->image_path, file_size, file_mtime)) {
+        snprintf(source, size, "%s", request->image_path);
+        return true;
+    }
+    if (request->embedded && file_get_identity(request->path, file_size, file_mtime)) {
+        snprintf(source, size, "%s", request->path);
+        *embedded = true;
+        return true;
+    }
+    
+    char directory[MAX_PATH];
+    snprintf(directory, sizeof(directory), "%s", request->path);
+    char *separator = strrchr(directory, PATH_SEP[0]);
+    if (!separator) return false;
+    *separator = '\0';
+    
+    for (size_t i = 0; i < sizeof(ARTWORK_FOLDER_NAMES) / sizeof(ARTWORK_FOLDER_NAMES[0]); i++) {
+        if (snprintf(source, size, "%s%s%s", directory, PATH_SEP, ARTWORK_FOLDER_NAMES[i]) < (int)size &&
+            file_get_identity(source, file_size, file_mtime)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Thumbnails are raw pixels, trusted only while the source keeps its size and
+// mtime. The file name is just a hash, so the source path is stored and checked.
+static uint32_t* artwork_thumb_load(const char *path, const char *source, int64_t file_size,
+                                    int64_t file_mtime, int *width, int *height) {
+    FILE *file = fopen(path, "rb");
+    if (!file) return NULL;
+    
+    ArtworkThumbHeader header;
+    char stored_path[MAX_PATH];
+    uint32_t *pixels = NULL;
+    bool ok = fread(&header, sizeof(header), 1, file) == 1 &&
+              memcmp(header.magic, ARTWORK_THUMB_MAGIC, sizeof(header.magic)) == 0 &&
+              header.source_size == file_size && header.source_mtime == file_mtime &&
+              header.width > 0 && header.height > 0 && header.width <= 4096 && header.height <= 4096 &&
+              header.path_length < sizeof(stored_path) &&
+              fread(stored_path, 1, header.path_length, file) == header.path_length;
+    
+    if (ok) {
+        stored_path[header.path_length] = '\0';
+        ok = strcmp(stored_path, source) == 0;
+    }
+    
+    if (ok) {
+        size_t count = (size_t)header.width * header.height;
+        pixels = malloc(count * sizeof(uint32_t));
+        if (pixels && fread(pixels, sizeof(uint32_t), count, file) != count) {
+            free(pixels);
+            pixels = NULL;
+        }
+        *width = (int)header.width;
+        *height = (int)header.height;
+    }
+    
+    fclose(file);
+    return pixels;
+}
+
+// Written aside and renamed into place, like the library database, so a
+// reader never sees a thumbnail half written
+static void artwork_thumb_save(const char *path, const char *source, const uint32_t *pixels,
+                               int width, int height, int64_t file_size, int64_t file_mtime) {
+    char temp_path[MAX_PATH];
+    if (snprintf(temp_path, sizeof(temp_path), "%s.tmp", path) >= (int)sizeof(temp_path)) return;
+    
+    FILE *file = fopen(temp_path, "wb");
+    if (!file) return;
+    
+    ArtworkThumbHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, ARTWORK_THUMB_MAGIC, sizeof(header.magic));
+    header.width = (uint32_t)width;
+    header.height = (uint32_t)height;
+    header.source_size = file_size;
+    header.source_mtime = file_mtime;
+    header.path_length = (uint32_t)strlen(source);
+    
+    size_t count = (size_t)width * height;
+    bool ok = fwrite(&header, sizeof(header), 1, file) == 1 &&
+              fwrite(source, 1, header.path_length, file) == header.path_length &&
+              fwrite(pixels, sizeof(uint32_t), count, file) == count;
+    ok = (fclose(file) == 0) && ok;
+    
+#ifdef _WIN32
+    ok = ok && MoveFileExA(temp_path, path, MOVEFILE_REPLACE_EXISTING);
+#else
+    ok = ok && rename(temp_path, path) == 0;
+#endif
+    
+    if (!ok) {
+        remove(temp_path);
+    }
+}
+
+// Decodes the attached picture of an audio file, or an image file, to a surface
+static SDL_Surface* artwork_decode(const char *source, bool embedded) {
+    if (!embedded) return IMG_Load(source);
+    
+    AVFormatContext *format = NULL;
+    if (avformat_open_input(&format, source, NULL, NULL) < 0) return NULL;
+    
+    SDL_Surface *surface = NULL;
+    for (unsigned int i = 0; i < format->nb_streams && !surface; i++) {
+        AVStream *stream = format->streams[i];
+        if (!(stream->disposition & AV_DISPOSITION_ATTACHED_PIC) || stream->attached_pic.size <= 0) continue;
+        
+        // The packet is the image file as stored, JPEG or PNG
+        SDL_RWops *data = SDL_RWFromConstMem(stream->attached_pic.data, stream->attached_pic.size);
+        if (data) surface = IMG_Load_RW(data, 1);
+    }
+    
+    avformat_close_input(&format);
+    return surface;
+}
+
+// Area-average downscale: each output pixel is the mean of the source block
+// it covers, so every source pixel is read once whatever the ratio
+static void artwork_downscale(const uint32_t *src, int src_w, int src_h, int src_pitch,
+                              uint32_t *dst, int dst_w, int dst_h) {
+    for (int y = 0; y < dst_h; y++) {
+        int y0 = (int)((int64_t)y * src_h / dst_h);
+        int y1 = (int)((int64_t)(y + 1) * src_h / dst_h);
+        if (y1 <= y0) y1 = y0 + 1;
+        
+        for (int x = 0; x < dst_w; x++) {
+            int x0 = (int)((int64_t)x * src_w / dst_w);
+            int x1 = (int)((int64_t)(x + 1) * src_w / dst_w);
+            if (x1 <= x0) x1 = x0 + 1;
+            
+            uint32_t sum[4] = {0, 0, 0, 0};
+            for (int sy = y0; sy < y1; sy++) {
+                const uint32_t *row = src + (size_t)sy * src_pitch;
+                for (int sx = x0; sx < x1; sx++) {
+                    uint32_t pixel = row[sx];
+                    sum[0] += pixel & 0xFF;
+                    sum[1] += (pixel >> 8) & 0xFF;
+                    sum[2] += (pixel >> 16) & 0xFF;
+                    sum[3] += pixel >> 24;
+                }
+            }
+            
+            uint32_t count = (uint32_t)((y1 - y0) * (x1 - x0)), half = count / 2;
+            dst[(size_t)y * dst_w + x] = ((sum[0] + half) / count) | (((sum[1] + half) / count) << 8) |
+                                         (((sum[2] + half) / count) << 16) | (((sum[3] + half) / count) << 24);
+        }
+    }
+}
+
+// Everything a request needs, off the UI thread: the disk thumbnail when it
+// is current, otherwise a full decode, downscale and a fresh thumbnail
+static void artwork_load(ArtworkCache *cache, const ArtworkRequest *request, ArtworkResult *result) {
+    char source[MAX_PATH], thumb[MAX_PATH];
+    bool embedded;
+    int64_t file_size, file_mtime;
+    
+    memset(result, 0, sizeof(ArtworkResult));
+    result->track = request->track;
+    result->size = request->size;
+    if (!artwork_source(request, source, sizeof(source), &embedded, &file_size, &file_mtime)) return;
+    
+    bool have_thumb_path = artwork_thumb_path(source, request->size, thumb, sizeof(thumb));
+    if (have_thumb_path) {
+        result->pixels = artwork_thumb_load(thumb, source, file_size, file_mtime,
+                                            &result->width, &result->height);
+        if (result->pixels) {
+            atomic_fetch_add(&cache->thumbs_loaded, 1);
+            return;
+        }
+    }
+    
+    SDL_Surface *decoded = artwork_decode(source, embedded);
+    SDL_Surface *surface = decoded ? SDL_ConvertSurfaceFormat(decoded, SDL_PIXELFORMAT_ARGB8888, 0) : NULL;
+    if (decoded) SDL_FreeSurface(decoded);
+    if (!surface) return;
+    atomic_fetch_add(&cache->decoded, 1);
+    
+    // Fit the longest side to the size asked for; never scale up
+    int width = surface->w, height = surface->h;
+    if (width > request->size || height > request->size) {
+        if (width >= height) {
+            height = (int)((int64_t)height * request->size / width);
+            width = request->size;
+        } else {
+            width = (int)((int64_t)width * request->size / height);
+            height = request->size;
+        }
+        if (width < 1) width = 1;
+        if (height < 1) height = 1;
+    }
+    
+    result->pixels = malloc(sizeof(uint32_t) * (size_t)width * height);
+    if (result->pixels) {
+        artwork_downscale(surface->pixels, surface->w, surface->h, surface->pitch / 4,
+                          result->pixels, width, height);
+        result->width = width;
+        result->height = height;
+        if (have_thumb_path) {
+            artwork_thumb_save(thumb, source, result->pixels, width, height, file_size, file_mtime);
+        }
+    }
+    SDL_FreeSurface(surface);
+}
+
+// Serves the newest request first, so what scrolled into view most
+// recently is what shows up first
+static void* artwork_thread_function(void *arg) {
+    ArtworkCache *cache = arg;
+    ArtworkRequest request;
+    
+    pthread_mutex_lock(&cache->lock);
+    while (cache->running) {
+        if (cache->queue_count == 0) {
+            pthread_cond_wait(&cache->cond, &cache->lock);
+            continue;
+        }
+        request = cache->queue[--cache->queue_count];
+        pthread_mutex_unlock(&cache->lock);
+        
+        ArtworkResult result;
+        artwork_load(cache, &request, &result);
+        
+        pthread_mutex_lock(&cache->lock);
+        if (cache->result_count == cache->result_capacity) {
+            int capacity = cache->result_capacity ? cache->result_capacity * 2 : 16;
+            ArtworkResult *grown = realloc(cache->results, sizeof(ArtworkResult) * capacity);
+            if (!grown) {
+                free(result.pixels);
+                continue;
+            }
+            cache->results = grown;
+            cache->result_capacity = capacity;
+        }
+        cache->results[cache->result_count++] = result;
+        
+        // Wake a main loop that is sleeping on events
+        SDL_Event wake;
+        memset(&wake, 0, sizeof(wake));
+        wake.type = SDL_USEREVENT;
+        SDL_PushEvent(&wake);
+    }
+    pthread_mutex_unlock(&cache->lock);
+    return NULL;
+}
+
+static bool artwork_start(ArtworkCache *cache) {
+    if (cache->initialized) return true;
+    
+    if (pthread_mutex_init(&cache->lock, NULL) != 0) return false;
+    if (pthread_cond_init(&cache->cond, NULL) != 0) {
+        pthread_mutex_destroy(&cache->lock);
+        return false;
+    }
+    
+    cache->running = true;
+    if (pthread_create(&cache->thread, NULL, artwork_thread_function, cache) != 0) {
+        pthread_cond_destroy(&cache->cond);
+        pthread_mutex_destroy(&cache->lock);
+        return false;
+    }
+    if (cache->budget == 0) cache->budget = (size_t)ARTWORK_BUDGET_MB << 20;
+    for (int i = 0; i < ARTWORK_CACHE_SLOTS; i++) {
+        cache->entries[i].track = TRACK_ID_NONE;
+    }
+    cache->initialized = true;
+    return true;
+}
+
+static void artwork_entry_release(ArtworkCache *cache, ArtworkEntry *entry) {
+    if (entry->texture) {
+        SDL_DestroyTexture(entry->texture);
+        cache->bytes -= entry->bytes;
+    }
+    memset(entry, 0, sizeof(ArtworkEntry));
+    entry->track = TRACK_ID_NONE;
+}
+
+// Least recently used entry not drawn this frame, optionally only textures
+static ArtworkEntry* artwork_lru(ArtworkCache *cache, bool textures_only) {
+    ArtworkEntry *victim = NULL;
+    for (int i = 0; i < ARTWORK_CACHE_SLOTS; i++) {
+        ArtworkEntry *entry = &cache->entries[i];
+        if (entry->track == TRACK_ID_NONE || entry->state == ARTWORK_PENDING) continue;
+        if (entry->last_used == cache->frame || (textures_only && !entry->texture)) continue;
+        if (!victim || entry->last_used < victim->last_used) victim = entry;
+    }
+    return victim;
+}
+
+// The artwork for a track fitted to `size`, or NULL while it is still
+// being fetched or when there is none. Never blocks: a miss queues the
+// track for the worker and the texture turns up in a later frame.
+static SDL_Texture* artwork_get(ArtworkCache *cache, const TrackStore *store, TrackId id, int size,
+                                int *width, int *height) {
+    if (id == TRACK_ID_NONE || size <= 0 || !artwork_start(cache)) return NULL;
+    
+    ArtworkEntry *free_entry = NULL;
+    for (int i = 0; i < ARTWORK_CACHE_SLOTS; i++) {
+        ArtworkEntry *entry = &cache->entries[i];
+        if (entry->track == id && entry->size == size) {
+            entry->last_used = cache->frame;
+            if (entry->texture) {
+                *width = entry->width;
+                *height = entry->height;
+            }
+            return entry->texture;
+        }
+        if (entry->track == TRACK_ID_NONE && !free_entry) free_entry = entry;
+    }
+    
+    if (!free_entry) {
+        free_entry = artwork_lru(cache, false);
+        if (!free_entry) return NULL;
+        artwork_entry_release(cache, free_entry);
+    }
+    free_entry->track = id;
+    free_entry->size = size;
+    free_entry->state = ARTWORK_PENDING;
+    free_entry->last_used = cache->frame;
+    
+    pthread_mutex_lock(&cache->lock);
+    
+    // A full queue gives up its oldest request, whose entry goes with it
+    if (cache->queue_count == ARTWORK_QUEUE_SIZE) {
+        const ArtworkRequest *oldest = &cache->queue[0];
+        for (int i = 0; i < ARTWORK_CACHE_SLOTS; i++) {
+            ArtworkEntry *entry = &cache->entries[i];
+            if (entry->track == oldest->track && entry->size == oldest->size) {
+                artwork_entry_release(cache, entry);
+            }
+        }
+        memmove(cache->queue, cache->queue + 1, sizeof(ArtworkRequest) * (ARTWORK_QUEUE_SIZE - 1));
+        cache->queue_count--;
+    }
+    
+    // Paths are copied: the store may grow while the worker runs
+    ArtworkRequest *request = &cache->queue[cache->queue_count++];
+    request->track = id;
+    request->size = size;
+    request->embedded = (store->flags[id] & TRACK_FLAG_HAS_ARTWORK) != 0;
+    snprintf(request->path, sizeof(request->path), "%s", track_store_text(store, store->path[id]));
+    snprintf(request->image_path, sizeof(request->image_path), "%s",
+             track_store_text(store, store->artwork_path[id]));
+    
+    pthread_cond_signal(&cache->cond);
+    pthread_mutex_unlock(&cache->lock);
+    return NULL;
+}
+
+// Turns finished work into textures, then trims to the memory budget.
+// Runs once per frame on the UI thread; true if any artwork arrived.
+static bool artwork_poll(ArtworkCache *cache, SDL_Renderer *renderer) {
+    cache->frame++;
+    if (!cache->initialized) return false;
+    
+    pthread_mutex_lock(&cache->lock);
+    int count = cache->result_count;
+    ArtworkResult *results = cache->results;
+    cache->results = NULL;
+    cache->result_count = cache->result_capacity = 0;
+    pthread_mutex_unlock(&cache->lock);
+    
+    bool arrived = false;
+    for (int r = 0; r < count; r++) {
+        ArtworkResult *result = &results[r];
+        ArtworkEntry *entry = NULL;
+        for (int i = 0; i < ARTWORK_CACHE_SLOTS && !entry; i++) {
+            ArtworkEntry *candidate = &cache->entries[i];
+            if (candidate->track == result->track && candidate->size == result->size &&
+                candidate->state == ARTWORK_PENDING) {
+                entry = candidate;
+            }
+        }
+        
+        // Evicted while in flight: the work is dropped
+        if (entry) {
+            entry->state = ARTWORK_MISSING;
+            if (result->pixels) {
+                SDL_Texture *texture = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_ARGB8888,
+                                                         SDL_TEXTUREACCESS_STATIC,
+                                                         result->width, result->height);
+                if (texture) {
+                    SDL_UpdateTexture(texture, NULL, result->pixels, result->width * 4);
+                    SDL_SetTextureBlendMode(texture, SDL_BLENDMODE_BLEND);
+                    entry->texture = texture;
+                    entry->width = result->width;
+                    entry->height = result->height;
+                    entry->bytes = (size_t)result->width * result->height * 4;
+                    entry->state = ARTWORK_READY;
+                    cache->bytes += entry->bytes;
+                }
+            }
+            arrived = true;
+        }
+        free(result->pixels);
+    }
+    free(results);
+    
+    while (cache->bytes > cache->budget) {
+        ArtworkEntry *victim = artwork_lru(cache, true);
+        if (!victim) break;
+        artwork_entry_release(cache, victim);
+        cache->evicted++;
+    }
+    return arrived;
+}
+
+// After a render device reset. Ready entries are forgotten and fetched
+// again, from the thumbnail cache; work in flight uploads to the new device.
+static void artwork_drop_textures(ArtworkCache *cache) {
+    for (int i = 0; i < ARTWORK_CACHE_SLOTS; i++) {
+        if (cache->entries[i].texture) artwork_entry_release(cache, &cache->entries[i]);
+    }
+}
+
+static void artwork_cleanup(ArtworkCache *cache) {
+    if (!cache->initialized) return;
+    
+    pthread_mutex_lock(&cache->lock);
+    cache->running = false;
+    pthread_cond_signal(&cache->cond);
+    pthread_mutex_unlock(&cache->lock);
+    pthread_join(cache->thread, NULL);
+    
+    printf("  Artwork: %zu decoded, %zu from thumbnails, %llu evicted, %zu KB held\n",
+           atomic_load(&cache->decoded), atomic_load(&cache->thumbs_loaded),
+           (unsigned long long)cache->evicted, cache->bytes / 1024);
+    
+    for (int i = 0; i < ARTWORK_CACHE_SLOTS; i++) {
+        artwork_entry_release(cache, &cache->entries[i]);
+    }
+    for (int i = 0; i < cache->result_count; i++) {
+        free(cache->results[i].pixels);
+    }
+    free(cache->results);
+    pthread_cond_destroy(&cache->cond);
+    pthread_mutex_destroy(&cache->lock);
+    cache->initialized = false;
+}
+
+static Widget* create_album_art_display(const char *id) {
+    return widget_create(WIDGET_ALBUM_ART, id);
+}
+
+// The playing track's cover, fitted and centred, or a placeholder while it
+// loads or when there is none
+static void render_album_art_widget(Widget *widget, SDL_Renderer *renderer) {
+    const Playlist *playlist = &g_app->current_playlist;
+    TrackId id = TRACK_ID_NONE;
+    if (playlist->current_index >= 0 && playlist->current_index < playlist->track_count) {
+        id = playlist->track_ids[playlist->current_index];
+    }
+    
+    render_drop_shadow(renderer, widget->bounds, 6, COLOR_PALETTE.glass_shadow);
+    
+    int width = 0, height = 0;
+    SDL_Texture *art = artwork_get(&g_app->artwork, &g_app->library, id, (int)widget->bounds.w,
+                                   &width, &height);
+    if (!art) {
+        render_rounded_rect(renderer, widget->bounds, 12, COLOR_PALETTE.bg_tertiary);
+        render_text_centered(renderer, g_app->fonts[4], "♪", widget->bounds, COLOR_PALETTE.text_tertiary);
+        return;
+    }
+    
+    float scale = fminf(widget->bounds.w / width, widget->bounds.h / height);
+    SDL_Rect target = {
+        (int)(widget->bounds.x + (widget->bounds.w - width * scale) * 0.5f),
+        (int)(widget->bounds.y + (widget->bounds.h - height * scale) * 0.5f),
+        (int)(width * scale), (int)(height * scale)
+    };
+    
+    // Whatever is queued belongs underneath the cover
+    geom_flush(renderer);
+    SDL_RenderCopy(renderer, art, NULL, &target);
+    g_app->geom.stats.draw_calls++;
+}
+
+// ═══════════════════════════════════════════════════════════════════════════════
+// ║                           DAMAGE TRACKING                                  ║
+// ═══════════════════════════════════════════════════════════════════════════════
+
+static Rect ui_main_area_rect(void) {
+    return (Rect){40, 40, g_app->window_width - 80, 720};
+}
+
+static Rect ui_controls_rect(void) {
+    return (Rect){40, 770, g_app->window_width - 80, 180};
+}
+
+static Rect ui_status_bar_rect(void) {
+    return (Rect){0, g_app->window_height - 30, g_app->window_width, 30};
+}
+
+// Adds a region to redraw next frame. Overlapping regions are merged, and
+// once the list is full everything collapses into one bounding rect.
+static void ui_invalidate(Rect rect) {
+    SDL_Rect add = {
+        (int)floorf(rect.x), (int)floorf(rect.y),
+        (int)ceilf(rect.x + rect.w) - (int)floorf(rect.x),
+        (int)ceilf(rect.y + rect.h) - (int)floorf(rect.y)
+    };
+    
+    // Clamp to the window
+    int right = add.x + add.w < g_app->window_width ? add.x + add.w : g_app->window_width;
+    int bottom = add.y + add.h < g_app->window_height ? add.y + add.h : g_app->window_height;
+    add.x = add.x > 0 ? add.x : 0;
+    add.y = add.y > 0 ? add.y : 0;
+    add.w = right - add.x;
+    add.h = bottom - add.y;
+    if (add.w <= 0 || add.h <= 0) return;
+    
+    for (;;) {
+        bool merged = false;
+        
+        for (int i = 0; i < g_app->damage_count; i++) {
+            SDL_Rect *existing = &g_app->damage[i];
+            if (add.x > existing->x + existing->w || existing->x > add.x + add.w ||
+                add.y > existing->y + existing->h || existing->y > add.y + add.h) {
+                continue;
+            }
+            
+            // Absorb it and retry, since the union may now touch others
+            int x1 = add.x < existing->x ? add.x : existing->x;
+            int y1 = add.y < existing->y ? add.y : existing->y;
+            int x2 = add.x + add.w > existing->x + existing->w ? add.x + add.w : existing->x + existing->w;
+            int y2 = add.y + add.h > existing->y + existing->h ? add.y + add.h : existing->y + existing->h;
+            add = (SDL_Rect){x1, y1, x2 - x1, y2 - y1};
+            
+            *existing = g_app->damage[--g_app->damage_count];
+            merged = true;
+            break;
+        }
+        
+        if (!merged) break;
+    }
+    
+    if (g_app->damage_count == UI_DAMAGE_MAX) {
+        // Too fragmented to be worth clipping separately
+        for (int i = 0; i < g_app->damage_count; i++) {
+            const SDL_Rect *existing = &g_app->damage[i];
+            int x1 = add.x < existing->x ? add.x : existing->x;
+            int y1 = add.y < existing->y ? add.y : existing->y;
+            int x2 = add.x + add.w > existing->x + existing->w ? add.x + add.w : existing->x + existing->w;
+            int y2 = add.y + add.h > existing->y + existing->h ? add.y + add.h : existing->y + existing->h;
+            add = (SDL_Rect){x1, y1, x2 - x1, y2 - y1};
+        }
+        g_app->damage_count = 0;
+    }
+    
+    g_app->damage[g_app->damage_count++] = add;
+}
+
+static void ui_invalidate_all(void) {
+    g_app->damage_count = 0;
+    ui_invalidate((Rect){0, 0, g_app->window_width, g_app->window_height});
+    
+    // The frame texture must match the window
+    if (g_app->frame_texture) {
+        int width = 0, height = 0;
+        SDL_QueryTexture(g_app->frame_texture, NULL, NULL, &width, &height);
+        if (width != g_app->window_width || height != g_app->window_height) {
+            SDL_DestroyTexture(g_app->frame_texture);
+            g_app->frame_texture = NULL;
+        }
+    }
+}
+
+// Damages each composite panel whose content differs from what was drawn
+static void ui_track_changes(void) {
+    UiSnapshot now;
+    memset(&now, 0, sizeof(now));
+    
+    const Playlist *playlist = &g_app->current_playlist;
+    now.track = TRACK_ID_NONE;
+    if (playlist->current_index >= 0 && playlist->current_index < playlist->track_count) {
+        now.track = playlist->track_ids[playlist->current_index];
+        now.track_flags = g_app->library.flags[now.track];
+    }
+    
+    snprintf(now.time_display, sizeof(now.time_display), "%s / %s",
+             g_app->current_time, g_app->total_time);
+    now.shuffle = g_app->audio.shuffle;
+    now.repeat_one = g_app->audio.repeat_one;
+    now.repeat_all = g_app->audio.repeat_all;
+    snprintf(now.status, sizeof(now.status), "%s", g_app->status_message);
+    ui_latency_text(now.latency, sizeof(now.latency));
+    now.track_count = playlist->track_count;
+    
+    UiSnapshot *drawn = &g_app->drawn;
+    
+    if (now.track != drawn->track || now.track_flags != drawn->track_flags) {
+        ui_invalidate(ui_main_area_rect());
+        if (g_app->track_list) widget_mark_dirty(g_app->track_list);
+        if (g_app->album_art) widget_mark_dirty(g_app->album_art);
+    }
+    if (strcmp(now.time_display, drawn->time_display) != 0 || now.shuffle != drawn->shuffle ||
+        now.repeat_one != drawn->repeat_one || now.repeat_all != drawn->repeat_all) {
+        ui_invalidate(ui_controls_rect());
+    }
+    if (strcmp(now.status, drawn->status) != 0 || strcmp(now.latency, drawn->latency) != 0) {
+        ui_invalidate(ui_status_bar_rect());
+    }
+    if (now.track_count != drawn->track_count) {
+        // The sidebar and track list follow the playlist too
+        ui_invalidate_all();
+    }
+    
+    *drawn = now;
+}
+
+// Nothing is playing, animating or arriving from the scanner, and the
+// last frame drew everything there was to draw
+static bool ui_is_idle(void) {
+    return !g_app->audio.playing && !g_app->animating && !g_app->scanner.active &&
+           !g_app->loudness.active && g_app->search.count == g_app->library.count && g_app->damage_count == 0;
+}
+
+// Grid cell holding a window coordinate, clamped to the grid
+static int ui_grid_cell(float v, int cells) {
+    int cell = (int)floorf(v / UI_GRID_CELL);
+    return cell < 0 ? 0 : (cell >= cells ? cells - 1 : cell);
+}
+
+// Buckets every visible widget into the grid cells its bounds overlap.
+// Counting sort: count per cell, sum, then fill back to front so each
+// cell ends at its start and lists its widgets in creation order.
+static void ui_hit_grid_build(void) {
+    HitGrid *grid = &g_app->hit_grid;
+    int cols = (g_app->window_width + UI_GRID_CELL - 1) / UI_GRID_CELL;
+    int rows = (g_app->window_height + UI_GRID_CELL - 1) / UI_GRID_CELL;
+    if (cols < 1) cols = 1;
+    if (rows < 1) rows = 1;
+    int cells = cols * rows;
+    
+    if (cols != grid->cols || rows != grid->rows || !grid->cell_start) {
+        int *cell_start = realloc(grid->cell_start, (size_t)(cells + 1) * sizeof(int));
+        if (!cell_start) return;
+        grid->cell_start = cell_start;
+        grid->cols = cols;
+        grid->rows = rows;
+    }
+    memset(grid->cell_start, 0, (size_t)(cells + 1) * sizeof(int));
+    
+    // Cell range of each widget: first column, last column, first row, last row
+    int span[WIDGET_MAX][4];
+    int total = 0;
+    for (int i = 0; i < g_app->widget_count; i++) {
+        const Widget *widget = &g_app->widgets[i];
+        const Rect *b = &widget->bounds;
+        if (!widget->visible || b->w <= 0 || b->h <= 0) {
+            span[i][0] = span[i][2] = 0;
+            span[i][1] = span[i][3] = -1;
+            continue;
+        }
+        
+        span[i][0] = ui_grid_cell(b->x, cols);
+        span[i][1] = ui_grid_cell(b->x + b->w, cols);
+        span[i][2] = ui_grid_cell(b->y, rows);
+        span[i][3] = ui_grid_cell(b->y + b->h, rows);
+        for (int cy = span[i][2]; cy <= span[i][3]; cy++) {
+            for (int cx = span[i][0]; cx <= span[i][1]; cx++) {
+                grid->cell_start[cy * cols + cx]++;
+                total++;
+            }
+        }
+    }
+    
+    if (total > grid->item_capacity) {
+        uint16_t *items = realloc(grid->items, (size_t)total * sizeof(uint16_t));
+        if (!items) {
+            memset(grid->cell_start, 0, (size_t)(cells + 1) * sizeof(int));
+            return;
+        }
+        grid->items = items;
+        grid->item_capacity = total;
+    }
+    
+    // Each cell's count becomes where it ends
+    for (int c = 1; c < cells; c++) {
+        grid->cell_start[c] += grid->cell_start[c - 1];
+    }
+    grid->cell_start[cells] = total;
+    
+    for (int i = g_app->widget_count - 1; i >= 0; i--) {
+        for (int cy = span[i][2]; cy <= span[i][3]; cy++) {
+            for (int cx = span[i][0]; cx <= span[i][1]; cx++) {
+                grid->items[--grid->cell_start[cy * cols + cx]] = (uint16_t)i;
+            }
+        }
+    }
+    
+    grid->dirty = false;
+}
+
+// Delivers this frame's mouse input to the widgets under the cursor plus
+// the ones that were hovered or held before, which need the leave and the
+// release. Everything else never hears about it.
+static void ui_route_mouse(void) {
+    HitGrid *grid = &g_app->hit_grid;
+    if (grid->dirty) ui_hit_grid_build();
+    
+    Widget *targets[WIDGET_MAX];
+    bool seen[WIDGET_MAX] = {false};
+    int count = 0;
+    
+    int x = g_app->mouse_x, y = g_app->mouse_y;
+    if (grid->cell_start && x >= 0 && y >= 0) {
+        int cx = x / UI_GRID_CELL, cy = y / UI_GRID_CELL;
+        if (cx < grid->cols && cy < grid->rows) {
+            int cell = cy * grid->cols + cx;
+            for (int k = grid->cell_start[cell]; k < grid->cell_start[cell + 1]; k++) {
+                int i = grid->items[k];
+                if (!seen[i]) {
+                    seen[i] = true;
+                    targets[count++] = &g_app->widgets[i];
+                }
+            }
+        }
+    }
+    for (int t = 0; t < g_app->mouse_target_count; t++) {
+        int i = (int)(g_app->mouse_targets[t] - g_app->widgets);
+        if (!seen[i]) {
+            seen[i] = true;
+            targets[count++] = g_app->mouse_targets[t];
+        }
+    }
+    
+    g_app->mouse_target_count = 0;
+    for (int t = 0; t < count; t++) {
+        Widget *widget = targets[t];
+        if (!widget->visible) continue;
+        
+        widget_handle_mouse(widget, x, y, g_app->mouse_pressed, g_app->mouse_released);
+        if (widget->hovered || widget->pressed) {
+            g_app->mouse_targets[g_app->mouse_target_count++] = widget;
+        }
+    }
+}
+
+// ═══════════════════════════════════════════════════════════════════════════════
+// ║                           GEOMETRY BATCH                                   ║
+// ═══════════════════════════════════════════════════════════════════════════════
+
+static SDL_Color geom_color(Color color) {
+    return (SDL_Color){
+        (Uint8)(fmaxf(0.0f, fminf(1.0f, color.r)) * 255.0f + 0.5f),
+        (Uint8)(fmaxf(0.0f, fminf(1.0f, color.g)) * 255.0f + 0.5f),
+        (Uint8)(fmaxf(0.0f, fminf(1.0f, color.b)) * 255.0f + 0.5f),
+        (Uint8)(fmaxf(0.0f, fminf(1.0f, color.a)) * 255.0f + 0.5f)
+    };
+}
+
+#if SDL_VERSION_ATLEAST(2, 0, 18)
+// A flush draws the backdrop layer before the shapes and text, so a cut
+// queued over any of those has to send them out first
+static void geom_keep_order(GeomBuffer *buffer) {
+    GeomBatch *geom = &g_app->geom;
+    if (buffer == &geom->backdrop.layer && geom->shapes.index_count > 0) {
+        geom_flush(g_app->renderer);
+    }
+}
+
+// Grows a buffer, doubling, to take `vertices` and `indices` more
+static bool geom_reserve(GeomBuffer *buffer, int vertices, int indices) {
+    geom_keep_order(buffer);
+    
+    if (buffer->vertex_count + vertices > buffer->vertex_capacity) {
+        int capacity = buffer->vertex_capacity ? buffer->vertex_capacity : 1024;
+        while (capacity < buffer->vertex_count + vertices) capacity *= 2;
+        
+        SDL_Vertex *grown = realloc(buffer->vertices, sizeof(SDL_Vertex) * capacity);
+        if (!grown) return false;
+        buffer->vertices = grown;
+        buffer->vertex_capacity = capacity;
+    }
+    if (buffer->index_count + indices > buffer->index_capacity) {
+        int capacity = buffer->index_capacity ? buffer->index_capacity : 2048;
+        while (capacity < buffer->index_count + indices) capacity *= 2;
+        
+        int *grown = realloc(buffer->indices, sizeof(int) * capacity);
+        if (!grown) return false;
+        buffer->indices = grown;
+        buffer->index_capacity = capacity;
+    }
+    return true;
+}
+
+// The shadow texels, written into the atlas's top-left corner when it is
+// made: white, with alpha falling off smoothly from one opaque texel in the
+// middle, and a clear row and column after them for filtering to stop at.
+// Shadows stretch them as a nine-slice; every other shape samples that
+// middle texel as a solid fill.
+static void geom_shadow_texels(SDL_Texture *texture) {
+    GeomBatch *geom = &g_app->geom;
+    
+    enum { SIZE = GEOM_SHADOW_EDGE * 2 + 1, PITCH = SIZE + 1 };
+    Uint32 pixels[PITCH * PITCH];
+    for (int y = 0; y < PITCH; y++) {
+        for (int x = 0; x < PITCH; x++) {
+            float dx = (float)(x - GEOM_SHADOW_EDGE), dy = (float)(y - GEOM_SHADOW_EDGE);
+            float t = fminf(1.0f, sqrtf(dx * dx + dy * dy) / GEOM_SHADOW_EDGE);
+            float alpha = (x < SIZE && y < SIZE) ? 1.0f - t * t * (3.0f - 2.0f * t) : 0.0f;
+            pixels[y * PITCH + x] = ((Uint32)(alpha * 255.0f + 0.5f) << 24) | 0x00FFFFFFu;
+        }
+    }
+    
+    SDL_Rect area = { 0, 0, PITCH, PITCH };
+    SDL_UpdateTexture(texture, &area, pixels, PITCH * sizeof(Uint32));
+    geom->solid_u = (GEOM_SHADOW_EDGE + 0.5f) / TEXT_ATLAS_SIZE;
+    geom->shadow_u = (float)SIZE / TEXT_ATLAS_SIZE;
+}
+
+// The texture every shape samples, see GlyphAtlas
+static SDL_Texture* geom_texture(SDL_Renderer *renderer) {
+    GlyphAtlas *atlas = text_atlas(renderer);
+    return atlas ? atlas->texture : NULL;
+}
+
+// Quarter circle for a radius, built the first time the radius is used.
+// Radii past the table reuse its largest entry, scaled by the caller.
+static const CornerMesh* geom_corner(int radius) {
+    CornerMesh *mesh = &g_app->geom.corners[radius];
+    if (mesh->segments == 0) {
+        int segments = radius / 3 + 2;
+        if (segments > GEOM_CORNER_SEGMENTS) segments = GEOM_CORNER_SEGMENTS;
+        
+        for (int k = 0; k <= segments; k++) {
+            float angle = k * (float)M_PI * 0.5f / segments;
+            mesh->arc[k] = (Point){ cosf(angle) * radius, sinf(angle) * radius };
+        }
+        mesh->segments = segments;
+    }
+    return mesh;
+}
+
+static SDL_Vertex geom_vertex(float x, float y, SDL_Color color, float u, float v) {
+    SDL_Vertex vertex;
+    vertex.position.x = x;
+    vertex.position.y = y;
+    vertex.color = color;
+    vertex.tex_coord.x = u;
+    vertex.tex_coord.y = v;
+    return vertex;
+}
+
+static SDL_Vertex geom_vertex_mapped(float x, float y, SDL_Color color, const GeomTexMap *map) {
+    return geom_vertex(x, y, color, map->u + x * map->u_per_x, map->v + y * map->v_per_y);
+}
+
+// Queues a filled rounded rectangle: a fan from the center to the outline,
+// ringed by a one-pixel strip fading to transparent as cheap antialiasing.
+// Texture coordinates follow window position through `map`.
+static void geom_rounded_rect(GeomBuffer *buffer, Rect rect, float radius, SDL_Color color,
+                              const GeomTexMap *map) {
+    if (rect.w <= 0.0f || rect.h <= 0.0f || color.a == 0) return;
+    
+    radius = fmaxf(0.0f, fminf(radius, fminf(rect.w, rect.h) * 0.5f));
+    int whole = (int)(radius + 0.5f);
+    if (whole >= GEOM_CORNER_RADII) whole = GEOM_CORNER_RADII - 1;
+    
+    // Outline clockwise from the top-left corner, with outward normals
+    Point outline[4 * (GEOM_CORNER_SEGMENTS + 1)], normal[4 * (GEOM_CORNER_SEGMENTS + 1)];
+    int n = 0;
+    if (whole == 0) {
+        const float d = 0.70710678f;
+        outline[0] = (Point){ rect.x, rect.y };                   normal[0] = (Point){ -d, -d };
+        outline[1] = (Point){ rect.x + rect.w, rect.y };          normal[1] = (Point){  d, -d };
+        outline[2] = (Point){ rect.x + rect.w, rect.y + rect.h }; normal[2] = (Point){  d,  d };
+        outline[3] = (Point){ rect.x, rect.y + rect.h };          normal[3] = (Point){ -d,  d };
+        n = 4;
+    } else {
+        const CornerMesh *mesh = geom_corner(whole);
+        float scale = radius / whole, inverse = 1.0f / whole;
+        Point center[4] = {
+            { rect.x + radius, rect.y + radius },
+            { rect.x + rect.w - radius, rect.y + radius },
+            { rect.x + rect.w - radius, rect.y + rect.h - radius },
+            { rect.x + radius, rect.y + rect.h - radius }
+        };
+        static const float sign[4][2] = { {-1, -1}, {1, -1}, {1, 1}, {-1, 1} };
+        
+        for (int c = 0; c < 4; c++) {
+            for (int k = 0; k <= mesh->segments; k++) {
+                // Odd corners run the arc backwards to stay clockwise
+                Point arc = mesh->arc[(c & 1) ? mesh->segments - k : k];
+                outline[n] = (Point){ center[c].x + sign[c][0] * arc.x * scale,
+                                      center[c].y + sign[c][1] * arc.y * scale };
+                normal[n] = (Point){ sign[c][0] * arc.x * inverse, sign[c][1] * arc.y * inverse };
+                n++;
+            }
+        }
+    }
+    
+    if (!geom_reserve(buffer, 1 + n * 2, n * 9)) return;
+    SDL_Color clear = color;
+    clear.a = 0;
+    
+    int base = buffer->vertex_count;
+    SDL_Vertex *v = &buffer->vertices[base];
+    v[0] = geom_vertex_mapped(rect.x + rect.w * 0.5f, rect.y + rect.h * 0.5f, color, map);
+    for (int i = 0; i < n; i++) {
+        v[1 + i] = geom_vertex_mapped(outline[i].x, outline[i].y, color, map);
+        v[1 + n + i] = geom_vertex_mapped(outline[i].x + normal[i].x, outline[i].y + normal[i].y,
+                                          clear, map);
+    }
+    
+    int *index = &buffer->indices[buffer->index_count];
+    for (int i = 0; i < n; i++) {
+        int j = (i + 1) % n;
+        int inner_i = base + 1 + i, inner_j = base + 1 + j;
+        int outer_i = inner_i + n, outer_j = inner_j + n;
+        *index++ = base;    *index++ = inner_i; *index++ = inner_j;
+        *index++ = inner_i; *index++ = outer_i; *index++ = outer_j;
+        *index++ = inner_i; *index++ = outer_j; *index++ = inner_j;
+    }
+    
+    buffer->vertex_count += 1 + n * 2;
+    buffer->index_count += n * 9;
+}
+
+// Reserves `count` quads in the shapes buffer, each indexed as two
+// triangles, and returns their corners for the caller to fill in the order
+// top-left, top-right, bottom-left, bottom-right
+static SDL_Vertex* geom_quads(int count) {
+    GeomBuffer *shapes = &g_app->geom.shapes;
+    if (!geom_reserve(shapes, count * 4, count * 6)) return NULL;
+    
+    int base = shapes->vertex_count;
+    int *index = &shapes->indices[shapes->index_count];
+    for (int i = 0; i < count; i++, base += 4) {
+        *index++ = base;     *index++ = base + 1; *index++ = base + 2;
+        *index++ = base + 1; *index++ = base + 3; *index++ = base + 2;
+    }
+    
+    SDL_Vertex *vertices = &shapes->vertices[shapes->vertex_count];
+    shapes->vertex_count += count * 4;
+    shapes->index_count += count * 6;
+    return vertices;
+}
+#endif
+
+static void geom_begin_frame(void) {
+    GeomBatch *geom = &g_app->geom;
+    geom->last = geom->stats;
+    memset(&geom->stats, 0, sizeof(GeomStats));
+}
+
+// Submits everything queued: the backdrop layer, then shapes and text in
+// one call. Must run before the clip rect changes and before the atlas is
+// rewritten.
+static void geom_flush(SDL_Renderer *renderer) {
+#if SDL_VERSION_ATLEAST(2, 0, 18)
+    GeomBatch *geom = &g_app->geom;
+    GeomBuffer *backdrop = &geom->backdrop.layer;
+    
+    if (backdrop->index_count > 0 && geom->backdrop.texture) {
+        SDL_RenderGeometry(renderer, geom->backdrop.texture, backdrop->vertices, backdrop->vertex_count,
+                           backdrop->indices, backdrop->index_count);
+        geom->stats.draw_calls++;
+        geom->stats.vertices += backdrop->vertex_count;
+    }
+    backdrop->vertex_count = backdrop->index_count = 0;
+    
+    if (geom->shapes.index_count > 0) {
+        SDL_RenderGeometry(renderer, g_app->text.atlas.texture, geom->shapes.vertices,
+                           geom->shapes.vertex_count, geom->shapes.indices, geom->shapes.index_count);
+        geom->stats.draw_calls++;
+        geom->stats.vertices += geom->shapes.vertex_count;
+    }
+    geom->shapes.vertex_count = geom->shapes.index_count = 0;
+#else
+    (void)renderer;
+#endif
+}
+
+// After a render device reset; the backdrop is made again on first use, and
+// the shadow texels come back with the atlas (text_drop_atlas)
+static void geom_drop_textures(void) {
+    GeomBatch *geom = &g_app->geom;
+    
+    if (geom->backdrop.texture) SDL_DestroyTexture(geom->backdrop.texture);
+    geom->backdrop.texture = NULL;
+    geom->backdrop.stale = true;
+}
+
+static void geom_cleanup(void) {
+    GeomBatch *geom = &g_app->geom;
+    
+    if (geom->backdrop.texture) SDL_DestroyTexture(geom->backdrop.texture);
+    free(geom->backdrop.layer.vertices);
+    free(geom->backdrop.layer.indices);
+    free(geom->shapes.vertices);
+    free(geom->shapes.indices);
+    memset(geom, 0, sizeof(GeomBatch));
+}
+
+#if SDL_VERSION_ATLEAST(2, 0, 18)
+// One box pass down each column of `src` (width x height RGBA floats),
+// written transposed into `dst` (height x width) so the same pass run again
+// blurs along the original rows. A running sum makes the cost independent
+// of the radius; past the edges the border pixel repeats.
+static void backdrop_blur_scalar(const float *src, float *dst, int width, int height, int radius) {
+    const float scale = 1.0f / (radius * 2 + 1);
+    
+    for (int x = 0; x < width; x++) {
+        float sum[4];
+        for (int c = 0; c < 4; c++) sum[c] = src[x * 4 + c] * (radius + 1);
+        for (int i = 1; i <= radius; i++) {
+            const float *p = src + ((size_t)(i < height ? i : height - 1) * width + x) * 4;
+            for (int c = 0; c < 4; c++) sum[c] += p[c];
+        }
+        
+        for (int y = 0; y < height; y++) {
+            float *out = dst + ((size_t)x * height + y) * 4;
+            for (int c = 0; c < 4; c++) out[c] = sum[c] * scale;
+            
+            int enter = y + radius + 1 < height ? y + radius + 1 : height - 1;
+            int leave = y - radius > 0 ? y - radius : 0;
+            const float *in = src + ((size_t)enter * width + x) * 4;
+            const float *gone = src + ((size_t)leave * width + x) * 4;
+            for (int c = 0; c < 4; c++) sum[c] += in[c] - gone[c];
+        }
+    }
+}
+
+#ifdef TUXMUSIC_X86_SIMD
+// One pixel per vector, four columns per step so each row read is a single
+// 64-byte run
+__attribute__((target("sse2")))
+static void backdrop_blur_sse(const float *src, float *dst, int width, int height, int radius) {
+    const __m128 scale = _mm_set1_ps(1.0f / (radius * 2 + 1));
+    const __m128 edge = _mm_set1_ps((float)(radius + 1));
+    int x = 0;
+    
+    for (; x + 4 <= width; x += 4) {
+        __m128 sum[4];
+        for (int k = 0; k < 4; k++) sum[k] = _mm_mul_ps(_mm_loadu_ps(src + (x + k) * 4), edge);
+        for (int i = 1; i <= radius; i++) {
+            const float *p = src + ((size_t)(i < height ? i : height - 1) * width + x) * 4;
+            for (int k = 0; k < 4; k++) sum[k] = _mm_add_ps(sum[k], _mm_loadu_ps(p + k * 4));
+        }
+        
+        for (int y = 0; y < height; y++) {
+            for (int k = 0; k < 4; k++) {
+                _mm_storeu_ps(dst + ((size_t)(x + k) * height + y) * 4, _mm_mul_ps(sum[k], scale));
+            }
+            
+            int enter = y + radius + 1 < height ? y + radius + 1 : height - 1;
+            int leave = y - radius > 0 ? y - radius : 0;
+            const float *in = src + ((size_t)enter * width + x) * 4;
+            const float *gone = src + ((size_t)leave * width + x) * 4;
+            for (int k = 0; k < 4; k++) {
+                sum[k] = _mm_add_ps(sum[k], _mm_sub_ps(_mm_loadu_ps(in + k * 4), _mm_loadu_ps(gone + k * 4)));
+            }
+        }
+    }
+    
+    for (; x < width; x++) {
+        __m128 sum = _mm_mul_ps(_mm_loadu_ps(src + x * 4), edge);
+        for (int i = 1; i <= radius; i++) {
+            sum = _mm_add_ps(sum, _mm_loadu_ps(src + ((size_t)(i < height ? i : height - 1) * width + x) * 4));
+        }
+        for (int y = 0; y < height; y++) {
+            _mm_storeu_ps(dst + ((size_t)x * height + y) * 4, _mm_mul_ps(sum, scale));
+            
+            int enter = y + radius + 1 < height ? y + radius + 1 : height - 1;
+            int leave = y - radius > 0 ? y - radius : 0;
+            sum = _mm_add_ps(sum, _mm_sub_ps(_mm_loadu_ps(src + ((size_t)enter * width + x) * 4),
+                                             _mm_loadu_ps(src + ((size_t)leave * width + x) * 4)));
+        }
+    }
+}
+#endif
+#endif
+
+// Redraws the background offscreen, reads it back and blurs a half-size
+// copy, when the window size has changed since the last time or the
+// backdrop was marked stale. A failure leaves no texture and the plain
+// gradient and unblurred glass are drawn instead.
+static void backdrop_update(SDL_Renderer *renderer) {
+#if SDL_VERSION_ATLEAST(2, 0, 18)
+    Backdrop *backdrop = &g_app->geom.backdrop;
+    int width = g_app->window_width, height = g_app->window_height;
+    if (!backdrop->stale && backdrop->width == width && backdrop->height == height) return;
+    
+    backdrop->width = width;
+    backdrop->height = height;
+    backdrop->stale = false;
+    if (backdrop->texture) {
+        SDL_DestroyTexture(backdrop->texture);
+        backdrop->texture = NULL;
+    }
+    if (width < 2 || height < 2 || !geom_texture(renderer)) return;
+    
+    if (!backdrop->kernel) {
+        backdrop->kernel = backdrop_blur_scalar;
+#ifdef TUXMUSIC_X86_SIMD
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("sse2")) backdrop->kernel = backdrop_blur_sse;
+#endif
+    }
+    
+    // The blurred copy goes to the right, or below where that is too wide for
+    // the renderer; with neither fitting there is no backdrop
+    int half_w = width / 2, half_h = height / 2;
+    SDL_RendererInfo info;
+    int max_w = 0, max_h = 0;
+    if (SDL_GetRendererInfo(renderer, &info) == 0) {
+        max_w = info.max_texture_width;
+        max_h = info.max_texture_height;
+    }
+    int stride = width + half_w, rows = height;
+    backdrop->blur_x = width;
+    backdrop->blur_y = 0;
+    if (max_w > 0 && stride > max_w) {
+        stride = width;
+        rows = height + half_h;
+        backdrop->blur_x = 0;
+        backdrop->blur_y = height;
+    }
+    if ((max_w > 0 && stride > max_w) || (max_h > 0 && rows > max_h)) return;
+    
+    Uint32 *pixels = malloc(sizeof(Uint32) * (size_t)stride * rows);
+    float *work = malloc(sizeof(float) * 4 * 2 * (size_t)half_w * half_h);
+    SDL_Texture *target = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_ARGB8888,
+                                            SDL_TEXTUREACCESS_TARGET, width, height);
+    SDL_Texture *texture = NULL;
+    if (!pixels || !work || !target) goto done;
+    
+    // The background alone, read back into the left of the pixel buffer
+    SDL_Texture *previous = SDL_GetRenderTarget(renderer);
+    SDL_SetRenderTarget(renderer, target);
+    SDL_RenderSetClipRect(renderer, NULL);
+    render_background_gradient();
+    geom_flush(renderer);
+    int read = SDL_RenderReadPixels(renderer, NULL, SDL_PIXELFORMAT_ARGB8888, pixels, stride * sizeof(Uint32));
+    SDL_SetRenderTarget(renderer, previous);
+    if (read != 0) goto done;
+    
+    // Box-filter down to half size, then blur both axes there
+    float *a = work, *b = work + 4 * (size_t)half_w * half_h;
+    for (int y = 0; y < half_h; y++) {
+        const Uint32 *row0 = pixels + (size_t)(y * 2) * stride;
+        const Uint32 *row1 = row0 + stride;
+        for (int x = 0; x < half_w; x++) {
+            float *out = a + ((size_t)y * half_w + x) * 4;
+            for (int c = 0; c < 4; c++) {
+                int shift = c * 8;
+                out[c] = (((row0[x * 2] >> shift) & 0xFF) + ((row0[x * 2 + 1] >> shift) & 0xFF) +
+                          ((row1[x * 2] >> shift) & 0xFF) + ((row1[x * 2 + 1] >> shift) & 0xFF)) * 0.25f;
+            }
+        }
+    }
+    for (int pass = 0; pass < BACKDROP_BLUR_PASSES; pass++) {
+        backdrop->kernel(a, b, half_w, half_h, BACKDROP_BLUR_RADIUS);
+        backdrop->kernel(b, a, half_h, half_w, BACKDROP_BLUR_RADIUS);
+    }
+    
+    // Blurred copy beside or below the sharp one; the rest stays unused
+    for (int y = 0; y < half_h; y++) {
+        Uint32 *out = pixels + (size_t)(backdrop->blur_y + y) * stride + backdrop->blur_x;
+        for (int x = 0; x < half_w; x++) {
+            const float *in = a + ((size_t)y * half_w + x) * 4;
+            Uint32 pixel = 0;
+            for (int c = 0; c < 4; c++) pixel |= (Uint32)(in[c] + 0.5f) << (c * 8);
+            out[x] = pixel;
+        }
+    }
+    
+    texture = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_ARGB8888, SDL_TEXTUREACCESS_STATIC, stride, rows);
+    if (!texture) goto done;
+    SDL_UpdateTexture(texture, NULL, pixels, stride * sizeof(Uint32));
+    SDL_SetTextureBlendMode(texture, SDL_BLENDMODE_BLEND);
+#if SDL_VERSION_ATLEAST(2, 0, 12)
+    SDL_SetTextureScaleMode(texture, SDL_ScaleModeLinear);
+#endif
+    backdrop->texture = texture;
+    backdrop->texture_width = stride;
+    backdrop->texture_height = rows;
+    
+done:
+    if (target) SDL_DestroyTexture(target);
+    free(pixels);
+    free(work);
+#else
+    (void)renderer;
+#endif
+}
+
+// Queues `rect` cut from the backdrop, sharp or blurred, at the same window
+// position it was drawn at. False when there is no backdrop to draw from.
+static bool backdrop_draw(Rect rect, float radius, bool blurred) {
+#if SDL_VERSION_ATLEAST(2, 0, 18)
+    Backdrop *backdrop = &g_app->geom.backdrop;
+    if (!backdrop->texture) return false;
+    
+    float texture_w = (float)backdrop->texture_width, texture_h = (float)backdrop->texture_height;
+    GeomTexMap map = blurred ?
+        (GeomTexMap){ backdrop->blur_x / texture_w, 0.5f / texture_w, 
+                      backdrop->blur_y / texture_h, 0.5f / texture_h } :
+        (GeomTexMap){ 0.0f, 1.0f / texture_w, 0.0f, 1.0f / texture_h };
+    geom_rounded_rect(&backdrop->layer, rect, radius, (SDL_Color){255, 255, 255, 255}, &map);
+    return true;
+#else
+    (void)rect; (void)radius; (void)blurred;
+    return false;
+#endif
+}
+
+// Without the geometry API (SDL before 2.0.18) shapes are drawn at once as
+// plain rectangles, and counted one draw call each
+static void geom_fill_immediate(SDL_Renderer *renderer, Rect rect, Color color) {
+    SDL_Color c = geom_color(color);
+    SDL_Rect target = {
+        (int)floorf(rect.x), (int)floorf(rect.y), (int)ceilf(rect.w), (int)ceilf(rect.h)
+    };
+    SDL_SetRenderDrawBlendMode(renderer, SDL_BLENDMODE_BLEND);
+    SDL_SetRenderDrawColor(renderer, c.r, c.g, c.b, c.a);
+    SDL_RenderFillRect(renderer, &target);
+    g_app->geom.stats.draw_calls++;
+}
+
+static void render_rounded_rect(SDL_Renderer *renderer, Rect rect, float radius, Color color) {
+#if SDL_VERSION_ATLEAST(2, 0, 18)
+    if (!geom_texture(renderer)) return;
+    
+    GeomTexMap solid = { g_app->geom.solid_u, 0.0f, g_app->geom.solid_u, 0.0f };
+    geom_rounded_rect(&g_app->geom.shapes, rect, radius, geom_color(color), &solid);
+#else
+    (void)radius;
+    geom_fill_immediate(renderer, rect, color);
+#endif
+}
+
+static void render_gradient_rect(SDL_Renderer *renderer, Rect rect, Color top, Color bottom) {
+#if SDL_VERSION_ATLEAST(2, 0, 18)
+    GeomBatch *geom = &g_app->geom;
+    if (!geom_texture(renderer) || !geom_reserve(&geom->shapes, 4, 6)) return;
+    
+    SDL_Color a = geom_color(top), b = geom_color(bottom);
+    float u = geom->solid_u;
+    int base = geom->shapes.vertex_count;
+    SDL_Vertex *v = &geom->shapes.vertices[base];
+    v[0] = geom_vertex(rect.x, rect.y, a, u, u);
+    v[1] = geom_vertex(rect.x + rect.w, rect.y, a, u, u);
+    v[2] = geom_vertex(rect.x + rect.w, rect.y + rect.h, b, u, u);
+    v[3] = geom_vertex(rect.x, rect.y + rect.h, b, u, u);
+    
+    int *index = &geom->shapes.indices[geom->shapes.index_count];
+    index[0] = base;     index[1] = base + 1; index[2] = base + 2;
+    index[3] = base;     index[4] = base + 2; index[5] = base + 3;
+    geom->shapes.vertex_count += 4;
+    geom->shapes.index_count += 6;
+#else
+    // A few bands approximate the blend
+    const int bands = 16;
+    for (int i = 0; i < bands; i++) {
+        Rect band = { rect.x, rect.y + rect.h * i / bands, rect.w, rect.h / bands + 1.0f };
+        geom_fill_immediate(renderer, band, color_lerp(top, bottom, (i + 0.5f) / bands));
+    }
+#endif
+}
+
+// A soft shadow under `rect`, dropped by `offset` and spreading twice as far:
+// the shadow texture as a nine-slice, its corners unstretched and its
+// opaque middle texel filling the center
+static void render_drop_shadow(SDL_Renderer *renderer, Rect rect, float offset, Color color) {
+    float spread = fmaxf(2.0f, offset * 2.0f);
+    Rect outer = { rect.x - spread, rect.y - spread + offset, rect.w + spread * 2, rect.h + spread * 2 };
+    
+#if SDL_VERSION_ATLEAST(2, 0, 18)
+    GeomBatch *geom = &g_app->geom;
+    if (!geom_texture(renderer) || !geom_reserve(&geom->shapes, 16, 54)) return;
+    
+    float corner = fminf(spread * 2.0f, fminf(outer.w, outer.h) * 0.5f);
+    float xs[4] = { outer.x, outer.x + corner, outer.x + outer.w - corner, outer.x + outer.w };
+    float ys[4] = { outer.y, outer.y + corner, outer.y + outer.h - corner, outer.y + outer.h };
+    float uv[4] = { 0.0f, geom->solid_u, geom->solid_u, geom->shadow_u };
+    SDL_Color c = geom_color(color);
+    
+    int base = geom->shapes.vertex_count;
+    SDL_Vertex *v = &geom->shapes.vertices[base];
+    for (int row = 0; row < 4; row++) {
+        for (int col = 0; col < 4; col++) {
+            v[row * 4 + col] = geom_vertex(xs[col], ys[row], c, uv[col], uv[row]);
+        }
+    }
+    
+    int *index = &geom->shapes.indices[geom->shapes.index_count];
+    for (int row = 0; row < 3; row++) {
+        for (int col = 0; col < 3; col++) {
+            int i = base + row * 4 + col;
+            *index++ = i;     *index++ = i + 1; *index++ = i + 5;
+            *index++ = i;     *index++ = i + 5; *index++ = i + 4;
+        }
+    }
+    geom->shapes.vertex_count += 16;
+    geom->shapes.index_count += 54;
+#else
+    color.a *= 0.5f;
+    geom_fill_immediate(renderer, (Rect){ rect.x, rect.y + offset, rect.w, rect.h }, color);
+    (void)outer;
+#endif
+}
+
+// Frosted panel: a soft shadow, the cached blurred background cut to the
+// panel, a translucent fill and a sheen fading down from a bright top edge.
+// The blur is the same for every panel; blur_radius sets how far the
+// shadow spreads.
+static void render_glassmorphism_effect(SDL_Renderer *renderer, Rect rect, float blur_radius) {
+    const float radius = 16.0f;
+    
+    render_drop_shadow(renderer, rect, blur_radius * 0.5f, COLOR_PALETTE.glass_shadow);
+    backdrop_draw(rect, radius, true);
+    
+    Color fill = COLOR_PALETTE.bg_secondary;
+    fill.a = 0.6f;
+    render_rounded_rect(renderer, rect, radius, fill);
+    
+    if (rect.w > radius * 2) {
+        Color sheen = COLOR_PALETTE.glass_light, clear = sheen;
+        clear.a = 0.0f;
+        render_gradient_rect(renderer, (Rect){ rect.x + radius, rect.y + 1, rect.w - radius * 2, rect.h * 0.4f },
+                             sheen, clear);
+        render_rounded_rect(renderer, (Rect){ rect.x + radius, rect.y, rect.w - radius * 2, 1 }, 0,
+                            COLOR_PALETTE.glass_border);
+    }
+}
+
+// ═══════════════════════════════════════════════════════════════════════════════
+// ║                           TEXT RENDERING                                   ║
+// ═══════════════════════════════════════════════════════════════════════════════
+
+// Decodes one code point and advances; malformed input yields U+FFFD
+static uint32_t utf8_decode(const char **text) {
+    const unsigned char *p = (const unsigned char*)*text;
+    uint32_t codepoint;
+    int extra;
+    
+    if (p[0] < 0x80) { codepoint = p[0]; extra = 0; }
+    else if ((p[0] & 0xE0) == 0xC0) { codepoint = p[0] & 0x1F; extra = 1; }
+    else if ((p[0] & 0xF0) == 0xE0) { codepoint = p[0] & 0x0F; extra = 2; }
+    else if ((p[0] & 0xF8) == 0xF0) { codepoint = p[0] & 0x07; extra = 3; }
+    else { *text += 1; return 0xFFFD; }
+    
+    for (int i = 1; i <= extra; i++) {
+        if ((p[i] & 0xC0) != 0x80) {
+            *text += i;
+            return 0xFFFD;
+        }
+        codepoint = (codepoint << 6) | (p[i] & 0x3F);
+    }
+    
+    *text += extra + 1;
+    return codepoint;
+}
+
+// Index into g_app->fonts, or -1 for a font the atlas does not serve
+static int text_font_index(TTF_Font *font) {
+    for (int i = 0; i < TEXT_FONTS; i++) {
+        if (font && g_app->fonts[i] == font) return i;
+    }
+    return -1;
+}
+
+static GlyphAtlas* text_atlas(SDL_Renderer *renderer) {
+    GlyphAtlas *atlas = &g_app->text.atlas;
+    if (!atlas->texture) {
+        atlas->glyphs = calloc(TEXT_ATLAS_SLOTS, sizeof(AtlasGlyph));
+        atlas->texture = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_ARGB8888, 
+                                           SDL_TEXTUREACCESS_STATIC, 
+                                           TEXT_ATLAS_SIZE, TEXT_ATLAS_SIZE);
+        if (!atlas->glyphs || !atlas->texture) {
+            free(atlas->glyphs);
+            if (atlas->texture) SDL_DestroyTexture(atlas->texture);
+            memset(atlas, 0, sizeof(GlyphAtlas));
+            return NULL;
+        }
+        SDL_SetTextureBlendMode(atlas->texture, SDL_BLENDMODE_BLEND);
+#if SDL_VERSION_ATLEAST(2, 0, 12)
+        // Stretched shadow corners need filtering whatever the global hint says;
+        // glyphs land on whole pixels at their own size, so it leaves them sharp
+        SDL_SetTextureScaleMode(atlas->texture, SDL_ScaleModeLinear);
+#endif
+#if SDL_VERSION_ATLEAST(2, 0, 18)
+        geom_shadow_texels(atlas->texture);
+#endif
+        atlas->shelf_y = TEXT_ATLAS_TOP;
+    }
+    return atlas;
+}
+
+// Forgets every glyph; layouts built on the old contents notice the new generation
+static void text_atlas_clear(GlyphAtlas *atlas) {
+    // Text already queued this frame still points into the old contents
+    geom_flush(g_app->renderer);
+    
+    memset(atlas->glyphs, 0, sizeof(AtlasGlyph) * TEXT_ATLAS_SLOTS);
+    atlas->glyph_count = 0;
+    atlas->shelf_x = atlas->shelf_height = 0;
+    atlas->shelf_y = TEXT_ATLAS_TOP;
+    atlas->generation++;
+}
+
+// Finds a glyph of g_app->fonts[font_index], rasterizing and uploading it on
+// first use
+static const AtlasGlyph* text_atlas_glyph(GlyphAtlas *atlas, int font_index, uint32_t codepoint) {
+    TTF_Font *font = g_app->fonts[font_index];
+    uint32_t key = (uint32_t)font_index << 24 | codepoint;
+    size_t mask = TEXT_ATLAS_SLOTS - 1;
+    size_t slot = (key * 2654435761u) & mask;
+    
+    while (atlas->glyphs[slot].key != 0) {
+        if (atlas->glyphs[slot].key == key) return &atlas->glyphs[slot];
+        slot = (slot + 1) & mask;
+    }
+    
+#if SDL_TTF_VERSION_ATLEAST(2, 0, 18)
+    int minx, maxx, miny, maxy, advance;
+    if (TTF_GlyphMetrics32(font, codepoint, &minx, &maxx, &miny, &maxy, &advance) != 0) return NULL;
+    SDL_Surface *surface = TTF_RenderGlyph32_Blended(font, codepoint, (SDL_Color){255, 255, 255, 255});
+#else
+    // Older SDL_ttf only knows the Basic Multilingual Plane
+    Uint16 glyph = codepoint <= 0xFFFF ? (Uint16)codepoint : 0xFFFD;
+    int minx, maxx, miny, maxy, advance;
+    if (TTF_GlyphMetrics(font, glyph, &minx, &maxx, &miny, &maxy, &advance) != 0) return NULL;
+    SDL_Surface *surface = TTF_RenderGlyph_Blended(font, glyph, (SDL_Color){255, 255, 255, 255});
+#endif
+    if (!surface) return NULL;
+    
+    // Next shelf, or start over once the atlas (or its hash table) is full
+    if (atlas->shelf_x + surface->w + 1 > TEXT_ATLAS_SIZE) {
+        atlas->shelf_x = 0;
+        atlas->shelf_y += atlas->shelf_height + 1;
+        atlas->shelf_height = 0;
+    }
+    if (atlas->shelf_y + surface->h > TEXT_ATLAS_SIZE || atlas->glyph_count >= TEXT_ATLAS_SLOTS * 3 / 4) {
+        if (atlas->glyph_count == 0 || surface->w > TEXT_ATLAS_SIZE ||
+            surface->h > TEXT_ATLAS_SIZE - TEXT_ATLAS_TOP) {
+            SDL_FreeSurface(surface);
+            return NULL;
+        }
+        text_atlas_clear(atlas);
+        slot = (key * 2654435761u) & mask;
+    }
+    
+    AtlasGlyph *entry = &atlas->glyphs[slot];
+    entry->key = key;
+    entry->source = (SDL_Rect){ atlas->shelf_x, atlas->shelf_y, surface->w, surface->h };
+    entry->offset_x = minx < 0 ? minx : 0;
+    entry->advance = advance;
+    
+    // TTF_Render*_Blended produces ARGB8888, the atlas format
+    SDL_UpdateTexture(atlas->texture, &entry->source, surface->pixels, surface->pitch);
+    SDL_FreeSurface(surface);
+    
+    atlas->shelf_x += entry->source.w + 1;
+    if (entry->source.h > atlas->shelf_height) atlas->shelf_height = entry->source.h;
+    atlas->glyph_count++;
+    
+    g_app->text.stats.uploads++;
+    g_app->text.total_uploads++;
+    return entry;
+}
+
+static int text_kerning(TTF_Font *font, uint32_t previous, uint32_t codepoint) {
+#if SDL_TTF_VERSION_ATLEAST(2, 0, 18)
+    return previous ? TTF_GetFontKerningSizeGlyphs32(font, previous, codepoint) : 0;
+#else
+    return 0;   // Pair kerning needs SDL_ttf 2.0.18
+#endif
+}
+
+// Builds the quads for `layout->text` from the atlas. Retries once if the
+// atlas had to be cleared part way, since earlier quads would be stale.
+static bool text_layout_build(TextLayout *layout, GlyphAtlas *atlas) {
+    size_t length = strlen(layout->text);
+    SDL_Vertex *vertices = realloc(layout->vertices, sizeof(SDL_Vertex) * 4 * (length + 1));
+    if (!vertices) return false;
+    layout->vertices = vertices;
+    
+    const SDL_Color color = {255, 255, 255, 255};
+    const float scale = 1.0f / TEXT_ATLAS_SIZE;
+    int font_index = text_font_index(layout->font);
+    
+    for (int attempt = 0; attempt < 2; attempt++) {
+        unsigned generation = atlas->generation;
+        const char *cursor = layout->text;
+        uint32_t previous = 0;
+        int pen = 0, count = 0, height = TTF_FontHeight(layout->font);
+        
+        while (*cursor) {
+            uint32_t codepoint = utf8_decode(&cursor);
+            const AtlasGlyph *glyph = text_atlas_glyph(atlas, font_index, codepoint);
+            if (!glyph) continue;
+            
+            pen += text_kerning(layout->font, previous, codepoint);
+            previous = codepoint;
+            
+            float x0 = (float)(pen + glyph->offset_x), y0 = 0.0f;
+            float x1 = x0 + glyph->source.w, y1 = (float)glyph->source.h;
+            float u0 = glyph->source.x * scale, v0 = glyph->source.y * scale;
+            float u1 = (glyph->source.x + glyph->source.w) * scale;
+            float v1 = (glyph->source.y + glyph->source.h) * scale;
+            
+            SDL_Vertex *quad = &vertices[count];
+            quad[0] = (SDL_Vertex){ {x0, y0}, color, {u0, v0} };
+            quad[1] = (SDL_Vertex){ {x1, y0}, color, {u1, v0} };
+            quad[2] = (SDL_Vertex){ {x0, y1}, color, {u0, v1} };
+            quad[3] = (SDL_Vertex){ {x1, y1}, color, {u1, v1} };
+            count += 4;
+            
+            pen += glyph->advance;
+        }
+        
+        if (generation == atlas->generation) {
+            layout->vertex_count = count;
+            layout->width = pen;
+            layout->height = height;
+            layout->generation = generation;
+            g_app->text.stats.layouts++;
+            return true;
+        }
+    }
+    return false;
+}
+
+// The cached layout for (font, text), laid out now if missing or stale
+static TextLayout* text_layout(SDL_Renderer *renderer, TTF_Font *font, const char *text) {
+    GlyphAtlas *atlas = text_font_index(font) >= 0 ? text_atlas(renderer) : NULL;
+    if (!atlas || !text || !text[0]) return NULL;
+    
+    uint32_t hash = hash_string(text);
+    
+    TextRenderer *renderer_state = &g_app->text;
+    TextLayout *victim = &renderer_state->cache[0];
+    
+    for (int i = 0; i < TEXT_CACHE_SIZE; i++) {
+        TextLayout *layout = &renderer_state->cache[i];
+        if (layout->font == font && layout->hash == hash && strcmp(layout->text, text) == 0) {
+            layout->last_used = renderer_state->frame;
+            if (layout->generation != atlas->generation && !text_layout_build(layout, atlas)) return NULL;
+            renderer_state->stats.hits++;
+            return layout;
+        }
+        
+        if (!victim->font) continue;
+        if (!layout->font || layout->last_used < victim->last_used) victim = layout;
+    }
+    
+    // Evict the least recently used entry
+    char *copy = strdup(text);
+    if (!copy) return NULL;
+    free(victim->text);
+    
+    victim->font = font;
+    victim->hash = hash;
+    victim->text = copy;
+    victim->last_used = renderer_state->frame;
+    
+    if (!text_layout_build(victim, atlas)) {
+        victim->font = NULL;
+        return NULL;
+    }
+    return victim;
+}
+
+static void text_begin_frame(void) {
+    TextRenderer *text = &g_app->text;
+    
+    if (text->stats.uploads > 0) {
+        text->upload_frames++;
+        text->last_upload_frame = text->frame;
+    }
+    text->last = text->stats;
+    memset(&text->stats, 0, sizeof(TextStats));
+    text->frame++;
+}
+
+// Queues a string with its top-left corner at (x, y) behind whatever was
+// queued before it. Optionally reports its size.
+static void text_draw(SDL_Renderer *renderer, TTF_Font *font, const char *text, 
+                      float x, float y, Color color, int *width, int *height) {
+    TextLayout *layout = text_layout(renderer, font, text);
+    if (width) *width = layout ? layout->width : 0;
+    if (height) *height = layout ? layout->height : 0;
+    if (!layout || layout->vertex_count == 0) return;
+    
+    TextRenderer *state = &g_app->text;
+    
+    // Whole pixels keep glyphs sharp
+    float origin_x = floorf(x + 0.5f), origin_y = floorf(y + 0.5f);
+    SDL_Color tint = geom_color(color);
+    
+#if SDL_VERSION_ATLEAST(2, 0, 18)
+    // Into the shapes buffer, so it stays in order with them at the next geom_flush
+    SDL_Vertex *out = geom_quads(layout->vertex_count / 4);
+    if (!out) return;
+    for (int i = 0; i < layout->vertex_count; i++) {
+        out[i] = layout->vertices[i];
+        out[i].position.x += origin_x;
+        out[i].position.y += origin_y;
+        out[i].color = tint;
+    }
+#else
+    if (state->scratch_capacity < layout->vertex_count) {
+        SDL_Vertex *scratch = realloc(state->scratch, sizeof(SDL_Vertex) * layout->vertex_count);
+        if (!scratch) return;
+        state->scratch = scratch;
+        state->scratch_capacity = layout->vertex_count;
+    }
+    for (int i = 0; i < layout->vertex_count; i++) {
+        state->scratch[i] = layout->vertices[i];
+        state->scratch[i].position.x += origin_x;
+        state->scratch[i].position.y += origin_y;
+    }
+    
+
+    // No geometry API: one copy per glyph, tinted through the texture
+    SDL_Texture *texture = state->atlas.texture;
+    SDL_SetTextureColorMod(texture, tint.r, tint.g, tint.b);
+    SDL_SetTextureAlphaMod(texture, tint.a);
+    for (int i = 0; i < layout->vertex_count; i += 4) {
+        const SDL_Vertex *quad = &state->scratch[i];
+        SDL_Rect source = {
+            (int)(quad[0].tex_coord.x * TEXT_ATLAS_SIZE + 0.5f), (int)(quad[0].tex_coord.y * TEXT_ATLAS_SIZE + 0.5f),
+            (int)((quad[3].tex_coord.x - quad[0].tex_coord.x) * TEXT_ATLAS_SIZE + 0.5f),
+            (int)((quad[3].tex_coord.y - quad[0].tex_coord.y) * TEXT_ATLAS_SIZE + 0.5f)
+        };
+        SDL_Rect target = { (int)quad[0].position.x, (int)quad[0].position.y, source.w, source.h };
+        SDL_RenderCopy(renderer, texture, &source, &target);
+        g_app->geom.stats.draw_calls++;
+    }
+#endif
+    state->stats.draws++;
+}
+
+static bool text_measure(SDL_Renderer *renderer, TTF_Font *font, const char *text, 
+                         int *width, int *height) {
+    TextLayout *layout = text_layout(renderer, font, text);
+    *width = layout ? layout->width : 0;
+    *height = layout ? layout->height : 0;
+    return layout != NULL;
+}
+
+static void render_text_centered(SDL_Renderer *renderer, TTF_Font *font, const char *text, 
+                                 Rect rect, Color color) {
+    int width, height;
+    if (!text_measure(renderer, font, text, &width, &height)) return;
+    
+    text_draw(renderer, font, text, rect.x + (rect.w - width) * 0.5f, 
+              rect.y + (rect.h - height) * 0.5f, color, NULL, NULL);
+}
+
+// align: 0 = left edge at x, 1 = centred on x, 2 = right edge at x
+static void render_text_aligned(SDL_Renderer *renderer, TTF_Font *font, const char *text,
+                                int x, int y, Color color, int align) {
+    int width = 0, height;
+    if (align != 0 && !text_measure(renderer, font, text, &width, &height)) return;
+    
+    float left = align == 1 ? x - width * 0.5f : align == 2 ? (float)(x - width) : (float)x;
+    text_draw(renderer, font, text, left, (float)y, color, NULL, NULL);
+}
+
+// After a render device reset. text_atlas makes the atlas again, and the
+// bumped generation makes every cached layout rebuild its quads.
+static void text_drop_atlas(void) {
+    GlyphAtlas *atlas = &g_app->text.atlas;
+    if (!atlas->texture) return;
+    
+    unsigned generation = atlas->generation;
+    SDL_DestroyTexture(atlas->texture);
+    free(atlas->glyphs);
+    memset(atlas, 0, sizeof(GlyphAtlas));
+    atlas->generation = generation + 1;
+}
+
+static void text_cleanup(void) {
+    TextRenderer *text = &g_app->text;
+    
+    printf("  Text: %llu glyph uploads over %llu frames, %llu frames uploading, last on frame %llu\n",
+           (unsigned long long)text->total_uploads, (unsigned long long)text->frame,
+           (unsigned long long)text->upload_frames, (unsigned long long)text->last_upload_frame);
+    
+    if (text->atlas.texture) SDL_DestroyTexture(text->atlas.texture);
+    free(text->atlas.glyphs);
+    for (int i = 0; i < TEXT_CACHE_SIZE; i++) {
+        free(text->cache[i].text);
+        free(text->cache[i].vertices);
+    }
+    free(text->scratch);
+    memset(text, 0, sizeof(TextRenderer));
+}
+
+// ═══════════════════════════════════════════════════════════════════════════════
+// ║                           WIDGET SYSTEM                                    ║
+// ═══════════════════════════════════════════════════════════════════════════════
+
+static Widget* widget_create(WidgetType type, const char *id) {
+    if (g_app->widget_count >= WIDGET_MAX) return NULL;
+    
+    size_t payload_size = 0;
+    switch (type) {
+        case WIDGET_SLIDER:   payload_size = sizeof(WidgetSlider); break;
+        case WIDGET_PROGRESS: payload_size = sizeof(WidgetProgress); break;
+        case WIDGET_LIST:     payload_size = sizeof(WidgetList); break;
+        case WIDGET_IMAGE:    payload_size = sizeof(WidgetImage); break;
+        default: break;
+    }
+    
+    void *payload = NULL;
+    if (payload_size > 0) {
+        payload = calloc(1, payload_size);
+        if (!payload) return NULL;
+    }
+    
+    int index = g_app->widget_count++;
+    Widget *widget = &g_app->widgets[index];
+    memset(widget, 0, sizeof(Widget));
+    widget->info = &g_app->widget_info[index];
+    memset(widget->info, 0, sizeof(WidgetInfo));
+    widget->payload = payload;
+    
+    widget->type = type;
+    strncpy(widget->info->id, id, 63);
+    widget->visible = true;
+    widget->enabled = true;
+    widget->info->color = COLOR_PALETTE.bg_secondary;
+    widget->info->hover_color = COLOR_PALETTE.bg_tertiary;
+    widget->info->press_color = COLOR_PALETTE.accent_primary;
+    widget->target_animation_t = 0.0f;
+    
+    g_app->hit_grid.dirty = true;
+    return widget;
+}
+
+// Releases what widget_create allocated; the slot itself belongs to g_app
+static void widget_destroy(Widget *widget) {
+    free(widget->payload);
+    widget->payload = NULL;
+}
+
+static void widget_set_bounds(Widget *widget, float x, float y, float w, float h) {
+    // Where it was needs repainting as much as where it goes
+    ui_invalidate(widget->render_bounds);
+    
+    widget->bounds = (Rect){x, y, w, h};
+    widget->render_bounds = (Rect){
+        x - UI_DAMAGE_MARGIN, y - UI_DAMAGE_MARGIN,
+        w + UI_DAMAGE_MARGIN * 2, h + UI_DAMAGE_MARGIN * 2
+    };
+    widget_mark_dirty(widget);
+    g_app->hit_grid.dirty = true;
+}
+
+static void widget_set_text(Widget *widget, const char *text) {
+    if (strncmp(widget->info->text, text, MAX_TEXT - 1) == 0) return;
+    
+    strncpy(widget->info->text, text, MAX_TEXT - 1);
+    widget->info->text[MAX_TEXT - 1] = '\0';
+    widget_mark_dirty(widget);
+}
+
+static void widget_set_callback(Widget *widget, WidgetCallback callback) {
+    widget->info->on_click = callback;
+}
+
+static void widget_mark_dirty(Widget *widget) {
+    widget->dirty = true;
+}
+
+// Puts a widget on the per-frame update list until widget_update reports
+// it has come to rest
+static void widget_activate(Widget *widget) {
+    if (widget->active) return;
+    
+    widget->active = true;
+    g_app->active_widgets[g_app->active_count++] = widget;
+}
+
+static bool widget_handle_mouse(Widget *widget, int x, int y, bool pressed, bool released) {
+    bool inside = point_in_rect(x, y, widget->bounds);
+    
+    // Update hover state
+    if (widget->hovered != inside) {
+        widget_mark_dirty(widget);
+    }
+    widget->hovered = inside;
+    widget->target_animation_t = inside ? 1.0f : 0.0f;
+    if (widget->animation_t != widget->target_animation_t) {
+        widget_activate(widget);
+    }
+    
+    if (inside && widget->type == WIDGET_LIST) {
+        list_widget_handle_mouse(widget, y, pressed);
+    }
+    
+    // Handle clicks
+    if (inside && pressed && widget->enabled) {
+        widget->pressed = true;
+        widget_mark_dirty(widget);
+        widget->focused = true;
+        g_app->focused_widget = widget;
+        
+        // A slider follows the cursor from the update loop while held
+        if (widget->type == WIDGET_SLIDER) {
+            widget->slider->dragging = true;
+            widget_activate(widget);
+        }
+        
+        if (widget->info->on_click) {
+            widget->info->on_click(widget, widget->info->user_data);
+        }
+        
+        return true;
+    } else if (released && widget->pressed) {
+        widget->pressed = false;
+        widget_mark_dirty(widget);
+    }
+    
+    return false;
+}
+
+// Advances one active widget; returns false once it has nothing left to
+// animate, which takes it off the update list
+static bool widget_update(Widget *widget, float delta_time) {
+    bool moving = false;
+    
+    // Smooth animation interpolation, snapping once the change is invisible
+    float remaining = widget->target_animation_t - widget->animation_t;
+    if (fabsf(remaining) > 0.002f) {
+        widget->animation_t += remaining * UI_ANIMATION_SPEED * delta_time;
+        widget_mark_dirty(widget);
+        moving = true;
+    } else if (remaining != 0.0f) {
+        widget->animation_t = widget->target_animation_t;
+        widget_mark_dirty(widget);
+    }
+    
+    // Type-specific updates
+    if (widget->type == WIDGET_SLIDER && widget->slider->dragging) {
+        // Handle slider dragging
+        float relative_x = (g_app->mouse_x - widget->bounds.x) / widget->bounds.w;
+        relative_x = fmaxf(0.0f, fminf(1.0f, relative_x));
+        
+        float new_value = widget->slider->min_value + 
+                         relative_x * (widget->slider->max_value - widget->slider->min_value);
+        
+        if (new_value != widget->slider->value) {
+            widget->slider->value = new_value;
+            widget_mark_dirty(widget);
+            
+            if (widget->info->on_value_change) {
+                widget->info->on_value_change(widget, widget->info->user_data);
+            }
+        }
+        
+        // Held until the button comes up, not just for the frame it went down
+        if (g_app->mouse_released || 
+            !(SDL_GetMouseState(NULL, NULL) & SDL_BUTTON(SDL_BUTTON_LEFT))) {
+            widget->slider->dragging = false;
+            widget_mark_dirty(widget);
+        } else {
+            moving = true;
+        }
+    }
+    
+    if (widget->type == WIDGET_LIST && list_widget_update(widget, delta_time)) {
+        moving = true;
+    }
+    return moving;
+}
+
+static void widget_render(Widget *widget, SDL_Renderer *renderer) {
+    if (!widget->visible) return;
+    
+    // Interpolate colors based on animation state
+    Color render_color = color_lerp(widget->info->color, widget->info->hover_color, 
+                                   ease_out_cubic(widget->animation_t));
+    
+    if (widget->pressed) {
+        render_color = widget->info->press_color;
+    }
+    
+    // Render based on widget type
+    switch (widget->type) {
+        case WIDGET_BUTTON:
+            render_button_widget(widget, renderer, render_color);
+            break;
+            
+        case WIDGET_SLIDER:
+            render_slider_widget(widget, renderer, render_color);
+            break;
+            
+        case WIDGET_PROGRESS:
+            render_progress_widget(widget, renderer, render_color);
+            break;
+            
+        case WIDGET_SPECTRUM:
+            render_spectrum_widget(widget, renderer);
+            break;
+            
+        case WIDGET_ALBUM_ART:
+            render_album_art_widget(widget, renderer);
+            break;
+            
+        case WIDGET_LIST:
+            render_list_widget(widget, renderer, render_color);
+            break;
+            
+        default:
+            // Default rectangle
+            render_rounded_rect(renderer, widget->bounds, 8, render_color);
+            break;
+    }
+}
+
+static void render_button_widget(Widget *widget, SDL_Renderer *renderer, Color color) {
+    // Beautiful glassmorphism button
+    render_drop_shadow(renderer, widget->bounds, 4, COLOR_PALETTE.glass_shadow);
+    render_glassmorphism_effect(renderer, widget->bounds, 8);
+    render_rounded_rect(renderer, widget->bounds, 12, color);
+    
+    // Button text
+    if (strlen(widget->info->text) > 0) {
+        render_text_centered(renderer, g_app->fonts[2], widget->info->text, 
+                           widget->bounds, COLOR_PALETTE.text_primary);
+    }
+    
+    // Hover glow effect
+    if (widget->animation_t > 0.1f) {
+        Color glow = COLOR_PALETTE.accent_primary;
+        glow.a = widget->animation_t * 0.3f;
+        
+        Rect glow_rect = {
+            widget->bounds.x - 2, 
+            widget->bounds.y - 2,
+            widget->bounds.w + 4, 
+            widget->bounds.h + 4
+        };
+        render_rounded_rect(renderer, glow_rect, 14, glow);
+    }
+}
+
+static void render_slider_widget(Widget *widget, SDL_Renderer *renderer, Color color) {
+    // Track background
+    Rect track_rect = {
+        widget->bounds.x,
+        widget->bounds.y + widget->bounds.h * 0.4f,
+        widget->bounds.w,
+        widget->bounds.h * 0.2f
+    };
+    render_rounded_rect(renderer, track_rect, track_rect.h * 0.5f, COLOR_PALETTE.bg_tertiary);
+    
+    // Progress fill
+    float progress = (widget->slider->value - widget->slider->min_value) / 
+                    (widget->slider->max_value - widget->slider->min_value);
+    
+    Rect fill_rect = track_rect;
+    fill_rect.w = track_rect.w * progress;
+    render_rounded_rect(renderer, fill_rect, fill_rect.h * 0.5f, COLOR_PALETTE.accent_primary);
+    
+    // Handle
+    float handle_size = widget->bounds.h * 0.8f;
+    float handle_x = widget->bounds.x + (widget->bounds.w - handle_size) * progress;
+    
+    Rect handle_rect = {
+        handle_x,
+        widget->bounds.y + (widget->bounds.h - handle_size) * 0.5f,
+        handle_size,
+        handle_size
+    };
+    
+    // Handle shadow and glow
+    render_drop_shadow(renderer, handle_rect, 2, COLOR_PALETTE.glass_shadow);
+    
+    if (widget->animation_t > 0.1f || widget->slider->dragging) {
+        Color glow = COLOR_PALETTE.accent_primary;
+        glow.a = (widget->slider->dragging ? 0.6f : widget->animation_t * 0.4f);
+        
+        Rect glow_rect = {
+            handle_rect.x - 4,
+            handle_rect.y - 4, 
+            handle_rect.w + 8,
+            handle_rect.h + 8
+        };
+        render_rounded_rect(renderer, glow_rect, glow_rect.h * 0.5f, glow);
+    }
+    
+    render_rounded_rect(renderer, handle_rect, handle_rect.h * 0.5f, COLOR_PALETTE.text_primary);
+}
+
+// ═══════════════════════════════════════════════════════════════════════════════
+// ║                           TRACK LIST                                       ║
+// ═══════════════════════════════════════════════════════════════════════════════
+
+static Widget* create_track_list(const char *id) {
+    Widget *widget = widget_create(WIDGET_LIST, id);
+    if (!widget) return NULL;
+    
+    widget->list->source = &g_app->current_playlist;
+    widget->list->selected_index = -1;
+    widget->list->row_height = LIST_ROW_HEIGHT;
+    
+    for (int i = 0; i < LIST_ROW_CACHE; i++) {
+        g_app->list_rows[i].id = TRACK_ID_NONE;
+    }
+    return widget;
+}
+
+// Highest valid top row: the last row sits on the bottom edge
+static float list_widget_max_scroll(const Widget *widget) {
+    float visible = widget->bounds.h / widget->list->row_height;
+    float max = widget->list->source->track_count - visible;
+    return max > 0.0f ? max : 0.0f;
+}
+
+static void list_widget_jump(Widget *widget, float rows) {
+    float target = widget->list->scroll_target + rows;
+    widget->list->scroll_target = fmaxf(0.0f, fminf(list_widget_max_scroll(widget), target));
+    widget_activate(widget);
+}
+
+// Constant time at any list length, since every row has the same height
+static void list_widget_scroll_to(Widget *widget, int index, bool center) {
+    float visible = widget->bounds.h / widget->list->row_height;
+    float target = widget->list->scroll_target;
+    
+    if (center) {
+        target = index + 0.5f - visible * 0.5f;
+    } else if (index < target) {
+        target = (float)index;
+    } else if (index + 1 > target + visible) {
+        target = index + 1 - visible;
+    }
+    
+    widget->list->scroll_target = fmaxf(0.0f, fminf(list_widget_max_scroll(widget), target));
+    widget_activate(widget);
+}
+
+// Row under a window y coordinate, or -1
+static int list_widget_row_at(const Widget *widget, int y) {
+    float row = widget->list->scroll + (y - widget->bounds.y) / widget->list->row_height;
+    int index = (int)floorf(row);
+    return index >= 0 && index < widget->list->source->track_count ? index : -1;
+}
+
+// Mouse input with the cursor over the list, from widget_handle_mouse
+static void list_widget_handle_mouse(Widget *widget, int y, bool pressed) {
+    if (g_app->mouse_wheel != 0) {
+        list_widget_jump(widget, -g_app->mouse_wheel * LIST_WHEEL_ROWS);
+    }
+    
+    // Click selects, a click on the selected row plays it
+    if (pressed) {
+        int index = list_widget_row_at(widget, y);
+        if (index >= 0 && index == widget->list->selected_index) {
+            list_widget_play(widget, index);
+        }
+        widget->list->selected_index = index;
+        widget_mark_dirty(widget);
+    }
+}
+
+// Plays a row. Rows of a smart playlist play from the Now Playing list,
+// which takes the track on first if it does not have it yet.
+static void list_widget_play(Widget *widget, int index) {
+    Playlist *source = widget->list->source;
+    if (index < 0 || index >= source->track_count) return;
+    
+    Playlist *now_playing = &g_app->current_playlist;
+    if (source == now_playing) {
+        playlist_play_track(now_playing, index);
+        return;
+    }
+    
+    TrackId id = source->track_ids[index];
+    if (!playlist_contains(now_playing, id)) playlist_append(now_playing, id);
+    playlist_play_track(now_playing, playlist_index_of(now_playing, id));
+}
+
+// Eases the scroll toward its target; true while still on the way
+static bool list_widget_update(Widget *widget, float delta_time) {
+    // The playlist may have shrunk under us
+    float max = list_widget_max_scroll(widget);
+    if (widget->list->scroll_target > max) widget->list->scroll_target = max;
+    
+    float remaining = widget->list->scroll_target - widget->list->scroll;
+    if (fabsf(remaining) > 0.001f) {
+        widget->list->scroll += remaining * fminf(1.0f, LIST_SCROLL_SPEED * delta_time);
+        widget_mark_dirty(widget);
+        return true;
+    } else if (remaining != 0.0f) {
+        widget->list->scroll = widget->list->scroll_target;
+        widget_mark_dirty(widget);
+    }
+    return false;
+}
+
+// Display text for a row, formatted once per track and kept while its
+// metadata stays the same
+static const char* list_widget_row_text(const TrackStore *store, TrackId id) {
+    ListRow *row = &g_app->list_rows[id & (LIST_ROW_CACHE - 1)];
+    
+    if (row->id == id && row->title == store->title[id] && 
+        row->artist == store->artist[id] && row->flags == store->flags[id]) {
+        return row->text;
+    }
+    
+    row->id = id;
+    row->title = store->title[id];
+    row->artist = store->artist[id];
+    row->flags = store->flags[id];
+    
+    const char *title = track_store_text(store, row->title);
+    const char *artist = track_store_text(store, row->artist);
+    
+    if ((row->flags & TRACK_FLAG_METADATA_LOADED) && title[0]) {
+        if (artist[0]) {
+            snprintf(row->text, sizeof(row->text), "%s — %s", title, artist);
+        } else {
+            snprintf(row->text, sizeof(row->text), "%s", title);
+        }
+    } else {
+        snprintf(row->text, sizeof(row->text), "%s", track_store_filename(store, id));
+    }
+    return row->text;
+}
+
+// Draws only the rows that intersect the widget, whatever the playlist size
+static void render_list_widget(Widget *widget, SDL_Renderer *renderer, Color color) {
+    const Playlist *playlist = widget->list->source;
+    const TrackStore *store = playlist->store;
+    float row_height = widget->list->row_height;
+    
+    // By track, so it shows in search results too
+    const Playlist *now_playing = &g_app->current_playlist;
+    TrackId playing = now_playing->current_index >= 0 ? 
+                      now_playing->track_ids[now_playing->current_index] : TRACK_ID_NONE;
+    
+    render_glassmorphism_effect(renderer, widget->bounds, 8);
+    
+    // Keep rows inside the widget without losing the damage clip around it
+    SDL_Rect previous, clip = {
+        (int)widget->bounds.x, (int)widget->bounds.y, (int)widget->bounds.w, (int)widget->bounds.h
+    };
+    bool clipped = SDL_RenderIsClipEnabled(renderer);
+    if (clipped) {
+        SDL_RenderGetClipRect(renderer, &previous);
+        if (!SDL_IntersectRect(&previous, &clip, &clip)) return;
+    }
+    geom_flush(renderer);
+    SDL_RenderSetClipRect(renderer, &clip);
+    
+    int first = (int)floorf(widget->list->scroll);
+    int last = (int)ceilf(widget->list->scroll + widget->bounds.h / row_height);
+    if (last > playlist->track_count) last = playlist->track_count;
+    
+    for (int index = first < 0 ? 0 : first; index < last; index++) {
+        Rect row = {
+            widget->bounds.x,
+            widget->bounds.y + (index - widget->list->scroll) * row_height,
+            widget->bounds.w,
+            row_height
+        };
+        
+        TrackId id = playlist->track_ids[index];
+        if (id == playing) {
+            Color highlight = COLOR_PALETTE.accent_primary;
+            highlight.a = 0.25f;
+            render_rounded_rect(renderer, row, 6, highlight);
+        } else if (index == widget->list->selected_index) {
+            render_rounded_rect(renderer, row, 6, color);
+        }
+        
+        render_text_aligned(renderer, g_app->fonts[1], list_widget_row_text(store, id),
+                            (int)(row.x + 12), (int)(row.y + 6),
+                            id == playing ? COLOR_PALETTE.text_primary : COLOR_PALETTE.text_secondary, 0);
+    }
+    
+    // Scrollbar thumb, sized to the visible share of the list
+    float visible = widget->bounds.h / row_height;
+    if (playlist->track_count > visible) {
+        float share = visible / playlist->track_count;
+        float height = fmaxf(24.0f, widget->bounds.h * share);
+        float travel = widget->bounds.h - height;
+        float max = list_widget_max_scroll(widget);
+        
+        Rect thumb = {
+            widget->bounds.x + widget->bounds.w - 6,
+            widget->bounds.y + (max > 0.0f ? travel * widget->list->scroll / max : 0.0f),
+            4, height
+        };
+        render_rounded_rect(renderer, thumb, 2, COLOR_PALETTE.text_tertiary);
+    }
+    
+    geom_flush(renderer);
+    SDL_RenderSetClipRect(renderer, clipped ? &previous : NULL);
+}
+
+// ═══════════════════════════════════════════════════════════════════════════════
+// ║                             BENCHMARKS                                     ║
+// ═══════════════════════════════════════════════════════════════════════════════
+
+static double bench_elapsed(Uint64 start) {
+    return (double)(SDL_GetPerformanceCounter() - start) / SDL_GetPerformanceFrequency();
+}
+
+// ns/sample for the full 32-band cascade at 96 kHz, per available kernel
+static int bench_equalizer(void) {
+    const int sample_rate = 96000;
+    const int block = 1024;
+    const int blocks = sample_rate * 4 / block; // Four seconds of stereo audio
+    
+    float *source = malloc(sizeof(float) * block * 2);
+    float *buffer = malloc(sizeof(float) * block * 2);
+    if (!source || !buffer) {
+        free(source);
+        free(buffer);
+        return 1;
+    }
+    
+    uint32_t seed = 0x12345678u;
+    for (int i = 0; i < block * 2; i++) {
+        seed = seed * 1664525u + 1013904223u;
+        source[i] = ((seed >> 8) / 8388608.0f - 1.0f) * 0.5f;
+    }
+    
+    // Alternate boost/cut so every band is active
+    float gains[EQ_BANDS];
+    for (int band = 0; band < EQ_BANDS; band++) {
+        gains[band] = (band & 1) ? -6.0f : 6.0f;
+    }
+    
+    struct { const char *name; EqualizerKernel kernel; bool supported; } kernels[] = {
+        { "scalar", eq_kernel_scalar, true },
+#ifdef TUXMUSIC_X86_SIMD
+        { "sse2", eq_kernel_sse, __builtin_cpu_supports("sse2") },
+        { "avx2", eq_kernel_avx2, __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma") },
+#endif
+    };
+    
+    equalizer_flush_denormals();
+    printf("Equalizer: %d bands, %d Hz stereo, %d-frame blocks\n", EQ_BANDS, sample_rate, block);
+    
+    for (size_t k = 0; k < sizeof(kernels) / sizeof(kernels[0]); k++) {
+        if (!kernels[k].supported) continue;
+        
+        Equalizer eq;
+        equalizer_initialize(&eq);
+        equalizer_update(&eq, gains, 0.0f, sample_rate, 1);
+        eq.kernel = kernels[k].kernel;
+        
+        memcpy(buffer, source, sizeof(float) * block * 2);
+        eq.kernel(&eq, buffer, block); // Warm up
+        
+        double runs[BENCH_REPEATS];
+        for (int run = 0; run < BENCH_REPEATS; run++) {
+            Uint64 start = SDL_GetPerformanceCounter();
+            for (int i = 0; i < blocks; i++) {
+                memcpy(buffer, source, sizeof(float) * block * 2);
+                eq.kernel(&eq, buffer, block);
+            }
+            runs[run] = bench_elapsed(start);
+        }
+        double seconds = bench_median(runs, BENCH_REPEATS);
+        
+        double samples = (double)blocks * block * 2;
+        printf("  %-7s %7.2f ns/sample  %7.2f ns/frame  %6.0fx realtime\n",
+               kernels[k].name, seconds * 1e9 / samples, seconds * 2e9 / samples,
+               (blocks * (double)block / sample_rate) / seconds);
+        
+        char name[64];
+        snprintf(name, sizeof(name), "eq.%s", kernels[k].name);
+        bench_record(name, "ns/sample", seconds * 1e9 / samples);
+    }
+    
+    free(source);
+    free(buffer);
+    return 0;
+}
+
+// ns/frame to get decoded audio to a 48 kHz float stereo device, per path
+static int bench_convert(void) {
+    const int output_rate = 48000;
+    const int block = 1152;
+    
+    struct { const char *name; const char *key; enum AVSampleFormat format; int rate; } cases[] = {
+        { "copy     fltp 48k",   "copy.fltp.48k",       AV_SAMPLE_FMT_FLTP, 48000 },
+        { "convert  s16  48k",   "convert.s16.48k",     AV_SAMPLE_FMT_S16,  48000 },
+        { "resample fltp 44.1k", "resample.fltp.44k1",  AV_SAMPLE_FMT_FLTP, 44100 },
+        { "resample s32p 96k",   "resample.s32p.96k",   AV_SAMPLE_FMT_S32P, 96000 },
+    };
+    
+    printf("Output conversion: %d Hz float stereo, %d-sample frames\n", output_rate, block);
+    
+    for (size_t c = 0; c < sizeof(cases) / sizeof(cases[0]); c++) {
+        AVFrame *frame = av_frame_alloc();
+        if (!frame) return 1;
+        
+        frame->format = cases[c].format;
+        frame->nb_samples = block;
+        frame->sample_rate = cases[c].rate;
+        frame->channels = AUDIO_CHANNELS;
+        frame->channel_layout = AV_CH_LAYOUT_STEREO;
+        if (av_frame_get_buffer(frame, 0) < 0) {
+            av_frame_free(&frame);
+            return 1;
+        }
+        
+        // Noise, so no path gets to skip work on silence
+        uint32_t seed = 0x2545f491u;
+        int planes = av_sample_fmt_is_planar(frame->format) ? AUDIO_CHANNELS : 1;
+        int samples = block * AUDIO_CHANNELS / planes;
+        for (int p = 0; p < planes; p++) {
+            for (int i = 0; i < samples; i++) {
+                seed = seed * 1664525u + 1013904223u;
+                float value = ((seed >> 8) / 8388608.0f - 1.0f) * 0.5f;
+                
+                if (frame->format == AV_SAMPLE_FMT_FLTP) {
+                    ((float*)frame->extended_data[p])[i] = value;
+                } else if (frame->format == AV_SAMPLE_FMT_S16) {
+                    ((int16_t*)frame->extended_data[p])[i] = (int16_t)(value * 32767.0f);
+                } else {
+                    ((int32_t*)frame->extended_data[p])[i] = (int32_t)(value * 2147483647.0f);
+                }
+            }
+        }
+        
+        AudioDecoder decoder;
+        memset(&decoder, 0, sizeof(decoder));
+        if (!audio_decoder_set_output(&decoder, AV_CH_LAYOUT_STEREO, AUDIO_CHANNELS,
+                                      cases[c].format, cases[c].rate, output_rate)) {
+            av_frame_free(&frame);
+            return 1;
+        }
+        
+        // Ten seconds of source audio per run
+        int blocks = cases[c].rate * 10 / block;
+        uint64_t produced = 0;
+        
+        double runs[BENCH_REPEATS];
+        for (int run = 0; run < BENCH_REPEATS; run++) {
+            produced = 0;
+            Uint64 start = SDL_GetPerformanceCounter();
+            for (int i = 0; i < blocks; i++) {
+                audio_decoder_convert(&decoder, frame, 0);
+                produced += decoder.count;
+                decoder.count = decoder.offset = decoder.processed = 0;
+            }
+            runs[run] = bench_elapsed(start);
+        }
+        double seconds = bench_median(runs, BENCH_REPEATS);
+        
+        printf("  %-20s %7.2f ns/frame  %7.0fx realtime\n", cases[c].name,
+               seconds * 1e9 / produced, (double)produced / output_rate / seconds);
+        
+        char name[64];
+        snprintf(name, sizeof(name), "output.%s", cases[c].key);
+        bench_record(name, "ns/frame", seconds * 1e9 / produced);
+        
+        if (decoder.swr_context) swr_free(&decoder.swr_context);
+        free(decoder.frames);
+        av_frame_free(&frame);
+    }
+    
+    return 0;
+}
+
+// Seek latency per file, with the container's own seeking and with the seek
+// index. Each seek decodes up to the exact target sample, as playback does.
+static int bench_seek(int count, char **files) {
+    const int seeks = 64;
+    
+    if (count <= 0) {
+        fprintf(stderr, "Usage: tuxmusic --bench-seek FILE...\n");
+        return 1;
+    }
+    
+    AVPacket *packet = av_packet_alloc();
+    AVFrame *frame = av_frame_alloc();
+    if (!packet || !frame) {
+        av_packet_free(&packet);
+        av_frame_free(&frame);
+        return 1;
+    }
+    
+    printf("Seek: %d random seeks per file, decoded to the exact sample\n", seeks);
+    
+    for (int f = 0; f < count; f++) {
+        for (int indexed = 0; indexed < 2; indexed++) {
+            AudioDecoder decoder;
+            if (!audio_decoder_open(&decoder, files[f], 48000)) {
+                fprintf(stderr, "  %s: cannot open\n", files[f]);
+                break;
+            }
+            if (decoder.duration <= 0) {
+                fprintf(stderr, "  %s: unknown duration\n", files[f]);
+                audio_decoder_close(&decoder);
+                break;
+            }
+            
+            const char *format = decoder.format_context->iformat->name;
+            if (indexed && !decoder.index.usable) {
+                printf("  %-8s %-9s not needed for this format\n", format, "indexed");
+                audio_decoder_close(&decoder);
+                break;
+            }
+            if (!indexed) {
+                decoder.index.usable = false;
+            }
+            bool cached = decoder.index.count > 0;
+            
+            // The first seek near the end pays for building the index
+            Uint64 start = SDL_GetPerformanceCounter();
+            audio_decoder_index_to(&decoder, decoder.duration * 0.9, packet);
+            audio_decoder_seek(&decoder, decoder.duration * 0.9);
+            while (decoder.discard_to >= 0 && audio_decoder_read(&decoder, packet, frame)) {}
+            double first = bench_elapsed(start);
+            
+            double total = 0.0, worst = 0.0, error = 0.0;
+            uint32_t seed = 0x9e3779b9u;
+            for (int i = 0; i < seeks; i++) {
+                seed = seed * 1664525u + 1013904223u;
+                double target = (seed >> 8) / 16777216.0 * decoder.duration * 0.95;
+                
+                start = SDL_GetPerformanceCounter();
+                audio_decoder_index_to(&decoder, target, packet);
+                audio_decoder_seek(&decoder, target);
+                while (decoder.discard_to >= 0 && audio_decoder_read(&decoder, packet, frame)) {}
+                double elapsed = bench_elapsed(start);
                 
-                // Smooth the spectrum
-                engine->spectrum_data[i] = engine->spectrum_data[i] * 0.8f + amplitude * 0.2f;
+                total += elapsed;
+                worst = elapsed > worst ? elapsed : worst;
+                error += fabs(decoder.seek_reached - target);
             }
             
-            pthread_mutex_unlock(&engine->spectrum_mutex);
+            printf("  %-8s %-9s first %8.2f ms%s  mean %7.2f ms  max %7.2f ms  off %6.2f ms  %d points  %s\n",
+                   format, indexed ? "indexed" : "container", first * 1e3, cached ? " (cached)" : "",
+                   total * 1e3 / seeks, worst * 1e3, error * 1e3 / seeks, decoder.index.count, files[f]);
+            
+            // Closing never writes the index, so the user's seek cache stays as it was
+            audio_decoder_close(&decoder);
         }
-        
-        SDL_Delay(16); // ~60 FPS spectrum update
     }
     
-    return NULL;
+    av_frame_free(&frame);
+    av_packet_free(&packet);
+    return 0;
 }
 
-// ═══════════════════════════════════════════════════════════════════════════════
-// ║                           WIDGET SYSTEM                                    ║
-// ═══════════════════════════════════════════════════════════════════════════════
+static int compare_double(const void *a, const void *b) {
+    double x = *(const double*)a;
+    double y = *(const double*)b;
+    return (x > y) - (x < y);
+}
 
-static Widget* widget_create(WidgetType type, const char *id) {
-    if (g_app->widget_count >= 100) return NULL;
+// Sorts `values` in place
+static double bench_median(double *values, int count) {
+    qsort(values, count, sizeof(double), compare_double);
+    return (count & 1) ? values[count / 2] : (values[count / 2 - 1] + values[count / 2]) * 0.5;
+}
+
+static void bench_record(const char *name, const char *unit, double value) {
+    if (g_bench.count == BENCH_MAX_RESULTS) return;
     
-    Widget *widget = &g_app->widgets[g_app->widget_count++];
-    memset(widget, 0, sizeof(Widget));
+    BenchResult *result = &g_bench.results[g_bench.count++];
+    snprintf(result->name, sizeof(result->name), "%s", name);
+    snprintf(result->unit, sizeof(result->unit), "%s", unit);
+    result->value = value;
+}
+
+// JSON, one result per line, in the order they were measured
+static bool bench_write_report(const char *path) {
+    FILE *file = fopen(path, "w");
+    if (!file) {
+        fprintf(stderr, "Cannot write %s: %s\n", path, strerror(errno));
+        return false;
+    }
     
-    widget->type = type;
-    strncpy(widget->id, id, 63);
-    widget->visible = true;
-    widget->enabled = true;
-    widget->color = COLOR_PALETTE.bg_secondary;
-    widget->hover_color = COLOR_PALETTE.bg_tertiary;
-    widget->press_color = COLOR_PALETTE.accent_primary;
-    widget->target_animation_t = 0.0f;
+    fprintf(file, "{\n");
+    fprintf(file, "  \"version\": \"%d.%d.%d\",\n", TUXMUSIC_VERSION_MAJOR,
+            TUXMUSIC_VERSION_MINOR, TUXMUSIC_VERSION_PATCH);
+    fprintf(file, "  \"built\": \"%s\",\n", TUXMUSIC_BUILD_DATE);
+    fprintf(file, "  \"ffmpeg\": \"%s\",\n", av_version_info());
+    fprintf(file, "  \"cpus\": %d,\n", SDL_GetCPUCount());
+    fprintf(file, "  \"repeats\": %d,\n", BENCH_REPEATS);
+    fprintf(file, "  \"results\": [\n");
+    for (int i = 0; i < g_bench.count; i++) {
+        const BenchResult *result = &g_bench.results[i];
+        fprintf(file, "    { \"name\": \"%s\", \"unit\": \"%s\", \"value\": %.6g }%s\n",
+                result->name, result->unit, result->value, i + 1 < g_bench.count ? "," : "");
+    }
+    fprintf(file, "  ]\n}\n");
     
-    return widget;
+    if (fclose(file) != 0) {
+        fprintf(stderr, "Cannot write %s: %s\n", path, strerror(errno));
+        return false;
+    }
+    return true;
 }
 
-static void widget_set_bounds(Widget *widget, float x, float y, float w, float h) {
-    widget->bounds = (Rect){x, y, w, h};
-    widget->render_bounds = widget->bounds;
+// Deterministic test signal, interleaved stereo float: a logarithmic sine
+// sweep from 20 Hz to 20 kHz over `seconds`, or white noise
+static void bench_signal(float *samples, int frames, int64_t position, int rate, double seconds,
+                         bool noise, double *phase, uint32_t *seed) {
+    for (int i = 0; i < frames; i++) {
+        float value;
+        if (noise) {
+            *seed = *seed * 1664525u + 1013904223u;
+            value = ((*seed >> 8) / 8388608.0f - 1.0f) * 0.5f;
+        } else {
+            double t = (double)(position + i) / rate;
+            double frequency = 20.0 * pow(1000.0, t / seconds);
+            *phase = fmod(*phase + 2.0 * M_PI * frequency / rate, 2.0 * M_PI);
+            value = (float)(sin(*phase) * 0.5);
+        }
+        samples[i * 2] = value;
+        samples[i * 2 + 1] = value;
+    }
 }
 
-static void widget_set_text(Widget *widget, const char *text) {
-    strncpy(widget->text, text, MAX_TEXT - 1);
-    widget->text[MAX_TEXT - 1] = '\0';
+// Sends one frame (NULL drains) and writes out whatever packets it yields
+static bool bench_encode(AVFormatContext *output, AVStream *stream, AVCodecContext *encoder,
+                         AVFrame *frame, AVPacket *packet) {
+    if (avcodec_send_frame(encoder, frame) < 0) return false;
+    
+    for (;;) {
+        int ret = avcodec_receive_packet(encoder, packet);
+        if (ret == AVERROR(EAGAIN) || ret == AVERROR_EOF) return true;
+        if (ret < 0) return false;
+        
+        av_packet_rescale_ts(packet, encoder->time_base, stream->time_base);
+        packet->stream_index = stream->index;
+        if (av_interleaved_write_frame(output, packet) < 0) return false;
+    }
 }
 
-static bool widget_handle_mouse(Widget *widget, int x, int y, bool pressed, bool released) {
-    bool inside = point_in_rect(x, y, widget->bounds);
-    
-    // Update hover state
-    widget->hovered = inside;
-    widget->target_animation_t = inside ? 1.0f : 0.0f;
-    
-    // Handle clicks
-    if (inside && pressed && widget->enabled) {
-        widget->pressed = true;
-        widget->focused = true;
-        g_app->focused_widget = widget;
+// Encodes a tagged fixture through libavformat. Returns false, leaving no
+// file behind, when this FFmpeg build has no encoder for the format.
+static bool bench_write_fixture(const char *path, const BenchFormat *format, double seconds,
+                                bool noise, const char *title, int track) {
+    const AVCodec *codec = avcodec_find_encoder(format->codec);
+    if (!codec) return false;
+    
+    AVFormatContext *output = NULL;
+    AVCodecContext *encoder = NULL;
+    AVStream *stream = NULL;
+    SwrContext *swr = NULL;
+    AVFrame *frame = av_frame_alloc();
+    AVPacket *packet = av_packet_alloc();
+    float *source = NULL;
+    bool header = false;
+    bool ok = false;
+    
+    if (!frame || !packet) goto done;
+    if (avformat_alloc_output_context2(&output, NULL, format->muxer, path) < 0) goto done;
+    
+    encoder = avcodec_alloc_context3(codec);
+    stream = avformat_new_stream(output, NULL);
+    if (!encoder || !stream) goto done;
+    
+    encoder->sample_rate = format->sample_rate;
+    encoder->channels = AUDIO_CHANNELS;
+    encoder->channel_layout = AV_CH_LAYOUT_STEREO;
+    encoder->sample_fmt = codec->sample_fmts ? codec->sample_fmts[0] : AV_SAMPLE_FMT_FLTP;
+    encoder->bit_rate = format->bit_rate;
+    encoder->time_base = (AVRational){ 1, format->sample_rate };
+    encoder->strict_std_compliance = FF_COMPLIANCE_EXPERIMENTAL; // FFmpeg's own Vorbis and Opus
+    if (output->oformat->flags & AVFMT_GLOBALHEADER) {
+        encoder->flags |= AV_CODEC_FLAG_GLOBAL_HEADER;
+    }
+    if (avcodec_open2(encoder, codec, NULL) < 0 ||
+        avcodec_parameters_from_context(stream->codecpar, encoder) < 0) {
+        goto done;
+    }
+    stream->time_base = encoder->time_base;
+    
+    // Tags give the scanner's metadata path something to read
+    av_dict_set(&output->metadata, "title", title, 0);
+    av_dict_set(&output->metadata, "artist", "Tux Music Bench", 0);
+    av_dict_set(&output->metadata, "album", noise ? "Noise" : "Sweeps", 0);
+    av_dict_set_int(&output->metadata, "track", track, 0);
+    
+    if (avio_open(&output->pb, path, AVIO_FLAG_WRITE) < 0) goto done;
+    if (avformat_write_header(output, NULL) < 0) goto done;
+    header = true;
+    
+    swr = swr_alloc_set_opts(NULL, AV_CH_LAYOUT_STEREO, encoder->sample_fmt, format->sample_rate,
+                             AV_CH_LAYOUT_STEREO, AV_SAMPLE_FMT_FLT, format->sample_rate, 0, NULL);
+    if (!swr || swr_init(swr) < 0) goto done;
+    
+    // PCM takes any frame size; whole frames only, as not every encoder
+    // accepts a short last one
+    int block = encoder->frame_size > 0 ? encoder->frame_size : 1024;
+    int64_t total = (int64_t)(seconds * format->sample_rate) / block * block;
+    source = malloc(sizeof(float) * block * AUDIO_CHANNELS);
+    if (!source) goto done;
+    
+    double phase = 0.0;
+    uint32_t seed = 0x2545f491u;
+    for (int64_t position = 0; position < total; position += block) {
+        bench_signal(source, block, position, format->sample_rate, seconds, noise, &phase, &seed);
         
-        if (widget->on_click) {
-            widget->on_click(widget, widget->user_data);
-        }
+        frame->format = encoder->sample_fmt;
+        frame->nb_samples = block;
+        frame->sample_rate = format->sample_rate;
+        frame->channels = AUDIO_CHANNELS;
+        frame->channel_layout = AV_CH_LAYOUT_STEREO;
+        if (av_frame_get_buffer(frame, 0) < 0) goto done;
         
-        return true;
-    } else if (released) {
-        widget->pressed = false;
+        const uint8_t *input = (const uint8_t*)source;
+        swr_convert(swr, frame->extended_data, block, &input, block);
+        frame->pts = position;
+        
+        bool sent = bench_encode(output, stream, encoder, frame, packet);
+        av_frame_unref(frame);
+        if (!sent) goto done;
     }
     
-    return false;
+    ok = bench_encode(output, stream, encoder, NULL, packet);
+    
+done:
+    if (header && av_write_trailer(output) < 0) ok = false;
+    if (output && output->pb) avio_closep(&output->pb);
+    if (!ok) remove(path);
+    
+    free(source);
+    swr_free(&swr);
+    avcodec_free_context(&encoder);
+    avformat_free_context(output);
+    av_packet_free(&packet);
+    av_frame_free(&frame);
+    return ok;
+}
+
+// ns/sample for one spectrum update: windowed downmix, FFT and banding
+static void bench_fft(void) {
+    const int updates = 4096;
+    
+    AudioEngine *engine = calloc(1, sizeof(AudioEngine));
+    float *block = malloc(sizeof(float) * FFT_SIZE * AUDIO_CHANNELS);
+    if (!engine || !block || !spectrum_initialize(engine) ||
+        !pcm_ring_initialize(&engine->ring, AUDIO_RING_FRAMES, FFT_SIZE + AUDIO_BUFFER_MAX)) {
+        fprintf(stderr, "  fft: out of memory\n");
+        if (engine) spectrum_cleanup(engine);
+        free(engine);
+        free(block);
+        return;
+    }
+    pthread_mutex_init(&engine->spectrum_mutex, NULL);
+    engine->device_spec.freq = 48000;
+    atomic_store(&engine->device_rate, 48000);
+    
+    // The analyzer reads frames the device has already consumed
+    double phase = 0.0;
+    uint32_t seed = 0x9e3779b9u;
+    bench_signal(block, FFT_SIZE, 0, 48000, 1.0, true, &phase, &seed);
+    pcm_ring_write(&engine->ring, block, FFT_SIZE);
+    pcm_ring_read(&engine->ring, block, FFT_SIZE);
+    spectrum_analyze(engine); // Warm up, and builds the band edges
+    
+    double runs[BENCH_REPEATS];
+    for (int run = 0; run < BENCH_REPEATS; run++) {
+        Uint64 start = SDL_GetPerformanceCounter();
+        for (int i = 0; i < updates; i++) {
+            spectrum_analyze(engine);
+        }
+        runs[run] = bench_elapsed(start);
+    }
+    double seconds = bench_median(runs, BENCH_REPEATS);
+    
+    printf("Spectrum: %d-point FFT, %d bands\n", FFT_SIZE, SPECTRUM_SIZE);
+    printf("  %7.2f ns/sample  %7.2f us/update\n",
+           seconds * 1e9 / ((double)updates * FFT_SIZE), seconds * 1e6 / updates);
+    bench_record("fft.spectrum", "ns/sample", seconds * 1e9 / ((double)updates * FFT_SIZE));
+    
+    pcm_ring_cleanup(&engine->ring);
+    spectrum_cleanup(engine);
+    pthread_mutex_destroy(&engine->spectrum_mutex);
+    free(engine);
+    free(block);
 }
 
-static void widget_update(Widget *widget, float delta_time) {
-    // Smooth animation interpolation
-    widget->animation_t += (widget->target_animation_t - widget->animation_t) * 
-                          UI_ANIMATION_SPEED * delta_time;
+// ns/frame for the loudness meter (K-weighting, gating blocks and true peak)
+// over ten seconds of 48 kHz stereo noise, per available kernel
+static void bench_loudness(void) {
+    const int rate = 48000;
+    const int frames = rate * 10;
+    
+    float *samples = malloc(sizeof(float) * frames * AUDIO_CHANNELS);
+    if (!samples) {
+        fprintf(stderr, "  loudness: out of memory\n");
+        return;
+    }
     
-    // Type-specific updates
-    if (widget->type == WIDGET_SLIDER && widget->slider.dragging) {
-        // Handle slider dragging
-        float relative_x = (g_app->mouse_x - widget->bounds.x) / widget->bounds.w;
-        relative_x = fmaxf(0.0f, fminf(1.0f, relative_x));
-        
-        float new_value = widget->slider.min_value + 
-                         relative_x * (widget->slider.max_value - widget->slider.min_value);
+    double phase = 0.0;
+    uint32_t seed = 0x2545f491u;
+    bench_signal(samples, frames, 0, rate, 10.0, true, &phase, &seed);
+    
+    struct { const char *name; LoudnessFilterKernel filter; LoudnessPeakKernel peak; bool supported; } kernels[] = {
+        { "scalar", loudness_filter_scalar, loudness_peak_scalar, true },
+#ifdef TUXMUSIC_X86_SIMD
+        { "sse2", loudness_filter_sse, loudness_peak_sse, __builtin_cpu_supports("sse2") },
+#endif
+    };
+    
+    equalizer_flush_denormals();
+    printf("Loudness: %d Hz stereo, 4x true peak\n", rate);
+    
+    for (size_t k = 0; k < sizeof(kernels) / sizeof(kernels[0]); k++) {
+        if (!kernels[k].supported) continue;
         
-        if (new_value != widget->slider.value) {
-            widget->slider.value = new_value;
+        double runs[BENCH_REPEATS];
+        LoudnessResult result;
+        for (int run = 0; run < BENCH_REPEATS; run++) {
+            LoudnessMeter meter;
+            loudness_meter_initialize(&meter, rate);
+            meter.filter_kernel = kernels[k].filter;
+            meter.peak_kernel = kernels[k].peak;
             
-            if (widget->on_value_change) {
-                widget->on_value_change(widget, widget->user_data);
+            Uint64 start = SDL_GetPerformanceCounter();
+            for (int i = 0; i < frames; i += 4096) {
+                loudness_meter_add(&meter, samples + (size_t)i * AUDIO_CHANNELS,
+                                   frames - i < 4096 ? frames - i : 4096);
             }
+            loudness_meter_finish(&meter, &result);
+            runs[run] = bench_elapsed(start);
         }
+        double ns = bench_median(runs, BENCH_REPEATS) * 1e9 / frames;
         
-        if (!g_app->mouse_pressed) {
-            widget->slider.dragging = false;
-        }
+        char name[64];
+        snprintf(name, sizeof(name), "loudness.%s", kernels[k].name);
+        printf("  %-8s %7.2f ns/frame  (%.1f LUFS, %.1f LU, %.2f peak)\n",
+               kernels[k].name, ns, result.loudness, result.range, result.peak);
+        bench_record(name, "ns/frame", ns);
     }
+    
+    free(samples);
 }
 
-static void widget_render(Widget *widget, SDL_Renderer *renderer) {
-    if (!widget->visible) return;
-    
-    // Interpolate colors based on animation state
-    Color render_color = color_lerp(widget->color, widget->hover_color, 
-                                   ease_out_cubic(widget->animation_t));
-    
-    if (widget->pressed) {
-        render_color = widget->press_color;
+// Decode throughput per codec, through the same decoder and output
+// conversion playback uses (to a 48 kHz device, so 44.1 kHz sources resample)
+static void bench_decode(const char *directory) {
+    static const BenchFormat formats[] = {
+        { "wav",    "wav",  "wav",  AV_CODEC_ID_PCM_S16LE, 44100, 0 },
+        { "flac",   "flac", "flac", AV_CODEC_ID_FLAC,      44100, 0 },
+        { "alac",   "m4a",  "ipod", AV_CODEC_ID_ALAC,      44100, 0 },
+        { "mp3",    "mp3",  "mp3",  AV_CODEC_ID_MP3,       44100, 256000 },
+        { "aac",    "m4a",  "ipod", AV_CODEC_ID_AAC,       44100, 256000 },
+        { "vorbis", "ogg",  "ogg",  AV_CODEC_ID_VORBIS,    44100, 192000 },
+        { "opus",   "opus", "ogg",  AV_CODEC_ID_OPUS,      48000, 128000 },
+    };
+    static const char *signals[] = { "sweep", "noise" };
+    
+    AVPacket *packet = av_packet_alloc();
+    AVFrame *frame = av_frame_alloc();
+    if (!packet || !frame) {
+        av_packet_free(&packet);
+        av_frame_free(&frame);
+        return;
     }
     
-    // Render based on widget type
-    switch (widget->type) {
-        case WIDGET_BUTTON:
-            render_button_widget(widget, renderer, render_color);
-            break;
-            
-        case WIDGET_SLIDER:
-            render_slider_widget(widget, renderer, render_color);
-            break;
-            
-        case WIDGET_PROGRESS:
-            render_progress_widget(widget, renderer, render_color);
-            break;
+    printf("Decode: %.0f s fixtures to 48 kHz float stereo\n", BENCH_FIXTURE_SECONDS);
+    
+    for (size_t f = 0; f < sizeof(formats) / sizeof(formats[0]); f++) {
+        for (int s = 0; s < 2; s++) {
+            char label[64], path[MAX_PATH];
+            snprintf(label, sizeof(label), "%s.%s", formats[f].name, signals[s]);
+            snprintf(path, sizeof(path), "%s%s%s-%s.%s", directory, PATH_SEP,
+                     formats[f].name, signals[s], formats[f].extension);
             
-        case WIDGET_SPECTRUM:
-            render_spectrum_widget(widget, renderer);
-            break;
+            if (!bench_write_fixture(path, &formats[f], BENCH_FIXTURE_SECONDS, s == 1, label, s + 1)) {
+                printf("  %-14s no encoder in this FFmpeg build\n", label);
+                continue;
+            }
             
-        case WIDGET_ALBUM_ART:
-            render_album_art_widget(widget, renderer);
-            break;
+            double runs[BENCH_REPEATS];
+            uint64_t produced = 0;
+            bool failed = false;
+            for (int run = 0; run < BENCH_REPEATS && !failed; run++) {
+                AudioDecoder decoder;
+                if (!audio_decoder_open(&decoder, path, 48000)) {
+                    failed = true;
+                    break;
+                }
+                
+                produced = 0;
+                Uint64 start = SDL_GetPerformanceCounter();
+                while (audio_decoder_read(&decoder, packet, frame)) {
+                    produced += decoder.count;
+                    decoder.count = decoder.offset = decoder.processed = 0;
+                }
+                produced += decoder.count;
+                runs[run] = bench_elapsed(start);
+                
+                audio_decoder_close(&decoder);
+            }
+            if (failed || produced == 0) {
+                printf("  %-14s cannot decode %s\n", label, path);
+                continue;
+            }
             
-        case WIDGET_LIST:
-            render_list_widget(widget, renderer, render_color);
-            break;
+            double seconds = bench_median(runs, BENCH_REPEATS);
+            double realtime = (double)produced / 48000.0 / seconds;
+            printf("  %-14s %7.2f ns/frame  %7.0fx realtime\n", label, seconds * 1e9 / produced, realtime);
             
-        default:
-            // Default rectangle
-            render_rounded_rect(renderer, widget->bounds, 8, render_color);
-            break;
+            char name[64];
+            snprintf(name, sizeof(name), "decode.%s", label);
+            bench_record(name, "x realtime", realtime);
+        }
     }
+    
+    av_frame_free(&frame);
+    av_packet_free(&packet);
 }
 
-static void render_button_widget(Widget *widget, SDL_Renderer *renderer, Color color) {
-    // Beautiful glassmorphism button
-    render_drop_shadow(renderer, widget->bounds, 4, COLOR_PALETTE.glass_shadow);
-    render_glassmorphism_effect(renderer, widget->bounds, 8);
-    render_rounded_rect(renderer, widget->bounds, 12, color);
+// Rows shaped like a real library: ten tracks an album, twenty albums an artist
+static void bench_synthetic_library(TrackStore *store, int count) {
+    static const char *genres[] = { "Rock", "Jazz", "Electronic", "Classical", "Hip-Hop", "Folk" };
+    static const char *words[] = { "Night", "River", "Echo", "Golden", "Static", "Blue", "Fire", "Glass" };
     
-    // Button text
-    if (strlen(widget->text) > 0) {
-        render_text_centered(renderer, g_app->fonts[2], widget->text, 
-                           widget->bounds, COLOR_PALETTE.text_primary);
-    }
+    Track *track = calloc(1, sizeof(Track));
+    if (!track) return;
     
-    // Hover glow effect
-    if (widget->animation_t > 0.1f) {
-        Color glow = COLOR_PALETTE.accent_primary;
-        glow.a = widget->animation_t * 0.3f;
+    for (int i = 0; i < count; i++) {
+        int album = i / 10, artist = album / 20;
+        TrackMetadata *meta = &track->metadata;
         
-        Rect glow_rect = {
-            widget->bounds.x - 2, 
-            widget->bounds.y - 2,
-            widget->bounds.w + 4, 
-            widget->bounds.h + 4
-        };
-        render_rounded_rect(renderer, glow_rect, 14, glow);
+        snprintf(meta->title, sizeof(meta->title), "%s %s %d", words[i % 8], words[(i / 8) % 8], i);
+        snprintf(meta->artist, sizeof(meta->artist), "Artist %d", artist);
+        snprintf(meta->album, sizeof(meta->album), "%s Album %d", words[album % 8], album);
+        snprintf(meta->genre, sizeof(meta->genre), "%s", genres[artist % 6]);
+        snprintf(meta->year, sizeof(meta->year), "%d", 1960 + album % 60);
+        snprintf(meta->track_num, sizeof(meta->track_num), "%d", i % 10 + 1);
+        snprintf(meta->format, sizeof(meta->format), "flac");
+        snprintf(track->filepath, sizeof(track->filepath), "/bench/Artist %d/Album %d/%02d.flac",
+                 artist, album, i % 10 + 1);
+        meta->duration_seconds = 150.0 + (i * 37) % 240;
+        meta->bitrate = 900000;
+        meta->sample_rate = 44100;
+        meta->channels = 2;
+        meta->date_added = 1500000000 + i;
+        meta->rating = (float)(i % 6);
+        track->metadata_loaded = true;
+        track->file_size = 30000000 + i;
+        track->file_mtime = 1500000000 + i;
+        track->file_hash = hash_u32((uint32_t)i);
+        
+        track_store_add(store, track);
     }
+    
+    free(track);
 }
 
-static void render_slider_widget(Widget *widget, SDL_Renderer *renderer, Color color) {
-    // Track background
-    Rect track_rect = {
-        widget->bounds.x,
-        widget->bounds.y + widget->bounds.h * 0.4f,
-        widget->bounds.w,
-        widget->bounds.h * 0.2f
+// Until the scanner has merged everything, without the headless loop's naps
+static double bench_scan_pass(const char *directory) {
+    Playlist target;
+    playlist_initialize(&target, "Bench");
+    
+    Uint64 start = SDL_GetPerformanceCounter();
+    library_scanner_add_directory(&g_app->scanner, directory, &target);
+    while (g_app->scanner.active) {
+        library_scanner_poll(&g_app->scanner, SCAN_BATCH_PER_FRAME);
+        if (g_app->scanner.active) SDL_Delay(1);
+    }
+    double seconds = bench_elapsed(start);
+    
+    playlist_cleanup(&target);
+    return seconds;
+}
+
+// Scan rate into an empty library and with the database as cache, then the
+// database itself at BENCH_LIBRARY_TRACKS rows
+static void bench_library(const char *directory) {
+    char scan_dir[MAX_PATH], db_path[MAX_PATH], path[MAX_PATH];
+    snprintf(scan_dir, sizeof(scan_dir), "%s%sscan", directory, PATH_SEP);
+    snprintf(db_path, sizeof(db_path), "%s%slibrary.db", directory, PATH_SEP);
+    if (!make_directory(scan_dir)) {
+        fprintf(stderr, "Cannot create %s\n", scan_dir);
+        return;
+    }
+    
+    static const BenchFormat formats[] = {
+        { "flac", "flac", "flac", AV_CODEC_ID_FLAC,      44100, 0 },
+        { "wav",  "wav",  "wav",  AV_CODEC_ID_PCM_S16LE, 44100, 0 },
     };
-    render_rounded_rect(renderer, track_rect, track_rect.h * 0.5f, COLOR_PALETTE.bg_tertiary);
+    for (int i = 0; i < BENCH_SCAN_FILES; i++) {
+        const BenchFormat *format = &formats[i & 1];
+        char title[64];
+        snprintf(title, sizeof(title), "Scan %03d", i);
+        snprintf(path, sizeof(path), "%s%s%03d.%s", scan_dir, PATH_SEP, i, format->extension);
+        bench_write_fixture(path, format, 1.0, (i & 2) != 0, title, i + 1);
+    }
     
-    // Progress fill
-    float progress = (widget->slider.value - widget->slider.min_value) / 
-                    (widget->slider.max_value - widget->slider.min_value);
+    // The scanner and its cache live in the app state; this one is never saved
+    g_app = calloc(1, sizeof(TuxMusicApp));
+    if (!g_app) return;
+    g_app->ephemeral_library = true;
+    track_store_initialize(&g_app->library);
+    playlist_initialize(&g_app->current_playlist, "Now Playing");
     
-    Rect fill_rect = track_rect;
-    fill_rect.w = track_rect.w * progress;
-    render_rounded_rect(renderer, fill_rect, fill_rect.h * 0.5f, COLOR_PALETTE.accent_primary);
+    printf("Library: %d one-second files, %d database rows\n", BENCH_SCAN_FILES, BENCH_LIBRARY_TRACKS);
+    
+    // Cold: every file probed. The files were just written, so this is the
+    // probe cost with a warm page cache, not disk latency.
+    double runs[BENCH_REPEATS];
+    size_t files = 0;
+    for (int run = 0; run < BENCH_REPEATS; run++) {
+        track_store_cleanup(&g_app->library);
+        track_store_initialize(&g_app->library);
+        runs[run] = bench_scan_pass(scan_dir);
+        files = g_app->library.count;
+    }
+    double cold = bench_median(runs, BENCH_REPEATS);
+    
+    // Warm: the database written by the last pass answers for every file
+    library_db_save(&g_app->library, db_path);
+    track_store_cleanup(&g_app->library);
+    track_store_initialize(&g_app->library);
+    library_db_load(&g_app->library_cache, &g_app->library, db_path);
+    for (int run = 0; run < BENCH_REPEATS; run++) {
+        runs[run] = bench_scan_pass(scan_dir);
+    }
+    double warm = bench_median(runs, BENCH_REPEATS);
     
-    // Handle
-    float handle_size = widget->bounds.h * 0.8f;
-    float handle_x = widget->bounds.x + (widget->bounds.w - handle_size) * progress;
+    if (files > 0) {
+        printf("  scan     %8.0f files/s probed  %8.0f files/s unchanged\n", files / cold, files / warm);
+        bench_record("scan.probe", "files/s", files / cold);
+        bench_record("scan.cached", "files/s", files / warm);
+    } else {
+        printf("  scan     no fixtures were scanned from %s\n", scan_dir);
+    }
     
-    Rect handle_rect = {
-        handle_x,
-        widget->bounds.y + (widget->bounds.h - handle_size) * 0.5f,
-        handle_size,
-        handle_size
-    };
+    // Database load, which is most of a warm start
+    library_cache_cleanup(&g_app->library_cache);
+    track_store_cleanup(&g_app->library);
+    track_store_initialize(&g_app->library);
+    bench_synthetic_library(&g_app->library, BENCH_LIBRARY_TRACKS);
     
-    // Handle shadow and glow
-    render_drop_shadow(renderer, handle_rect, 2, COLOR_PALETTE.glass_shadow);
+    Uint64 start = SDL_GetPerformanceCounter();
+    bool saved = library_db_save(&g_app->library, db_path);
+    double save = bench_elapsed(start);
     
-    if (widget->animation_t > 0.1f || widget->slider.dragging) {
-        Color glow = COLOR_PALETTE.accent_primary;
-        glow.a = (widget->slider.dragging ? 0.6f : widget->animation_t * 0.4f);
+    for (int run = 0; saved && run < BENCH_REPEATS; run++) {
+        library_cache_cleanup(&g_app->library_cache);
+        track_store_cleanup(&g_app->library);
+        track_store_initialize(&g_app->library);
         
-        Rect glow_rect = {
-            handle_rect.x - 4,
-            handle_rect.y - 4, 
-            handle_rect.w + 8,
-            handle_rect.h + 8
-        };
-        render_rounded_rect(renderer, glow_rect, glow_rect.h * 0.5f, glow);
+        start = SDL_GetPerformanceCounter();
+        library_db_load(&g_app->library_cache, &g_app->library, db_path);
+        runs[run] = bench_elapsed(start);
+    }
+    if (saved && g_app->library.count == BENCH_LIBRARY_TRACKS) {
+        double load = bench_median(runs, BENCH_REPEATS);
+        printf("  database %8.2f ms load  %8.2f ms save\n", load * 1e3, save * 1e3);
+        bench_record("library_db.load", "ms", load * 1e3);
+        bench_record("library_db.save", "ms", save * 1e3);
     }
+    remove(db_path);
     
-    render_rounded_rect(renderer, handle_rect, handle_rect.h * 0.5f, COLOR_PALETTE.text_primary);
+    app_cleanup_library();
+    free(g_app);
+    g_app = NULL;
+}
+
+// Whether a default output device opens at all, in any format
+static bool bench_audio_available(void) {
+    if (SDL_InitSubSystem(SDL_INIT_AUDIO) < 0) return false;
+    
+    SDL_AudioSpec wanted = {0}, obtained;
+    wanted.freq = AUDIO_SAMPLE_RATE;
+    wanted.format = AUDIO_F32SYS;
+    wanted.channels = AUDIO_CHANNELS;
+    wanted.samples = AUDIO_BUFFER_START;
+    SDL_AudioDeviceID device = SDL_OpenAudioDevice(NULL, 0, &wanted, &obtained, SDL_AUDIO_ALLOW_ANY_CHANGE);
+    if (device) SDL_CloseAudioDevice(device);
+    return device != 0;
+}
+
+// app_render frame times with the whole window redrawn, and with only the
+// track list scrolling, for small, large and very large playlists
+static void bench_render(void) {
+    static const int sizes[] = { 100, 10000, 100000 };
+    static const char *labels[] = { "100", "10k", "100k" };
+    
+    // app_initialize exits when it cannot get a window or an audio device;
+    // check both first
+    if (SDL_Init(SDL_INIT_VIDEO) < 0 || SDL_GetNumVideoDisplays() < 1) {
+        printf("Render: no display, skipped\n");
+        SDL_Quit();
+        return;
+    }
+    if (!bench_audio_available()) {
+        printf("Render: no audio device, skipped\n");
+        SDL_Quit();
+        return;
+    }
+    
+    app_initialize(PACE_ON_DEMAND, 0, true);
+    
+    TrackId first = (TrackId)g_app->library.count;
+    bench_synthetic_library(&g_app->library, sizes[2]);
+    
+    Widget *list = g_app->track_list;
+    double *frames = malloc(sizeof(double) * BENCH_RENDER_FRAMES);
+    if (!frames || !list || g_app->library.count < first + (size_t)sizes[2]) {
+        free(frames);
+        app_cleanup();
+        return;
+    }
+    
+    printf("Render: %dx%d, %d frames each\n", g_app->window_width, g_app->window_height,
+           BENCH_RENDER_FRAMES);
+    
+    for (int s = 0; s < 3; s++) {
+        Playlist *playlist = &g_app->current_playlist;
+        playlist_cleanup(playlist);
+        playlist_initialize(playlist, "Now Playing");
+        for (int i = 0; i < sizes[s]; i++) {
+            playlist_append(playlist, first + (TrackId)i);
+        }
+        list->list->scroll = list->list->scroll_target = 0.0f;
+        
+        for (int scenario = 0; scenario < 2; scenario++) {
+            ui_invalidate_all();
+            app_render(); // Warm up the glyph atlas and layouts
+            
+            float max_scroll = list_widget_max_scroll(list);
+            for (int f = 0; f < BENCH_RENDER_FRAMES; f++) {
+                SDL_PumpEvents();
+                if (scenario == 0) {
+                    ui_invalidate_all();
+                } else {
+                    float scroll = max_scroll > 0.0f ? fmodf((float)f * 0.75f, max_scroll) : 0.0f;
+                    list->list->scroll = list->list->scroll_target = scroll;
+                    widget_mark_dirty(list);
+                }
+                
+                Uint64 start = SDL_GetPerformanceCounter();
+                app_render();
+                frames[f] = bench_elapsed(start);
+            }
+            
+            double median = bench_median(frames, BENCH_RENDER_FRAMES);
+            double p99 = frames[BENCH_RENDER_FRAMES * 99 / 100];
+            const char *kind = scenario == 0 ? "full" : "scroll";
+            printf("  %-6s %-6s %7.3f ms median  %7.3f ms p99\n", labels[s], kind, median * 1e3, p99 * 1e3);
+            
+            char name[64];
+            snprintf(name, sizeof(name), "render.%s.%s", kind, labels[s]);
+            bench_record(name, "ms", median * 1e3);
+            snprintf(name, sizeof(name), "render.%s.%s.p99", kind, labels[s]);
+            bench_record(name, "ms", p99 * 1e3);
+        }
+    }
+    
+    free(frames);
+    app_cleanup();
+}
+
+// tuxmusic --bench-suite [--bench-dir=DIR] [--bench-out=FILE]
+//
+// Generates its own fixtures, runs every benchmark, and writes the results
+// as JSON for diffing between releases. Fixtures go to the cache directory
+// unless --bench-dir says otherwise.
+static int bench_suite(int argc, char **argv) {
+    const char *output = "tuxmusic-bench.json";
+    char directory[MAX_PATH] = "";
+    
+    for (int i = 0; i < argc; i++) {
+        if (strncmp(argv[i], "--bench-dir=", 12) == 0) {
+            snprintf(directory, sizeof(directory), "%s", argv[i] + 12);
+        } else if (strncmp(argv[i], "--bench-out=", 12) == 0) {
+            output = argv[i] + 12;
+        } else {
+            fprintf(stderr, "Usage: tuxmusic --bench-suite [--bench-dir=DIR] [--bench-out=FILE]\n");
+            return 1;
+        }
+    }
+    
+    if (!directory[0]) {
+        char cache[MAX_PATH];
+        if (!cache_directory(cache, sizeof(cache))) {
+            fprintf(stderr, "No cache directory; pass --bench-dir=DIR\n");
+            return 1;
+        }
+        snprintf(directory, sizeof(directory), "%s%sbench", cache, PATH_SEP);
+    }
+    if (!make_directory(directory)) {
+        fprintf(stderr, "Cannot create %s\n", directory);
+        return 1;
+    }
+    
+    av_register_all();
+    av_log_set_level(AV_LOG_ERROR);
+    g_bench.count = 0;
+    printf("Fixtures in %s\n\n", directory);
+    
+    bench_equalizer();
+    bench_convert();
+    bench_fft();
+    bench_loudness();
+    bench_decode(directory);
+    bench_library(directory);
+    bench_render();
+    
+    if (!bench_write_report(output)) return 1;
+    printf("\n%d results written to %s\n", g_bench.count, output);
+    return 0;
 }
 
 // ═══════════════════════════════════════════════════════════════════════════════
@@ -1440,29 +12250,40 @@ static bool point_in_rect(int x, int y, Rect rect) {
            y >= rect.y && y <= rect.y + rect.h;
 }
 
+static bool rect_intersects(Rect a, Rect b) {
+    return a.x < b.x + b.w && b.x < a.x + a.w &&
+           a.y < b.y + b.h && b.y < a.y + a.h;
+}
+
 // Application cleanup
 static void app_cleanup(void) {
     if (!g_app) return;
     
-    // Stop audio engine
-    if (g_app->audio.initialized) {
-        g_app->audio.threads_active = false;
-        
-        if (g_app->audio.spectrum_thread) {
-            pthread_join(g_app->audio.spectrum_thread, NULL);
-        }
-        
-        audio_cleanup(&g_app->audio);
-    }
+    app_cleanup_library();
+    pacer_print_stats(&g_app->pacer);
+    
+    // Artwork textures, like the atlas below, need the renderer alive
+    artwork_cleanup(&g_app->artwork);
+    
+    // The glyph atlas, cached layouts and batch buffers go with the renderer
+    geom_cleanup();
+    text_cleanup();
     
     // Cleanup fonts
-    for (int i = 0; i < 6; i++) {
+    for (int i = 0; i < TEXT_FONTS; i++) {
         if (g_app->fonts[i]) {
             TTF_CloseFont(g_app->fonts[i]);
         }
     }
     
+    for (int i = 0; i < g_app->widget_count; i++) {
+        widget_destroy(&g_app->widgets[i]);
+    }
+    free(g_app->hit_grid.cell_start);
+    free(g_app->hit_grid.items);
+    
     // Cleanup SDL
+    if (g_app->frame_texture) SDL_DestroyTexture(g_app->frame_texture);
     if (g_app->renderer) SDL_DestroyRenderer(g_app->renderer);
     if (g_app->window) SDL_DestroyWindow(g_app->window);
     
@@ -1473,3 +12294,36 @@ static void app_cleanup(void) {
     free(g_app);
     g_app = NULL;
 }
+
+// Everything but the window: shared with headless runs
+static void app_cleanup_library(void) {
+    // Stop background scanning before the library goes away
+    library_scanner_cleanup(&g_app->scanner);
+    loudness_scanner_cleanup(&g_app->loudness, &g_app->library);
+    
+    // Stop audio engine
+    if (g_app->audio.initialized) {
+        g_app->audio.threads_active = false;
+        
+        if (g_app->audio.spectrum_thread) {
+            pthread_join(g_app->audio.spectrum_thread, NULL);
+        }
+        
+        audio_cleanup(&g_app->audio);
+    }
+    
+    // Persist the library for the next warm start, then release it
+    char db_path[MAX_PATH];
+    if (!g_app->ephemeral_library && g_app->library.count > 0 &&
+        library_db_path(db_path, sizeof(db_path))) {
+        library_db_save(&g_app->library, db_path);
+    }
+    library_cache_cleanup(&g_app->library_cache);
+    playlist_cleanup(&g_app->current_playlist);
+    for (int i = 0; i < g_app->smart_playlist_count; i++) {
+        playlist_cleanup(&g_app->smart_playlists[i]);
+    }
+    search_index_cleanup(&g_app->search);
+    playlist_sorter_cleanup(&g_app->sorter);
+    track_store_cleanup(&g_app->library);
+}